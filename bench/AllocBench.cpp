@@ -0,0 +1,290 @@
+// Heap allocations per move over the native simulation (pio run -e allocbench).
+//
+// Runs moves through the real MotorController/StepEngine path on SimStepHal with the
+// output the firmware produces while they run: the start and progress logs, TURN and
+// LOAD lines, a STATUS line every STATUS_PERIOD_MS as the test mode LED loop used to
+// build, all written out through SerialManager. Each case runs twice:
+//   FIXED   the firmware as it is, formatting into fixed buffers
+//   STRING  the same moves with the output built the way it was before the fixed-buffer
+//           formatter, by String concatenation as the old getStatus() and logs did and
+//           handed over as const String&, alongside the firmware's own
+// Heap::allocations() counts every allocation on the way (operator new on the host):
+//   START  allocations per move while starting it, logs included
+//   RUN    allocations per move from then until it has finished and reported DONE
+//   HELD   blocks still held after all the moves of the case (FIXED)
+// per case, over MOVES moves each, after one warm-up move. The host's String keeps short
+// text inline where the ESP32's allocates, so its STRING figures are a lower bound.
+//
+//   .pio/build/allocbench/program [MOVES]    (default 20)
+//
+// Exits non-zero if any FIXED move allocates.
+#include <Arduino.h>
+#include "SerialManager.h"
+#include "MotorController.h"
+#include "HeapStats.h"
+
+namespace {
+
+const uint64_t MAX_MOVE_MICROS = 120ULL * 1000000ULL;
+const unsigned long STATUS_PERIOD_MS = 200;
+const int SET_RPM = 450;
+
+enum MoveKind { ROTATION_RPM, ROTATION_LEVEL, TIMED_RPM, POSITION, QUEUED, PAUSED, SPEED_CHANGE };
+enum Output { FIXED, STRING };
+
+struct Case {
+    const char* name;
+    MoveKind kind;
+};
+
+const Case CASES[] = {
+    { "ROT RPM",   ROTATION_RPM },
+    { "ROT LEVEL", ROTATION_LEVEL },
+    { "TIME RPM",  TIMED_RPM },
+    { "MOVE",      POSITION },
+    { "QUEUE",     QUEUED },
+    { "PAUSE",     PAUSED },        // Paused and resumed part way
+    { "SET",       SPEED_CHANGE },  // Speed changed part way
+};
+
+SerialManager serialManager;
+MotorController motorController;
+
+void tick() {
+    Sim::advance(1000);
+    motorController.update();
+    serialManager.pump();
+    Sim::clearSerialOutput();
+}
+
+// STATUS as the handler and the old LED loop built it
+void sendStatus() {
+    TextBuffer<OutMessage::MAX_TEXT + 1> line;
+    motorController.getStatus(line);
+    serialManager.sendResponse(line.c_str());
+}
+
+// The old output path: SerialManager took const String&, so even a literal became a
+// String on the way
+void oldLog(const String& message) {
+    serialManager.sendLog(message.c_str());
+}
+
+void oldResponse(const String& response) {
+    serialManager.sendResponse(response.c_str());
+}
+
+// The old validateRPM()'s feedback
+void oldRpmLog(int rpm) {
+    if (rpm >= Nema23Profile::OPTIMAL_RPM_LOW && rpm <= Nema23Profile::OPTIMAL_RPM_HIGH) {
+        oldLog("RPM " + String(rpm) + " is in optimal range");
+    } else {
+        oldLog("RPM " + String(rpm) + " is outside optimal range (" +
+               String(Nema23Profile::OPTIMAL_RPM_LOW) + "-" + String(Nema23Profile::OPTIMAL_RPM_HIGH) + ")");
+    }
+}
+
+// The old getStatus(), from the same figures the status record carries
+String oldStatus() {
+    Frame::StatusRecord status;
+    motorController.getStatusRecord(status);
+    MotorState state = motorController.state();
+    if (state == MotorState::ROTATING || state == MotorState::TIME_MODE) {
+        String followInfo = " LOAD:" + String(status.loadTenths / 10.0f, 1) + "%" +
+                            " FOLLOW:" + String(motorController.followingError());
+        if (state == MotorState::TIME_MODE) {
+            return "TIME_MODE RPM:" + String((int)status.rpm) +
+                   " ELAPSED:" + String((unsigned long)status.elapsedMillis / 1000) + "s" +
+                   " ROTATIONS:" + String((int)status.completedRotations) +
+                   followInfo + " [TEST]";
+        } else if (status.targetRotations == 0) {
+            return "ROTATING RPM:" + String((int)status.rpm) +
+                   " SEGMENT:" + String(1) +
+                   " QUEUED:" + String((unsigned)motorController.queueDepth()) +
+                   " COMPLETED:" + String((int)status.completedRotations) +
+                   followInfo + " [TEST]";
+        }
+        return "ROTATING RPM:" + String((int)status.rpm) +
+               " COMPLETED:" + String((int)status.completedRotations) +
+               "/" + String((int)status.targetRotations) +
+               followInfo + " [TEST]";
+    }
+    return String(MotorController::stateName(state)) + " [TEST]";
+}
+
+// The logs the old start of each move built
+void oldStartLogs(const Case& test) {
+    switch (test.kind) {
+        case ROTATION_LEVEL:
+            oldLog("Speed Level " + String(18) + " = " + String(motorController.speedLevelRPM(18), 1) + " RPM");
+            oldLog("Starting rotation: " + String(motorController.rpm()) + " RPM, " + String(2) +
+                   " rotations, Direction: " + String("CW"));
+            break;
+        case TIMED_RPM:
+            oldRpmLog(300);
+            oldLog("Starting time mode: " + String(300) + " RPM for " + String(1) + " seconds, Direction: " +
+                   String("CW"));
+            break;
+        case POSITION:
+            oldRpmLog(300);
+            oldLog("Starting move: " + String(0L) + " -> " + String(6400L) + " steps, " + String(300) + " RPM");
+            break;
+        case QUEUED:
+            oldRpmLog(300);
+            oldRpmLog(200);
+            oldLog("Starting queued motion: segment " + String(1) + ", " + String(1) + " more queued");
+            break;
+        default:
+            oldRpmLog(300);
+            oldLog("Starting rotation: " + String(300) + " RPM, " + String(2) + " rotations, Direction: " +
+                   String("CW"));
+            break;
+    }
+}
+
+void startMove(const Case& test) {
+    switch (test.kind) {
+        case ROTATION_LEVEL:
+            motorController.executeRotationWithSpeed(18, 2);
+            break;
+        case TIMED_RPM:
+            motorController.executeTime(300, 1);
+            break;
+        case POSITION:
+            motorController.executeMove(6400, true, 300, 0);
+            break;
+        case QUEUED:
+            motorController.enqueueRotation(300, 0, 1);
+            motorController.enqueueRotation(200, 0, 1);
+            break;
+        default:
+            motorController.executeRotation(300, 2);
+            break;
+    }
+}
+
+// Runs one move to its end; false if it never finished
+bool runMove(const Case& test, Output output, uint32_t& startAllocations, uint32_t& runAllocations) {
+    uint32_t before = Heap::allocations();
+    startMove(test);
+    if (output == STRING) {
+        oldStartLogs(test);
+    }
+    uint32_t started = Heap::allocations();
+
+    uint64_t start = Sim::now();
+    unsigned long lastStatus = millis();
+    bool interrupted = false;
+    do {
+        if (Sim::now() - start > MAX_MOVE_MICROS) {
+            return false;
+        }
+        tick();
+        if (millis() - lastStatus >= STATUS_PERIOD_MS) {
+            if (output == STRING) {
+                oldResponse(oldStatus());
+            } else {
+                sendStatus();
+            }
+            lastStatus = millis();
+        }
+        if (!interrupted && Sim::now() - start > 400000) {
+            interrupted = true;
+            if (test.kind == PAUSED) {
+                motorController.pause();
+                if (output == STRING) {
+                    oldLog("Motor paused");
+                }
+                for (int i = 0; i < 300; i++) {
+                    tick();
+                }
+                motorController.resume();
+                if (output == STRING) {
+                    oldLog("Motor resumed");
+                    oldLog("Resuming move: " + String(motorController.position()) + " steps left");  // Same digits
+                }
+            } else if (test.kind == SPEED_CHANGE) {
+                motorController.setSpeed(SET_RPM, 0);
+                if (output == STRING) {
+                    oldRpmLog(SET_RPM);
+                    oldLog("Speed changed to " + String(SET_RPM) + " RPM");
+                }
+            }
+        }
+    } while (motorController.isMotorRunning());
+    for (int i = 0; i < 5; i++) {
+        tick();  // DONE and the last lines go out
+    }
+
+    startAllocations += started - before;
+    runAllocations += Heap::allocations() - started;
+    return true;
+}
+
+struct CaseResult {
+    long moves;
+    double start;  // Allocations per move
+    double run;
+    long held;
+};
+
+// One warm-up move, then `moves` measured ones; false if a move never finished
+bool runCase(const Case& test, Output output, long moves, CaseResult& result) {
+    uint32_t startAllocations = 0;
+    uint32_t runAllocations = 0;
+    runMove(test, output, startAllocations, runAllocations);  // Warm-up
+    startAllocations = 0;
+    runAllocations = 0;
+
+    Heap::Stats before;
+    Heap::read(before);
+    bool finished = true;
+    result.moves = 0;
+    for (; result.moves < moves; result.moves++) {
+        if (!runMove(test, output, startAllocations, runAllocations)) {
+            finished = false;
+            break;
+        }
+    }
+    Heap::Stats after;
+    Heap::read(after);
+
+    result.start = result.moves > 0 ? (double)startAllocations / result.moves : 0.0;
+    result.run = result.moves > 0 ? (double)runAllocations / result.moves : 0.0;
+    result.held = (long)after.usedBlocks - (long)before.usedBlocks;
+    return finished;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    long moves = argc > 1 ? atol(argv[1]) : 20;
+
+    serialManager.begin();
+    motorController.begin(serialManager);
+    motorController.setLoadReportInterval(100);  // Plenty of LOAD lines too
+
+    printf("%ld moves per case\n\n", moves);
+    printf("%-10s %6s %8s %8s %6s %13s %11s\n", "CASE", "MOVES", "START", "RUN", "HELD", "STRING START", "STRING RUN");
+    long failures = 0;
+    for (const Case& test : CASES) {
+        CaseResult fixed = {};
+        CaseResult string = {};
+        if (!runCase(test, FIXED, moves, fixed) || !runCase(test, STRING, moves, string)) {
+            printf("  FAIL %s: move never finished\n", test.name);
+            failures++;
+        }
+        printf("%-10s %6ld %8.1f %8.1f %6ld %13.1f %11.1f\n", test.name, fixed.moves, fixed.start, fixed.run,
+               fixed.held, string.start, string.run);
+        if (fixed.start + fixed.run > 0 || fixed.held != 0) {
+            failures++;
+        }
+    }
+
+    if (failures > 0) {
+        printf("\nFAILED: %ld cases allocated\n", failures);
+        return 1;
+    }
+    printf("\nOK: no move allocated\n");
+    return 0;
+}
@@ -0,0 +1,332 @@
+// Text against binary framing over a pseudo-terminal (pio run -e framebench).
+//
+// A writer thread sends telemetry - TURN, LOAD, FOLLOW and a status report in turn - into
+// one end of a pty, encoded as the firmware encodes it in a text or a binary (HELLO BIN)
+// session, and the reader decodes it from the other end byte by byte with FrameDecoder or
+// a line parser, as a host would. Each message carries its sequence number, so the reader
+// knows which one it got. Per run:
+//   BYTES/MSG  encoded size, framing included
+//   MSG/S      messages decoded per second over the pty
+//   @BAUD      messages per second the UART at BAUD could carry at that size
+//   P50 P99    one-way latency, write to decoded, us
+//   MAX
+//   LOST       messages that never came out (dropped by the CRC check or unparseable)
+//   BAD        messages that came out wrong
+// Flood runs send as fast as the pty takes them; paced runs send RATE messages per second,
+// so their latency is not queueing. The corrupted runs flip one byte in every CORRUPT: a
+// binary session drops the frames hit, a text one may hand over a wrong value. Exits
+// non-zero if a clean run loses a message or a corrupted binary run lets a bad one through.
+//
+//   .pio/build/framebench/program [COUNT [RATE [BAUD]]]    (defaults 200000, 2000, 115200)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+#include "FrameCodec.h"
+
+namespace {
+
+const size_t CORRUPT = 1000;  // One byte in this many flipped
+const int READ_IDLE_MS = 200;
+
+enum Kind : uint8_t { TURN, LOAD, FOLLOW, STATUS, KINDS };
+
+struct Message {
+    Kind kind;
+    uint32_t value;  // Sequence number; modulo 1000 for LOAD
+};
+
+typedef std::chrono::steady_clock Clock;
+
+Kind kindOf(size_t index) {
+    return (Kind)(index % KINDS);
+}
+
+Message messageFor(size_t index) {
+    Kind kind = kindOf(index);
+    return { kind, (uint32_t)(kind == LOAD ? index % 1000 : index) };
+}
+
+Frame::StatusRecord statusFor(uint32_t value) {
+    Frame::StatusRecord status = { Frame::STATE_ROTATING, 300, value, 4000000000u, 123456, -3, 421 };
+    return status;
+}
+
+// As SerialManager::write() in a text session
+size_t encodeText(const Message& message, uint8_t* out) {
+    char* line = (char*)out;
+    switch (message.kind) {
+        case TURN:
+            return sprintf(line, "TURN:%ld\r\n", (long)message.value);
+        case LOAD:
+            return sprintf(line, "LOAD:%.1f%%\r\n", message.value / 10.0f);
+        case FOLLOW:
+            return sprintf(line, "FOLLOW:%ld\r\n", (long)message.value);
+        default:
+            return sprintf(line, "ROTATING RPM:300 COMPLETED:%lu/4000000000\r\n", (unsigned long)message.value);
+    }
+}
+
+size_t encodeBinary(const Message& message, uint8_t* out) {
+    uint8_t payload[Frame::STATUS_SIZE];
+    switch (message.kind) {
+        case TURN:
+            Frame::put32(payload, message.value);
+            return Frame::encode(Frame::TURN, payload, 4, out);
+        case LOAD:
+            Frame::put16(payload, (uint16_t)message.value);
+            return Frame::encode(Frame::LOAD, payload, 2, out);
+        case FOLLOW:
+            Frame::put32(payload, message.value);
+            return Frame::encode(Frame::FOLLOW, payload, 4, out);
+        default:
+            Frame::encodeStatus(statusFor(message.value), payload);
+            return Frame::encode(Frame::STATUS, payload, Frame::STATUS_SIZE, out);
+    }
+}
+
+class TextReader {
+private:
+    char line[128];
+    size_t length;
+
+public:
+    TextReader() : length(0) {}
+
+    bool push(uint8_t byte, Message& message) {
+        if (byte != '\n') {
+            if (byte != '\r' && length < sizeof(line) - 1) {
+                line[length++] = (char)byte;
+            }
+            return false;
+        }
+        line[length] = '\0';
+        length = 0;
+
+        unsigned long value;
+        float load;
+        if (sscanf(line, "TURN:%lu", &value) == 1) {
+            message = { TURN, (uint32_t)value };
+        } else if (sscanf(line, "LOAD:%f%%", &load) == 1) {
+            message = { LOAD, (uint32_t)(load * 10 + 0.5f) };
+        } else if (sscanf(line, "FOLLOW:%lu", &value) == 1) {
+            message = { FOLLOW, (uint32_t)value };
+        } else if (sscanf(line, "ROTATING RPM:300 COMPLETED:%lu/", &value) == 1) {
+            message = { STATUS, (uint32_t)value };
+        } else {
+            return false;
+        }
+        return true;
+    }
+};
+
+class BinaryReader {
+private:
+    FrameDecoder decoder;
+
+public:
+    bool push(uint8_t byte, Message& message) {
+        if (!decoder.push(byte)) {
+            return false;
+        }
+        const uint8_t* payload = decoder.payload();
+        switch (decoder.type()) {
+            case Frame::TURN:
+                message = { TURN, Frame::get32(payload) };
+                return true;
+            case Frame::LOAD:
+                message = { LOAD, Frame::get16(payload) };
+                return true;
+            case Frame::FOLLOW:
+                message = { FOLLOW, Frame::get32(payload) };
+                return true;
+            case Frame::STATUS: {
+                Frame::StatusRecord status;
+                Frame::decodeStatus(payload, status);
+                message = { STATUS, status.completedRotations };
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+};
+
+struct Result {
+    size_t bytes;
+    double seconds;
+    std::vector<uint32_t> latency;  // us
+    size_t lost;
+    size_t bad;
+};
+
+// Index of the message a decoded one is, at or after expected; SIZE_MAX if it can't be
+size_t indexOf(const Message& message, size_t expected, size_t count) {
+    size_t index = message.value;
+    if (message.kind == LOAD) {
+        index = expected + (message.value + 1000 - expected % 1000) % 1000;
+        while (index < count && kindOf(index) != LOAD) {
+            index += 1000;
+        }
+    }
+    if (index < expected || index >= count || kindOf(index) != message.kind || messageFor(index).value != message.value) {
+        return SIZE_MAX;
+    }
+    return index;
+}
+
+void writeAll(int fd, const uint8_t* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written <= 0) {
+            return;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+}
+
+template <class Reader>
+Result run(bool binary, size_t count, unsigned rate, bool corrupt) {
+    int writer;
+    int reader;
+    struct termios raw;
+    memset(&raw, 0, sizeof(raw));
+    cfmakeraw(&raw);
+    Result result = { 0, 0, {}, 0, 0 };
+    if (openpty(&writer, &reader, nullptr, &raw, nullptr) != 0) {
+        perror("openpty");
+        exit(2);
+    }
+
+    std::vector<std::atomic<int64_t>> sent(count);
+    std::atomic<bool> finished(false);
+    Clock::time_point start = Clock::now();
+
+    std::thread sender([&]() {
+        uint8_t frame[128];
+        size_t total = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (rate > 0) {
+                std::this_thread::sleep_until(start + std::chrono::microseconds((uint64_t)i * 1000000 / rate));
+            }
+            Message message = messageFor(i);
+            size_t length = binary ? encodeBinary(message, frame) : encodeText(message, frame);
+            if (corrupt) {
+                for (size_t b = 0; b < length; b++) {
+                    if ((total + b) % CORRUPT == CORRUPT / 2) {
+                        frame[b] ^= 0x5A;
+                    }
+                }
+            }
+            total += length;
+            sent[i] = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+            writeAll(writer, frame, length);
+        }
+        result.bytes = total;
+        finished = true;
+    });
+
+    Reader decoder;
+    size_t expected = 0;
+    Clock::time_point last = start;
+    uint8_t buffer[4096];
+    struct pollfd readable = { reader, POLLIN, 0 };
+    while (expected < count) {
+        int ready = poll(&readable, 1, READ_IDLE_MS);
+        if (ready <= 0) {
+            if (finished) {
+                break;  // Whatever is still missing is lost
+            }
+            continue;
+        }
+        ssize_t received = read(reader, buffer, sizeof(buffer));
+        if (received <= 0) {
+            break;
+        }
+        int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+        for (ssize_t b = 0; b < received; b++) {
+            Message message;
+            if (!decoder.push(buffer[b], message)) {
+                continue;
+            }
+            size_t index = indexOf(message, expected, count);
+            if (index == SIZE_MAX) {
+                result.bad++;
+                continue;
+            }
+            result.lost += index - expected;
+            result.latency.push_back((uint32_t)(now - sent[index]));
+            expected = index + 1;
+        }
+        last = Clock::now();
+    }
+    result.lost += count - expected;
+    result.seconds = std::chrono::duration<double>(last - start).count();
+
+    sender.join();
+    close(writer);
+    close(reader);
+    return result;
+}
+
+uint32_t percentile(std::vector<uint32_t>& values, double fraction) {
+    if (values.empty()) {
+        return 0;
+    }
+    size_t index = (size_t)(fraction * (values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+bool report(const char* name, bool binary, size_t count, unsigned rate, bool corrupt, unsigned long baud) {
+    Result result = binary ? run<BinaryReader>(true, count, rate, corrupt) : run<TextReader>(false, count, rate, corrupt);
+    double perMessage = (double)result.bytes / count;
+    uint32_t maximum = result.latency.empty() ? 0 : *std::max_element(result.latency.begin(), result.latency.end());
+    uint32_t p50 = percentile(result.latency, 0.5);
+    uint32_t p99 = percentile(result.latency, 0.99);
+    printf("%-16s %7zu %9.1f %10.0f %8.0f %7lu %7lu %7lu %7zu %6zu\n", name, count, perMessage,
+           result.latency.size() / result.seconds, baud / 10.0 / perMessage, (unsigned long)p50,
+           (unsigned long)p99, (unsigned long)maximum, result.lost, result.bad);
+
+    if (!corrupt) {
+        return result.lost == 0 && result.bad == 0;
+    }
+    return !binary || result.bad == 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+    unsigned rate = argc > 2 ? (unsigned)atoi(argv[2]) : 2000;
+    unsigned long baud = argc > 3 ? strtoul(argv[3], nullptr, 10) : 115200;
+    if (count < KINDS) {
+        count = KINDS;
+    }
+    if (rate < 1) {
+        rate = 1;
+    }
+    size_t paced = std::min(count, (size_t)rate * 2);
+
+    printf("%-16s %7s %9s %10s %8s %7s %7s %7s %7s %6s\n", "RUN", "MSGS", "BYTES/MSG", "MSG/S", "@BAUD",
+           "P50", "P99", "MAX", "LOST", "BAD");
+    bool ok = true;
+    ok &= report("text flood", false, count, 0, false, baud);
+    ok &= report("binary flood", true, count, 0, false, baud);
+    ok &= report("text paced", false, paced, rate, false, baud);
+    ok &= report("binary paced", true, paced, rate, false, baud);
+    ok &= report("text corrupt", false, count, 0, true, baud);
+    ok &= report("binary corrupt", true, count, 0, true, baud);
+
+    printf("%s\n", ok ? "OK" : "FAIL");
+    return ok ? 0 : 1;
+}
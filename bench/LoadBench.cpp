@@ -0,0 +1,185 @@
+// Load filter benchmark (pio run -e loadbench).
+//
+// Feeds raw current-sense samples through LoadFilter in DMA-frame sized blocks, as the
+// load task does, and prints the filter cost per sample plus the filtered load over time.
+// Samples come from a recorded file (one raw 12-bit reading per line or separated by
+// commas/spaces, '#' starts a comment) captured at RATE Hz, or from a synthetic trace:
+// 1 s at 20 %, 2 s at 80 %, 2 s at 30 % of rated current with 1 kHz chopper ripple
+// and noise. For the synthetic trace it also reports the 10-90 % step response time and
+// the peak-to-peak ripple left on the load figure at steady state. test_load_filter asserts
+// those against test/test_load_filter/load_capture.txt, which is a sample file too.
+//
+//   .pio/build/loadbench/program [samples.txt [RATE]] [--csv]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include "LoadFilter.h"
+
+namespace {
+
+const uint32_t DEFAULT_RATE = 20000;   // MotorController::LOAD_SAMPLE_RATE
+const size_t FRAME_SAMPLES = 256;      // One DMA frame
+const LoadFilter::Config FILTER = { 64, 4, 0, 3100 };
+
+bool loadFile(const char* path, std::vector<uint16_t>& samples) {
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        return false;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        char* comment = strchr(line, '#');
+        if (comment != nullptr) {
+            *comment = '\0';
+        }
+        for (char* token = strtok(line, " ,;\t\r\n"); token != nullptr; token = strtok(nullptr, " ,;\t\r\n")) {
+            samples.push_back((uint16_t)atoi(token));
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+uint16_t levelFor(double percent) {
+    return (uint16_t)(FILTER.zeroLevel + (FILTER.fullLevel - FILTER.zeroLevel) * percent / 100.0);
+}
+
+void synthesize(uint32_t rate, std::vector<uint16_t>& samples) {
+    uint32_t seed = 1;
+    for (uint32_t i = 0; i < rate * 5; i++) {
+        double t = (double)i / rate;
+        double percent = t < 1.0 ? 20.0 : t < 3.0 ? 80.0 : 30.0;
+        double ripple = 200.0 * sin(2.0 * M_PI * 1000.0 * t);
+        seed = seed * 1664525u + 1013904223u;
+        double noise = (double)((seed >> 8) % 301) - 150.0;
+        double value = levelFor(percent) + ripple + noise;
+        samples.push_back((uint16_t)(value < 0 ? 0 : value > 4095 ? 4095 : value));
+    }
+}
+
+// Filter the whole trace once, recording the load after every decimated output. Blocks
+// of one decimation period line up with the filter's output boundaries.
+void run(const std::vector<uint16_t>& samples, std::vector<uint16_t>& loads) {
+    LoadFilter filter;
+    filter.configure(FILTER);
+    for (size_t i = 0; i < samples.size(); i += FILTER.decimation) {
+        size_t count = samples.size() - i < FILTER.decimation ? samples.size() - i : FILTER.decimation;
+        if (filter.push(&samples[i], count) > 0) {
+            loads.push_back(filter.loadTenths());
+        }
+    }
+}
+
+double nanosPerSample(const std::vector<uint16_t>& samples) {
+    const int ROUNDS = 200;
+    LoadFilter filter;
+    filter.configure(FILTER);
+    uint32_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (size_t i = 0; i < samples.size(); i += FRAME_SAMPLES) {
+            size_t count = samples.size() - i < FRAME_SAMPLES ? samples.size() - i : FRAME_SAMPLES;
+            filter.push(&samples[i], count);
+            sink += filter.loadTenths();
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double nanos = std::chrono::duration<double, std::nano>(end - start).count();
+    return nanos / ((double)ROUNDS * samples.size()) + (sink == 1 ? 1e-9 : 0.0);
+}
+
+// Milliseconds from the step at `from` until the load has moved 10 % -> 90 % of the way
+double riseMillis(const std::vector<uint16_t>& loads, double outputRate, size_t from, double low, double high) {
+    double ten = low + (high - low) * 0.1;
+    double ninety = low + (high - low) * 0.9;
+    long start = -1;
+    for (size_t i = from; i < loads.size(); i++) {
+        bool pastTen = high > low ? loads[i] >= ten : loads[i] <= ten;
+        bool pastNinety = high > low ? loads[i] >= ninety : loads[i] <= ninety;
+        if (start < 0 && pastTen) {
+            start = (long)i;
+        }
+        if (pastNinety) {
+            return (i - start) * 1000.0 / outputRate;
+        }
+    }
+    return -1;
+}
+
+void ripple(const std::vector<uint16_t>& loads, size_t from, size_t to, uint16_t& low, uint16_t& high) {
+    low = 0xFFFF;
+    high = 0;
+    for (size_t i = from; i < to && i < loads.size(); i++) {
+        low = loads[i] < low ? loads[i] : low;
+        high = loads[i] > high ? loads[i] : high;
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    bool csv = false;
+    const char* path = nullptr;
+    uint32_t rate = DEFAULT_RATE;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) {
+            csv = true;
+        } else if (path == nullptr) {
+            path = argv[i];
+        } else {
+            rate = (uint32_t)atoi(argv[i]);
+        }
+    }
+
+    std::vector<uint16_t> samples;
+    if (path != nullptr && !loadFile(path, samples)) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return 1;
+    }
+    if (path == nullptr) {
+        synthesize(rate, samples);
+    }
+    if (samples.size() < FILTER.decimation) {
+        fprintf(stderr, "Need at least %u samples\n", FILTER.decimation);
+        return 1;
+    }
+
+    std::vector<uint16_t> loads;
+    run(samples, loads);
+    double outputRate = (double)rate / FILTER.decimation;
+
+    if (csv) {
+        printf("seconds,load_percent\n");
+        for (size_t i = 0; i < loads.size(); i++) {
+            printf("%.4f,%.1f\n", (i + 1) / outputRate, loads[i] / 10.0);
+        }
+        return 0;
+    }
+
+    printf("%zu samples at %lu Hz (%s), decimation %u, IIR shift %u -> %.1f Hz\n", samples.size(),
+           (unsigned long)rate, path != nullptr ? path : "synthetic", FILTER.decimation, FILTER.smoothingShift, outputRate);
+    printf("Filter cost: %.2f ns/sample on this host\n", nanosPerSample(samples));
+
+    uint16_t low;
+    uint16_t high;
+    if (path != nullptr) {
+        ripple(loads, loads.size() / 10, loads.size(), low, high);
+        printf("Load after settling: %.1f .. %.1f %%, final %.1f %%\n", low / 10.0, high / 10.0, loads.back() / 10.0);
+        return 0;
+    }
+
+    size_t second = (size_t)outputRate;
+    ripple(loads, second / 2, second, low, high);
+    printf("20 %% steady: %.1f .. %.1f %% (ripple %.1f %%)\n", low / 10.0, high / 10.0, (high - low) / 10.0);
+    ripple(loads, second * 2, second * 3, low, high);
+    printf("80 %% steady: %.1f .. %.1f %% (ripple %.1f %%)\n", low / 10.0, high / 10.0, (high - low) / 10.0);
+    printf("Step 20 -> 80 %%: 10-90 %% in %.1f ms\n", riseMillis(loads, outputRate, second, 200, 800));
+    printf("Step 80 -> 30 %%: 10-90 %% in %.1f ms\n", riseMillis(loads, outputRate, second * 3, 800, 300));
+    return 0;
+}
@@ -0,0 +1,179 @@
+// Command parse cost benchmark (pio run -e parsebench).
+//
+// Parses the qt_signal.txt move commands and a few plain ones ROUNDS times each, two ways:
+//   STRING  the original loop(): the line gathered into a String a byte at a time as
+//           readStringUntil() did, trimmed, then the SPEED:/RPM: x ROT:/TIME: branches
+//           with indexOf/substring/toInt
+//   PARSER  CommandParser: bytes fed into its ring, tokenized and dispatched through a
+//           command table
+// and prints per command the host time and heap allocations per line for each. Both must
+// come up with the same speed, count and direction for every line, or it exits non-zero.
+// The host's String keeps short text inline where the ESP32's allocates, so its STRING
+// allocation figures are a lower bound.
+//
+//   .pio/build/parsebench/program [ROUNDS]    (default 200000)
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "CommandParser.h"
+#include "HeapStats.h"
+
+namespace {
+
+const char* LINES[] = {
+    "SPEED:10 ROT:5 DIR:CW",
+    "SPEED:20 TIME:30 DIR:CCW",
+    "RPM:120 ROT:50",
+    "RPM:300 TIME:5 DIR:CCW",
+    "ROT:5 RPM:100 DIR:CW",   // Any order: the String chain doesn't know this one
+    "HELLO",
+    "STATUS",
+};
+
+enum Kind : uint8_t { NONE, SPEED_ROT, SPEED_TIME, RPM_ROT, RPM_TIME, HELLO, STATUS };
+
+struct Parsed {
+    Kind kind;
+    long speed;   // Level or RPM
+    long amount;  // Rotations or seconds
+    bool clockwise;
+
+    bool operator==(const Parsed& other) const {
+        return kind == other.kind && speed == other.speed && amount == other.amount && clockwise == other.clockwise;
+    }
+};
+
+Parsed result;
+
+// The original String chain, one branch per speed x amount pair
+void parseString(const String& input) {
+    result = { NONE, 0, 0, true };
+    const char* speedKeys[] = { "SPEED:", "RPM:" };
+    const char* amountKeys[] = { " ROT:", " TIME:" };
+    const Kind kinds[2][2] = { { SPEED_ROT, SPEED_TIME }, { RPM_ROT, RPM_TIME } };
+
+    if (input == "HELLO") {
+        result.kind = HELLO;
+        return;
+    }
+    if (input == "STATUS") {
+        result.kind = STATUS;
+        return;
+    }
+    for (int s = 0; s < 2; s++) {
+        for (int a = 0; a < 2; a++) {
+            if (!input.startsWith(speedKeys[s]) || input.indexOf(amountKeys[a]) == -1) {
+                continue;
+            }
+            int speedIndex = input.indexOf(speedKeys[s]) + strlen(speedKeys[s]);
+            int amountIndex = input.indexOf(amountKeys[a]) + strlen(amountKeys[a]);
+            int dirIndex = input.indexOf(" DIR:");
+
+            result.kind = kinds[s][a];
+            result.speed = input.substring(speedIndex, input.indexOf(amountKeys[a])).toInt();
+            if (dirIndex != -1) {
+                result.amount = input.substring(amountIndex, dirIndex).toInt();
+                String direction = input.substring(dirIndex + 5);
+                direction.trim();
+                result.clockwise = (direction == "CW");
+            } else {
+                result.amount = input.substring(amountIndex).toInt();
+            }
+            return;
+        }
+    }
+}
+
+// readStringUntil('\n') and trim(), as SerialManager::readCommand() did
+void runString(const char* line) {
+    String input;
+    for (const char* c = line; *c != '\0'; c++) {
+        input += String(*c);
+    }
+    input.trim();
+    parseString(input);
+}
+
+void takeMove(const ParsedCommand& command, Kind kind, const char* speedKey, const char* amountKey) {
+    result.kind = kind;
+    result.speed = command.getInt(speedKey, 0);
+    result.amount = command.getInt(amountKey, 0);
+    result.clockwise = strcmp(command.getText("DIR", "CW"), "CW") == 0;
+}
+
+void onSpeedRot(const ParsedCommand& command) { takeMove(command, SPEED_ROT, "SPEED", "ROT"); }
+void onSpeedTime(const ParsedCommand& command) { takeMove(command, SPEED_TIME, "SPEED", "TIME"); }
+void onRpmRot(const ParsedCommand& command) { takeMove(command, RPM_ROT, "RPM", "ROT"); }
+void onRpmTime(const ParsedCommand& command) { takeMove(command, RPM_TIME, "RPM", "TIME"); }
+void onHello(const ParsedCommand&) { result.kind = HELLO; }
+void onStatus(const ParsedCommand&) { result.kind = STATUS; }
+
+const CommandEntry COMMANDS[] = {
+    { "SPEED: ROT:",  onSpeedRot },
+    { "SPEED: TIME:", onSpeedTime },
+    { "RPM: ROT:",    onRpmRot },
+    { "RPM: TIME:",   onRpmTime },
+    { "HELLO",        onHello },
+    { "STATUS",       onStatus },
+};
+
+CommandParser parser;
+
+void runParser(const char* line, size_t length) {
+    result = { NONE, 0, 0, true };
+    parser.feed((const uint8_t*)line, length);
+    ParsedCommand command;
+    while (parser.poll(command)) {
+        CommandParser::dispatch(COMMANDS, sizeof(COMMANDS) / sizeof(COMMANDS[0]), command);
+    }
+}
+
+struct Cost {
+    double nanos;
+    double allocations;
+};
+
+template <class Run>
+Cost measure(long rounds, Run run) {
+    uint32_t before = Heap::allocations();
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < rounds; i++) {
+        run();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return { seconds / rounds * 1e9, (double)(Heap::allocations() - before) / rounds };
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    long rounds = argc > 1 ? atol(argv[1]) : 200000;
+    if (rounds < 1) {
+        rounds = 1;
+    }
+
+    bool ok = true;
+    printf("%-26s %10s %8s %10s %8s\n", "COMMAND", "STRING NS", "ALLOCS", "PARSER NS", "ALLOCS");
+    for (const char* line : LINES) {
+        char withNewline[64];
+        size_t length = (size_t)snprintf(withNewline, sizeof(withNewline), "%s\n", line);
+
+        runString(line);
+        Parsed viaString = result;
+        runParser(withNewline, length);
+        Parsed viaParser = result;
+        // The String chain misses reordered keys; where it finds the command it must agree
+        bool agree = viaString.kind == NONE ? viaParser.kind != NONE : viaString == viaParser;
+        ok &= agree;
+
+        Cost string = measure(rounds, [line]() { runString(line); });
+        Cost table = measure(rounds, [&withNewline, length]() { runParser(withNewline, length); });
+        printf("%-26s %10.1f %8.1f %10.1f %8.1f%s\n", line, string.nanos, string.allocations, table.nanos,
+               table.allocations, agree ? "" : "   MISMATCH");
+    }
+
+    printf("%s\n", ok ? "OK" : "FAIL");
+    return ok ? 0 : 1;
+}
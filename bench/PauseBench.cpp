@@ -0,0 +1,303 @@
+// Pause, stop and emergency stop check over the native simulation (pio run -e pausebench).
+//
+// Runs moves through the real MotorController/StepEngine path on SimStepHal and pauses
+// them (STOP) at random times, resuming (RELOAD) after a rest or while they are still
+// ramping down; some are ended with stop() (CLOSE) or emergencyStop() (ESTOP) instead.
+// Every STEP rising edge of the move is checked:
+//   JUMP   largest change between consecutive step intervals while moving, as in
+//          RetargetBench; above 100 % the speed jumped instead of ramping
+//   REST   speed of the last step before every standstill and of the first one after
+//          it, over the ramp start speed; above END_LIMIT it stopped or started at speed
+//   STEPS  rotations and queued segments must make exactly their step count through
+//          any number of pauses
+//   TIME   timed moves must still run for their duration, rests left out, within
+//          TIME_TOLERANCE
+//   ESTOP  an emergency stop may only finish the step already under way
+// per case, over MOVES moves each.
+//
+//   .pio/build/pausebench/program [MOVES] [SEED]    (defaults 20 and 1)
+//
+// Exits non-zero on any failed check.
+#include <Arduino.h>
+#include <math.h>
+#include <random>
+#include "SerialManager.h"
+#include "MotorController.h"
+
+namespace {
+
+const long STEPS_PER_REV = 3200;               // DEFAULT_AXIS: 200 x 1/16
+const uint32_t RAMP_ACCEL = SpeedTable::RAMP_ACCEL;  // Default ramp, so speed levels use their tables
+const uint32_t RAMP_JERK = 160000;
+const double REST_INTERVAL = 1e6 / SpeedTable::RAMP_START_RATE;  // us, first and last step
+const double STANDSTILL = 1.01 * REST_INTERVAL;  // Longer gaps between steps are rests
+const uint64_t MAX_MOVE_MICROS = 120ULL * 1000000ULL;
+const double JUMP_SLACK_US = 2.0;              // Whole-microsecond rounding of two intervals
+const double JUMP_MARGIN = 1.25;               // The integrator steps at the mean velocity
+const double END_LIMIT = 2.0;                  // Steps next to a rest at most this much above rest speed
+const double TIME_TOLERANCE = 0.02;
+const int REPORTED_FAILURES = 10;
+
+enum MoveKind { ROTATION_RPM, ROTATION_LEVEL, TIMED_RPM, TIMED_LEVEL, QUEUED };
+
+struct Case {
+    const char* name;
+    MoveKind kind;
+    RampProfile profile;
+};
+
+const Case CASES[] = {
+    { "ROT RPM",      ROTATION_RPM,   RampProfile::TRAPEZOIDAL },
+    { "ROT LEVEL",    ROTATION_LEVEL, RampProfile::TRAPEZOIDAL },  // Ramp tables
+    { "ROT SCURVE",   ROTATION_RPM,   RampProfile::SCURVE },
+    { "TIME RPM",     TIMED_RPM,      RampProfile::TRAPEZOIDAL },
+    { "TIME LEVEL",   TIMED_LEVEL,    RampProfile::TRAPEZOIDAL },
+    { "TIME SCURVE",  TIMED_RPM,      RampProfile::SCURVE },
+    { "QUEUE",        QUEUED,         RampProfile::TRAPEZOIDAL },  // Blended segments
+};
+
+struct CaseResult {
+    long moves;
+    long pauses;
+    long stops;
+    long emergencyStops;
+    double worstJump;   // Share of the allowed interval change
+    double worstRest;   // Speed next to a standstill over rest speed
+    double worstTime;   // Relative running time error, timed moves
+    long stepErrors;
+};
+
+SerialManager serialManager;
+MotorController motorController;
+std::mt19937 rng;
+long failures = 0;
+
+long uniform(long low, long high) {
+    return std::uniform_int_distribution<long>(low, high)(rng);
+}
+
+void fail(const char* name, const char* what, double expected, double actual) {
+    if (++failures <= REPORTED_FAILURES) {
+        printf("  FAIL %s %s: expected %.3f, got %.3f\n", name, what, expected, actual);
+    }
+}
+
+void tick() {
+    Sim::advance(1000);
+    motorController.update();
+    serialManager.pump();
+    Sim::clearSerialOutput();
+}
+
+// Follows the STEP rising edges of one move as they are recorded (the simulation keeps a
+// ring of them, too short for a whole move)
+struct PulseCheck {
+    long seen;
+    long steps;
+    uint64_t first;
+    uint64_t last;
+    double lastInterval;  // 0 before the first interval and after a standstill
+    double restTime;      // Standstills, less the start interval that follows each
+};
+
+void checkRest(const Case& test, CaseResult& result, double interval, const char* what) {
+    double speed = REST_INTERVAL / interval;
+    if (speed > result.worstRest) {
+        result.worstRest = speed;
+    }
+    if (speed > END_LIMIT) {
+        fail(test.name, what, 1e6 / REST_INTERVAL, 1e6 / interval);
+    }
+}
+
+void checkPulses(const Case& test, CaseResult& result, PulseCheck& check) {
+    PlatformStepHal& timer = motorController.timer();
+    for (long recorded = timer.recordedPulses(); check.seen < recorded; check.seen++) {
+        uint64_t pulse = timer.pulseTime(check.seen);
+        if (check.steps == 0) {
+            check.first = pulse;
+        } else {
+            double interval = (double)(pulse - check.last);
+            if (interval > STANDSTILL) {
+                // Stood still: it must have come down to rest speed first
+                if (check.lastInterval > 0) {
+                    checkRest(test, result, check.lastInterval, "speed before standstill (steps/s)");
+                }
+                check.restTime += interval - REST_INTERVAL;
+                check.lastInterval = 0;
+            } else if (check.lastInterval == 0) {
+                checkRest(test, result, interval, "speed starting off (steps/s)");
+                check.lastInterval = interval;
+            } else {
+                double longer = check.lastInterval > interval ? check.lastInterval : interval;
+                // dt = 1 / v, so one step changes it by a * dt^3 at acceleration a
+                double allowed = JUMP_MARGIN * RAMP_ACCEL * longer * longer * longer * 1e-12;
+                double change = fabs(interval - check.lastInterval) - JUMP_SLACK_US;
+                double jump = change > 0 ? change / allowed : 0;
+                if (jump > result.worstJump) {
+                    result.worstJump = jump;
+                }
+                if (jump > 1.0) {
+                    fail(test.name, "interval change (us)", allowed + JUMP_SLACK_US, change + JUMP_SLACK_US);
+                }
+                check.lastInterval = interval;
+            }
+        }
+        check.last = pulse;
+        check.steps++;
+    }
+}
+
+// Starts the move; returns the steps it has to make, 0 for timed moves
+long startMove(const Case& test, int seconds) {
+    int rotations = (int)uniform(5, 30);
+    switch (test.kind) {
+        case ROTATION_RPM:
+            motorController.executeRotation((int)uniform(30, 600), rotations);
+            break;
+        case ROTATION_LEVEL:
+            motorController.executeRotationWithSpeed((int)uniform(14, 20), rotations);
+            break;
+        case TIMED_RPM:
+            motorController.executeTime((int)uniform(30, 600), seconds);
+            return 0;
+        case TIMED_LEVEL:
+            motorController.executeTimeWithSpeed((int)uniform(14, 20), seconds);
+            return 0;
+        case QUEUED: {
+            // Same direction, so consecutive segments blend at speed
+            long steps = 0;
+            for (long i = uniform(2, 6); i > 0; i--) {
+                rotations = (int)uniform(1, 5);
+                if (motorController.enqueueRotation((int)uniform(30, 600), 0, rotations) != 0) {
+                    steps += rotations * STEPS_PER_REV;
+                }
+            }
+            tick();  // The queue starts from update()
+            return steps;
+        }
+    }
+    return (long)rotations * STEPS_PER_REV;
+}
+
+bool runMove(const Case& test, CaseResult& result) {
+    PlatformStepHal& timer = motorController.timer();
+    timer.clearPulses();
+    PulseCheck check = {};
+
+    int seconds = (int)uniform(2, 6);
+    long steps = startMove(test, seconds);
+
+    // Something happens every 50..800 ms: mostly a pause, now and then the end of the move
+    uint64_t start = Sim::now();
+    uint64_t nextAction = start + (uint64_t)uniform(50, 800) * 1000;
+    uint64_t resumeAt = 0;
+    bool stopped = false;
+    bool emergency = false;
+    while (motorController.isMotorRunning()) {
+        if (Sim::now() - start > MAX_MOVE_MICROS) {
+            fail(test.name, "move finished", 1, 0);
+            return false;
+        }
+        if (motorController.isMotorPaused()) {
+            if (Sim::now() >= resumeAt) {
+                motorController.resume();
+                nextAction = Sim::now() + (uint64_t)uniform(50, 800) * 1000;
+            }
+        } else if (!stopped && Sim::now() >= nextAction) {
+            long action = uniform(0, 19);
+            if (action < 16) {
+                motorController.pause();
+                result.pauses++;
+                // One in three resumes while it is still ramping down
+                long rest = uniform(0, 2) == 0 ? uniform(0, 5) : uniform(20, 300);
+                resumeAt = Sim::now() + (uint64_t)rest * 1000;
+            } else if (action < 18) {
+                motorController.stop();
+                result.stops++;
+                stopped = true;
+            } else {
+                checkPulses(test, result, check);
+                long before = timer.recordedPulses();
+                motorController.emergencyStop();
+                result.emergencyStops++;
+                stopped = true;
+                emergency = true;
+                if (motorController.isMotorRunning()) {
+                    fail(test.name, "running after ESTOP", 0, 1);
+                }
+                for (int i = 0; i < 5; i++) {
+                    tick();
+                }
+                if (timer.recordedPulses() - before > 1) {
+                    fail(test.name, "steps after ESTOP", 1, (double)(timer.recordedPulses() - before));
+                }
+                check.seen = timer.recordedPulses();  // It halted at speed, on purpose
+                check.lastInterval = 0;
+            }
+        }
+        tick();
+        checkPulses(test, result, check);
+    }
+    for (int i = 0; i < 5; i++) {
+        tick();  // Nothing may follow the end of the move
+    }
+    checkPulses(test, result, check);
+    result.moves++;
+
+    if (!emergency && check.lastInterval > 0) {
+        checkRest(test, result, check.lastInterval, "last step speed (steps/s)");
+    }
+    if (!stopped && steps > 0 && check.steps != steps) {
+        result.stepErrors++;
+        fail(test.name, "steps", (double)steps, (double)check.steps);
+    }
+    if (!stopped && steps == 0 && check.steps >= 2) {
+        // The first step comes one interval after the start, like the last one before the end
+        double running = (check.last - check.first - check.restTime) / 1e6;
+        double error = fabs(running - seconds) / seconds;
+        if (error > result.worstTime) {
+            result.worstTime = error;
+        }
+        if (error > TIME_TOLERANCE) {
+            fail(test.name, "running time (s)", seconds, running);
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    long moves = argc > 1 ? atol(argv[1]) : 20;
+    uint32_t seed = argc > 2 ? (uint32_t)atol(argv[2]) : 1;
+    rng.seed(seed);
+
+    serialManager.begin();
+    motorController.begin(serialManager);
+    motorController.timer().setAlarmLatency(2);  // Constant, so the intervals stay exact
+
+    printf("%ld moves per case, seed %lu\n\n", moves, (unsigned long)seed);
+    printf("%-12s %6s %6s %5s %5s %8s %7s %6s %7s\n", "CASE", "MOVES", "PAUSES", "STOPS", "ESTOP",
+           "JUMP", "REST", "STEPS", "TIME");
+    for (const Case& test : CASES) {
+        CaseResult result = {};
+        motorController.setRamp(test.profile, RAMP_ACCEL, RAMP_JERK);
+        for (long i = 0; i < moves; i++) {
+            if (!runMove(test, result)) {
+                break;
+            }
+        }
+        bool timed = test.kind == TIMED_RPM || test.kind == TIMED_LEVEL;
+        printf("%-12s %6ld %6ld %5ld %5ld %7.0f%% %6.2fx %6s %6.2f%%\n", test.name, result.moves,
+               result.pauses, result.stops, result.emergencyStops, result.worstJump * 100, result.worstRest,
+               timed ? "-" : result.stepErrors == 0 ? "exact" : "WRONG", result.worstTime * 100);
+    }
+
+    if (failures > 0) {
+        printf("\nFAILED: %ld checks\n", failures);
+        return 1;
+    }
+    printf("\nOK: every pause and stop ramped down and every move kept its count or time\n");
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Motion planner cost benchmark (pio run -e plannerbench).
+//
+// Plans the same moves with every ramp profile and the speed level tables and calls
+// nextInterval() until each one ends, as the step ISR does, and prints per profile the
+// steps planned and the host time per step: mean, and the slowest of ROUNDS repeats of
+// the whole set.
+//
+//   .pio/build/plannerbench/program [ROUNDS]    (default 20)
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "MotionPlanner.h"
+#include "SpeedTable.h"
+
+namespace {
+
+const uint32_t ACCEL = 16000;   // steps/s^2, SpeedTable::RAMP_ACCEL
+const uint32_t JERK = 160000;   // steps/s^3
+const double CRUISE_US[] = { 18.75, 50, 156.25, 1000, 10000 };
+const long MOVE_STEPS[] = { 200, 3200, 64000 };
+
+volatile uint32_t sink;  // Keeps the intervals from being optimized away
+
+// Runs one move to the end, returns its step count
+long drain(MotionPlanner& planner) {
+    long steps = 0;
+    uint32_t interval;
+    while ((interval = planner.nextInterval()) != 0) {
+        sink = interval;
+        steps++;
+    }
+    return steps;
+}
+
+// Every cruise speed and length once; level > 0 replays that speed level's table instead
+long runSet(MotionPlanner& planner, int level) {
+    long steps = 0;
+    for (long length : MOVE_STEPS) {
+        if (level > 0) {
+            planner.planTable(SpeedTable::ramp(level), SpeedTable::rampSteps(level),
+                              SpeedTable::DELAY_US[level - 1], length);
+            steps += drain(planner);
+            continue;
+        }
+        for (double micros : CRUISE_US) {
+            planner.plan((uint64_t)(micros * 4294967296.0), length);
+            steps += drain(planner);
+        }
+    }
+    return steps;
+}
+
+void bench(const char* name, RampProfile profile, int level, int rounds) {
+    RampConfig config = { profile, ACCEL, JERK, SpeedTable::RAMP_START_RATE };
+    MotionPlanner planner;
+    planner.setConfig(config);
+
+    long steps = 0;
+    double total = 0;
+    double worst = 0;
+    for (int round = 0; round < rounds; round++) {
+        auto start = std::chrono::steady_clock::now();
+        long setSteps = runSet(planner, level);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        steps += setSteps;
+        total += seconds;
+        double perStep = seconds / setSteps;
+        worst = perStep > worst ? perStep : worst;
+    }
+    printf("%-12s %10ld %8.2f %8.2f\n", name, steps / rounds, total / steps * 1e9, worst * 1e9);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 20;
+    if (rounds < 1) {
+        rounds = 1;
+    }
+
+    printf("%-12s %10s %8s %8s\n", "PROFILE", "STEPS", "NS/STEP", "WORST");
+    bench("none", RampProfile::NONE, 0, rounds);
+    bench("trapezoidal", RampProfile::TRAPEZOIDAL, 0, rounds);
+    bench("scurve", RampProfile::SCURVE, 0, rounds);
+    bench("table-1", RampProfile::TRAPEZOIDAL, 1, rounds);
+    bench("table-20", RampProfile::TRAPEZOIDAL, SpeedTable::LEVELS, rounds);
+    return 0;
+}
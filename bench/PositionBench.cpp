@@ -0,0 +1,267 @@
+// Position mode check over the native simulation (pio run -e positionbench).
+//
+// Runs MOVES random position moves through the real MotorController/StepEngine path on
+// SimStepHal: absolute and relative targets in steps and degrees, RPMs and speed levels,
+// all three ramp profiles, with some moves paused and resumed, or stopped or emergency
+// stopped part way. After every move it checks the axis position against the target
+// worked out here, and the step engine's count against the net steps the simulated shaft
+// actually made. It then
+// homes against the simulated switch placed at random distances, starting off and on the
+// switch, checks that position 0 lands exactly on the switch edge and that positions
+// still add up afterwards, and that soft limits refuse moves past them.
+//
+//   .pio/build/positionbench/program [MOVES] [SEED]    (defaults 2000 and 1)
+//
+// Exits non-zero on any mismatch.
+#include <Arduino.h>
+#include <random>
+#include "SerialManager.h"
+#include "MotorController.h"
+
+namespace {
+
+const long STEPS_PER_REV = 3200;                 // DEFAULT_AXIS: 200 x 1/16
+const long MAX_TARGET = 8 * STEPS_PER_REV;       // Absolute targets within +-8 revolutions
+const long MAX_RELATIVE = 3 * STEPS_PER_REV;
+const uint64_t MAX_MOVE_MICROS = 120ULL * 1000000ULL;
+const int HOMING_TRIALS = 40;
+const int MOVES_AFTER_HOMING = 5;
+const int REPORTED_FAILURES = 10;
+
+SerialManager serialManager;
+MotorController motorController;
+std::mt19937 rng;
+
+long failures = 0;
+long worstError = 0;
+
+long uniform(long low, long high) {
+    return std::uniform_int_distribution<long>(low, high)(rng);
+}
+
+void tick() {
+    Sim::advance(1000);
+    motorController.update();
+    serialManager.pump();
+    Sim::clearSerialOutput();
+}
+
+// Run the motion task until the move (or homing) is over
+bool runToEnd() {
+    uint64_t start = Sim::now();
+    while (motorController.isMotorRunning()) {
+        if (Sim::now() - start > MAX_MOVE_MICROS) {
+            return false;
+        }
+        tick();
+    }
+    return true;
+}
+
+void fail(const char* what, long expected, long actual) {
+    long error = actual > expected ? actual - expected : expected - actual;
+    if (error > worstError) {
+        worstError = error;
+    }
+    if (++failures <= REPORTED_FAILURES) {
+        printf("  FAIL %s: expected %ld, got %ld\n", what, expected, actual);
+    }
+}
+
+// The engine's position is offset from the shaft's net steps by whatever zero was set last
+void checkPosition(const char* what, long expected, long shaftZero) {
+    long position = motorController.position();
+    if (position != expected) {
+        fail(what, expected, position);
+    }
+    long shaft = motorController.timer().netSteps() - shaftZero;
+    if (shaft != position) {
+        fail("shaft against position", position, shaft);
+    }
+}
+
+void randomRamp() {
+    switch (uniform(0, 5)) {
+        case 0:
+            motorController.setRamp(RampProfile::NONE, 0, 0);
+            break;
+        case 1:
+            motorController.setRamp(RampProfile::SCURVE, (uint32_t)uniform(4000, 40000), (uint32_t)uniform(40000, 400000));
+            break;
+        default:
+            motorController.setRamp(RampProfile::TRAPEZOIDAL, 16000, 160000);
+            break;
+    }
+}
+
+// One random move from the current position; returns false if it never finished
+bool randomMove(long& expected, long shaftZero, long& interrupted) {
+    bool relative = uniform(0, 1) == 1;
+    bool degrees = uniform(0, 3) == 0;
+    long target;
+    if (degrees) {
+        // Hundredths of a degree, as the MOVE command parses them
+        double limit = (relative ? MAX_RELATIVE : MAX_TARGET) * 360.0 / STEPS_PER_REV;
+        double value = uniform((long)(-limit * 100), (long)(limit * 100)) / 100.0;
+        target = motorController.degreesToSteps(value);
+        long exact = (long)llround(value * STEPS_PER_REV / 360.0);
+        if (target != exact) {
+            fail("degree conversion", exact, target);
+        }
+    } else {
+        target = relative ? uniform(-MAX_RELATIVE, MAX_RELATIVE) : uniform(-MAX_TARGET, MAX_TARGET);
+    }
+
+    // Speeds that cross the longest move (16 revolutions) well within MAX_MOVE_MICROS
+    int level = uniform(0, 4) == 0 ? (int)uniform(14, 20) : 0;
+    int rpm = (int)uniform(30, 600);
+    if (uniform(0, 9) == 0) {
+        randomRamp();
+    }
+
+    long start = motorController.position();
+    if (motorController.executeMove(target, relative, rpm, level) != MoveResult::STARTED) {
+        fail("move refused", 0, 1);
+        return true;
+    }
+    expected = relative ? start + target : target;
+
+    // Interrupt one move in ten part way: pause and resume, or stop it for good
+    if (uniform(0, 9) == 0) {
+        long wait = uniform(1, 200);
+        for (long i = 0; i < wait && motorController.isMotorRunning(); i++) {
+            tick();
+        }
+        if (uniform(0, 1) == 0) {
+            motorController.pause();
+            for (long i = uniform(1, 50); i > 0; i--) {
+                tick();
+            }
+            motorController.resume();
+        } else if (motorController.isMotorRunning()) {
+            // Ramped down or halted at once (ESTOP)
+            if (uniform(0, 1) == 0) {
+                motorController.stop();
+            } else {
+                motorController.emergencyStop();
+            }
+            if (!runToEnd()) {
+                return false;
+            }
+            for (int i = 0; i < 5; i++) {
+                tick();  // Let a pending falling edge complete
+            }
+            // Wherever the shaft stopped; the position must agree
+            expected = motorController.timer().netSteps() - shaftZero;
+            interrupted++;
+        }
+    }
+    return runToEnd();
+}
+
+// Home with the switch placed so it closes `distance` steps CCW of the shaft (negative:
+// the shaft starts on it); returns the shaft position of position 0
+bool homeOnce(long distance, long& shaftZero) {
+    long closesAt = motorController.timer().netSteps() - distance;
+    motorController.limitSwitch().place(closesAt);
+    if (!motorController.home() || !runToEnd()) {
+        fail("homing finished", 1, 0);
+        return false;
+    }
+    if (!motorController.isHomed()) {
+        fail("homed", 1, 0);
+        return false;
+    }
+
+    // The latch pass stops before the first step with the switch closed: on its edge
+    shaftZero = motorController.timer().netSteps();
+    if (shaftZero != closesAt) {
+        fail("home on the switch edge", closesAt, shaftZero);
+    }
+    checkPosition("position after homing", 0, shaftZero);
+    return true;
+}
+
+void checkSoftLimits(long shaftZero) {
+    motorController.setSoftLimits(true, -STEPS_PER_REV, STEPS_PER_REV);
+    long before = motorController.position();
+    if (motorController.executeMove(2 * STEPS_PER_REV, false, 120, 0) != MoveResult::LIMIT) {
+        fail("soft limit refused absolute", 1, 0);
+    }
+    if (motorController.executeMove(-before - STEPS_PER_REV - 1, true, 120, 0) != MoveResult::LIMIT) {
+        fail("soft limit refused relative", 1, 0);
+    }
+    if (motorController.isMotorRunning()) {
+        fail("refused move did not run", 0, 1);
+        runToEnd();
+    }
+    checkPosition("position after refused moves", before, shaftZero);
+
+    if (motorController.executeMove(STEPS_PER_REV, false, 120, 0) != MoveResult::STARTED || !runToEnd()) {
+        fail("move onto soft limit", 1, 0);
+    }
+    checkPosition("position at soft limit", STEPS_PER_REV, shaftZero);
+    motorController.setSoftLimits(false, 0, 0);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    long moves = argc > 1 ? atol(argv[1]) : 2000;
+    uint32_t seed = argc > 2 ? (uint32_t)atol(argv[2]) : 1;
+    rng.seed(seed);
+
+    serialManager.begin();
+    motorController.begin(serialManager);
+    motorController.timer().setAlarmLatency(2);
+    motorController.timer().setAlarmJitter(6, seed);
+
+    printf("%ld random moves, seed %lu\n", moves, (unsigned long)seed);
+    long expected = 0;
+    long interrupted = 0;
+    long shaftZero = motorController.timer().netSteps() - motorController.position();
+    long steps = 0;
+    for (long i = 0; i < moves; i++) {
+        long from = motorController.position();
+        if (!randomMove(expected, shaftZero, interrupted)) {
+            fail("move finished", 1, 0);
+            break;
+        }
+        checkPosition("position after move", expected, shaftZero);
+        steps += labs(motorController.position() - from);
+    }
+    printf("  %ld steps moved, %ld moves stopped part way\n", steps, interrupted);
+
+    printf("%d homing runs\n", HOMING_TRIALS);
+    motorController.setRamp(RampProfile::TRAPEZOIDAL, 16000, 160000);
+    for (int trial = 0; trial < HOMING_TRIALS; trial++) {
+        // One run in four starts with the switch already closed
+        long distance = trial % 4 == 3 ? -uniform(0, 400) : uniform(1, 20 * STEPS_PER_REV);
+        if (!homeOnce(distance, shaftZero)) {
+            break;
+        }
+        motorController.limitSwitch().remove();
+        for (int i = 0; i < MOVES_AFTER_HOMING; i++) {
+            if (!randomMove(expected, shaftZero, interrupted)) {
+                fail("move finished", 1, 0);
+                break;
+            }
+            checkPosition("position after homing and moves", expected, shaftZero);
+        }
+    }
+
+    printf("Soft limits and a missing switch\n");
+    checkSoftLimits(shaftZero);
+    motorController.home();  // No switch placed: gives up after HOME_MAX_REVOLUTIONS
+    runToEnd();
+    if (motorController.isHomed()) {
+        fail("homing without a switch fails", 0, 1);
+    }
+
+    if (failures > 0) {
+        printf("FAILED: %ld mismatches, worst %ld steps\n", failures, worstError);
+        return 1;
+    }
+    printf("OK: every position matched the target and the shaft exactly\n");
+    return 0;
+}
@@ -0,0 +1,313 @@
+// Driver policy check and benchmark (pio run -e profilebench).
+//
+// Builds the station's controller (TB6600), the same on a DRV8825 and the one without a
+// motor (SimulatedDriver, what TEST_MODE used to be a separate build for) into one binary
+// and runs the same moves through each: the drivers on SimStepHal must end every move
+// with the station's TURN/DONE replies and position, the simulated one with its replies
+// and, for moves of a known length, its position; timed moves must last their time.
+// Then per variant:
+//   CODE     bytes of the instantiation's member functions in this binary, from nm
+//   BEFORE   the same for the controller before it was a template (MotorController at
+//            ee07e0a, TEST_MODE for the simulated driver; it only drove a TB6600)
+//   IDLE     ns per update() at rest
+//   MOVING   ns per update() during a rotation (the step ISR not included)
+//   START    us per move start, driver delays excluded (they pass on the fake clock)
+//
+//   .pio/build/profilebench/program [BEFORE [BEFORE_TEST_MODE]]
+//
+// BEFORE and BEFORE_TEST_MODE are host builds of ee07e0a with the same flags (-Os), e.g. its
+// bench env without and with -D TEST_MODE; without them the figures recorded below are
+// used. Later changes to the controller count towards CODE too.
+//
+// Exits non-zero on any mismatch.
+#include <Arduino.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include "SerialManager.h"
+#include "MotorController.h"
+
+namespace {
+
+const uint64_t MAX_MOVE_MICROS = 30ULL * 1000000ULL;
+const double TIME_TOLERANCE = 0.05;
+const int ROUNDS = 5;             // Of each measurement, the fastest counts
+const int IDLE_CALLS = 200000;
+const int MOVING_PASSES = 2000;   // Of 1 ms, UPDATES_PER_PASS update() calls each
+const int UPDATES_PER_PASS = 50;
+const int STARTS = 200;
+
+// ee07e0a's MotorController:: functions, host g++ 12.2 -Os
+const size_t RECORDED_BEFORE = 14767;
+const size_t RECORDED_BEFORE_TEST_MODE = 13312;
+
+typedef BasicMotorController<Drv8825Driver, Nema23Profile> Drv8825Controller;
+typedef BasicMotorController<SimulatedDriver, Nema23Profile> SimulatedController;
+
+SerialManager serialManager;
+MotorController station;
+Drv8825Controller drv8825;
+SimulatedController simulated;
+
+enum MoveKind { ROTATION, ROTATION_LEVEL, TIMED, POSITION };
+
+struct MoveCase {
+    const char* name;
+    MoveKind kind;
+    int speed;     // RPM or speed level
+    long amount;   // Rotations, seconds or target steps
+    bool clockwise;
+};
+
+const MoveCase MOVE_CASES[] = {
+    { "ROT 300",   ROTATION,       300, 2,     true },
+    { "MOVE",      POSITION,       200, -1600, true },
+    { "LEVEL 10",  ROTATION_LEVEL, 10,  1,     false },
+    { "TIME 120",  TIMED,          120, 1,     false },  // Last: the simulated driver doesn't move
+};
+const size_t MOVE_COUNT = sizeof(MOVE_CASES) / sizeof(MOVE_CASES[0]);
+
+struct MoveOutcome {
+    std::string replies;  // TURN and DONE lines
+    long position;
+    double seconds;
+};
+
+struct Timing {
+    size_t code;    // Bytes, 0 if nm couldn't tell
+    size_t before;
+    double idle;    // ns
+    double moving;  // ns
+    double start;   // us
+};
+
+// TURN:{n} and DONE lines of the output, one per line
+std::string replies(const std::string& output) {
+    std::string found;
+    size_t at = 0;
+    while (at < output.size()) {
+        size_t end = output.find('\n', at);
+        std::string line = output.substr(at, end == std::string::npos ? std::string::npos : end - at);
+        at = end == std::string::npos ? output.size() : end + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.compare(0, 5, "TURN:") == 0 || line == "DONE") {
+            found += line + "\n";
+        }
+    }
+    return found;
+}
+
+// Bytes of the functions in a binary whose names start with prefix, from nm; 0 without nm
+size_t codeBytes(const char* binary, const char* prefix) {
+    std::string command = std::string("nm -C -S --size-sort '") + binary + "' 2>/dev/null";
+    FILE* symbols = popen(command.c_str(), "r");
+    if (symbols == nullptr) {
+        return 0;
+    }
+    size_t total = 0;
+    char line[4096];
+    while (fgets(line, sizeof(line), symbols) != nullptr) {
+        // address size type name
+        unsigned long long address;
+        unsigned long long size;
+        char type;
+        int name;
+        if (sscanf(line, "%llx %llx %c %n", &address, &size, &type, &name) == 3 && strchr("tTwW", type) != nullptr
+            && strncmp(line + name, prefix, strlen(prefix)) == 0) {
+            total += size;
+        }
+    }
+    pclose(symbols);
+    return total;
+}
+
+template <class Controller>
+void tick(Controller& controller, std::string& output) {
+    Sim::advance(1000);
+    controller.update();
+    serialManager.pump();
+    output += Sim::serialOutput();
+    Sim::clearSerialOutput();
+}
+
+template <class Controller>
+void startMove(Controller& controller, const MoveCase& test) {
+    switch (test.kind) {
+        case ROTATION:
+            controller.executeRotation(test.speed, (int)test.amount, test.clockwise);
+            break;
+        case ROTATION_LEVEL:
+            controller.executeRotationWithSpeed(test.speed, (int)test.amount, test.clockwise);
+            break;
+        case TIMED:
+            controller.executeTime(test.speed, (int)test.amount, test.clockwise);
+            break;
+        case POSITION:
+            controller.executeMove(test.amount, false, test.speed, 0);
+            break;
+    }
+}
+
+template <class Controller>
+bool runMoves(Controller& controller, MoveOutcome* results) {
+    serialManager.begin();
+    controller.begin(serialManager);
+    controller.setPosition(0);
+    Sim::clearSerialOutput();
+
+    for (size_t i = 0; i < MOVE_COUNT; i++) {
+        std::string output;
+        uint64_t start = Sim::now();
+        startMove(controller, MOVE_CASES[i]);
+        while (controller.isMotorRunning() && Sim::now() - start < MAX_MOVE_MICROS) {
+            tick(controller, output);
+        }
+        results[i].seconds = (Sim::now() - start) / 1e6;
+        for (int settle = 0; settle < 20; settle++) {
+            tick(controller, output);
+        }
+        if (controller.isMotorRunning()) {
+            return false;
+        }
+        results[i].replies = replies(output);
+        results[i].position = controller.position();
+    }
+    return true;
+}
+
+double since(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+}
+
+template <class Controller>
+void measure(Controller& controller, Timing& timing) {
+    timing.idle = timing.moving = timing.start = 1e30;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < IDLE_CALLS; i++) {
+            controller.update();
+        }
+        timing.idle = std::min(timing.idle, since(begin) / IDLE_CALLS);
+
+        controller.executeRotation(60, 100);
+        double nanos = 0;
+        for (int pass = 0; pass < MOVING_PASSES; pass++) {
+            Sim::advance(1000);
+            begin = std::chrono::steady_clock::now();
+            for (int i = 0; i < UPDATES_PER_PASS; i++) {
+                controller.update();
+            }
+            nanos += since(begin);
+            serialManager.pump();
+            Sim::clearSerialOutput();
+        }
+        timing.moving = std::min(timing.moving, nanos / ((double)MOVING_PASSES * UPDATES_PER_PASS));
+        controller.emergencyStop();
+
+        nanos = 0;
+        for (int start = 0; start < STARTS; start++) {
+            begin = std::chrono::steady_clock::now();
+            controller.executeRotation(300, 1);
+            nanos += since(begin);
+            controller.emergencyStop();
+            serialManager.pump();
+            Sim::clearSerialOutput();
+        }
+        timing.start = std::min(timing.start, nanos / STARTS / 1000.0);
+    }
+}
+
+// false if the variant's results don't match the station's
+bool compare(const char* name, const MoveOutcome* expected, const MoveOutcome* results, bool steps) {
+    bool matched = true;
+    for (size_t i = 0; i < MOVE_COUNT; i++) {
+        const MoveCase& test = MOVE_CASES[i];
+        const char* problem = nullptr;
+        bool timed = test.kind == TIMED;
+        if (timed && fabs(results[i].seconds - test.amount) > TIME_TOLERANCE * test.amount) {
+            problem = "took too long or too short";
+        } else if (timed && results[i].replies.find("DONE") == std::string::npos) {
+            problem = "no DONE";
+        } else if (!timed && results[i].replies != expected[i].replies) {
+            problem = "replies differ";
+        } else if ((steps || !timed) && results[i].position != expected[i].position) {
+            problem = "position differs";
+        }
+        size_t turns = 0;
+        for (size_t at = 0; (at = results[i].replies.find("TURN:", at)) != std::string::npos; at++) {
+            turns++;
+        }
+        printf("%-10s %-9s %6zu %9ld %8.3f  %s\n", name, test.name, turns, results[i].position, results[i].seconds,
+               problem != nullptr ? problem : "ok");
+        if (problem != nullptr) {
+            matched = false;
+        }
+    }
+    return matched;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    MoveOutcome stationMoves[MOVE_COUNT];
+    MoveOutcome drv8825Moves[MOVE_COUNT];
+    MoveOutcome simulatedMoves[MOVE_COUNT];
+    Timing stationTiming;
+    Timing drv8825Timing;
+    Timing simulatedTiming;
+
+    // One at a time: the Sim clock drives the step timer begun last
+    bool ran = runMoves(station, stationMoves);
+    measure(station, stationTiming);
+    ran = runMoves(drv8825, drv8825Moves) && ran;
+    measure(drv8825, drv8825Timing);
+    ran = runMoves(simulated, simulatedMoves) && ran;
+    measure(simulated, simulatedTiming);
+
+    printf("The same moves through each driver\n\n");
+    printf("%-10s %-9s %6s %9s %8s  %s\n", "DRIVER", "MOVE", "TURNS", "POSITION", "SECONDS", "RESULT");
+    bool matched = compare(Tb6600Driver::name(), stationMoves, stationMoves, true);
+    matched = compare(Drv8825Driver::name(), stationMoves, drv8825Moves, true) && matched;
+    matched = compare(SimulatedDriver::name(), stationMoves, simulatedMoves, false) && matched;
+
+    stationTiming.code = codeBytes(argv[0], "BasicMotorController<Tb6600Driver, Nema23Profile>::");
+    drv8825Timing.code = codeBytes(argv[0], "BasicMotorController<Drv8825Driver, Nema23Profile>::");
+    simulatedTiming.code = codeBytes(argv[0], "BasicMotorController<SimulatedDriver, Nema23Profile>::");
+    stationTiming.before = argc > 1 ? codeBytes(argv[1], "MotorController::") : RECORDED_BEFORE;
+    drv8825Timing.before = 0;
+    simulatedTiming.before = argc > 2 ? codeBytes(argv[2], "MotorController::") : RECORDED_BEFORE_TEST_MODE;
+
+    printf("\nController per driver on this host%s\n\n", argc > 1 ? "" : ", BEFORE as recorded");
+    printf("%-10s %7s %7s %7s %9s %9s %9s\n", "DRIVER", "CODE", "BEFORE", "CHANGE", "IDLE ns", "MOVING ns", "START us");
+    const Timing* timings[] = { &stationTiming, &drv8825Timing, &simulatedTiming };
+    const char* names[] = { Tb6600Driver::name(), Drv8825Driver::name(), SimulatedDriver::name() };
+    for (size_t i = 0; i < 3; i++) {
+        char code[24] = "-";
+        char before[24] = "-";
+        char change[24] = "-";
+        if (timings[i]->code > 0) {
+            snprintf(code, sizeof(code), "%zu", timings[i]->code);
+        }
+        if (timings[i]->before > 0) {
+            snprintf(before, sizeof(before), "%zu", timings[i]->before);
+        }
+        if (timings[i]->code > 0 && timings[i]->before > 0) {
+            snprintf(change, sizeof(change), "%+ld", (long)timings[i]->code - (long)timings[i]->before);
+        }
+        printf("%-10s %7s %7s %7s %9.1f %9.1f %9.2f\n", names[i], code, before, change, timings[i]->idle,
+               timings[i]->moving, timings[i]->start);
+    }
+
+    if (!ran || !matched) {
+        printf("\nFAILED: %s\n", ran ? "a driver's moves didn't match" : "a move didn't end");
+        return 1;
+    }
+    printf("\nOK: every driver ran the moves the station did\n");
+    return 0;
+}
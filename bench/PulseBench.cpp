@@ -0,0 +1,323 @@
+// Pulse burst check and benchmark over the native simulation (pio run -e pulsebench).
+//
+// ENCODE  PulseEncoder on its own, the way the step ISR fills a 64-item burst: steps and
+//         items per microsecond of host time for planned intervals at running speeds (one
+//         item each) and for slow steps that take several. Every burst is decoded again
+//         and must give back its intervals exactly.
+// MOVES   moves through the real MotorController/StepEngine path on SimStepHal, once with
+//         an edge per alarm as GpioPulses makes them and once in bursts as RmtPulses
+//         plays them. Per case:
+//           STEPS    STEP rising edges of the move
+//           ALARMS   timer interrupts per step, edges / bursts
+//           DIFF     edges whose time differs between the two, and the largest difference
+//                    in microseconds; for PAUSE and ESTOP only the edges before them count
+//           EXTRA    steps the bursts made beyond the edges: 0, or 1 for the pulse under
+//                    way at an ESTOP
+//           ERR      bursts that overlapped the one before, DIR written under a burst, a
+//                    burst without its end marker, or the engine's position not matching
+//                    the edges
+//
+//   .pio/build/pulsebench/program [REPEATS]    (default 200)
+//
+// Exits non-zero on any mismatch.
+#include <Arduino.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "SerialManager.h"
+#include "MotorController.h"
+#include "PulseEncoder.h"
+
+namespace {
+
+const uint32_t PULSE_WIDTH_US = 5;   // StepEngine's
+const uint16_t BURST_ITEMS = 64;     // RmtPulses::BURST_ITEMS
+const size_t INTERVALS = 1 << 16;
+const uint64_t MAX_MOVE_MICROS = 120ULL * 1000000ULL;
+
+volatile uint32_t sink;  // Keeps the timed encoding from being optimised away
+
+// ENCODE
+
+struct EncodeCase {
+    const char* name;
+    uint32_t shortest;
+    uint32_t longest;
+};
+
+const EncodeCase ENCODE_CASES[] = {
+    { "RUNNING",  19, 2000 },       // MAX_RPM down to ramp start speed
+    { "SLOW",     20000, 200000 },  // Past the 15-bit item: up to 7 items a step
+};
+
+// Fill one burst from intervals[from..], as StepEngine::sendBurst() does; returns the
+// steps it took
+size_t encodeBurst(const uint32_t* intervals, size_t from, size_t count, PulseItem* items, uint16_t& used) {
+    PulseEncoder encoder(items, BURST_ITEMS, PULSE_WIDTH_US);
+    size_t i = from;
+    while (i < count) {
+        bool fitted = encoder.step(intervals[i++]);
+        if (!fitted || encoder.full()) {
+            break;
+        }
+    }
+    used = encoder.finish();
+    return i - from;
+}
+
+// Rising edges of the burst must follow the intervals, the last step's pulse only
+bool checkBurst(const uint32_t* intervals, size_t steps, const PulseItem* items, uint16_t used) {
+    uint64_t at = 0;
+    uint64_t expected = 0;
+    size_t rising = 0;
+    bool level = false;
+    bool ended = false;
+    for (uint16_t i = 0; i < used && !ended; i++) {
+        uint32_t durations[2] = { items[i].duration0(), items[i].duration1() };
+        bool levels[2] = { items[i].level0(), items[i].level1() };
+        for (int half = 0; half < 2; half++) {
+            if (durations[half] == 0) {
+                ended = true;
+                break;
+            }
+            if (levels[half] && !level) {
+                if (rising >= steps || at != expected) {
+                    return false;
+                }
+                expected += intervals[rising++];
+            }
+            if (levels[half] && durations[half] != PULSE_WIDTH_US) {
+                return false;
+            }
+            level = levels[half];
+            at += durations[half];
+        }
+    }
+    // Ends right after the last pulse, where the line goes back to idle low
+    return ended && rising == steps && at == expected - intervals[steps - 1] + PULSE_WIDTH_US;
+}
+
+bool runEncode(const EncodeCase& test, long repeats) {
+    std::mt19937 random(1);
+    std::uniform_int_distribution<uint32_t> pick(test.shortest, test.longest);
+    std::vector<uint32_t> intervals(INTERVALS);
+    for (uint32_t& interval : intervals) {
+        interval = pick(random);
+    }
+    PulseItem items[BURST_ITEMS];
+
+    long failures = 0;
+    long itemsTotal = 0;
+    long bursts = 0;
+    for (size_t from = 0; from < INTERVALS;) {
+        uint16_t used;
+        size_t steps = encodeBurst(intervals.data(), from, INTERVALS, items, used);
+        if (!checkBurst(intervals.data() + from, steps, items, used)) {
+            if (failures++ < 5) {
+                printf("  FAIL %s: burst at step %zu does not decode to its intervals\n", test.name, from);
+            }
+        }
+        itemsTotal += used;
+        bursts++;
+        from += steps;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (long r = 0; r < repeats; r++) {
+        for (size_t from = 0; from < INTERVALS;) {
+            uint16_t used;
+            from += encodeBurst(intervals.data(), from, INTERVALS, items, used);
+            sink = sink + items[used - 1].value;
+        }
+    }
+    double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    double steps = (double)INTERVALS * repeats;
+
+    printf("%-8s %7.1f %9.1f %9.1f %8.2f %6ld\n", test.name, (double)itemsTotal / bursts,
+           steps / micros, (double)itemsTotal * repeats / micros, micros * 1000.0 / steps, failures);
+    return failures == 0;
+}
+
+// MOVES
+
+SerialManager serialManager;
+MotorController motorController;
+
+enum MoveKind { ROTATION_RPM, ROTATION_LEVEL, POSITION, TURNS, PAUSED, EMERGENCY };
+
+struct MoveCase {
+    const char* name;
+    MoveKind kind;
+    int speed;  // RPM or speed level
+};
+
+const MoveCase MOVE_CASES[] = {
+    { "ROT 60",    ROTATION_RPM,   60 },
+    { "ROT 300",   ROTATION_RPM,   300 },
+    { "ROT 1000",  ROTATION_RPM,   1000 },
+    { "LEVEL 20",  ROTATION_LEVEL, 20 },   // Ramp tables
+    { "MOVE",      POSITION,       450 },  // Out and back
+    { "TURNS",     TURNS,          300 },  // Queued segments that reverse DIR
+    { "PAUSE",     PAUSED,         600 },
+    { "ESTOP",     EMERGENCY,      800 },  // Cuts the burst playing
+};
+
+struct MoveRun {
+    std::vector<uint64_t> pulses;  // From the start of the move
+    uint64_t interruptAt;          // PAUSE or ESTOP, from the start of the move
+    long alarms;
+    long errors;
+};
+
+void tick() {
+    Sim::advance(1000);
+    motorController.update();
+    serialManager.pump();
+    Sim::clearSerialOutput();
+}
+
+void startMove(const MoveCase& test) {
+    switch (test.kind) {
+        case ROTATION_LEVEL:
+            motorController.executeRotationWithSpeed(test.speed, 3);
+            break;
+        case POSITION:
+            motorController.executeMove(9600, true, test.speed, 0);
+            break;
+        case TURNS:
+            motorController.enqueueRotation(test.speed, 0, 1, true);
+            motorController.enqueueRotation(test.speed, 0, 1, false);
+            motorController.enqueueRotation(test.speed, 0, 2, true);
+            tick();  // The queue starts from update()
+            break;
+        default:
+            motorController.executeRotation(test.speed, 3);
+            break;
+    }
+}
+
+void runMove(const MoveCase& test, uint16_t burstItems, MoveRun& run) {
+    PlatformStepHal& timer = motorController.timer();
+    timer.setBurstItems(burstItems);
+    timer.clearPulses();
+    long alarms = timer.alarms();
+    long errors = timer.burstErrors();
+
+    uint64_t start = Sim::now();
+    long origin = motorController.position();
+    startMove(test);
+    bool interrupted = false;
+    bool returned = false;
+    run.interruptAt = MAX_MOVE_MICROS;
+    while (motorController.isMotorRunning() && Sim::now() - start < MAX_MOVE_MICROS) {
+        tick();
+        if (!interrupted && Sim::now() - start >= 400000) {
+            interrupted = true;
+            run.interruptAt = Sim::now() - start;
+            if (test.kind == PAUSED) {
+                motorController.pause();
+                for (int i = 0; i < 200; i++) {
+                    tick();
+                }
+                motorController.resume();
+            } else if (test.kind == EMERGENCY) {
+                motorController.emergencyStop();
+            }
+        }
+        if (test.kind == POSITION && !returned && !motorController.isMotorRunning()) {
+            returned = true;
+            motorController.executeMove(origin, false, test.speed, 0);  // And back
+        }
+    }
+    for (int i = 0; i < 5; i++) {
+        tick();  // Nothing may follow the end of the move
+    }
+
+    run.pulses.clear();
+    for (long i = 0; i < timer.recordedPulses(); i++) {
+        run.pulses.push_back(timer.pulseTime(i) - start);
+    }
+    run.alarms = timer.alarms() - alarms;
+    run.errors = timer.burstErrors() - errors;
+    if (motorController.position() != timer.netSteps()) {
+        printf("  FAIL %s: position %ld, edges %ld\n", test.name, motorController.position(), timer.netSteps());
+        run.errors++;
+    }
+}
+
+bool compareMoves(const MoveCase& test) {
+    MoveRun edges;
+    MoveRun bursts;
+    runMove(test, 0, edges);
+    runMove(test, BURST_ITEMS, bursts);
+
+    // Bursts plan up to one ahead, so a pause ramps down a burst later than the edges do;
+    // only the pulses before it must match. An emergency stop may let the burst finish the
+    // pulse under way. Everything else matches to the microsecond
+    uint64_t until = edges.interruptAt < bursts.interruptAt ? edges.interruptAt : bursts.interruptAt;
+    size_t edgeCount = 0;
+    size_t burstCount = 0;
+    while (edgeCount < edges.pulses.size() && edges.pulses[edgeCount] < until) {
+        edgeCount++;
+    }
+    while (burstCount < bursts.pulses.size() && bursts.pulses[burstCount] < until) {
+        burstCount++;
+    }
+    size_t common = edgeCount < burstCount ? edgeCount : burstCount;
+    long differing = (long)(edgeCount + burstCount - 2 * common);
+    uint64_t largest = 0;
+    for (size_t i = 0; i < common; i++) {
+        uint64_t a = edges.pulses[i];
+        uint64_t b = bursts.pulses[i];
+        uint64_t difference = a > b ? a - b : b - a;
+        if (difference > 0) {
+            differing++;
+            if (difference > largest) {
+                largest = difference;
+            }
+        }
+    }
+
+    long steps = (long)edges.pulses.size();
+    long after = (long)bursts.pulses.size() - steps;
+    printf("%-9s %7ld %6.2f %6.3f %6ld %6llu %+5ld %4ld\n", test.name, steps,
+           steps > 0 ? (double)edges.alarms / steps : 0.0, steps > 0 ? (double)bursts.alarms / steps : 0.0,
+           differing, (unsigned long long)largest, after, edges.errors + bursts.errors);
+
+    bool allowed = differing == 0 && (test.kind == EMERGENCY ? after >= 0 && after <= 1 : after == 0);
+    return allowed && edges.errors + bursts.errors == 0 && steps > 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    long repeats = argc > 1 ? atol(argv[1]) : 200;
+    long failures = 0;
+
+    printf("Encoding %zu intervals into %u-item bursts, %ld times\n\n", INTERVALS, (unsigned)BURST_ITEMS, repeats);
+    printf("%-8s %7s %9s %9s %8s %6s\n", "CASE", "ITEMS", "STEPS/us", "ITEMS/us", "ns/STEP", "FAIL");
+    for (const EncodeCase& test : ENCODE_CASES) {
+        if (!runEncode(test, repeats)) {
+            failures++;
+        }
+    }
+
+    serialManager.begin();
+    motorController.begin(serialManager);
+    motorController.timer().setAlarmLatency(2);  // Constant, so both runs see the same
+
+    printf("\nEdges against bursts, alarm latency 2 us\n\n");
+    printf("%-9s %7s %6s %6s %6s %6s %5s %4s\n", "CASE", "STEPS", "EDGE", "BURST", "DIFF", "MAX", "EXTRA", "ERR");
+    for (const MoveCase& test : MOVE_CASES) {
+        if (!compareMoves(test)) {
+            failures++;
+        }
+    }
+
+    if (failures > 0) {
+        printf("\nFAILED: %ld cases\n", failures);
+        return 1;
+    }
+    printf("\nOK: every burst decoded to its intervals and played the edges' pulse train\n");
+    return 0;
+}
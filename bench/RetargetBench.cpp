@@ -0,0 +1,242 @@
+// Live speed change check over the native simulation (pio run -e retargetbench).
+//
+// Runs moves through the real MotorController/StepEngine path on SimStepHal and changes
+// their speed with setSpeed() (SET RPM: / SET SPEED:) at random times while they run,
+// then checks every STEP rising edge of the move:
+//   JUMP   largest change between consecutive step intervals, less 2 us of whole-microsecond
+//          rounding, as a share of what the ramp's acceleration allows at that speed; above
+//          100 % the speed jumped instead of ramping
+//   END    speed of the last step against the rest speed the move should stop at
+//   STEPS  rotation moves must make exactly their step count
+//   TIME   timed moves must still last their duration, within TIME_TOLERANCE
+// per case, over MOVES moves each.
+//
+//   .pio/build/retargetbench/program [MOVES] [SEED]    (defaults 20 and 1)
+//
+// Exits non-zero on any failed check.
+#include <Arduino.h>
+#include <math.h>
+#include <random>
+#include "SerialManager.h"
+#include "MotorController.h"
+
+namespace {
+
+const long STEPS_PER_REV = 3200;               // DEFAULT_AXIS: 200 x 1/16
+const uint32_t RAMP_ACCEL = SpeedTable::RAMP_ACCEL;  // Default ramp, so speed levels use their tables
+const uint32_t RAMP_JERK = 160000;
+const uint32_t START_RATE = SpeedTable::RAMP_START_RATE;
+const uint64_t MAX_MOVE_MICROS = 120ULL * 1000000ULL;
+const double JUMP_SLACK_US = 2.0;              // Whole-microsecond rounding of two intervals
+const double JUMP_MARGIN = 1.25;               // The integrator steps at the mean velocity
+const double END_LIMIT = 2.0;                  // Last step at most this much above rest speed
+const double TIME_TOLERANCE = 0.02;
+const int REPORTED_FAILURES = 10;
+
+enum MoveKind { ROTATION_RPM, ROTATION_LEVEL, TIMED_RPM, TIMED_LEVEL };
+
+struct Case {
+    const char* name;
+    MoveKind kind;
+    RampProfile profile;
+};
+
+const Case CASES[] = {
+    { "ROT RPM",      ROTATION_RPM,   RampProfile::TRAPEZOIDAL },
+    { "ROT LEVEL",    ROTATION_LEVEL, RampProfile::TRAPEZOIDAL },  // Starts on the ramp table
+    { "ROT SCURVE",   ROTATION_RPM,   RampProfile::SCURVE },
+    { "TIME RPM",     TIMED_RPM,      RampProfile::TRAPEZOIDAL },
+    { "TIME LEVEL",   TIMED_LEVEL,    RampProfile::TRAPEZOIDAL },
+    { "TIME SCURVE",  TIMED_RPM,      RampProfile::SCURVE },
+};
+
+struct CaseResult {
+    long moves;
+    long sets;
+    double worstJump;   // Share of the allowed interval change
+    double worstEnd;    // Last step speed over rest speed
+    double worstTime;   // Relative duration error, timed moves
+    long stepErrors;
+};
+
+SerialManager serialManager;
+MotorController motorController;
+std::mt19937 rng;
+long failures = 0;
+
+long uniform(long low, long high) {
+    return std::uniform_int_distribution<long>(low, high)(rng);
+}
+
+void fail(const char* name, const char* what, double expected, double actual) {
+    if (++failures <= REPORTED_FAILURES) {
+        printf("  FAIL %s %s: expected %.3f, got %.3f\n", name, what, expected, actual);
+    }
+}
+
+void tick() {
+    Sim::advance(1000);
+    motorController.update();
+    serialManager.pump();
+    Sim::clearSerialOutput();
+}
+
+// New speed for a SET: speed levels 14..20 or 30..600 RPM, as the move started with
+void changeSpeed(const Case& test, CaseResult& result) {
+    SpeedChange change;
+    if (test.kind == ROTATION_LEVEL || test.kind == TIMED_LEVEL) {
+        change = motorController.setSpeed(0, (int)uniform(14, 20));
+    } else {
+        change = motorController.setSpeed((int)uniform(30, 600), 0);
+    }
+    if (change == SpeedChange::APPLIED) {
+        result.sets++;
+    }
+}
+
+// Follows the STEP rising edges of one move as they are recorded (the simulation keeps a
+// ring of them, too short for a whole move)
+struct PulseCheck {
+    long seen;
+    long steps;
+    uint64_t first;
+    uint64_t last;
+    double lastInterval;
+};
+
+void checkPulses(const Case& test, CaseResult& result, PulseCheck& check) {
+    PlatformStepHal& timer = motorController.timer();
+    for (long recorded = timer.recordedPulses(); check.seen < recorded; check.seen++) {
+        uint64_t pulse = timer.pulseTime(check.seen);
+        if (check.steps == 0) {
+            check.first = pulse;
+        } else {
+            double interval = (double)(pulse - check.last);
+            if (check.steps > 1) {
+                double longer = check.lastInterval > interval ? check.lastInterval : interval;
+                // dt = 1 / v, so one step changes it by a * dt^3 at acceleration a
+                double allowed = JUMP_MARGIN * RAMP_ACCEL * longer * longer * longer * 1e-12;
+                double change = fabs(interval - check.lastInterval) - JUMP_SLACK_US;
+                double jump = change > 0 ? change / allowed : 0;
+                if (jump > result.worstJump) {
+                    result.worstJump = jump;
+                }
+                if (jump > 1.0) {
+                    fail(test.name, "interval change (us)", allowed + JUMP_SLACK_US, change + JUMP_SLACK_US);
+                }
+            }
+            check.lastInterval = interval;
+        }
+        check.last = pulse;
+        check.steps++;
+    }
+}
+
+bool runMove(const Case& test, CaseResult& result) {
+    PlatformStepHal& timer = motorController.timer();
+    timer.clearPulses();
+    PulseCheck check = {};
+
+    int rotations = (int)uniform(5, 30);
+    int seconds = (int)uniform(2, 6);
+    switch (test.kind) {
+        case ROTATION_RPM:
+            motorController.executeRotation((int)uniform(30, 600), rotations);
+            break;
+        case ROTATION_LEVEL:
+            motorController.executeRotationWithSpeed((int)uniform(14, 20), rotations);
+            break;
+        case TIMED_RPM:
+            motorController.executeTime((int)uniform(30, 600), seconds);
+            break;
+        case TIMED_LEVEL:
+            motorController.executeTimeWithSpeed((int)uniform(14, 20), seconds);
+            break;
+    }
+
+    // A SET every 20..400 ms, the odd one landing on the ramps
+    uint64_t start = Sim::now();
+    uint64_t nextSet = start + (uint64_t)uniform(20, 400) * 1000;
+    double slowestRate = 1e9;
+    while (motorController.isMotorRunning()) {
+        if (Sim::now() - start > MAX_MOVE_MICROS) {
+            fail(test.name, "move finished", 1, 0);
+            return false;
+        }
+        if (Sim::now() >= nextSet) {
+            changeSpeed(test, result);
+            nextSet = Sim::now() + (uint64_t)uniform(20, 400) * 1000;
+        }
+        tick();
+        checkPulses(test, result, check);
+        double rate = motorController.rpm() * STEPS_PER_REV / 60.0;
+        if (rate < slowestRate) {
+            slowestRate = rate;
+        }
+    }
+    result.moves++;
+
+    // Moves slower than the start speed stop at their cruise speed
+    double restRate = slowestRate < START_RATE ? slowestRate : START_RATE;
+    if (check.steps >= 2) {
+        double end = 1e6 / check.lastInterval / restRate;
+        if (end > result.worstEnd) {
+            result.worstEnd = end;
+        }
+        if (end > END_LIMIT) {
+            fail(test.name, "last step speed (steps/s)", restRate, 1e6 / check.lastInterval);
+        }
+    }
+
+    if ((test.kind == ROTATION_RPM || test.kind == ROTATION_LEVEL) && check.steps != rotations * STEPS_PER_REV) {
+        result.stepErrors++;
+        fail(test.name, "steps", (double)rotations * STEPS_PER_REV, (double)check.steps);
+    }
+    if ((test.kind == TIMED_RPM || test.kind == TIMED_LEVEL) && check.steps >= 2) {
+        // The first step comes one interval after the start, like the last one before the end
+        double duration = (check.last - check.first) / 1e6;
+        double error = fabs(duration - seconds) / seconds;
+        if (error > result.worstTime) {
+            result.worstTime = error;
+        }
+        if (error > TIME_TOLERANCE) {
+            fail(test.name, "duration (s)", seconds, duration);
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    long moves = argc > 1 ? atol(argv[1]) : 20;
+    uint32_t seed = argc > 2 ? (uint32_t)atol(argv[2]) : 1;
+    rng.seed(seed);
+
+    serialManager.begin();
+    motorController.begin(serialManager);
+    motorController.timer().setAlarmLatency(2);  // Constant, so the intervals stay exact
+
+    printf("%ld moves per case, seed %lu\n\n", moves, (unsigned long)seed);
+    printf("%-12s %6s %6s %8s %7s %6s %7s\n", "CASE", "MOVES", "SETS", "JUMP", "END", "STEPS", "TIME");
+    for (const Case& test : CASES) {
+        CaseResult result = {};
+        motorController.setRamp(test.profile, RAMP_ACCEL, RAMP_JERK);
+        for (long i = 0; i < moves; i++) {
+            if (!runMove(test, result)) {
+                break;
+            }
+        }
+        bool timed = test.kind == TIMED_RPM || test.kind == TIMED_LEVEL;
+        printf("%-12s %6ld %6ld %7.0f%% %6.2fx %6s %6.2f%%\n", test.name, result.moves, result.sets,
+               result.worstJump * 100, result.worstEnd, timed ? "-" : result.stepErrors == 0 ? "exact" : "WRONG",
+               result.worstTime * 100);
+    }
+
+    if (failures > 0) {
+        printf("\nFAILED: %ld checks\n", failures);
+        return 1;
+    }
+    printf("\nOK: every speed change ramped and every move ended on its count or time\n");
+    return 0;
+}
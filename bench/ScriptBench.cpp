@@ -0,0 +1,545 @@
+// Motion script compiler and simulation check (pio run -e scriptbench).
+//
+// Given a script file it is the host-side compiler: each line (after ; comments and blank
+// lines are dropped) goes through CommandParser and ScriptCompiler as the PROG line the
+// device would get, so a script that compiles here uploads. Errors name the file line.
+// Otherwise it lists the bytecode and its size, and
+//   --upload  prints the PROG BEGIN / PROG ... / PROG END lines to send
+//   --run     runs the image through ScriptRunner on SimStepHal and lists the moves the
+//             step stream holds: steps (negative CCW), when they start, how long they last
+//             and the rest before them
+//
+//   .pio/build/scriptbench/program [script.txt] [--upload] [--run]
+//
+// Without a file it runs the built-in cases below on SimStepHal, each compiled the same
+// way, and checks the steps of every move in the trace against what the script asks for
+// (count and direction, the rest a DWELL or WAIT PIN makes, the length of a TIME move) and
+// the way it ends (RUN DONE, RUN_ERROR, or an abort that ramps the move down), then that
+// scripts with errors fail at the right line and damaged images don't load. Exits
+// non-zero on any mismatch.
+#include <Arduino.h>
+#include <string>
+#include <vector>
+#include "SerialManager.h"
+#include "MotorController.h"
+#include "MotionScript.h"
+#include "ScriptRunner.h"
+#include "TraceLog.h"
+#include "FrameCodec.h"
+
+namespace {
+
+const double STANDSTILL_US = 1.01e6 / SpeedTable::RAMP_START_RATE;  // Longer gaps are rests
+const uint64_t MAX_RUN_MICROS = 120ULL * 1000000ULL;
+const size_t MAX_LINE = 120;  // Well inside the parser's ring
+const uint8_t TEST_PIN = 38;
+const uint64_t ABORT_RAMP_MS = 1000;  // Down from any script speed
+
+SerialManager serialManager;
+MotorController motorController;
+ScriptRunner scriptRunner(motorController, serialManager);
+
+// Compiling
+
+struct Compiled {
+    std::vector<std::string> statements;  // As uploaded, without PROG
+    std::vector<int> fileLines;           // Of each statement
+    std::vector<uint8_t> image;
+};
+
+std::string trim(const std::string& text) {
+    size_t first = text.find_first_not_of(" \t\r");
+    if (first == std::string::npos) {
+        return "";
+    }
+    size_t last = text.find_last_not_of(" \t\r");
+    return text.substr(first, last - first + 1);
+}
+
+// false with error naming the file line if the source doesn't compile
+bool compile(const std::string& source, Compiled& compiled, std::string& error) {
+    ScriptCompiler compiler;
+    CommandParser parser;
+    compiler.begin();
+    compiled = Compiled();
+
+    int fileLine = 0;
+    size_t at = 0;
+    while (at < source.size()) {
+        size_t end = source.find('\n', at);
+        std::string line = source.substr(at, end == std::string::npos ? std::string::npos : end - at);
+        at = end == std::string::npos ? source.size() : end + 1;
+        fileLine++;
+
+        size_t comment = line.find(';');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        line = trim(line);
+        if (line.empty()) {
+            continue;
+        }
+        if (line.size() > MAX_LINE) {
+            error = "line " + std::to_string(fileLine) + ": too long";
+            return false;
+        }
+
+        std::string command = "PROG " + line + "\n";
+        ParsedCommand statement;
+        parser.feed((const uint8_t*)command.data(), command.size());
+        if (!parser.poll(statement) || statement.malformed) {
+            // The device answers such a line PARSE_ERROR and drops it
+            error = "line " + std::to_string(fileLine) + ": more than " +
+                    std::to_string(ParsedCommand::MAX_FIELDS - 1) + " words, a word too long or a number out of range";
+            parser.reset();
+            return false;
+        }
+        compiled.statements.push_back(line);
+        compiled.fileLines.push_back(fileLine);
+        const char* failure = compiler.add(statement);
+        if (failure != nullptr) {
+            error = "line " + std::to_string(fileLine) + ": " + failure;
+            return false;
+        }
+    }
+
+    const char* failure = compiler.finish();
+    if (failure != nullptr) {
+        uint16_t line = compiler.errorLine();
+        int reported = line >= 1 && line <= compiled.fileLines.size() ? compiled.fileLines[line - 1] :
+                       fileLine > 0 ? fileLine : 1;
+        error = "line " + std::to_string(reported) + ": " + failure;
+        return false;
+    }
+    compiled.image.assign(compiler.data(), compiler.data() + compiler.size());
+    return true;
+}
+
+void printListing(const Compiled& compiled) {
+    const uint8_t* code;
+    size_t codeLength;
+    uint16_t lines;
+    Script::validate(compiled.image.data(), compiled.image.size(), code, codeLength, lines);
+
+    printf("%5s %6s %5s  %s\n", "LINE", "OFFSET", "BYTES", "INSTRUCTION");
+    Script::Instruction instruction;
+    size_t index = 0;
+    for (size_t offset = 0; Script::decode(code, codeLength, offset, instruction); offset += instruction.size) {
+        char text[64];
+        Script::describe(instruction, text, sizeof(text));
+        if (index < compiled.fileLines.size()) {
+            printf("%5d %6zu %5u  %s\n", compiled.fileLines[index], offset, (unsigned)instruction.size, text);
+        } else {
+            printf("%5s %6zu %5u  %s\n", "", offset, (unsigned)instruction.size, text);
+        }
+        index++;
+        if (instruction.op == Script::END) {
+            break;
+        }
+    }
+    printf("\n%u lines, %zu code bytes, %zu byte image, CRC %04X\n", (unsigned)lines, codeLength,
+           compiled.image.size(), (unsigned)Frame::get16(&compiled.image[compiled.image.size() - 2]));
+}
+
+// Running
+
+// A stretch of steps in one direction without a rest
+struct Run {
+    long steps;        // Negative CCW
+    uint32_t start;    // us, first step
+    uint32_t end;      // us, last step
+    uint32_t restBefore;  // us since the last step of the run before, or since RUN
+};
+
+struct Outcome {
+    std::string output;      // Everything the serial port got
+    std::vector<Run> runs;
+    bool traceComplete;      // The trace ring held every step
+    uint32_t origin;         // micros() at RUN
+    uint64_t lastStep;       // us after RUN
+};
+
+void tick(std::string& output) {
+    Sim::advance(1000);
+    motorController.update();
+    scriptRunner.update();
+    serialManager.pump();
+    output += Sim::serialOutput();
+    Sim::clearSerialOutput();
+}
+
+void splitRuns(const std::vector<uint8_t>& image, uint32_t origin, Outcome& outcome) {
+    Trace::ImageHeader header;
+    outcome.runs.clear();
+    outcome.traceComplete = false;
+    if (!Trace::decodeImageHeader(image.data(), image.size(), header)) {
+        return;
+    }
+
+    std::vector<Trace::Step> steps;
+    size_t at = Trace::IMAGE_HEADER_SIZE;
+    Trace::Step decoded[Trace::MAX_BLOCK_STEPS];
+    for (uint16_t block = 0; block < header.blocks && at + Trace::BLOCK_HEADER_SIZE <= image.size(); block++) {
+        Trace::BlockHeader blockHeader;
+        Trace::decodeBlockHeader(&image[at], blockHeader);
+        at += Trace::BLOCK_HEADER_SIZE;
+        long count = Trace::decodeBlock(blockHeader, &image[at], decoded, Trace::MAX_BLOCK_STEPS);
+        if (count < 0) {
+            return;
+        }
+        steps.insert(steps.end(), decoded, decoded + count);
+        at += blockHeader.length;
+    }
+    outcome.traceComplete = steps.size() == header.steps;
+
+    uint32_t previous = origin;
+    for (size_t i = 0; i < steps.size(); i++) {
+        const Trace::Step& step = steps[i];
+        bool rest = i == 0 || (double)(int32_t)(step.time - previous) > STANDSTILL_US ||
+                    step.reverse != steps[i - 1].reverse;
+        if (rest) {
+            outcome.runs.push_back({ 0, step.time, step.time, step.time - previous });
+        }
+        Run& run = outcome.runs.back();
+        run.steps += step.reverse ? -1 : 1;
+        run.end = step.time;
+        previous = step.time;
+    }
+    outcome.origin = origin;
+    outcome.lastStep = steps.empty() ? 0 : (uint32_t)(steps.back().time - origin);
+}
+
+// Runs the image from position 0 until the script is over and the motor at rest.
+// pinHighAt raises TEST_PIN and abortAt calls abort(), ms after RUN; -1 for neither.
+bool simulate(const std::vector<uint8_t>& image, Outcome& outcome, long pinHighAt = -1, long abortAt = -1) {
+    outcome = Outcome();
+    digitalWrite(TEST_PIN, LOW);
+    if (!scriptRunner.load(image.data(), image.size())) {
+        outcome.output = "load refused";
+        return false;
+    }
+    motorController.setPosition(0);
+    motorController.timer().clearPulses();
+    motorController.startTrace();
+
+    uint64_t start = Sim::now();
+    uint32_t origin = micros();
+    if (!scriptRunner.run()) {
+        outcome.output = "run refused";
+        return false;
+    }
+    while ((scriptRunner.isRunning() || motorController.isMotorRunning()) && Sim::now() - start < MAX_RUN_MICROS) {
+        uint64_t elapsed = (Sim::now() - start) / 1000;
+        if (pinHighAt >= 0 && elapsed == (uint64_t)pinHighAt) {
+            digitalWrite(TEST_PIN, HIGH);
+        }
+        if (abortAt >= 0 && elapsed == (uint64_t)abortAt) {
+            scriptRunner.abort();
+        }
+        tick(outcome.output);
+    }
+    for (int i = 0; i < 20; i++) {
+        tick(outcome.output);  // DONE and the last replies
+    }
+    motorController.stopTrace();
+
+    const TraceRecorder& trace = motorController.trace();
+    std::vector<uint8_t> traceImage(trace.imageSize());
+    trace.readImage(0, traceImage.data(), traceImage.size());
+    splitRuns(traceImage, origin, outcome);
+    return !scriptRunner.isRunning();
+}
+
+void printRuns(const Outcome& outcome) {
+    printf("%4s %8s %9s %9s %9s\n", "RUN", "STEPS", "START ms", "LENGTH ms", "REST ms");
+    for (size_t i = 0; i < outcome.runs.size(); i++) {
+        const Run& run = outcome.runs[i];
+        printf("%4zu %8ld %9.1f %9.1f %9.1f\n", i + 1, run.steps, (run.start - outcome.origin) / 1000.0,
+               (run.end - run.start) / 1000.0, run.restBefore / 1000.0);
+    }
+    if (!outcome.traceComplete) {
+        printf("(the trace ring held only the last steps; the first rest is from RUN)\n");
+    }
+}
+
+// Built-in cases, on the default 3200 steps per revolution
+
+struct ExpectedRun {
+    long steps;
+    uint32_t minRestMs;   // At least this long at rest before it
+    uint32_t minMs;       // First to last step
+    uint32_t maxMs;       // 0 = unchecked
+};
+
+struct ScriptCase {
+    const char* name;
+    const char* source;
+    const char* ending;   // Must be in the output
+    long pinHighAt;       // ms, -1 = never
+    long abortAt;         // ms, -1 = never
+    int runCount;         // -1 = unchecked
+    ExpectedRun runs[8];
+};
+
+const ScriptCase SCRIPT_CASES[] = {
+    { "ROT", "RPM:300 ROT:1\nRPM:120 ROT:1 DIR:CCW", "RUN DONE", -1, -1, 2,
+      { { 3200, 0, 0, 0 }, { -3200, 0, 0, 0 } } },
+    { "LOOP", "LOOP:3\n  MOVE:800 REL RPM:200\n  DWELL:200\n  MOVE:-800 REL\nNEXT", "RUN DONE", -1, -1, 6,
+      { { 800, 0, 0, 0 }, { -800, 200, 0, 0 }, { 800, 0, 0, 0 }, { -800, 200, 0, 0 },
+        { 800, 0, 0, 0 }, { -800, 200, 0, 0 } } },
+    { "NESTED", "LOOP:2\n  LOOP:2\n    MOVE:400 REL\n  NEXT\n  MOVE:0\nNEXT", "RUN DONE", -1, -1, 6,
+      { { 400, 0, 0, 0 }, { 400, 0, 0, 0 }, { -800, 0, 0, 0 },
+        { 400, 0, 0, 0 }, { 400, 0, 0, 0 }, { -800, 0, 0, 0 } } },
+    { "DEGREES", "MOVE:90 DEG RPM:200\nMOVE:-45 DEG REL SPEED:10", "RUN DONE", -1, -1, 2,
+      { { 800, 0, 0, 0 }, { -400, 0, 0, 0 } } },
+    { "TIME", "SPEED:10 TIME:1\nDWELL:300\nRPM:200 TIME:1 DIR:CCW", "RUN DONE", -1, -1, 2,
+      { { 0, 0, 980, 1000 }, { 0, 300, 980, 1000 } } },
+    // 2 turns at 60 RPM take 2 s; sped up to 300 after half a second they take well under 1.5
+    { "SET", "RPM:60 ROT:2 NOWAIT\nDWELL:500\nSET RPM:300\nWAIT\nDWELL:100", "RUN DONE", -1, -1, 1,
+      { { 6400, 0, 0, 1500 } } },
+    { "NOWAIT", "MOVE:1600 RPM:100 NOWAIT\nDWELL:50\nMOVE:0", "RUN DONE", -1, -1, 2,
+      { { 1600, 0, 0, 0 }, { -1600, 0, 0, 0 } } },
+    { "PIN", "WAIT PIN:38 HIGH TIMEOUT:2000\nRPM:300 ROT:1", "RUN DONE", 400, -1, 1,
+      { { 3200, 400, 0, 0 } } },
+    { "TIMEOUT", "WAIT PIN:38 HIGH TIMEOUT:300\nRPM:300 ROT:1", "RUN_ERROR LINE:1 TIMEOUT", -1, -1, 0, {} },
+    { "SET_IDLE", "DWELL:10\nSET RPM:100", "RUN_ERROR LINE:2 SET_IDLE", -1, -1, 0, {} },
+    // Aborted the way ABORT does it: the move ramps down, and the script says nothing more
+    { "ABORT", "LOOP\n  RPM:300 ROT:1\n  RPM:300 ROT:1 DIR:CCW\nNEXT", "Motor stopping", -1, 1100, -1, {} },
+};
+
+struct ErrorCase {
+    const char* source;
+    const char* error;    // As compile() words it
+};
+
+const ErrorCase ERROR_CASES[] = {
+    { "NEXT", "line 1: NEXT_WITHOUT_LOOP" },
+    { "; setup\nLOOP:2\nRPM:100 ROT:1", "line 2: LOOP_NOT_CLOSED" },
+    { "RPM:100 ROT:1 FOO:2", "line 1: UNKNOWN:FOO" },
+    { "DWELL:100\n\nRPM:0 ROT:1", "line 3: RPM:1..6000" },
+    { "RPM:100 ROT:1 DIR:UP", "line 1: DIR:CW|CCW" },
+    { "LOOP\nNEXT", "line 2: EMPTY_LOOP" },
+    { "LOOP\nLOOP\nLOOP\nLOOP\nLOOP", "line 5: TOO_DEEP" },
+    { "MOVE:1.5", "line 1: MOVE:STEPS" },
+    { "WAIT PIN:35", "line 1: HIGH|LOW" },
+    { "WAIT PIN:40 HIGH", "line 1: PIN:34..39" },
+    { "WAIT PIN:16 HIGH", "line 1: PIN:34..39" },  // STEP: a script doesn't get to reconfigure it
+    { "JUMP:3", "line 1: UNKNOWN_STATEMENT" },
+    { "; only a comment", "line 1: EMPTY" },
+    { "RPM:100 ROT:1 DIR:CW NOWAIT A:1 B:2 C:3 D:4", "line 1: more than 7 words, a word too long or a number out of range" },
+    { "RPM:100 ROT:3000000000", "line 1: more than 7 words, a word too long or a number out of range" },
+};
+
+bool checkCase(const ScriptCase& test, const Outcome& outcome, std::string& problem) {
+    if (outcome.output.find(test.ending) == std::string::npos) {
+        problem = std::string("no ") + test.ending;
+        return false;
+    }
+    if (!outcome.traceComplete) {
+        problem = "trace overflowed";
+        return false;
+    }
+    if (test.abortAt >= 0) {
+        if (outcome.output.find("RUN") != std::string::npos) {
+            problem = "reported after the abort";
+            return false;
+        }
+        if (outcome.lastStep / 1000 > (uint64_t)test.abortAt + ABORT_RAMP_MS) {
+            problem = "stepped " + std::to_string(outcome.lastStep / 1000 - test.abortAt) + " ms after the abort";
+            return false;
+        }
+    }
+    if (test.runCount < 0) {
+        return true;
+    }
+    if ((int)outcome.runs.size() != test.runCount) {
+        problem = std::to_string(outcome.runs.size()) + " moves, not " + std::to_string(test.runCount);
+        return false;
+    }
+    for (int i = 0; i < test.runCount; i++) {
+        const ExpectedRun& expected = test.runs[i];
+        const Run& run = outcome.runs[i];
+        uint32_t length = (run.end - run.start) / 1000;
+        std::string which = "move " + std::to_string(i + 1) + ": ";
+        if (expected.steps != 0 && run.steps != expected.steps) {
+            problem = which + std::to_string(run.steps) + " steps";
+            return false;
+        }
+        if (run.restBefore / 1000 < expected.minRestMs) {
+            problem = which + "rest " + std::to_string(run.restBefore / 1000) + " ms";
+            return false;
+        }
+        if (length < expected.minMs || (expected.maxMs > 0 && length > expected.maxMs)) {
+            problem = which + std::to_string(length) + " ms long";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool checkDamage(const std::vector<uint8_t>& image, std::string& problem) {
+    const uint8_t* code;
+    size_t codeLength;
+    uint16_t lines;
+    std::vector<uint8_t> copy = image;
+    for (size_t i = 0; i < image.size(); i++) {
+        copy[i] ^= 0x10;
+        if (Script::validate(copy.data(), copy.size(), code, codeLength, lines)) {
+            problem = "a flipped bit at byte " + std::to_string(i) + " validates";
+            return false;
+        }
+        copy[i] = image[i];
+    }
+    for (size_t length = 0; length < image.size(); length++) {
+        if (Script::validate(image.data(), length, code, codeLength, lines)) {
+            problem = "the first " + std::to_string(length) + " bytes validate";
+            return false;
+        }
+    }
+    return true;
+}
+
+int runChecks() {
+    long failures = 0;
+    printf("Scripts run by ScriptRunner on SimStepHal, moves from the trace\n\n");
+    printf("%-9s %5s %5s %5s %7s  %s\n", "CASE", "LINES", "BYTES", "MOVES", "STEPS", "RESULT");
+    std::vector<uint8_t> sample;
+    for (const ScriptCase& test : SCRIPT_CASES) {
+        Compiled compiled;
+        std::string problem;
+        Outcome outcome;
+        bool passed = compile(test.source, compiled, problem) &&
+                      simulate(compiled.image, outcome, test.pinHighAt, test.abortAt) &&
+                      checkCase(test, outcome, problem);
+        if (!passed && problem.empty()) {
+            problem = outcome.output;
+        }
+        long steps = 0;
+        for (const Run& run : outcome.runs) {
+            steps += labs(run.steps);
+        }
+        printf("%-9s %5zu %5zu %5zu %7ld  %s\n", test.name, compiled.statements.size(), compiled.image.size(),
+               outcome.runs.size(), steps, passed ? "ok" : problem.c_str());
+        if (!passed) {
+            failures++;
+        }
+        if (compiled.image.size() > sample.size()) {
+            sample = compiled.image;
+        }
+    }
+
+    printf("\nScripts with errors\n\n");
+    for (const ErrorCase& test : ERROR_CASES) {
+        Compiled compiled;
+        std::string error;
+        bool passed = !compile(test.source, compiled, error) && error == test.error;
+        printf("%-40s %s\n", error.empty() ? "(compiled)" : error.c_str(), passed ? "ok" : test.error);
+        if (!passed) {
+            failures++;
+        }
+    }
+
+    // The longest script that fits, and one line more
+    std::string source;
+    Compiled compiled;
+    std::string error;
+    size_t fits = (Script::MAX_CODE - 1) / 8;  // MOVE is 8 bytes, END the last
+    for (size_t i = 0; i < fits; i++) {
+        source += "MOVE:" + std::to_string(i) + "\n";
+    }
+    bool longest = compile(source, compiled, error);
+    source += "MOVE:0\n";
+    std::string expected = "line " + std::to_string(fits + 1) + ": TOO_LONG";
+    bool tooLong = !compile(source, compiled, error) && error == expected;
+    printf("%-40s %s\n", error.c_str(), longest && tooLong ? "ok" : expected.c_str());
+    if (!longest || !tooLong) {
+        failures++;
+    }
+
+    std::string problem;
+    bool damaged = checkDamage(sample, problem);
+    printf("\nDamaged and cut short images of %zu bytes: %s\n", sample.size(), damaged ? "none load" : problem.c_str());
+    if (!damaged) {
+        failures++;
+    }
+
+    if (failures > 0) {
+        printf("\nFAILED: %ld checks\n", failures);
+        return 1;
+    }
+    printf("\nOK: every script moved as written and every bad one was caught\n");
+    return 0;
+}
+
+bool readFile(const char* path, std::string& text) {
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        return false;
+    }
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        text.append(buffer, length);
+    }
+    fclose(file);
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    bool upload = false;
+    bool run = false;
+    const char* path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--upload") == 0) {
+            upload = true;
+        } else if (strcmp(argv[i], "--run") == 0) {
+            run = true;
+        } else {
+            path = argv[i];
+        }
+    }
+
+    serialManager.begin();
+    motorController.begin(serialManager);
+    Sim::clearSerialOutput();
+    if (path == nullptr) {
+        return runChecks();
+    }
+
+    std::string source;
+    if (!readFile(path, source)) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return 1;
+    }
+    Compiled compiled;
+    std::string error;
+    if (!compile(source, compiled, error)) {
+        fprintf(stderr, "%s: %s\n", path, error.c_str());
+        return 1;
+    }
+
+    if (upload) {
+        printf("PROG BEGIN\n");
+        for (const std::string& statement : compiled.statements) {
+            printf("PROG %s\n", statement.c_str());
+        }
+        printf("PROG END\n");
+        return 0;
+    }
+    printListing(compiled);
+    if (run) {
+        Outcome outcome;
+        bool ended = simulate(compiled.image, outcome);
+        printf("\n");
+        printRuns(outcome);
+        printf("\n%s", outcome.output.c_str());
+        if (!ended) {
+            printf("Still running after %llu s\n", (unsigned long long)(MAX_RUN_MICROS / 1000000));
+            return 1;
+        }
+        return outcome.output.find("RUN DONE") == std::string::npos;
+    }
+    return 0;
+}
@@ -0,0 +1,139 @@
+// Step timing benchmark for the native simulation (pio run -e bench).
+//
+// Runs the standard matrix - speed levels 1-20 and RPMs up to MAX_RPM - through the real
+// MotorController/StepEngine path on SimStepHal, with a simulated interrupt latency of
+// LATENCY + 0..JITTER microseconds per alarm, and prints per case:
+//   LATE   how late the step ISR ran after its alarm (the histogram PERF reports on the board)
+//   CYCLE  cycle-to-cycle jitter |interval(n) - interval(n-1)| of the STEP rising edges,
+//          ramps included
+// as p50/p99/max in microseconds. Latency that accumulated into the pulse train would
+// show up as CYCLE growing beyond 2 * (LATENCY + JITTER).
+//
+//   .pio/build/bench/program [LATENCY] [JITTER]    (defaults 2 and 6)
+#include <Arduino.h>
+#include <chrono>
+#include "SerialManager.h"
+#include "MotorController.h"
+#include "Histogram.h"
+
+namespace {
+
+const int RPM_CASES[] = { 6, 30, 60, 120, 300, 600, 1000 };  // 1000 = MotorController MAX_RPM
+const long STEPS_PER_REV = 3200;                              // DEFAULT_AXIS: 200 x 1/16
+const uint64_t MAX_CASE_MICROS = 600ULL * 1000000ULL;
+
+SerialManager serialManager;
+MotorController motorController;
+
+struct CaseResult {
+    long steps;
+    uint64_t micros;
+    Histogram cycle;
+};
+
+// Revolutions needed to reach the cruise rate and hold it for a while
+int rotationsFor(double stepsPerSecond) {
+    double rampSteps = stepsPerSecond * stepsPerSecond / (2.0 * SpeedTable::RAMP_ACCEL);
+    return (int)(2.0 * rampSteps / STEPS_PER_REV) + 2;
+}
+
+// Drive the virtual clock in 1 ms slices, as the motion task would, until the move ends
+void runCase(CaseResult& result) {
+    PlatformStepHal& timer = motorController.timer();
+    long seen = timer.recordedPulses();
+    uint64_t start = Sim::now();
+    uint64_t lastPulse = 0;
+    uint64_t lastInterval = 0;
+
+    result.steps = 0;
+    result.cycle.reset();
+    do {
+        Sim::advance(1000);
+        motorController.update();
+        serialManager.pump();
+        Sim::clearSerialOutput();
+
+        for (long recorded = timer.recordedPulses(); seen < recorded; seen++) {
+            uint64_t pulse = timer.pulseTime(seen);
+            if (result.steps > 0) {
+                uint64_t interval = pulse - lastPulse;
+                if (result.steps > 1) {
+                    result.cycle.record((uint32_t)(interval > lastInterval ? interval - lastInterval
+                                                                           : lastInterval - interval));
+                }
+                lastInterval = interval;
+            }
+            lastPulse = pulse;
+            result.steps++;
+        }
+    } while (motorController.isMotorRunning() && Sim::now() - start < MAX_CASE_MICROS);
+
+    result.micros = Sim::now() - start;
+}
+
+void printCase(const char* name, const CaseResult& result) {
+    const Histogram& late = motorController.stepLateness();
+    printf("%-10s %8ld %9.2f   %4lu %4lu %5lu   %4lu %4lu %5lu\n", name, result.steps, result.micros / 1e6,
+           (unsigned long)late.percentile(500), (unsigned long)late.percentile(990), (unsigned long)late.maximum(),
+           (unsigned long)result.cycle.percentile(500), (unsigned long)result.cycle.percentile(990),
+           (unsigned long)result.cycle.maximum());
+}
+
+// Host CPU cost of building a STATUS reply, text versus binary record
+void benchStatus() {
+    const int CALLS = 100000;
+    Frame::StatusRecord record;
+    size_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < CALLS; i++) {
+        TextBuffer<OutMessage::MAX_TEXT + 1> line;
+        motorController.getStatus(line);
+        sink += line.length();
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (int i = 0; i < CALLS; i++) {
+        motorController.getStatusRecord(record);
+        sink += record.rpm;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    printf("\nSTATUS host cost: getStatus() %.0f ns, getStatusRecord() %.0f ns (%zu)\n",
+           std::chrono::duration<double, std::nano>(middle - start).count() / CALLS,
+           std::chrono::duration<double, std::nano>(end - middle).count() / CALLS, sink % 10);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    uint32_t latency = argc > 1 ? (uint32_t)atoi(argv[1]) : 2;
+    uint32_t jitter = argc > 2 ? (uint32_t)atoi(argv[2]) : 6;
+
+    serialManager.begin();
+    motorController.begin(serialManager);
+    motorController.timer().setAlarmLatency(latency);
+    motorController.timer().setAlarmJitter(jitter);
+
+    printf("Simulated ISR latency %lu us + 0..%lu us jitter\n\n", (unsigned long)latency, (unsigned long)jitter);
+    printf("%-10s %8s %9s   %-16s   %-16s\n", "CASE", "STEPS", "SECONDS", "LATE p50/p99/max", "CYCLE p50/p99/max");
+
+    static CaseResult result;
+    char name[16];
+    for (int level = 1; level <= SpeedTable::LEVELS; level++) {
+        motorController.stepLateness().reset();
+        motorController.executeRotationWithSpeed(level, rotationsFor(1e6 / SpeedTable::DELAY_US[level - 1]));
+        runCase(result);
+        snprintf(name, sizeof(name), "LEVEL %d", level);
+        printCase(name, result);
+    }
+    for (int rpm : RPM_CASES) {
+        motorController.stepLateness().reset();
+        motorController.executeRotation(rpm, rotationsFor(rpm * STEPS_PER_REV / 60.0));
+        runCase(result);
+        snprintf(name, sizeof(name), "RPM %d", rpm);
+        printCase(name, result);
+    }
+
+    benchStatus();
+    return 0;
+}
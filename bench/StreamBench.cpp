@@ -0,0 +1,303 @@
+// Telemetry stream benchmark over a pseudo-terminal (pio run -e streambench).
+//
+// Starts the native firmware program (pio run -e native) on a pty with its Serial drained
+// at BAUD, switches the link to binary frames and, for each rate in turn, runs STREAM with
+// all fields during a 300 RPM move, decoding the STREAM frames as the Qt UI would. Per rate:
+//   SAMPLES/S  decoded samples per second of wall time
+//   GAP        longest time between consecutive samples received, ms (one period
+//              while the link keeps up)
+//   STRIDE     largest stride seen; above 1 the link was saturated and batches coalesced
+//   OVERHEAD   framing and batch header bytes per 100 bytes of sample data
+//   LINK       share of the line rate all output used
+// With --csv it prints the decoded samples instead.
+//
+//   .pio/build/streambench/program NATIVE_PROGRAM [BAUD [SECONDS]] [--csv]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "FrameCodec.h"
+#include "Telemetry.h"
+
+namespace {
+
+const unsigned RATE_CASES[] = { 20, 100, 250, 500, 1000 };
+const unsigned long DEFAULT_BAUD = 115200;
+const double DEFAULT_SECONDS = 3.0;
+const int REPLY_TIMEOUT_MS = 5000;   // The program sends ESP32 READY for 3 s after start
+const char* MOVE = "RPM:300 ROT:1000";
+
+typedef std::chrono::steady_clock Clock;
+
+struct Link {
+    int fd;
+    pid_t pid;
+    FrameDecoder decoder;
+    uint64_t bytes;
+};
+
+struct CaseResult {
+    uint32_t samples;
+    uint32_t batches;
+    uint16_t maxGap;         // Sample periods
+    uint8_t maxStride;
+    uint64_t sampleBytes;
+    uint64_t streamBytes;    // STREAM frames, framing included
+    uint64_t linkBytes;      // Everything the program sent
+    double seconds;
+};
+
+bool spawn(const char* program, unsigned long baud, Link& link) {
+    struct termios raw;
+    memset(&raw, 0, sizeof(raw));
+    cfmakeraw(&raw);
+
+    char baudArgument[24];
+    snprintf(baudArgument, sizeof(baudArgument), "%lu", baud);
+    link.pid = forkpty(&link.fd, nullptr, &raw, nullptr);
+    if (link.pid < 0) {
+        return false;
+    }
+    if (link.pid == 0) {
+        execl(program, program, "0", baudArgument, (char*)nullptr);
+        _exit(127);
+    }
+    link.decoder.reset();
+    link.bytes = 0;
+    return true;
+}
+
+void finish(Link& link) {
+    kill(link.pid, SIGKILL);
+    waitpid(link.pid, nullptr, 0);
+    close(link.fd);
+}
+
+void sendCommand(Link& link, const char* line) {
+    uint8_t frame[Frame::MAX_FRAME];
+    size_t size = Frame::encode(Frame::COMMAND, (const uint8_t*)line, (uint8_t)strlen(line), frame);
+    if (write(link.fd, frame, size) != (ssize_t)size) {
+        perror("write");
+    }
+}
+
+// Reads what arrives within timeoutMs; false once the program has gone
+bool readLink(Link& link, int timeoutMs, uint8_t* buffer, size_t size, size_t& length) {
+    struct pollfd ready = { link.fd, POLLIN, 0 };
+    length = 0;
+    if (poll(&ready, 1, timeoutMs) <= 0) {
+        return true;
+    }
+    ssize_t got = read(link.fd, buffer, size);
+    if (got <= 0) {
+        return false;
+    }
+    length = (size_t)got;
+    link.bytes += length;
+    return true;
+}
+
+// HELLO BIN is answered in text; everything after READY BIN is framed
+bool enterBinary(Link& link) {
+    const char* ready = "READY BIN\r\n";
+    std::string text;
+    uint8_t buffer[256];
+    size_t length;
+
+    if (write(link.fd, "HELLO BIN\n", 10) != 10) {
+        return false;
+    }
+    auto deadline = Clock::now() + std::chrono::milliseconds(REPLY_TIMEOUT_MS);
+    while (Clock::now() < deadline) {
+        if (!readLink(link, 100, buffer, sizeof(buffer), length)) {
+            return false;
+        }
+        text.append((const char*)buffer, length);
+        size_t found = text.find(ready);
+        if (found != std::string::npos) {
+            for (size_t i = found + strlen(ready); i < text.size(); i++) {
+                link.decoder.push((uint8_t)text[i]);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename OnFrame>
+bool readFrames(Link& link, int timeoutMs, OnFrame onFrame) {
+    uint8_t buffer[256];
+    size_t length;
+    if (!readLink(link, timeoutMs, buffer, sizeof(buffer), length)) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (link.decoder.push(buffer[i])) {
+            onFrame(link.decoder);
+        }
+    }
+    return true;
+}
+
+bool isResponse(const FrameDecoder& decoder, const char* prefix) {
+    size_t length = strlen(prefix);
+    return decoder.type() == Frame::RESPONSE && decoder.length() >= length &&
+           memcmp(decoder.payload(), prefix, length) == 0;
+}
+
+// Sends a command and waits for the response starting with prefix
+bool request(Link& link, const char* command, const char* prefix) {
+    bool answered = false;
+    sendCommand(link, command);
+    auto deadline = Clock::now() + std::chrono::milliseconds(REPLY_TIMEOUT_MS);
+    while (!answered && Clock::now() < deadline) {
+        if (!readFrames(link, 100, [&](const FrameDecoder& decoder) {
+                if (isResponse(decoder, prefix)) {
+                    answered = true;
+                }
+            })) {
+            return false;
+        }
+    }
+    if (!answered) {
+        fprintf(stderr, "No %s reply to %s\n", prefix, command);
+    }
+    return answered;
+}
+
+void printSamples(unsigned rate, const Telemetry::Batch& batch, const Telemetry::Sample* samples) {
+    for (uint8_t i = 0; i < batch.count; i++) {
+        const Telemetry::Sample& sample = samples[i];
+        printf("%u,%u,%ld,%.4f,%.1f,%.1f,%d,%u\n", rate, (unsigned)(uint16_t)(batch.sequence + i * batch.stride),
+               (long)sample.position, sample.fraction / 65536.0, sample.rpmTenths / 10.0,
+               sample.loadTenths / 10.0, (int)sample.followingError, (unsigned)sample.state);
+    }
+}
+
+bool runCase(Link& link, unsigned rate, double seconds, bool csv, CaseResult& result) {
+    char command[32];
+    snprintf(command, sizeof(command), "STREAM RATE:%u", rate);
+    memset(&result, 0, sizeof(result));
+    if (!request(link, command, "STREAM RATE:")) {
+        return false;
+    }
+    sendCommand(link, MOVE);  // Moves have no reply
+
+    Telemetry::Sample samples[TelemetryStream::MAX_BATCH];
+    bool first = true;
+    uint16_t lastSequence = 0;
+    uint64_t startBytes = link.bytes;
+    auto start = Clock::now();
+    auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+    while (Clock::now() < end) {
+        bool running = readFrames(link, 10, [&](const FrameDecoder& decoder) {
+            Telemetry::Batch batch;
+            if (decoder.type() != Frame::STREAM ||
+                !Telemetry::decode(decoder.payload(), decoder.length(), batch, samples, TelemetryStream::MAX_BATCH)) {
+                return;
+            }
+            for (uint8_t i = 0; i < batch.count; i++) {
+                uint16_t sequence = (uint16_t)(batch.sequence + i * batch.stride);
+                uint16_t gap = (uint16_t)(sequence - lastSequence);
+                if (!first && gap > result.maxGap) {
+                    result.maxGap = gap;
+                }
+                lastSequence = sequence;
+                first = false;
+            }
+            result.samples += batch.count;
+            result.batches++;
+            if (batch.stride > result.maxStride) {
+                result.maxStride = batch.stride;
+            }
+            result.sampleBytes += batch.count * Telemetry::sampleSize(batch.fields);
+            result.streamBytes += decoder.length() + Frame::OVERHEAD;
+            if (csv) {
+                printSamples(rate, batch, samples);
+            }
+        });
+        if (!running) {
+            return false;
+        }
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    result.linkBytes = link.bytes - startBytes;
+
+    return request(link, "STREAM OFF", "STREAM OFF") && request(link, "CLOSE", "CLOSED");
+}
+
+void printCase(unsigned rate, unsigned long baud, const CaseResult& result) {
+    printf("%6u %10.1f %9.1f %7u %8.1f %% %6.1f %%\n", rate, result.samples / result.seconds,
+           result.maxGap * 1000.0 / rate, (unsigned)result.maxStride,
+           result.sampleBytes > 0 ? 100.0 * (result.streamBytes - result.sampleBytes) / result.sampleBytes : 0.0,
+           100.0 * result.linkBytes * 10 / (baud * result.seconds));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    bool csv = false;
+    const char* program = nullptr;
+    unsigned long baud = DEFAULT_BAUD;
+    double seconds = DEFAULT_SECONDS;
+    int position = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) {
+            csv = true;
+        } else if (position == 0) {
+            program = argv[i];
+            position++;
+        } else if (position == 1) {
+            baud = strtoul(argv[i], nullptr, 10);
+            position++;
+        } else {
+            seconds = atof(argv[i]);
+        }
+    }
+    if (program == nullptr || baud == 0 || seconds <= 0) {
+        fprintf(stderr, "Usage: %s NATIVE_PROGRAM [BAUD [SECONDS]] [--csv]\n", argv[0]);
+        return 1;
+    }
+
+    Link link;
+    if (!spawn(program, baud, link)) {
+        perror("forkpty");
+        return 1;
+    }
+    if (!enterBinary(link)) {
+        fprintf(stderr, "%s did not answer HELLO BIN\n", program);
+        finish(link);
+        return 1;
+    }
+
+    if (csv) {
+        printf("rate,sequence,position,fraction,rpm,load_percent,following_error,state\n");
+    } else {
+        printf("%lu baud, all fields (%zu bytes a sample, %u a batch), %.1f s per rate\n\n", baud,
+               Telemetry::sampleSize(Telemetry::ALL), (unsigned)Telemetry::batchCapacity(Telemetry::ALL), seconds);
+        printf("%6s %10s %9s %7s %10s %8s\n", "RATE", "SAMPLES/S", "GAP", "STRIDE", "OVERHEAD", "LINK");
+    }
+
+    int status = 0;
+    for (unsigned rate : RATE_CASES) {
+        CaseResult result;
+        if (!runCase(link, rate, seconds, csv, result)) {
+            fprintf(stderr, "Rate %u failed\n", rate);
+            status = 1;
+            break;
+        }
+        if (!csv) {
+            printCase(rate, baud, result);
+        }
+    }
+
+    finish(link);
+    return status;
+}
@@ -0,0 +1,249 @@
+// Tagged request benchmark over a pseudo-terminal (pio run -e tagbench).
+//
+// Starts the native firmware program (pio run -e native) on a pty with its Serial drained
+// at BAUD and talks to it through StationClient: REQUESTS queries (POS, STATUS, LOAD,
+// LIMITS, QUEUE, TRACE, HEAP and an unknown command in turn), first one at a time and then
+// pipelined a command queue deep, in a text and then a binary tagged session. A move runs
+// through each pipelined run, its TURNs and DONE coming back under its own tag between
+// the query replies. Per run:
+//   REQ/S     requests finished per second
+//   P50 P99   round trip, sending to final reply, ms
+//   MAX
+//   BUSY      requests the station turned away and the client sent again
+//   BYTES/REQ bytes received per request, logs and events included
+// Every reply must come back under its request's tag and be that command's; exits non-zero
+// on a mismatch, a stray tag or a request left without its final reply.
+//
+//   .pio/build/tagbench/program NATIVE_PROGRAM [BAUD [REQUESTS]]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <pty.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "StationClient.h"
+
+namespace {
+
+const unsigned long DEFAULT_BAUD = 115200;
+const size_t DEFAULT_REQUESTS = 2000;
+const int STARTUP_MS = 3200;         // ESP32 READY for 3 s after start, 200 ms apart, holds up commands
+const int HELLO_TIMEOUT_MS = 2000;
+const int DRAIN_TIMEOUT_MS = 60000;
+const char* MOVE = "RPM:300 ROT:2";
+const int MOVE_TURNS = 2;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Query {
+    const char* command;
+    const char* text;     // Start of the final reply in a text session
+    const char* binary;   // ... in a binary one
+};
+
+// STATUS is a text line in text sessions (its state name) and a record in binary ones
+const Query QUERIES[] = {
+    { "POS",    "POS:",        "POS:" },
+    { "STATUS", "",            "STATUS STATE:" },
+    { "LOAD",   "LOAD:",       "LOAD:" },
+    { "LIMITS", "LIMITS",      "LIMITS" },
+    { "QUEUE",  "QUEUE DEPTH:", "QUEUE DEPTH:" },
+    { "TRACE",  "TRACE ",      "TRACE " },
+    { "HEAP",   "HEAP FREE:",  "HEAP FREE:" },
+    { "NOPE",   "UNKNOWN",     "UNKNOWN" },
+};
+const size_t QUERY_COUNT = sizeof(QUERIES) / sizeof(QUERIES[0]);
+
+struct RunCase {
+    const char* name;
+    bool binary;
+    size_t window;
+    bool move;
+};
+
+const RunCase RUN_CASES[] = {
+    { "text",   false, 1,                              false },
+    { "text",   false, StationClient::DEFAULT_WINDOW,  true },
+    { "binary", true,  1,                              false },
+    { "binary", true,  StationClient::DEFAULT_WINDOW,  true },
+    { "text",   false, 4 * StationClient::DEFAULT_WINDOW, false },  // Past the queue: BUSY
+};
+
+struct RunResult {
+    std::vector<double> seconds;  // Round trip per query
+    unsigned long mismatches;
+    unsigned long retries;
+    bool moveDone;
+    double wall;
+    uint64_t bytes;
+};
+
+pid_t spawn(const char* program, unsigned long baud, int& fd) {
+    struct termios raw;
+    memset(&raw, 0, sizeof(raw));
+    cfmakeraw(&raw);
+
+    char baudArgument[24];
+    snprintf(baudArgument, sizeof(baudArgument), "%lu", baud);
+    pid_t pid = forkpty(&fd, nullptr, &raw, nullptr);
+    if (pid == 0) {
+        execl(program, program, "0", baudArgument, (char*)nullptr);
+        _exit(127);
+    }
+    return pid;
+}
+
+bool startsWith(const std::string& text, const char* prefix) {
+    return text.compare(0, strlen(prefix), prefix) == 0;
+}
+
+// The move's final DONE, its STARTED and every TURN in order
+bool moveMatches(const StationClient::Result& move) {
+    if (move.reply != "DONE" || move.replies.size() != 1 || move.replies[0] != "STARTED") {
+        return false;
+    }
+    int turns = 0;
+    for (const std::string& event : move.events) {
+        if (startsWith(event, "TURN:") && atoi(event.c_str() + 5) != ++turns) {
+            return false;
+        }
+    }
+    return turns == MOVE_TURNS;
+}
+
+bool runCase(StationClient& client, const RunCase& run, size_t requests, RunResult& result) {
+    result.seconds.clear();
+    result.mismatches = 0;
+    result.retries = 0;
+    result.moveDone = !run.move;
+    client.setWindow(run.window);
+
+    uint64_t startBytes = client.bytesReceived();
+    auto start = Clock::now();
+    if (run.move) {
+        client.submit(MOVE, [&](const StationClient::Result& move) {
+            result.moveDone = true;
+            if (!moveMatches(move)) {
+                fprintf(stderr, "Move: %s after %zu replies and %zu events\n", move.reply.c_str(),
+                        move.replies.size(), move.events.size());
+                result.mismatches++;
+            }
+        });
+    }
+    for (size_t i = 0; i < requests; i++) {
+        const Query& query = QUERIES[i % QUERY_COUNT];
+        client.submit(query.command, [&, query](const StationClient::Result& reply) {
+            result.seconds.push_back(reply.seconds);
+            result.retries += reply.retries;
+            if (!startsWith(reply.reply, run.binary ? query.binary : query.text) || reply.command != query.command) {
+                fprintf(stderr, "#%u %s: %s\n", (unsigned)reply.tag, reply.command.c_str(), reply.reply.c_str());
+                result.mismatches++;
+            }
+        });
+        // Keep a few windows queued rather than all of them, as a host producing commands would
+        while (client.waiting() > 4 * run.window + 1) {
+            if (!client.poll(10)) {
+                return false;
+            }
+        }
+    }
+    bool drained = client.drain(DRAIN_TIMEOUT_MS);
+    result.wall = std::chrono::duration<double>(Clock::now() - start).count();
+    result.bytes = client.bytesReceived() - startBytes;
+    return drained;
+}
+
+double percentile(const std::vector<double>& sorted, double share) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = (size_t)(share * (sorted.size() - 1) + 0.5);
+    return sorted[index] * 1000.0;
+}
+
+void printRun(const RunCase& run, size_t requests, RunResult& result) {
+    std::sort(result.seconds.begin(), result.seconds.end());
+    printf("%-7s %6zu %8.0f %7.2f %7.2f %7.2f %6lu %9.1f\n", run.name, run.window, requests / result.wall,
+           percentile(result.seconds, 0.5), percentile(result.seconds, 0.99), percentile(result.seconds, 1.0),
+           result.retries, (double)result.bytes / requests);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s NATIVE_PROGRAM [BAUD [REQUESTS]]\n", argv[0]);
+        return 1;
+    }
+    const char* program = argv[1];
+    unsigned long baud = argc > 2 ? strtoul(argv[2], nullptr, 10) : DEFAULT_BAUD;
+    size_t requests = argc > 3 ? strtoul(argv[3], nullptr, 10) : DEFAULT_REQUESTS;
+    if (baud == 0 || requests == 0) {
+        fprintf(stderr, "Usage: %s NATIVE_PROGRAM [BAUD [REQUESTS]]\n", argv[0]);
+        return 1;
+    }
+
+    int fd;
+    pid_t pid = spawn(program, baud, fd);
+    if (pid < 0) {
+        perror("forkpty");
+        return 1;
+    }
+    StationClient client;
+    client.attach(fd);
+    usleep(STARTUP_MS * 1000);
+
+    // Untagged output (ESP32 READY) is expected; anything tagged must belong to a request
+    unsigned long logs = 0;
+    client.setListener([&](const StationClient::Message& message) {
+        if (message.channel == StationClient::LOG) {
+            logs++;
+        }
+    });
+
+    printf("%lu baud, %zu queries per run\n\n", baud, requests);
+    printf("%-7s %6s %8s %7s %7s %7s %6s %9s\n", "MODE", "WINDOW", "REQ/S", "P50 ms", "P99 ms", "MAX ms", "BUSY",
+           "BYTES/REQ");
+
+    int status = 0;
+    bool opened = false;
+    bool binary = false;
+    for (const RunCase& run : RUN_CASES) {
+        if ((!opened || run.binary != binary) && !client.hello(run.binary, HELLO_TIMEOUT_MS)) {
+            fprintf(stderr, "%s did not answer HELLO%s TAG\n", program, run.binary ? " BIN" : "");
+            status = 1;
+            break;
+        }
+        opened = true;
+        binary = run.binary;
+
+        RunResult result;
+        bool drained = runCase(client, run, requests, result);
+        printRun(run, requests, result);
+        if (!drained || !result.moveDone || result.mismatches > 0) {
+            fprintf(stderr, "%s window %zu: %s\n", run.name, run.window,
+                    !drained ? "requests left without a final reply" : !result.moveDone ? "no move result" : "replies mismatched");
+            status = 1;
+        }
+    }
+
+    if (client.strayMessages() > 0) {
+        fprintf(stderr, "%lu tagged messages for no request\n", client.strayMessages());
+        status = 1;
+    }
+    printf("\n%lu log lines kept apart from the replies\n", logs);
+    if (status == 0) {
+        printf("OK: every request got its own replies\n");
+    }
+
+    client.close();
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    return status;
+}
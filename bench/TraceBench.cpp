@@ -0,0 +1,665 @@
+// Motion trace check, benchmark and decoder (pio run -e tracebench).
+//
+// Without a file it runs moves through the real MotorController/StepEngine path on
+// SimStepHal with the trace on, dumps each with TRACE DUMP the way the firmware sends it,
+// and decodes the TRACE lines back. Per case:
+//   STEPS    STEP rising edges of the move
+//   B/STEP   trace bytes per step it holds, block headers included
+//   DIFF     edges the trace got the time of wrong, plus any step missing or extra, and
+//            a final position that doesn't match the engine's
+//   ANOM     anomalies the analysis below reports; only ESTOP may have any (it stops at
+//            speed, and must be caught doing so)
+// then times TraceRecorder::step() over the intervals of all the cases, as recorded and
+// with the 0..7 us interrupt jitter of the board added: ns and bytes per step.
+//
+// Given a file, it decodes a dump captured from the serial port (the TRACE: and TRACE END
+// lines; anything else is skipped), checks its CRC, and lists the moves it holds with
+// their peak speed and acceleration, the state marks and every anomaly:
+//   JUMP     an interval changed more than ACCEL (steps/s^2) allows between two steps:
+//            the speed jumped instead of ramping (the check PauseBench makes)
+//   REST     a move started, stopped or turned round at more than END_LIMIT times the
+//            ramp start speed
+//   STATE    a step more than GRACE_US after the controller entered a state at rest
+// --csv prints the reconstructed curves instead, a line per step: time, position,
+// interval, velocity, acceleration and state.
+//
+//   .pio/build/tracebench/program [trace.txt [ACCEL]] [--csv]
+//
+// Exits non-zero if the dump doesn't decode, or without a file on any mismatch.
+#include <Arduino.h>
+#include <math.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "SerialManager.h"
+#include "MotorController.h"
+#include "TraceLog.h"
+
+namespace {
+
+const double DEFAULT_ACCEL = SpeedTable::RAMP_ACCEL;
+const double REST_INTERVAL = 1e6 / SpeedTable::RAMP_START_RATE;  // us, first and last step
+const double STANDSTILL = 1.01 * REST_INTERVAL;  // Longer gaps between steps are rests
+const double JUMP_SLACK_US = 2.0;                // Whole-microsecond rounding of two intervals
+const double JUMP_MARGIN = 1.25;                 // The integrator steps at the mean velocity
+const double END_LIMIT = 2.0;
+const int32_t GRACE_US = 100;                    // A pulse or burst under way may finish
+const uint64_t MAX_MOVE_MICROS = 120ULL * 1000000ULL;
+const int REPORTED_ANOMALIES = 20;
+const int BENCH_ROUNDS = 50;
+const size_t CURVE_WINDOW = 16;  // Steps: one interval is only good to a microsecond
+
+// A decoded dump
+
+struct Decoded {
+    Trace::ImageHeader header;
+    size_t bytes;
+    std::vector<Trace::Step> steps;
+    std::vector<Trace::Mark> marks;
+    long gaps;  // Blocks missing between two that are there
+};
+
+struct Anomaly {
+    uint32_t time;
+    const char* kind;
+    double expected;
+    double actual;
+};
+
+// TRACE:{offset} {hex} and TRACE END BYTES:{size} CRC:{crc} lines into the image
+bool parseDump(const std::string& text, std::vector<uint8_t>& image, std::string& error) {
+    unsigned long size = 0;
+    unsigned crc = 0;
+    bool ended = false;
+    std::vector<bool> seen;
+
+    size_t at = 0;
+    while (at < text.size()) {
+        size_t end = text.find('\n', at);
+        std::string line = text.substr(at, end == std::string::npos ? std::string::npos : end - at);
+        at = end == std::string::npos ? text.size() : end + 1;
+
+        unsigned long offset;
+        char hex[2 * Frame::MAX_PAYLOAD + 1];
+        if (sscanf(line.c_str(), "TRACE END BYTES:%lu CRC:%x", &size, &crc) == 2) {
+            ended = true;
+        } else if (sscanf(line.c_str(), "TRACE:%lu %128[0-9A-Fa-f]", &offset, hex) == 2) {
+            size_t length = strlen(hex) / 2;
+            if (image.size() < offset + length) {
+                image.resize(offset + length);
+                seen.resize(offset + length);
+            }
+            for (size_t i = 0; i < length; i++) {
+                unsigned byte;
+                sscanf(hex + 2 * i, "%2x", &byte);
+                image[offset + i] = (uint8_t)byte;
+                seen[offset + i] = true;
+            }
+        }
+    }
+
+    if (!ended) {
+        error = "no TRACE END line";
+        return false;
+    }
+    if (image.size() != size) {
+        error = "image is " + std::to_string(image.size()) + " bytes, TRACE END says " + std::to_string(size);
+        return false;
+    }
+    for (size_t i = 0; i < seen.size(); i++) {
+        if (!seen[i]) {
+            error = "no line holds byte " + std::to_string(i) + ", dump again with FROM:" + std::to_string(i);
+            return false;
+        }
+    }
+    if (Frame::crc16(image.data(), image.size()) != crc) {
+        error = "CRC mismatch";
+        return false;
+    }
+    return true;
+}
+
+bool decodeImage(const std::vector<uint8_t>& image, Decoded& decoded, std::string& error) {
+    if (!Trace::decodeImageHeader(image.data(), image.size(), decoded.header)) {
+        error = "not a version " + std::to_string(Trace::VERSION) + " trace image";
+        return false;
+    }
+    decoded.bytes = image.size();
+    decoded.steps.clear();
+    decoded.marks.clear();
+    decoded.gaps = 0;
+
+    size_t at = Trace::IMAGE_HEADER_SIZE;
+    Trace::Step steps[Trace::MAX_BLOCK_STEPS];
+    for (uint16_t block = 0; block < decoded.header.blocks; block++) {
+        Trace::BlockHeader header;
+        if (at + Trace::BLOCK_HEADER_SIZE > image.size()) {
+            error = "image ends in block " + std::to_string(block);
+            return false;
+        }
+        Trace::decodeBlockHeader(&image[at], header);
+        at += Trace::BLOCK_HEADER_SIZE;
+        if (at + header.length > image.size()) {
+            error = "image ends in block " + std::to_string(block);
+            return false;
+        }
+        long count = Trace::decodeBlock(header, &image[at], steps, Trace::MAX_BLOCK_STEPS);
+        if (count < 0) {
+            error = "block " + std::to_string(header.sequence) + " is malformed";
+            return false;
+        }
+        at += header.length;
+        if (block > 0 && !decoded.steps.empty() && header.time != decoded.steps.back().time) {
+            decoded.gaps++;  // Doesn't carry on from the block before
+        }
+        decoded.steps.insert(decoded.steps.end(), steps, steps + count);
+    }
+
+    for (uint16_t i = 0; i < decoded.header.marks; i++) {
+        if (at + Trace::MARK_SIZE > image.size()) {
+            error = "image ends in the marks";
+            return false;
+        }
+        Trace::Mark mark;
+        Trace::decodeMark(&image[at], mark);
+        decoded.marks.push_back(mark);
+        at += Trace::MARK_SIZE;
+    }
+    if (at != image.size()) {
+        error = "bytes left over after the marks";
+        return false;
+    }
+    return true;
+}
+
+// Analysis
+
+bool atRest(uint8_t state) {
+    switch ((MotorState)state) {
+        case MotorState::ROTATING:
+        case MotorState::TIME_MODE:
+        case MotorState::PAUSED:     // Ramping down
+        case MotorState::STOPPING:
+        case MotorState::HOMING:
+            return false;
+        default:
+            return true;
+    }
+}
+
+// From earlier to later across the 32-bit wrap
+int32_t since(uint32_t later, uint32_t earlier) {
+    return (int32_t)(later - earlier);
+}
+
+// Velocity (steps/s, negative CCW) and acceleration (steps/s^2) at every step, each over
+// up to CURVE_WINDOW steps back within a run: from a rest or a turn round on. NAN where
+// there isn't a step to measure from yet, or for acceleration two whole windows.
+void curves(const std::vector<Trace::Step>& steps, std::vector<double>& velocity, std::vector<double>& acceleration) {
+    velocity.assign(steps.size(), NAN);
+    acceleration.assign(steps.size(), NAN);
+    size_t run = 0;
+    for (size_t i = 0; i < steps.size(); i++) {
+        if (i == 0 || steps[i].interval > STANDSTILL) {
+            run = i;
+            continue;
+        }
+        if (steps[i].reverse != steps[i - 1].reverse) {
+            run = i - 1;
+        }
+        size_t back = i - run < CURVE_WINDOW ? i - run : CURVE_WINDOW;
+        double seconds = since(steps[i].time, steps[i - back].time) * 1e-6;
+        velocity[i] = (steps[i].reverse ? -1.0 : 1.0) * back / seconds;
+        if (i >= run + 2 * CURVE_WINDOW) {
+            // Between the middles of the two windows
+            double apart = since(steps[i].time, steps[i - 2 * back].time) * 0.5e-6;
+            acceleration[i] = (velocity[i] - velocity[i - back]) / apart;
+        }
+    }
+}
+
+struct Move {
+    uint32_t start;
+    long steps;
+    int32_t from;
+    int32_t to;
+    double peakSpeed;  // steps/s
+    double peakAccel;  // steps/s^2, either way
+};
+
+// Splits the steps into moves at standstills and checks every one of them
+void analyse(const Decoded& decoded, double accel, std::vector<Move>& moves, std::vector<Anomaly>& anomalies) {
+    const std::vector<Trace::Step>& steps = decoded.steps;
+    // Once the ring dropped blocks the trace starts wherever the oldest one left off
+    bool midMove = decoded.header.steps > steps.size();
+    size_t mark = 0;
+    bool rest = false;
+    uint32_t restSince = 0;
+    double lastInterval = 0;  // 0 = standing still
+    std::vector<double> velocity;
+    std::vector<double> acceleration;
+    curves(steps, velocity, acceleration);
+
+    for (size_t i = 0; i < steps.size(); i++) {
+        const Trace::Step& step = steps[i];
+        while (mark < decoded.marks.size() && since(decoded.marks[mark].time, step.time) <= 0) {
+            rest = atRest(decoded.marks[mark].state);
+            restSince = decoded.marks[mark].time;
+            mark++;
+        }
+        if (rest && since(step.time, restSince) > GRACE_US) {
+            anomalies.push_back({ step.time, "STATE", 0, (double)since(step.time, restSince) });
+        }
+
+        double interval = step.interval;
+        bool turned = i > 0 && step.reverse != steps[i - 1].reverse;
+        if (i == 0 || interval > STANDSTILL) {
+            if (i > 0 && lastInterval > 0 && REST_INTERVAL / lastInterval > END_LIMIT) {
+                anomalies.push_back({ steps[i - 1].time, "REST", 1e6 / REST_INTERVAL, 1e6 / lastInterval });
+            }
+            moves.push_back({ step.time, 0, step.position - (step.reverse ? -1 : 1), step.position, 0, 0 });
+            lastInterval = i == 0 && midMove && interval <= STANDSTILL ? interval : 0;
+        } else if (lastInterval == 0 || turned) {
+            // First step at speed after a rest, or the first one back after turning round
+            if (REST_INTERVAL / interval > END_LIMIT) {
+                anomalies.push_back({ step.time, "REST", 1e6 / REST_INTERVAL, 1e6 / interval });
+            }
+            if (turned && lastInterval > 0 && REST_INTERVAL / lastInterval > END_LIMIT) {
+                anomalies.push_back({ steps[i - 1].time, "REST", 1e6 / REST_INTERVAL, 1e6 / lastInterval });
+            }
+            lastInterval = interval;
+        } else {
+            double longer = lastInterval > interval ? lastInterval : interval;
+            // dt = 1 / v, so one step changes it by a * dt^3 at acceleration a
+            double allowed = JUMP_MARGIN * accel * longer * longer * longer * 1e-12;
+            double change = fabs(interval - lastInterval);
+            if (change - JUMP_SLACK_US > allowed) {
+                anomalies.push_back({ step.time, "JUMP", allowed + JUMP_SLACK_US, change });
+            }
+            lastInterval = interval;
+        }
+
+        Move& move = moves.back();
+        move.steps++;
+        move.to = step.position;
+        if (fabs(velocity[i]) > move.peakSpeed) {
+            move.peakSpeed = fabs(velocity[i]);
+        }
+        if (fabs(acceleration[i]) > move.peakAccel) {
+            move.peakAccel = fabs(acceleration[i]);
+        }
+    }
+    if (lastInterval > 0 && REST_INTERVAL / lastInterval > END_LIMIT) {
+        anomalies.push_back({ steps.back().time, "REST", 1e6 / REST_INTERVAL, 1e6 / lastInterval });
+    }
+}
+
+const char* markState(const Decoded& decoded, size_t& mark, uint32_t time) {
+    while (mark < decoded.marks.size() && since(decoded.marks[mark].time, time) <= 0) {
+        mark++;
+    }
+    return mark > 0 ? MotorController::stateName((MotorState)decoded.marks[mark - 1].state) : "";
+}
+
+void printCsv(const Decoded& decoded) {
+    printf("time_us,position,interval_us,velocity,acceleration,state\n");
+    const std::vector<Trace::Step>& steps = decoded.steps;
+    std::vector<double> velocity;
+    std::vector<double> acceleration;
+    curves(steps, velocity, acceleration);
+    size_t mark = 0;
+    int64_t time = 0;
+    for (size_t i = 0; i < steps.size(); i++) {
+        const Trace::Step& step = steps[i];
+        if (i > 0) {
+            time += step.interval;
+        }
+        printf("%lld,%ld,%lu,", (long long)time, (long)step.position, (unsigned long)step.interval);
+        if (!isnan(velocity[i])) {
+            printf("%.1f", velocity[i]);
+        }
+        printf(",");
+        if (!isnan(acceleration[i])) {
+            printf("%.0f", acceleration[i]);
+        }
+        printf(",%s\n", markState(decoded, mark, step.time));
+    }
+}
+
+void printAnomalies(const std::vector<Anomaly>& anomalies, uint32_t origin) {
+    int shown = 0;
+    for (const Anomaly& anomaly : anomalies) {
+        if (shown++ >= REPORTED_ANOMALIES) {
+            printf("  ... %zu more\n", anomalies.size() - REPORTED_ANOMALIES);
+            break;
+        }
+        double at = since(anomaly.time, origin) / 1000.0;
+        if (strcmp(anomaly.kind, "JUMP") == 0) {
+            printf("  %10.3f ms JUMP   interval changed by %.0f us, at most %.1f\n", at, anomaly.actual, anomaly.expected);
+        } else if (strcmp(anomaly.kind, "REST") == 0) {
+            printf("  %10.3f ms REST   %.0f steps/s next to a rest or turn, ramp start %.0f\n", at, anomaly.actual,
+                   anomaly.expected);
+        } else {
+            printf("  %10.3f ms STATE  step %.0f us after entering a state at rest\n", at, anomaly.actual);
+        }
+    }
+}
+
+void report(const Decoded& decoded, double accel) {
+    std::vector<Move> moves;
+    std::vector<Anomaly> anomalies;
+    analyse(decoded, accel, moves, anomalies);
+    uint32_t origin = !decoded.steps.empty() ? decoded.steps.front().time : 0;
+    if (!decoded.marks.empty() && (decoded.steps.empty() || since(decoded.marks.front().time, origin) < 0)) {
+        origin = decoded.marks.front().time;
+    }
+
+    size_t steps = decoded.steps.size();
+    double span = steps > 1 ? since(decoded.steps.back().time, decoded.steps.front().time) / 1e6 : 0;
+    printf("%zu steps over %.3f s (%lu recorded), %u blocks, %zu bytes: %.2f bytes/step\n", steps, span,
+           (unsigned long)decoded.header.steps, (unsigned)decoded.header.blocks, decoded.bytes,
+           steps > 0 ? (double)decoded.bytes / steps : 0.0);
+    if (decoded.gaps > 0) {
+        printf("%ld blocks don't carry on from the one before\n", decoded.gaps);
+    }
+
+    printf("\n%-4s %12s %8s %10s %10s %10s %12s\n", "MOVE", "START(ms)", "STEPS", "FROM", "TO", "PEAK(st/s)",
+           "ACCEL(st/s2)");
+    for (size_t i = 0; i < moves.size(); i++) {
+        const Move& move = moves[i];
+        printf("%-4zu %12.3f %8ld %10ld %10ld %10.0f %12.0f\n", i + 1, since(move.start, origin) / 1000.0, move.steps,
+               (long)move.from, (long)move.to, move.peakSpeed, move.peakAccel);
+    }
+
+    printf("\n%-12s %-12s %10s\n", "MARK(ms)", "STATE", "POSITION");
+    for (const Trace::Mark& mark : decoded.marks) {
+        printf("%12.3f %-12s %10ld\n", since(mark.time, origin) / 1000.0, MotorController::stateName((MotorState)mark.state),
+               (long)mark.position);
+    }
+
+    printf("\n%zu anomalies (acceleration %.0f steps/s^2)\n", anomalies.size(), accel);
+    printAnomalies(anomalies, origin);
+}
+
+// Simulated moves
+
+SerialManager serialManager;
+MotorController motorController;
+
+enum MoveKind { ROTATION_RPM, ROTATION_LEVEL, POSITION, TURNS, PAUSED, EMERGENCY };
+
+struct MoveCase {
+    const char* name;
+    MoveKind kind;
+    int speed;          // RPM or speed level
+    int revolutions;
+    uint16_t burst;     // SimStepHal burst items, 0 = an edge per alarm
+};
+
+const MoveCase MOVE_CASES[] = {
+    { "ROT 60",    ROTATION_RPM,   60,   3,  0 },
+    { "ROT 600",   ROTATION_RPM,   600,  3,  0 },
+    { "LEVEL 20",  ROTATION_LEVEL, 20,   3,  0 },   // Ramp tables
+    { "BURST 600", ROTATION_RPM,   600,  3,  64 },  // Steps logged after their burst
+    { "LONG 600",  ROTATION_RPM,   600,  12, 0 },   // More than the ring holds: the oldest go
+    { "MOVE",      POSITION,       300,  1,  0 },   // Out, POS SET:0 and back: a POSITION record
+    { "TURNS",     TURNS,          300,  1,  0 },   // Queued segments that reverse DIR
+    { "PAUSE",     PAUSED,         600,  3,  0 },
+    { "ESTOP",     EMERGENCY,      600,  3,  0 },   // Stops at speed: REST
+};
+
+struct CaseResult {
+    long steps;
+    long held;
+    size_t bytes;
+    long differing;
+    size_t anomalies;
+};
+
+std::vector<uint32_t> benchIntervals;  // Every case's, for the encoder timing
+
+void tick(std::string* output = nullptr) {
+    Sim::advance(1000);
+    motorController.update();
+    serialManager.pump();
+    if (output != nullptr) {
+        *output += Sim::serialOutput();
+    }
+    Sim::clearSerialOutput();
+}
+
+void startMove(const MoveCase& test) {
+    switch (test.kind) {
+        case ROTATION_LEVEL:
+            motorController.executeRotationWithSpeed(test.speed, test.revolutions);
+            break;
+        case POSITION:
+            motorController.executeMove(3200L * test.revolutions, true, test.speed, 0);
+            break;
+        case TURNS:
+            motorController.enqueueRotation(test.speed, 0, test.revolutions, true);
+            motorController.enqueueRotation(test.speed, 0, test.revolutions, false);
+            tick();  // The queue starts from update()
+            break;
+        default:
+            motorController.executeRotation(test.speed, test.revolutions);
+            break;
+    }
+}
+
+bool runCase(const MoveCase& test, CaseResult& result) {
+    PlatformStepHal& timer = motorController.timer();
+    timer.setBurstItems(test.burst);
+    timer.clearPulses();
+    motorController.startTrace();
+
+    uint64_t start = Sim::now();
+    startMove(test);
+    bool interrupted = false;
+    bool returned = false;
+    while (motorController.isMotorRunning() && Sim::now() - start < MAX_MOVE_MICROS) {
+        tick();
+        if (!interrupted && Sim::now() - start >= 400000) {
+            interrupted = true;
+            if (test.kind == PAUSED) {
+                motorController.pause();
+                for (int i = 0; i < 200; i++) {
+                    tick();
+                }
+                motorController.resume();
+            } else if (test.kind == EMERGENCY) {
+                motorController.emergencyStop();
+            }
+        }
+        if (test.kind == POSITION && !returned && !motorController.isMotorRunning()) {
+            returned = true;
+            motorController.setPosition(0);
+            motorController.executeMove(-3200L * test.revolutions, false, test.speed, 0);
+        }
+    }
+    for (int i = 0; i < 5; i++) {
+        tick();
+    }
+
+    std::string output;
+    motorController.dumpTrace(0);
+    while (output.find("TRACE END") == std::string::npos && Sim::now() - start < 2 * MAX_MOVE_MICROS) {
+        tick(&output);
+    }
+    std::vector<uint8_t> image;
+    std::string error;
+    Decoded decoded;
+    if (!parseDump(output, image, error) || !decodeImage(image, decoded, error)) {
+        printf("  FAIL %s: %s\n", test.name, error.c_str());
+        return false;
+    }
+
+    // The trace against the last edges SimStepHal recorded, all of them unless the ring
+    // dropped blocks
+    long pulses = timer.recordedPulses();
+    long held = (long)decoded.steps.size();
+    long first = pulses - held;
+    result.steps = pulses;
+    result.held = held;
+    result.bytes = decoded.bytes;
+    result.differing = labs(pulses - (long)decoded.header.steps) + (first < 0 ? -first : 0) + decoded.gaps;
+    if (first != 0 && decoded.header.blocks < TraceRecorder::BLOCKS) {
+        result.differing++;
+    }
+    for (long i = first > 0 ? first : 0; i < pulses; i++) {
+        if (decoded.steps[i - first].time != (uint32_t)timer.pulseTime(i)) {
+            result.differing++;
+        }
+    }
+    for (long i = 1; i < pulses; i++) {
+        benchIntervals.push_back((uint32_t)(timer.pulseTime(i) - timer.pulseTime(i - 1)));
+    }
+    if (decoded.steps.empty() || decoded.steps.back().position != motorController.position()) {
+        result.differing++;
+    }
+
+    std::vector<Move> moves;
+    std::vector<Anomaly> anomalies;
+    analyse(decoded, DEFAULT_ACCEL, moves, anomalies);
+    result.anomalies = anomalies.size();
+    if (!anomalies.empty() && test.kind != EMERGENCY) {
+        printAnomalies(anomalies, decoded.steps.front().time);
+    }
+
+    bool caught = test.kind == EMERGENCY ? result.anomalies > 0 : result.anomalies == 0;
+    return caught && result.differing == 0 && pulses > 0;
+}
+
+// ns per TraceRecorder::step() over the intervals, and the bytes the blocks took
+void benchEncoder(const char* name, const std::vector<uint32_t>& intervals) {
+    static TraceRecorder recorder;
+    uint8_t chunk[64];
+    size_t bytes = 0;
+    long steps = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        // Restarted every block-ring's worth, so the last round's image covers what it held
+        uint32_t time = 0;
+        long position = 0;
+        size_t from = 0;
+        while (from < intervals.size()) {
+            recorder.start(time, position, false);
+            size_t until = from + 12000 < intervals.size() ? from + 12000 : intervals.size();
+            for (size_t i = from; i < until; i++) {
+                time += intervals[i];
+                recorder.step(time, false, ++position);
+            }
+            if (round == 0) {
+                recorder.stop();
+                size_t size = recorder.imageSize();
+                bytes += size - Trace::IMAGE_HEADER_SIZE - recorder.marksHeld() * Trace::MARK_SIZE;
+                steps += recorder.steps();
+                recorder.readImage(size - sizeof(chunk), chunk, sizeof(chunk));
+            }
+            from = until;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double nanos = std::chrono::duration<double, std::nano>(end - start).count();
+    printf("%-9s %8zu %8.2f %8.2f\n", name, intervals.size(), nanos / ((double)BENCH_ROUNDS * intervals.size()),
+           steps > 0 ? (double)bytes / steps : 0.0);
+}
+
+int runSimulation() {
+    serialManager.begin();
+    motorController.begin(serialManager);
+    motorController.timer().setAlarmLatency(2);
+    Sim::clearSerialOutput();
+
+    long failures = 0;
+    printf("Moves on SimStepHal, traced and dumped\n\n");
+    printf("%-9s %7s %7s %6s %5s\n", "CASE", "STEPS", "B/STEP", "DIFF", "ANOM");
+    for (const MoveCase& test : MOVE_CASES) {
+        CaseResult result = {};
+        bool passed = runCase(test, result);
+        printf("%-9s %7ld %7.2f %6ld %5zu\n", test.name, result.steps,
+               result.held > 0 ? (double)result.bytes / result.held : 0.0, result.differing, result.anomalies);
+        if (!passed) {
+            failures++;
+        }
+    }
+
+    // The board's alarms come 0..7 us late on top of the planned intervals
+    std::vector<uint32_t> jittered(benchIntervals.size());
+    std::mt19937 random(1);
+    std::uniform_int_distribution<uint32_t> jitter(0, 7);
+    uint32_t previous = 0;
+    for (size_t i = 0; i < benchIntervals.size(); i++) {
+        uint32_t late = jitter(random);
+        jittered[i] = benchIntervals[i] + late - previous;
+        previous = late;
+    }
+
+    printf("\nTraceRecorder::step() on this host, %d rounds\n\n", BENCH_ROUNDS);
+    printf("%-9s %8s %8s %8s\n", "STEPS", "COUNT", "ns/STEP", "B/STEP");
+    benchEncoder("PLANNED", benchIntervals);
+    benchEncoder("JITTER", jittered);
+
+    if (failures > 0) {
+        printf("\nFAILED: %ld cases\n", failures);
+        return 1;
+    }
+    printf("\nOK: every trace decoded to the edges that went out\n");
+    return 0;
+}
+
+bool readFile(const char* path, std::string& text) {
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        return false;
+    }
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        text.append(buffer, length);
+    }
+    fclose(file);
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    bool csv = false;
+    const char* path = nullptr;
+    double accel = DEFAULT_ACCEL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) {
+            csv = true;
+        } else if (path == nullptr) {
+            path = argv[i];
+        } else {
+            accel = atof(argv[i]);
+        }
+    }
+    if (path == nullptr) {
+        return runSimulation();
+    }
+
+    std::string text;
+    if (!readFile(path, text)) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return 1;
+    }
+    std::vector<uint8_t> image;
+    std::string error;
+    Decoded decoded;
+    if (!parseDump(text, image, error) || !decodeImage(image, decoded, error)) {
+        fprintf(stderr, "%s: %s\n", path, error.c_str());
+        return 1;
+    }
+    if (csv) {
+        printCsv(decoded);
+    } else {
+        report(decoded, accel);
+    }
+    return 0;
+}
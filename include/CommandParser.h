@@ -0,0 +1,99 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Allocation-free command parsing.
+//
+// Bytes are appended to a fixed ring buffer as they arrive and tokenized by a small state
+// machine into words ("HELLO") and key:value pairs ("RPM:100"), in any order. A complete
+// line is matched against a command table by the words and keys it contains, e.g.
+// "RPM: ROT:" matches both "RPM:100 ROT:5 DIR:CW" and "ROT:5 RPM:100". Unknown extra
+// keys are kept, so new parameters don't need parser changes. A leading "#{tag}" word
+// ("#12 POS") tags the line for a pipelining host: it is taken off the fields and the
+// replies carry it back (SerialManager.h). Plain C++, no Arduino.
+
+struct CommandField {
+    static const int MAX_KEY = 11;
+    static const int MAX_VALUE = 15;
+    static const long MAX_NUMBER = 2147483647;  // long on the ESP32, kept on 64-bit hosts too
+
+    char key[MAX_KEY + 1];
+    char value[MAX_VALUE + 1];
+    bool hasValue;  // "KEY:VALUE" as opposed to a bare word
+    long number;    // Leading integer of value, like String::toInt(); the line is dropped past MAX_NUMBER
+};
+
+class ParsedCommand {
+public:
+    static const int MAX_FIELDS = 8;
+    static const uint16_t MAX_TAG = 0x7FFF;
+
+    CommandField fields[MAX_FIELDS];
+    uint8_t count;
+    uint16_t tag;   // 1..MAX_TAG, 0 when untagged
+    bool malformed; // Line was dropped (see CommandParser::poll); no fields, tag if it had one
+
+    ParsedCommand() : count(0), tag(0), malformed(false) {}
+    const CommandField* find(const char* key) const;
+    bool has(const char* key) const { return find(key) != nullptr; }
+    long getInt(const char* key, long fallback) const;
+    const char* getText(const char* key, const char* fallback) const;
+};
+
+typedef void (*CommandHandler)(const ParsedCommand& command);
+
+struct CommandEntry {
+    const char* pattern;  // Space separated words and "KEY:" tokens that must all be present
+    CommandHandler handler;
+};
+
+class CommandParser {
+private:
+    static const size_t RING_SIZE = 256;  // Power of two
+
+    enum TokenState : uint8_t {
+        SKIP_SPACE,
+        READ_KEY,
+        READ_VALUE,
+        DISCARD_LINE
+    };
+
+    uint8_t ring[RING_SIZE];
+    size_t head;
+    size_t tail;
+    unsigned long overflowCount;
+    unsigned long rejectedCount;
+
+    TokenState state;
+    ParsedCommand current;
+    uint8_t keyLength;
+    uint8_t valueLength;
+    bool negative;
+    bool digits;
+
+    void startField();
+    void finishField();
+    bool takeTag(const CommandField& field);
+    void discard();
+    bool consume(uint8_t byte);
+
+public:
+    CommandParser();
+    void reset();
+
+    // Append received bytes; returns how many fit (the rest are counted as overflow)
+    size_t feed(const uint8_t* data, size_t length);
+    bool feed(uint8_t byte);
+    size_t space() const { return (tail - head - 1) & (RING_SIZE - 1); }
+    // Run the tokenizer over buffered bytes until one command line is complete. A line
+    // with too many fields, a key or value too long, a number beyond a long or a bad tag
+    // comes out malformed, so the host can be told
+    bool poll(ParsedCommand& command);
+
+    unsigned long overflows() const { return overflowCount; }
+    unsigned long rejectedLines() const { return rejectedCount; }
+
+    static bool matches(const char* pattern, const ParsedCommand& command);
+    // Calls the first matching handler; false if nothing matched
+    static bool dispatch(const CommandEntry* table, size_t count, const ParsedCommand& command);
+};
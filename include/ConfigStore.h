@@ -0,0 +1,111 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "SpeedTable.h"
+
+// Station configuration: the motor parameters, speed table and limits that used to be
+// compiled into MotorController.h. MotorController fills in the compiled-in values, the
+// stored blob (if any) replaces them at boot and CONFIG SET changes them at run time.
+struct MotorConfig {
+    uint16_t stepPin;             // Axis 0 TB6600 PUL+/DIR+/ENA+
+    uint16_t dirPin;
+    uint16_t enablePin;
+    uint16_t stepsPerRevolution;  // Full steps of the motor
+    uint16_t microsteps;          // Driver DIP setting
+    uint16_t minRpm;
+    uint16_t maxRpm;
+    uint16_t loadZeroLevel;       // Current sense calibration, raw ADC
+    uint16_t loadFullLevel;
+    uint16_t speedDelay[SpeedTable::LEVELS];  // Step delay per speed level, us
+};
+
+// Where a stored blob (the configuration, the motion script) lives: NVS on the board, a
+// file on Linux
+class ConfigStorage {
+public:
+    virtual ~ConfigStorage() {}
+    // Bytes read into data, 0 if nothing is stored
+    virtual size_t read(uint8_t* data, size_t capacity) = 0;
+    virtual bool write(const uint8_t* data, size_t length) = 0;
+};
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+// One blob key in an NVS namespace, through the Arduino Preferences wrapper
+class NvsConfigStorage : public ConfigStorage {
+private:
+    const char* space;
+    const char* key;
+
+public:
+    explicit NvsConfigStorage(const char* space = "motor", const char* key = "config");
+    size_t read(uint8_t* data, size_t capacity) override;
+    bool write(const uint8_t* data, size_t length) override;
+};
+
+#else
+
+// A file, replaced atomically on write (host builds)
+class FileConfigStorage : public ConfigStorage {
+private:
+    const char* path;
+
+public:
+    explicit FileConfigStorage(const char* path = "motor_config.bin");
+    size_t read(uint8_t* data, size_t capacity) override;
+    bool write(const uint8_t* data, size_t length) override;
+};
+
+#endif
+
+#if defined(ARDUINO_ARCH_ESP32)
+typedef NvsConfigStorage PlatformConfigStorage;
+#else
+typedef FileConfigStorage PlatformConfigStorage;
+#endif
+
+// Versioned, CRC-checked serialization of MotorConfig, and the named fields CONFIG GET/SET
+// work on.
+//
+// Blob: magic "MCFG" | version | field count | fields (uint16 each) | crc16, little
+// endian, CRC-16/CCITT-FALSE over everything before it. Fields are stored in field order,
+// not as the struct, so padding never matters. New fields are only ever appended (with
+// VERSION bumped): an older blob then loads its fields and leaves the new ones at their
+// compiled-in values, while a blob from newer firmware is refused.
+class ConfigStore {
+public:
+    static const uint16_t VERSION = 1;
+    static const uint8_t FIELDS = 9 + SpeedTable::LEVELS;
+    static const size_t MAX_BLOB = 128;  // Room for blobs of later versions, to refuse them
+    static const uint32_t MAX_STEP_RATE = 64000;  // steps/s at MAXRPM (1000 RPM at 1/16 is 53333)
+
+    enum Result : uint8_t {
+        LOADED,
+        MISSING,      // Nothing stored yet
+        CORRUPT,      // Bad magic, length or CRC
+        UNSUPPORTED,  // Written by newer firmware
+        INVALID       // Intact, but fails validate()
+    };
+
+private:
+    ConfigStorage& storage;
+
+public:
+    explicit ConfigStore(ConfigStorage& storage);
+
+    // config keeps its values unless the result is LOADED
+    Result load(MotorConfig& config);
+    bool save(const MotorConfig& config);
+    static const char* resultName(Result result);
+
+    // Fields by index 0..FIELDS-1: "STEPPIN", ..., "DELAY1".."DELAY20"
+    static void fieldName(uint8_t field, char* name, size_t size);
+    static int findField(const char* name);  // -1 if unknown
+    static uint16_t getField(const MotorConfig& config, uint8_t field);
+    // false if the value is outside the field's range
+    static bool setField(MotorConfig& config, uint8_t field, long value);
+    static void fieldRange(uint8_t field, uint16_t& minimum, uint16_t& maximum);
+
+    // Checks across fields; nullptr when the configuration can be used, else the reason
+    static const char* validate(const MotorConfig& config);
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Continuous sampling of the driver current-sense input. The converter runs on its own
+// (DMA on the ESP32) and read() only collects what it has converted since the last call,
+// never waiting, so the reader can be a low-priority task away from the step ISR.
+class CurrentSense {
+public:
+    virtual ~CurrentSense() {}
+    virtual bool begin() = 0;
+    // Copy up to maxSamples raw 12-bit samples; returns how many, 0 when none are ready
+    virtual size_t read(uint16_t* samples, size_t maxSamples) = 0;
+    virtual uint32_t sampleRate() const = 0;
+};
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+#include <Arduino.h>
+#include <driver/adc.h>
+
+// ADC1 in continuous mode; on the ESP32 the conversions are moved to RAM by the I2S0
+// DMA engine, so sampling costs no CPU until read() picks up a frame
+class Esp32CurrentSense : public CurrentSense {
+private:
+    static const uint32_t FRAME_BYTES = 512;     // 256 conversions per DMA frame
+    static const uint32_t BUFFER_BYTES = 4096;   // Driver ring, ~100 ms at 20 kHz
+
+    int pin;
+    uint32_t rate;
+    int channel;
+    uint8_t frame[FRAME_BYTES];
+
+public:
+    Esp32CurrentSense(int pin, uint32_t sampleRate);
+    bool begin() override;
+    size_t read(uint16_t* samples, size_t maxSamples) override;
+    uint32_t sampleRate() const override { return rate; }
+};
+
+#else
+
+// Simulated current sense for host builds: produces samples at the sample rate against
+// the virtual clock, at a set level with optional noise, or replays a recorded sequence
+class SimCurrentSense : public CurrentSense {
+private:
+    uint32_t rate;
+    uint64_t produced;     // Samples handed out since begin()
+    uint64_t startMicros;
+    uint16_t level;
+    uint16_t noise;
+    uint32_t seed;
+    const uint16_t* script;
+    size_t scriptLength;
+    size_t scriptPosition;
+
+    uint16_t next();
+
+public:
+    // The pin is accepted for symmetry with the ESP32 version and otherwise ignored
+    SimCurrentSense(int pin, uint32_t sampleRate);
+    bool begin() override;
+    size_t read(uint16_t* samples, size_t maxSamples) override;
+    uint32_t sampleRate() const override { return rate; }
+
+    // Constant raw level, plus uniform noise of +-noise counts
+    void setLevel(uint16_t raw, uint16_t noise = 0);
+    // Replay recorded samples (not copied), then hold the last one
+    void play(const uint16_t* samples, size_t count);
+};
+
+#endif
+
+#if defined(ARDUINO_ARCH_ESP32)
+typedef Esp32CurrentSense PlatformCurrentSense;
+#else
+typedef SimCurrentSense PlatformCurrentSense;
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+#include <stdint.h>
+#include "StepHal.h"
+
+// Quadrature encoder on the motor shaft of the first axis. Counts up when the shaft turns
+// clockwise (the direction MotorController drives with DIR low), four counts per line.
+// count() is a free-running 32-bit position; it is read from the motion task only.
+class PositionEncoder {
+private:
+    long counts;  // Per revolution
+
+public:
+    explicit PositionEncoder(long countsPerRevolution) : counts(countsPerRevolution) {}
+    virtual ~PositionEncoder() {}
+    long countsPerRevolution() const { return counts; }
+    // stepsPerRevolution is only used by the simulated encoder, which derives its counts
+    // from the step output
+    virtual void begin(long stepsPerRevolution) = 0;
+    virtual long count() = 0;
+};
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+#include <driver/pcnt.h>
+
+// PCNT unit 0 decoding A/B in 4x mode. The hardware counter is 16 bits; it is cleared at
+// +-LIMIT and the limit interrupt carries the overflow into a 32-bit total.
+class Esp32Encoder : public PositionEncoder {
+private:
+    static const int16_t LIMIT = 16384;
+    static const pcnt_unit_t UNIT = PCNT_UNIT_0;
+
+    int pinA;
+    int pinB;
+    volatile long overflow;
+
+    static void IRAM_ATTR onLimit(void* encoder);
+
+public:
+    Esp32Encoder(int pinA, int pinB, long countsPerRevolution);
+    void begin(long stepsPerRevolution) override;
+    long count() override;
+};
+
+#else
+
+// Simulated encoder for host builds: follows the net steps of the running SimStepHal,
+// scaled to encoder counts. Tests make the shaft lose steps to exercise stall detection.
+class SimEncoder : public PositionEncoder {
+private:
+    long stepsPerRevolution;
+    long lostSteps;    // Commanded steps the shaft never made
+    bool stalled;
+    long stalledAt;    // Shaft position in steps while stalled
+
+    long shaftSteps() const;
+
+public:
+    // Pins are accepted for symmetry with the ESP32 encoder and otherwise ignored
+    SimEncoder(int pinA, int pinB, long countsPerRevolution);
+    void begin(long stepsPerRevolution) override;
+    long count() override;
+
+    // Drop steps once, as a motor skipping teeth under a load spike would
+    void slip(long steps);
+    // While stalled the shaft ignores step pulses altogether
+    void setStalled(bool stall);
+    bool isStalled() const { return stalled; }
+};
+
+#endif
+
+#if defined(ARDUINO_ARCH_ESP32)
+typedef Esp32Encoder PlatformEncoder;
+#else
+typedef SimEncoder PlatformEncoder;
+#endif
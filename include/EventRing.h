@@ -0,0 +1,57 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include "StepHal.h"
+
+// Lock-free single-producer / single-consumer ring of fixed-size records.
+//
+// The producer (the step ISR) only ever writes head and the consumer (loop()) only
+// writes tail, so neither side locks, disables interrupts or waits. When the ring is
+// full the producer drops the new record and counts it instead of blocking; the
+// consumer can tell from overflows() that records were lost. Records that must never be
+// lost can be protected by pushing the others with a reserve of free slots.
+template <typename T, uint32_t SIZE>
+class EventRing {
+    static_assert((SIZE & (SIZE - 1)) == 0, "EventRing size must be a power of two");
+
+private:
+    T records[SIZE];
+    std::atomic<uint32_t> head;  // Next slot to write, free-running
+    std::atomic<uint32_t> tail;  // Next slot to read, free-running
+    std::atomic<uint32_t> overflowCount;
+
+public:
+    EventRing() : head(0), tail(0), overflowCount(0) {}
+
+    // Producer side; fails (and counts an overflow) unless reserve slots stay free after it
+    bool STEP_ISR_ATTR push(const T& record, uint32_t reserve = 0) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) + reserve >= SIZE) {
+            overflowCount.store(overflowCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        records[h & (SIZE - 1)] = record;
+        head.store(h + 1, std::memory_order_release);  // Publish the record
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T& record) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        record = records[t & (SIZE - 1)];
+        tail.store(t + 1, std::memory_order_release);  // Hand the slot back
+        return true;
+    }
+
+    // Drop everything queued so far (consumer side)
+    void clear() { tail.store(head.load(std::memory_order_acquire), std::memory_order_release); }
+
+    uint32_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+    uint32_t overflows() const { return overflowCount.load(std::memory_order_relaxed); }
+    static constexpr uint32_t capacity() { return SIZE; }
+};
@@ -0,0 +1,115 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Binary framing, enabled per connection with "HELLO BIN":
+//
+//   0xA5 | length | type | payload[length] | crc16 (little endian)
+//
+// The CRC is CRC-16/CCITT-FALSE over length, type and payload. Commands travel as
+// COMMAND frames carrying the usual text command line, so every command in
+// qt_signal.txt works unchanged; telemetry uses fixed-size binary payloads.
+// Multi-byte fields are little endian. Plain C++ so the host side can link it directly.
+namespace Frame {
+
+const uint8_t SYNC = 0xA5;
+const uint8_t MAX_PAYLOAD = 64;
+const size_t OVERHEAD = 5;  // sync + length + type + crc16
+const size_t MAX_FRAME = MAX_PAYLOAD + OVERHEAD;
+
+enum Type : uint8_t {
+    // Host -> ESP32
+    COMMAND = 0x01,   // Text command line without newline
+
+    // ESP32 -> host
+    RESPONSE = 0x81,  // Text response (READY, PAUSED, RESUMED, CLOSED, ...)
+    LOG = 0x82,       // Free-form log line
+    TURN = 0x83,      // uint32 completed rotations
+    LOAD = 0x84,      // uint16 load in 0.1 % of rated driver current
+    DONE = 0x85,      // No payload
+    STATUS = 0x86,    // StatusRecord
+    SEGDONE = 0x87,   // uint16 segment id, uint8 free queue slots
+    FOLLOW = 0x88,    // int32 largest following error over the last second, steps
+    STALL = 0x89,     // int32 following error that tripped stall detection, steps
+    STREAM = 0x8A     // Telemetry batch, see Telemetry.h
+};
+
+// STATUS payload
+enum State : uint8_t {
+    STATE_IDLE = 0,
+    STATE_ROTATING = 1,
+    STATE_TIME_MODE = 2,
+    STATE_PAUSED = 3,
+    STATE_DONE = 4,
+    STATE_STOPPED = 5,
+    STATE_STALLED = 6
+};
+
+struct StatusRecord {
+    uint8_t state;
+    uint16_t rpm;
+    uint32_t completedRotations;
+    uint32_t targetRotations;   // 0 in time mode
+    uint32_t elapsedMillis;
+    int16_t followingError;     // Steps, saturated
+    uint16_t loadTenths;        // 0.1 % of rated driver current
+};
+
+const uint8_t STATUS_SIZE = 19;
+
+// Request tags (see SerialManager.h). In a session opened with "HELLO BIN TAG" every frame
+// but LOG and STREAM ends with a uint16 trailer: the tag of the request it answers (0 for
+// none), with TAG_FINAL set on that request's last frame
+const uint16_t TAG_FINAL = 0x8000;
+const uint8_t TAG_SIZE = 2;
+
+uint16_t crc16(const uint8_t* data, size_t length, uint16_t crc = 0xFFFF);
+
+// Returns the encoded size (length + OVERHEAD), 0 if the payload is too long
+size_t encode(uint8_t type, const uint8_t* payload, uint8_t length, uint8_t* out);
+
+void put16(uint8_t* out, uint16_t value);
+void put32(uint8_t* out, uint32_t value);
+uint16_t get16(const uint8_t* in);
+uint32_t get32(const uint8_t* in);
+
+void encodeStatus(const StatusRecord& status, uint8_t* out);
+void decodeStatus(const uint8_t* in, StatusRecord& status);
+
+}  // namespace Frame
+
+// Incremental, non-blocking frame parser: feed bytes as they arrive.
+// Bytes before a sync byte and frames with a bad CRC are dropped and counted.
+class FrameDecoder {
+private:
+    enum ParseState : uint8_t {
+        WAIT_SYNC,
+        READ_LENGTH,
+        READ_TYPE,
+        READ_PAYLOAD,
+        READ_CRC_LOW,
+        READ_CRC_HIGH
+    };
+
+    ParseState state;
+    uint8_t frameType;
+    uint8_t frameLength;
+    uint8_t received;
+    uint16_t crc;
+    uint8_t crcLow;
+    uint8_t buffer[Frame::MAX_PAYLOAD];
+    unsigned long crcErrorCount;
+    unsigned long droppedByteCount;
+
+public:
+    FrameDecoder();
+    void reset();
+    // Returns true when byte completes a valid frame
+    bool push(uint8_t byte);
+
+    uint8_t type() const { return frameType; }
+    uint8_t length() const { return frameLength; }
+    const uint8_t* payload() const { return buffer; }
+    unsigned long crcErrors() const { return crcErrorCount; }
+    unsigned long droppedBytes() const { return droppedByteCount; }
+};
@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+
+// Heap use and fragmentation for HEAP, and a count of every allocation since boot (or the
+// last reset), so output paths that still allocate show up as a rising count.
+//
+// On the ESP32 the allocator is wrapped at link time (-Wl,--wrap=malloc,calloc,realloc
+// in platformio.ini), which catches String, operator new and library allocations alike;
+// the figures come from heap_caps_get_info() over the 8-bit capable heap. On the host
+// operator new is replaced instead, and the byte figures read 0.
+namespace Heap {
+
+struct Stats {
+    uint32_t freeBytes;
+    uint32_t minimumFreeBytes;  // Low-water mark since boot
+    uint32_t largestFreeBlock;
+    uint32_t usedBlocks;        // Allocations currently held
+    uint32_t allocations;       // Since boot or resetAllocations()
+};
+
+void read(Stats& stats);
+uint32_t allocations();
+void resetAllocations();
+// Share of the free heap outside the largest free block, in percent: how much of it a
+// single allocation could not use
+uint8_t fragmentation(const Stats& stats);
+
+}  // namespace Heap
@@ -0,0 +1,97 @@
+#pragma once
+#include <stdint.h>
+#include "StepHal.h"
+
+// Fixed-bucket histogram of microsecond latencies, cheap enough to record from the step ISR.
+//
+// Values below 16 get a bucket each; above that every power of two is split into eight
+// buckets (so at most 12.5 % wide), up to 65535 us. Anything larger lands in the last bucket
+// and is still reflected exactly in maximum(). Percentiles report the upper edge of the
+// bucket they fall in, capped at the maximum, so they never understate.
+//
+// A single writer records; readers on other tasks may see a sample half-counted, which
+// only matters for statistics. reset() from another task can likewise lose a sample or two.
+class Histogram {
+public:
+    static const uint8_t BUCKETS = 112;
+
+private:
+    static const uint8_t LINEAR = 16;   // Exact buckets for 0..15
+    static const uint8_t SUB_BITS = 3;  // Eight buckets per power of two above that
+
+    volatile uint32_t counts[BUCKETS];
+    volatile uint32_t total;
+    volatile uint32_t largest;
+
+    static uint8_t STEP_ISR_ATTR bucketOf(uint32_t value) {
+        if (value < LINEAR) {
+            return (uint8_t)value;
+        }
+        uint32_t octave = 31 - __builtin_clz(value);  // >= 4
+        uint32_t sub = (value >> (octave - SUB_BITS)) & ((1 << SUB_BITS) - 1);
+        uint32_t bucket = LINEAR + ((octave - 4) << SUB_BITS) + sub;
+        return bucket < BUCKETS ? (uint8_t)bucket : BUCKETS - 1;
+    }
+
+public:
+    Histogram() { reset(); }
+
+    void STEP_ISR_ATTR record(uint32_t value) {
+        uint8_t bucket = bucketOf(value);
+        counts[bucket] = counts[bucket] + 1;
+        total = total + 1;
+        if (value > largest) {
+            largest = value;
+        }
+    }
+
+    void reset() {
+        for (uint8_t i = 0; i < BUCKETS; i++) {
+            counts[i] = 0;
+        }
+        total = 0;
+        largest = 0;
+    }
+
+    uint32_t count() const { return total; }
+    uint32_t maximum() const { return largest; }
+    uint32_t bucketCount(uint8_t bucket) const { return counts[bucket]; }
+
+    // Smallest and largest value counted in a bucket
+    static uint32_t bucketLow(uint8_t bucket) {
+        if (bucket < LINEAR) {
+            return bucket;
+        }
+        uint32_t octave = 4 + ((bucket - LINEAR) >> SUB_BITS);
+        uint32_t sub = (bucket - LINEAR) & ((1 << SUB_BITS) - 1);
+        return ((1u << SUB_BITS) + sub) << (octave - SUB_BITS);
+    }
+    static uint32_t bucketHigh(uint8_t bucket) {
+        if (bucket == BUCKETS - 1) {
+            return UINT32_MAX;
+        }
+        return bucketLow(bucket + 1) - 1;
+    }
+
+    // Value at or below which perMille / 1000 of the samples fall; 0 when empty
+    uint32_t percentile(uint16_t perMille) const {
+        uint32_t samples = total;
+        if (samples == 0) {
+            return 0;
+        }
+
+        uint64_t rank = ((uint64_t)samples * perMille + 999) / 1000;
+        if (rank == 0) {
+            rank = 1;
+        }
+        uint64_t seen = 0;
+        for (uint8_t i = 0; i < BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                uint32_t high = bucketHigh(i);
+                return high < largest ? high : largest;
+            }
+        }
+        return largest;
+    }
+};
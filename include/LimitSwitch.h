@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include "StepHal.h"
+
+// Home switch at the CCW end of the first axis. triggered() is read from the step ISR
+// before every step while homing, so it has to be cheap and interrupt safe.
+class LimitSwitch {
+public:
+    virtual ~LimitSwitch() {}
+    virtual void begin() = 0;
+    virtual bool STEP_ISR_ATTR triggered() = 0;
+};
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+// Switch to ground on an input with an external pull-up: closed reads LOW
+class Esp32LimitSwitch : public LimitSwitch {
+private:
+    int pin;
+
+public:
+    explicit Esp32LimitSwitch(int pin);
+    void begin() override;
+    bool IRAM_ATTR triggered() override;
+};
+
+#else
+
+// Simulated switch for host builds: closed while the net steps of the running SimStepHal
+// are at or below the position it was placed at, as a switch the carriage runs onto
+// when travelling CCW. Not placed, it never closes.
+class SimLimitSwitch : public LimitSwitch {
+private:
+    bool placed;
+    long closesAt;  // Net steps of the simulated shaft
+
+public:
+    // The pin is accepted for symmetry with the ESP32 switch and otherwise ignored
+    explicit SimLimitSwitch(int pin);
+    void begin() override {}
+    bool triggered() override;
+
+    void place(long netSteps) { closesAt = netSteps; placed = true; }
+    void remove() { placed = false; }
+};
+
+#endif
+
+#if defined(ARDUINO_ARCH_ESP32)
+typedef Esp32LimitSwitch PlatformLimitSwitch;
+#else
+typedef SimLimitSwitch PlatformLimitSwitch;
+#endif
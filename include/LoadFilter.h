@@ -0,0 +1,48 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Fixed-point filter turning raw current-sense ADC samples into a load figure.
+//
+// Two stages: a boxcar average over `decimation` samples (which also decimates, e.g.
+// 20 kHz / 64 = 312.5 Hz), then a single-pole IIR y += (x - y) >> smoothingShift on the
+// decimated stream. The IIR state is the raw ADC level in Q16, so 12-bit input leaves
+// plenty of headroom in 32 bits. Load is the filtered level between the zero and full
+// calibration points in tenths of a percent (above 1000 when over the rated current).
+// Plain C++, no Arduino: the host benchmark feeds it recorded sample files.
+class LoadFilter {
+public:
+    struct Config {
+        uint16_t decimation;    // Samples per boxcar block, 1..4096
+        uint8_t smoothingShift; // IIR time constant = 2^shift decimated outputs
+        uint16_t zeroLevel;     // Raw ADC reading at no current
+        uint16_t fullLevel;     // Raw ADC reading at rated current (100 %)
+    };
+
+private:
+    Config config;
+    uint32_t blockSum;
+    uint16_t blockCount;
+    uint64_t reciprocal;   // 2^32 / decimation, rounded up, for the block average
+    int32_t level;         // Q16 raw
+    bool primed;           // First block seeds the IIR instead of ramping up from zero
+    uint32_t outputs;
+
+public:
+    LoadFilter();
+    void configure(const Config& config);
+    const Config& getConfig() const { return config; }
+    void reset();
+    // Change only the calibration points; safe while another task pushes, at worst one
+    // output mixes the old and new levels
+    void setCalibration(uint16_t zeroLevel, uint16_t fullLevel);
+
+    // Feed raw samples (only the low 12 bits are used); returns how many decimated
+    // outputs they completed
+    size_t push(const uint16_t* samples, size_t count);
+
+    uint32_t levelQ16() const { return (uint32_t)level; }
+    // Load in 0.1 % of rated current, 0 below the zero level
+    uint16_t loadTenths() const;
+    uint32_t outputCount() const { return outputs; }
+};
@@ -0,0 +1,139 @@
+#pragma once
+#include <stdint.h>
+#include "StepHal.h"
+
+// Acceleration profile applied to every move
+enum class RampProfile : uint8_t {
+    NONE,         // Jump straight to cruise speed (original behaviour)
+    TRAPEZOIDAL,  // Constant acceleration
+    SCURVE        // Jerk-limited acceleration
+};
+
+struct RampConfig {
+    RampProfile profile;
+    uint32_t accel;      // steps/s^2
+    uint32_t jerk;       // steps/s^3 (S-curve only)
+    uint32_t startRate;  // steps/s, speed of the first and last step
+};
+
+// Per-step interval generator for accelerate / cruise / decelerate moves.
+//
+// Runs incrementally from the step ISR with fixed-point math only: one 64/32 division
+// per step, everything else multiplies and shifts. Units are chosen so each derivative
+// shifts by 16 more bits than the previous one:
+//   velocity      steps/us   Q32
+//   acceleration  steps/us^2 Q48
+//   jerk          steps/us^3 Q64
+//   interval      us         Q8 while ramping, Q32 at cruise
+// Whole microseconds are emitted and the fraction is carried in Q32, so the cruise rate is
+// exact to 2^-32 us per step and the long-run average never drifts from the requested
+// speed. Plan-time setup (plan(), requestDecel()) may use floating point; nextInterval()
+// never does.
+//
+// planTable() replays a precomputed ramp (see SpeedTable.h) instead: accel reads the table
+// forwards, decel backwards, so the step path is a single lookup.
+//
+// retarget() changes the cruise speed of a running move. The new targets are worked out
+// in the caller's context and handed over whole; the ISR takes them on its next step, so
+// it never sees half of them. A table move carries on integrating from its last interval.
+class MotionPlanner {
+private:
+    enum Phase : uint8_t {
+        PHASE_ACCEL,
+        PHASE_CRUISE,
+        PHASE_DECEL,
+        PHASE_DONE
+    };
+
+    RampConfig config;
+
+    int64_t startVelocity;   // Q32, speed the motor starts and stops at
+    int64_t cruiseVelocity;  // Q32
+    int64_t exitVelocity;    // Q32, speed at the last step (start speed unless blending)
+    int64_t maxAccel;        // Q48
+    int64_t jerk;            // Q64
+
+    // Shared with the step ISR
+    volatile int64_t velocity;
+    volatile int64_t accel;
+    volatile Phase phase;
+    volatile long stepIndex;
+    volatile long totalSteps;   // 0 = open-ended until requestDecel()
+    volatile long decelStart;
+    uint64_t cruiseInterval;    // Q32 us
+    uint32_t intervalFraction;  // Q32 remainder carried between emitted intervals
+    volatile uint32_t lastInterval;  // Q8 us before rounding, for speed telemetry
+
+    // Table mode
+    const uint16_t* rampTable;  // Q4 us, nullptr when integrating
+    uint16_t rampTableLength;
+    uint32_t tableRampMicros;
+
+    // Retarget handed to the ISR, taken on its next step
+    volatile bool retargetPending;
+    int64_t pendingCruiseVelocity;
+    int64_t pendingExitVelocity;
+    uint64_t pendingCruiseInterval;
+    long pendingDecelStart;
+    long pendingTotalSteps;
+
+    // Decel handed to the ISR the same way; it replaces any pending retarget
+    volatile bool decelPending;
+    long pendingStopSteps;     // From the step the ISR takes it on, last one included
+
+    uint32_t intervalFromVelocity(int64_t v) const;
+    float rampTime(float fromRate, float toRate) const;
+    float rampDistance(float fromRate, float toRate) const;
+    float reachableRate(float fromRate, float limitRate, float steps) const;
+    float cruiseRate() const;
+    float currentRate() const;
+    uint32_t STEP_ISR_ATTR integrate(int64_t target, bool up);
+    void STEP_ISR_ATTR applyRetarget();
+    void STEP_ISR_ATTR applyDecel();
+
+public:
+    MotionPlanner();
+    void setConfig(const RampConfig& config);
+    const RampConfig& getConfig() const { return config; }
+
+    // Plan a move cruising at cruiseIntervalQ32 (us/step, Q32); totalSteps = 0 runs until
+    // requestDecel()
+    void plan(uint64_t cruiseIntervalQ32, long totalSteps);
+    // Plan one segment of a blended sequence: enter at entryInterval and leave at
+    // exitInterval us/step instead of the start speed (0 = start / stop at rest)
+    void plan(uint64_t cruiseIntervalQ32, long totalSteps, uint32_t entryInterval, uint32_t exitInterval);
+    // Plan a move that replays a precomputed Q4 ramp and cruises at cruiseInterval us/step
+    void planTable(const uint16_t* ramp, uint16_t rampSteps, uint32_t cruiseInterval, long totalSteps);
+    // Interval before the next step in microseconds, 0 once the move is complete
+    uint32_t STEP_ISR_ATTR nextInterval();
+    // Ramp down from the current speed to rest and finish there, sooner than planned:
+    // open-ended moves, pause and stop. The ISR takes it on its next step; a segment
+    // planned to leave at speed stops instead
+    void requestDecel();
+    // Steps requestDecel() would take from here, the last one included
+    long stoppingSteps() const;
+    // Cruise at cruiseIntervalQ32 from now on, ramping from the current speed at the
+    // configured acceleration. The move still ends on its step count, or on totalSteps
+    // when that is > 0; short of room the new speed is lowered so the decel still fits.
+    // false once the move is decelerating, done, or about to start its decel or
+    // requestDecel() is pending
+    bool retarget(uint64_t cruiseIntervalQ32, long totalSteps = 0);
+    // Steps the running move makes in the given time when retargeted to cruiseIntervalQ32:
+    // the change of speed, the cruise and the final decel, for timed moves
+    long retargetSteps(uint64_t cruiseIntervalQ32, uint64_t micros) const;
+
+    long decelSteps() const;
+    // Speed (us/step) the planned move leaves at, for chaining the next segment
+    uint32_t exitInterval() const;
+    // Fastest speed (us/step) a move of the given length can start at and still stop
+    uint32_t stoppingInterval(long steps) const;
+    uint32_t decelTimeMillis() const;
+    // Steps the planned move (ramps included) takes to run for the given time, so timed
+    // moves can end on a step count instead of a clock check
+    uint64_t stepsForDuration(uint64_t micros) const;
+    bool isDecelerating() const { return phase == PHASE_DECEL || phase == PHASE_DONE; }
+    long stepsIssued() const { return stepIndex; }
+    long plannedSteps() const { return totalSteps; }
+    // Exact interval of the last step, Q8 us (the emitted ones are rounded to whole us)
+    uint32_t lastIntervalQ8() const { return lastInterval; }
+};
@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+
+// One queued move: cruise speed, length and direction
+struct MotionSegment {
+    uint16_t id;           // Acknowledged back to the host as QUEUED:/SEGDONE:
+    int rpm;               // Requested RPM, for status only
+    int speedLevel;        // 0 = plain RPM
+    uint64_t interval;     // Cruise us/step, Q32
+    long steps;
+    uint8_t axis;
+    bool clockwise;
+};
+
+// Bounded FIFO of motion segments waiting behind the running move.
+// Only touched from loop(); the step ISR sees segments once they are planned.
+class MotionQueue {
+private:
+    static const uint8_t CAPACITY = 16;
+
+    MotionSegment segments[CAPACITY];
+    uint8_t head;   // Oldest segment
+    uint8_t count;
+
+public:
+    MotionQueue();
+    bool push(const MotionSegment& segment);  // false when full
+    bool pop(MotionSegment& segment);
+    const MotionSegment* peek() const;
+    void clear() { head = 0; count = 0; }
+    uint8_t size() const { return count; }
+    uint8_t space() const { return CAPACITY - count; }
+    bool isEmpty() const { return count == 0; }
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "CommandParser.h"
+
+// Motion scripts: a sequence of moves, dwells, loops, speed changes and input waits that
+// the station runs on its own (RUN) instead of the host sending each move and waiting
+// for DONE.
+//
+// The source is one statement per line in the words and KEY:value pairs of the serial
+// commands, so the device compiles each line from the ParsedCommand it arrives as:
+//   RPM:{rpm}|SPEED:{level} ROT:{rotations} [DIR:{CW|CCW}] [NOWAIT]
+//   RPM:{rpm}|SPEED:{level} TIME:{seconds} [DIR:{CW|CCW}] [NOWAIT]
+//   MOVE:{target} [REL] [DEG] [RPM:{rpm}|SPEED:{level}] [NOWAIT]
+//   SET RPM:{rpm} | SET SPEED:{level}   speed of the running (NOWAIT) move
+//   DWELL:{ms}
+//   LOOP[:{count}] ... NEXT              no count repeats until ABORT
+//   WAIT                                 until the running move is done
+//   WAIT PIN:{gpio} {HIGH|LOW} [TIMEOUT:{ms}]   gpio 34..39, the input-only pins
+//   HOME
+// A move waits for the move before it; NOWAIT lets the script go on while it runs. The
+// script is over once its last move is.
+// Scripts drive axis X. The word PROG, which prefixes every uploaded line, is ignored.
+//
+// Each statement compiles to one instruction, so instruction n is line n:
+//   uint8 op | operands (little endian, see Op)
+// and the image stored and run is
+//   "MSCR" | uint16 version | uint16 lines | uint16 code bytes | code | crc16
+// with CRC-16/CCITT-FALSE over everything before it. Plain C++, so the host compiles with
+// the same code.
+namespace Script {
+
+const uint16_t VERSION = 1;
+const size_t HEADER_SIZE = 10;
+const size_t MAX_CODE = 1024;
+const size_t MAX_IMAGE = HEADER_SIZE + MAX_CODE + 2;
+const uint8_t MAX_DEPTH = 4;  // Nested loops
+
+enum Op : uint8_t {
+    END,        // Implicit after the last line
+    ROTATE,     // flags, uint16 speed, uint16 rotations
+    TIMED,      // flags, uint16 speed, uint16 seconds
+    MOVE,       // flags, uint16 speed (0 = MOVE's default), int32 steps or millidegrees
+    SET,        // flags, uint16 speed
+    DWELL,      // uint32 ms
+    LOOP,       // uint16 count, 0 = forever
+    NEXT,       // uint16 code offset of the loop body
+    WAIT_MOVE,
+    WAIT_PIN,   // flags, uint8 pin, uint32 timeout ms (0 = none)
+    HOME
+};
+
+enum Flag : uint8_t {
+    CCW = 0x01,
+    LEVEL = 0x02,     // speed is a speed level, else RPM
+    NOWAIT = 0x04,
+    RELATIVE = 0x08,
+    DEGREES = 0x10,   // MOVE target in millidegrees
+    HIGH_LEVEL = 0x20
+};
+
+struct Instruction {
+    uint8_t op;
+    uint8_t flags;
+    uint16_t speed;
+    uint8_t pin;
+    int32_t value;  // Rotations, seconds, target, ms, count or body offset
+    uint8_t size;   // Code bytes
+};
+
+// The instruction at offset; false if it is cut short or not an instruction
+bool decode(const uint8_t* code, size_t length, size_t offset, Instruction& instruction);
+// Checks an image end to end (header, CRC, every instruction and jump); the code and line
+// count on success
+bool validate(const uint8_t* image, size_t length, const uint8_t*& code, size_t& codeLength, uint16_t& lines);
+// Assembly-like text of an instruction for listings
+void describe(const Instruction& instruction, char* text, size_t size);
+
+}  // namespace Script
+
+// Compiles a script line by line into an image. Errors are short reasons for the
+// PROG_ERROR reply, naming the line they are on.
+class ScriptCompiler {
+private:
+    uint8_t image[Script::MAX_IMAGE];
+    size_t used;         // Code bytes
+    uint16_t lines;
+    uint16_t loops[Script::MAX_DEPTH];  // Body offsets of the open loops
+    uint16_t loopLines[Script::MAX_DEPTH];
+    uint8_t depth;
+    const char* failure;
+    uint16_t failedLine;
+    char reason[24];     // A failure that names a key
+
+    const char* compile(const ParsedCommand& statement);
+    const char* speedOf(const ParsedCommand& statement, bool required, uint8_t* code);
+    const char* flagsOf(const ParsedCommand& statement, uint8_t* code);
+    const char* fail(const char* format, const char* detail);
+    bool emit(const uint8_t* bytes, size_t length);
+
+public:
+    ScriptCompiler();
+    void begin();
+    // nullptr once the line is compiled, else why not; the script is then failed and
+    // takes no more lines
+    const char* add(const ParsedCommand& statement);
+    // Closes the script; nullptr with the image ready, else why not
+    const char* finish();
+    uint16_t lineCount() const { return lines; }
+    const char* error() const { return failure; }  // nullptr unless failed
+    uint16_t errorLine() const { return failedLine; }  // The line a failure is about
+    const uint8_t* data() const { return image; }
+    size_t size() const { return Script::HEADER_SIZE + used + 2; }
+};
@@ -1,36 +1,169 @@
 #pragma once
 #include <Arduino.h>
+#include "StepHal.h"
+#include "StepEngine.h"
+#include "MotionPlanner.h"
+#include "MotionQueue.h"
+#include "Encoder.h"
+#include "LimitSwitch.h"
+#include "PositionMonitor.h"
+#include "CurrentSense.h"
+#include "LoadFilter.h"
+#include "Telemetry.h"
+#include "TraceLog.h"
+#include "SpeedTable.h"
+#include "SpeedLevels.h"
+#include "ConfigStore.h"
+#include "FrameCodec.h"
+#include "TextWriter.h"
+#include "MotorProfile.h"
 
-// Test Mode Configuration - Comment out this line when motor is connected
-// #define TEST_MODE
+class SerialManager;
 
-class MotorController {
+// What happens when the following error exceeds the stall limit
+enum class StallPolicy : uint8_t {
+    OFF,    // Report the following error only
+    STOP,   // Stop the move and disable the drivers
+    RETRY   // Pause, then run the rest of the move again from the measured position
+};
+
+// Outcome of a move request: rotation, timed, LINE or MOVE
+enum class MoveResult : uint8_t {
+    STARTED,   // Running, or already at the target (DONE sent)
+    BUSY,      // Another move is running
+    LIMIT,     // Target outside the axis' soft limits
+    INVALID    // Bad speed level, count, duration or target out of range
+};
+
+// The reply word for a refused move (MOVE_BUSY, MOVE_LIMIT, MOVE_INVALID); nullptr if started
+inline const char* moveRefusal(MoveResult result) {
+    switch (result) {
+        case MoveResult::STARTED: return nullptr;
+        case MoveResult::BUSY:    return "MOVE_BUSY";
+        case MoveResult::LIMIT:   return "MOVE_LIMIT";
+        default:                  return "MOVE_INVALID";
+    }
+}
+
+// Outcome of a live speed change (SET RPM: / SET SPEED:)
+enum class SpeedChange : uint8_t {
+    APPLIED,   // Ramping to the new speed
+    IDLE,      // No move running
+    BUSY,      // Queued motion, homing, a pending stall retry, or already stopping
+    INVALID    // Bad speed level
+};
+
+// Steps of the homing routine on axis 0
+enum class HomingPhase : uint8_t {
+    NONE,
+    CLEAR,    // Started on the switch: move CW off it first
+    SEEK,     // CCW at HOME_SEEK_RPM until the switch closes
+    BACKOFF,  // CW until it has opened again
+    LATCH     // CCW at HOME_LATCH_RPM; the closing edge is position 0
+};
+
+// Ramp down of a running move by pause() or stop()
+enum class HaltPhase : uint8_t {
+    NONE,
+    PAUSING,   // Ramping down; the rest of the move runs again on resume()
+    PAUSED,    // At rest, waiting for resume()
+    RESUMING,  // resume() came while still ramping down: restart once at rest
+    STOPPING   // Ramping down; the drivers are disabled once at rest
+};
+
+// What the controller is doing, or how its last move ended (STATUS, LEDs)
+enum class MotorState : uint8_t {
+    IDLE,
+    READY,        // begin() has run (TEST_MODE_READY with SimulatedDriver)
+    ROTATING,     // Rotation, position, LINE or queued move
+    TIME_MODE,
+    PAUSED,
+    STOPPING,     // stop() is ramping down
+    DONE,
+    STOPPED,
+    LIMIT,        // Queued motion crossed a soft limit
+    STALLED,
+    HOMING,
+    HOMED,
+    HOME_FAILED
+};
+
+// Allowed position range of one axis, in steps
+struct SoftLimits {
+    bool enabled;
+    long min;
+    long max;
+};
+
+// Pins and drive train of one stepper axis
+struct AxisConfig {
+    int stepPin;
+    int dirPin;
+    int enablePin;
+    int stepsPerRevolution;  // Full steps per revolution
+    int microsteps;          // Driver microstep setting
+};
+
+// The station's motion controller, built for a driver policy and a motor profile
+// (MotorProfile.h). MotorController below is the one the firmware runs; the definitions are
+// in MotorController.cpp, which instantiates the combinations in use.
+template <class Driver, class Motor>
+class BasicMotorController {
 private:
-    // TB6600 Driver Pins - Updated to match actual connections
-    static const int ENABLE_PIN = 18;  // GPIO18 - TB6600 ENA+
-    static const int DIR_PIN = 17;     // GPIO17 - TB6600 DIR+
-    static const int STEP_PIN = 16;    // GPIO16 - TB6600 PUL+
-    
-    // Motor Parameters - Optimized for Nema23 5756 + TB6600
-    static const int STEPS_PER_REVOLUTION = 200;  // Nema23 standard (1.8° per step)
-    static const int MICROSTEPS = 16;  // TB6600 optimal setting for smooth operation
-    static const int TOTAL_STEPS_PER_REV = STEPS_PER_REVOLUTION * MICROSTEPS;  // 3200 steps/rev
-    
-    // Speed limits for Nema23 5756 + TB6600 (based on torque curve)
-    static const int MIN_RPM = 1;      // Minimum practical RPM
-    static const int MAX_RPM = 1000;   // Maximum safe RPM for this setup
-    static const int OPTIMAL_RPM_LOW = 50;   // Optimal low-speed range start
-    static const int OPTIMAL_RPM_HIGH = 300; // Optimal high-speed range end
-    
-    // Speed level definitions (20 levels)
-    static const int SPEED_LEVELS = 20;
-    static const int SPEED_DELAY_TABLE[SPEED_LEVELS];
+    // Compiled-in defaults below and in the motor profile; the configuration store (CONFIG)
+    // overrides the pins, drive train, RPM limits, load calibration and speed level delays
+    // of axis 0
+    
+    // Driver Pins - Updated to match actual connections (default axis)
+    static const int ENABLE_PIN = 18;  // GPIO18 - ENA+
+    static const int DIR_PIN = 17;     // GPIO17 - DIR+
+    static const int STEP_PIN = 16;    // GPIO16 - PUL+
+    
+    // Quadrature encoder on the X motor shaft (GPIO34/35 are input-only, pull-ups external)
+    static const int ENCODER_A_PIN = 34;
+    static const int ENCODER_B_PIN = 35;
+    static const long ENCODER_COUNTS_PER_REV = 4000;  // 1000 lines, 4x decoding
+    
+    // Home switch at the CCW end of the X axis (GPIO39 is input-only, pull-up external).
+    // The latch pass runs at the ramp start rate, so it stops dead on the switch edge
+    static const int HOME_SWITCH_PIN = 39;
+    static const int HOME_SEEK_RPM = 60;
+    static const int HOME_LATCH_RPM = 6;
+    static const int HOME_BACKOFF_FULL_STEPS = 40;
+    static const int HOME_MAX_REVOLUTIONS = 50;  // Seek travel before giving up
+    static const int MOVE_RPM = 100;             // MOVE without RPM: or SPEED:
+    
+    // Driver current sense (ADC1_CH0, DMA sampled) for the LOAD: figure. The levels are
+    // raw 12-bit readings at 11 dB attenuation; calibrate them for the sense circuit
+    static const int CURRENT_SENSE_PIN = 36;
+    static const uint32_t LOAD_SAMPLE_RATE = 20000;    // Hz
+    static const uint16_t LOAD_DECIMATION = 64;        // -> 312.5 Hz into the IIR
+    static const uint8_t LOAD_SMOOTHING_SHIFT = 4;     // IIR time constant 16 outputs, ~51 ms
+    static const uint16_t LOAD_ZERO_LEVEL = 0;
+    static const uint16_t LOAD_FULL_LEVEL = 3100;      // Rated driver current
+    
+    // Stall detection: a stepper that loses sync falls behind by whole groups of four
+    // full steps, while normal load lag stays within two
+    static const int STALL_FULL_STEPS = 8;
+    static const uint8_t STALL_RETRIES = 2;
+    static const unsigned long STALL_RETRY_DELAY = 500;  // ms at rest before retrying
+    
+    // All axes share one step timer; axis 0 owns it
+    static const uint8_t MAX_AXES = StepEngine::MAX_AXES;
+    
+    // Speed level definitions (20 levels, default delays and ramps in SpeedTable.h)
+    static const int SPEED_LEVELS = SpeedTable::LEVELS;
+    
+    // Configuration in use and what was derived from it when it was applied
+    MotorConfig settings;
+    SpeedLevels speedLevels;
+    bool started;             // begin() has run: pins are bound
     
     // Motor State
     bool isRunning;
     bool isPaused;
-    String currentStatus;
-    String pausedStatus;
+    MotorState currentState;
+    MotorState pausedState;   // What resume() goes back to
     int currentRPM;
     int targetRotations;
     int completedRotations;
@@ -38,49 +171,254 @@ private:
     unsigned long startTime;
     unsigned long pausedTime;
     unsigned long totalPausedDuration;
-    unsigned long stepInterval;
-    unsigned long lastStepTime;
+    uint64_t stepInterval;    // Cruise us/step, Q32
+    
+    // All output goes through SerialManager so it can be framed in binary mode
+    SerialManager* serial;
     long totalSteps;
     long currentSteps;
     bool isTimeMode;
     
+    // Per-axis configuration
+    AxisConfig axisConfig[MAX_AXES];
+    uint8_t axisCount;
+    uint8_t currentAxis;      // Axis for single-axis moves and queued segments
+    long revolutionSteps;     // Steps per revolution of the axis TURN counts
+    
+    // Step pulses are generated from the timer interrupt, not from update()
+    PlatformStepHal stepHal;
+    PlatformStepOutput axisOutputs[MAX_AXES - 1];
+    StepEngine stepEngine;
+    MotionPlanner planner;
     
-    // Test mode simulation
+    // Motion queue: the next segment is planned on the spare planner while the
+    // current one runs, and the step ISR switches over without stopping
+    MotionQueue motionQueue;
+    MotionPlanner segmentPlanner;
+    MotionPlanner* sparePlanner;
+    bool isQueueMode;
+    bool headCommitted;       // Last planned segment blends into the queue head
+    MotionSegment runningSegment;
+    MotionSegment stagedSegment;
+    uint16_t nextSegmentId;
+    bool stagedPending;       // Staged segment not yet taken over by the ISR
+    unsigned long segmentStartTime;
+    long stepBase;            // Steps from before the engine was last restarted
+    
+    // Closed-loop tracking of axis 0
+    PlatformEncoder encoder;
+    PositionMonitor positionMonitor;
+    StallPolicy stallPolicy;
+    long stallLimit;          // Following error that counts as a stall, steps
+    bool canRetry;            // Move can be rerun from its measured position
+    bool retryPending;        // Stalled, waiting to retry
+    uint8_t retriesLeft;
+    unsigned long stallTime;
+    int currentSpeedLevel;    // 0 = plain RPM
+    bool moveClockwise;
+    
+    // Position mode: the step engine counts each axis' position across moves; homing
+    // sets axis 0's zero at its switch
+    PlatformLimitSwitch homeSwitch;
+    HomingPhase homingPhase;
+    bool homed;
+    SoftLimits softLimits[MAX_AXES];
+    
+    // Pause and stop ramp down to rest; the move restarts from there on resume
+    HaltPhase haltPhase;
+    bool pausedAtSwitch;      // The homing switch ended the pause ramp
+    uint8_t lineAxes;         // Axes of a running line move, 0 for any other move
+    long lineTarget[MAX_AXES];  // Where a line move ends, per axis
+    
+    // Progress of a move with SimulatedDriver
     unsigned long lastSimulationUpdate;
     unsigned long simulationUpdateInterval;
     
-    // Motor load simulation
-    float simulatedLoad;  // 0.0 to 100.0%
+    // Following error report
+    unsigned long lastFollowReport;
+    static const unsigned long FOLLOW_REPORT_INTERVAL = 1000;  // Report every 1000ms (1 second)
+    
+    // Load from the current sense; sampled and filtered by the load task, published here
+    PlatformCurrentSense currentSense;
+    LoadFilter loadFilter;
+    volatile uint16_t loadTenths;
+    unsigned long loadReportInterval;  // ms, 0 = off
     unsigned long lastLoadReport;
-    static const unsigned long LOAD_REPORT_INTERVAL = 1000;  // Report every 1000ms (1 second)
+    
+    // STREAM telemetry, sampled at the end of every update()
+    TelemetryStream telemetry;
+    
+    // Motion trace of axis 0: steps from the step ISR, states from setState(). A dump goes
+    // out TRACE_LINES per update() while the outbox has room
+    static const size_t TRACE_CHUNK = 24;   // Image bytes per TRACE line, fits one frame
+    static const uint8_t TRACE_LINES = 4;
+    TraceRecorder traceRecorder;
+    bool traceDumping;
+    size_t traceOffset;       // Next image byte to send
+    size_t traceSize;
+    uint16_t traceCrc;
+    
+    uint32_t reportedOverflows;  // Step events dropped so far, as last logged
     
     // Step generation
-    void generateStep();
     void updateStepInterval(int rpm);
     void simulateProgress();
-    float calculateSimulatedLoad();
+    void reportProgress();
+    void updateMove();
+    void streamTelemetry();
+    void sendTrace();
+    void setState(MotorState state);  // Marked in the trace
+    uint8_t stateCode();  // Frame::State
+    void handleStepEvent(const StepEvent& event);
+    void resetEvents();
+    void finishMove();
+    void trackMove(bool tracked, bool clockwise, bool retry);
+    void checkStall();
+    void handleStall(long error);
+    void retryMove();
+    void rampedDown(bool atSwitch);
+    void restartMove();
+    void haltAndDisable(MotorState state);
     int validateRPM(int rpm);  // Validate and limit RPM to safe range
+    void useSpeed(int rpm, int speedLevel);  // speedLevel 0 = plain RPM
+    void planMove(int speedLevel, long steps);
+    MoveResult startRotation(int rpm, int speedLevel, int rotations, bool clockwise);
+    MoveResult startTimed(int rpm, int speedLevel, int duration, bool clockwise);
+    void startSteps(int speedLevel, long steps, bool clockwise);
+    bool withinLimits(uint8_t axis, long steps);  // Ending steps (signed) from here
+    bool checkLimits(uint8_t axis, long steps);   // Same, logging a refusal
+    void startHomingPhase(HomingPhase phase);
+    void homingStopped(bool atSwitch);
+    void homingFailed(const char* reason);
+    uint64_t intervalForRPM(int rpm, uint8_t axis);
+    long axisStepsPerRev(uint8_t axis) const;
+    void setDirection(uint8_t axis, bool clockwise);
+    void enableAxes(bool enabled);
+    bool buildSegment(int rpm, int speedLevel, bool clockwise, MotionSegment& segment);
+    uint16_t enqueue(MotionSegment& segment);
+    void startQueue();
+    void planSegment(MotionPlanner& segmentPlan, const MotionSegment& segment, uint32_t entryInterval);
+    void startSegment(const MotionSegment& segment);
+    void stageSegment();
+    void queueStopped();
+    void simulateQueue();
     
 public:
-    MotorController();
-    void begin();
-    void executeRotation(int rpm, int rotations, bool clockwise = true);
-    void executeTime(int rpm, int duration, bool clockwise = true);
-    void executeRotationWithSpeed(int speedLevel, int rotations, bool clockwise = true);
-    void executeTimeWithSpeed(int speedLevel, int duration, bool clockwise = true);
+    static constexpr AxisConfig DEFAULT_AXIS = { STEP_PIN, DIR_PIN, ENABLE_PIN, Motor::STEPS_PER_REVOLUTION,
+                                                 Motor::MICROSTEPS };
+    
+    // Default acceleration ramp (trapezoidal, matches the speed level tables)
+    static const uint32_t RAMP_ACCEL = SpeedTable::RAMP_ACCEL;
+    static const uint32_t RAMP_JERK = 160000;      // steps/s^3 (S-curve only)
+    static const uint32_t RAMP_START_RATE = SpeedTable::RAMP_START_RATE;
+    
+    BasicMotorController(const AxisConfig& axis = DEFAULT_AXIS);
+    // Add another axis on the shared step timer (before begin); returns its index or -1
+    int addAxis(const AxisConfig& axis);
+    uint8_t axes() { return axisCount; }
+    bool selectAxis(uint8_t axis);  // Axis for the following single-axis moves
+    void begin(SerialManager& serialManager);
+    MoveResult executeRotation(int rpm, int rotations, bool clockwise = true);
+    MoveResult executeTime(int rpm, int duration, bool clockwise = true);
+    MoveResult executeRotationWithSpeed(int speedLevel, int rotations, bool clockwise = true);
+    MoveResult executeTimeWithSpeed(int speedLevel, int duration, bool clockwise = true);
+    // Coordinated straight-line move: signed steps per axis (positive = CW), all axes
+    // start and finish together; rpm / speedLevel apply to the axis with the most steps
+    MoveResult executeLine(int rpm, int speedLevel, const long* steps, uint8_t count);
+    // Change the cruise speed of the running move: speedLevel 0 runs at rpm. It ramps there
+    // at the configured acceleration; rotation moves still end on their step count, timed
+    // ones at their end time
+    SpeedChange setSpeed(int rpm, int speedLevel);
+    int rpm() { return currentRPM; }
+    
+    // Position mode on the selected axis, in microsteps (positive = CW): move to target,
+    // or by target when relative. speedLevel 0 runs at rpm, or MOVE_RPM when that is 0
+    MoveResult executeMove(long target, bool relative, int rpm, int speedLevel);
+    long position() { return stepEngine.position(currentAxis); }
+    bool setPosition(long steps);  // Redefine where the selected axis is; false while running
+    long degreesToSteps(double degrees);
+    double stepsToDegrees(long steps);
+    // Find the home switch of axis 0 and make its closing edge position 0. Ends with
+    // HOMED or HOME_FAILED:{reason}; false while another move is running
+    bool home();
+    bool isHomed() { return homed; }
+    bool isHoming() { return homingPhase != HomingPhase::NONE; }
+    PlatformLimitSwitch& limitSwitch() { return homeSwitch; }
+    // Moves of a known length on the selected axis are refused if they would end outside
+    // [min, max]; queued segments are stopped when they cross it. Homing ignores them
+    bool setSoftLimits(bool enabled, long min, long max);
+    const SoftLimits& softLimit() { return softLimits[currentAxis]; }
+    
     int speedLevelToRPM(int speedLevel);
+    float speedLevelRPM(int speedLevel);
+    void setRamp(RampProfile profile, uint32_t accel, uint32_t jerk);
+    void setStallPolicy(StallPolicy policy);
+    StallPolicy getStallPolicy() { return stallPolicy; }
+    long followingError() { return positionMonitor.followingError(); }
+    
+    // Load task: filter whatever the current sense has converted since the last call;
+    // false when nothing was ready, so the caller can sleep
+    bool sampleLoad();
+    uint16_t load() { return loadTenths; }  // 0.1 % of rated current
+    void setLoadReportInterval(unsigned long ms);
+    
+    // STREAM: batched binary telemetry of the given Telemetry::Field bits at rate Hz, in
+    // place of TURN and periodic LOAD lines for the fields it covers; false unless in
+    // binary mode with a rate of 1..TelemetryStream::MAX_RATE
+    bool startStream(uint8_t fields, uint16_t rate);
+    void stopStream() { telemetry.stop(); }
+    const TelemetryStream& stream() const { return telemetry; }
+    
+    // Motion trace (TraceLog.h), recording from begin(). startTrace() drops what it holds
+    // and starts again, stopTrace() keeps it. dumpTrace() stops it and sends its image from
+    // byte from on as TRACE:{offset} {hex} lines, then TRACE END BYTES:{size} CRC:{crc16}
+    // over the whole image; false if from is past the end
+    void startTrace();
+    void stopTrace();
+    bool dumpTrace(size_t from);
+    const TraceRecorder& trace() const { return traceRecorder; }
+    bool isDumpingTrace() const { return traceDumping; }
+    
+    // Configuration: config() starts out as the compiled-in values. configure() takes a
+    // validated configuration (ConfigStore::validate) and recomputes what depends on it;
+    // false, with nothing changed, while a move is running. Pins only take effect before
+    // begin(), later changes are kept for saving and apply after a restart.
+    const MotorConfig& config() const { return settings; }
+    bool configure(const MotorConfig& config);
+    
+    // Queued moves run back-to-back after the current one; 0 = rejected or queue full
+    uint16_t enqueueRotation(int rpm, int speedLevel, int rotations, bool clockwise = true);
+    uint16_t enqueueTime(int rpm, int speedLevel, int duration, bool clockwise = true);
+    void flushQueue();
+    uint8_t queueDepth() { return motionQueue.size(); }
+    uint8_t queueSpace() { return motionQueue.space(); }
+    // stop() and pause() ramp the move down to rest at the configured acceleration; stop()
+    // then disables the drivers, resume() runs the rest of a paused move from rest, so
+    // rotations still make their exact step count and timed moves their running time.
+    // emergencyStop() halts at once (ESTOP) and disables the drivers
     void stop();
+    void emergencyStop();
     void pause();
     void resume();
     void update();  // Call this in main loop
-    String getStatus();
+    // STATUS text, written into the caller's buffer
+    void getStatus(TextWriter& out);
+    MotorState state() { return currentState; }
+    static const char* stateName(MotorState state);
+    void getStatusRecord(Frame::StatusRecord& status);
     bool isMotorRunning();
     bool isMotorPaused();
-    bool isTestMode() { 
-        #ifdef TEST_MODE
-            return true;
-        #else
-            return false;
-        #endif
-    }
-};
\ No newline at end of file
+    
+    // Instrumentation: per-step ISR lateness (see PERF) and the step timer itself,
+    // which the native benchmark reads recorded pulses from
+    Histogram& stepLateness() { return stepEngine.lateness(); }
+    PlatformStepHal& timer() { return stepHal; }
+    PlatformStepOutput& axisOutput(uint8_t axis) { return axisOutputs[axis - 1]; }  // Axes 1..; axis 0 is timer()
+    PlatformEncoder& positionEncoder() { return encoder; }
+    PlatformCurrentSense& loadSense() { return currentSense; }
+    static bool isTestMode() { return Driver::SIMULATED; }
+};
+
+// The station: a TB6600 on the Nema23 5756. With SimulatedDriver in place of Tb6600Driver it
+// runs without a motor connected
+typedef BasicMotorController<Tb6600Driver, Nema23Profile> MotorController;
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+#include <stdint.h>
+
+// Compile-time descriptions of what a BasicMotorController (MotorController.h) drives: a
+// driver policy for the step/dir driver and a profile of the motor, both plain structs of
+// constants. The driver policy's branches (simulated or not, enable polarity, settle
+// delays) fold away in each instantiation. The motor profile only supplies the defaults
+// of values CONFIG overrides at runtime, so it folds nothing. Another driver or motor is
+// a struct like these and an instantiation at the end of MotorController.cpp.
+
+// Driver policies
+
+// TB6600 (opto-isolated inputs, ENA+ high disables)
+struct Tb6600Driver {
+    static const bool SIMULATED = false;
+    static const bool ENABLE_ACTIVE_LOW = true;
+    static const uint16_t POWER_UP_MS = 100;      // After begin() sets the pins
+    static const uint16_t ENABLE_SETTLE_MS = 10;  // After enabling, before the first step
+    static const uint16_t DISABLE_SETTLE_MS = 5;
+    static const char* name() { return "TB6600"; }
+};
+
+// DRV8825 carrier (nENBL low enables, nSLEEP and nRESET tied high)
+struct Drv8825Driver {
+    static const bool SIMULATED = false;
+    static const bool ENABLE_ACTIVE_LOW = true;
+    static const uint16_t POWER_UP_MS = 2;        // Charge pump, 1.7 ms
+    static const uint16_t ENABLE_SETTLE_MS = 1;
+    static const uint16_t DISABLE_SETTLE_MS = 1;
+    static const char* name() { return "DRV8825"; }
+};
+
+// No driver connected (what TEST_MODE was): nothing steps, rotations and timed moves report
+// TURN and DONE after the time they would take, other moves end at once at their target
+struct SimulatedDriver {
+    static const bool SIMULATED = true;
+    static const bool ENABLE_ACTIVE_LOW = true;
+    static const uint16_t POWER_UP_MS = 0;
+    static const uint16_t ENABLE_SETTLE_MS = 0;
+    static const uint16_t DISABLE_SETTLE_MS = 0;
+    static const char* name() { return "simulated"; }
+};
+
+// Motor profiles: the compiled-in drive train and RPM limits, which CONFIG can override
+
+// Nema23 5756 on a TB6600 at 1/16 (speed limits from its torque curve)
+struct Nema23Profile {
+    static const int STEPS_PER_REVOLUTION = 200;  // 1.8° per step
+    static const int MICROSTEPS = 16;
+    static const int MIN_RPM = 1;
+    static const int MAX_RPM = 1000;
+    static const int OPTIMAL_RPM_LOW = 50;
+    static const int OPTIMAL_RPM_HIGH = 300;
+    static const char* name() { return "Nema23 5756"; }
+};
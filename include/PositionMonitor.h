@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+#include "Encoder.h"
+
+// Following error of the first axis: commanded steps against the encoder, in steps.
+//
+// MotorController counts a move's progress in unsigned steps, so tracking is restarted
+// with the direction at every (re)start of the step engine; the error carries across
+// restarts. Moves that don't drive the encoder's axis aren't tracked and leave the error
+// as it was. Motion task only.
+class PositionMonitor {
+private:
+    PositionEncoder& encoder;
+    bool tracking;
+    bool clockwise;
+    long stepsPerRevolution;
+    long baseCount;      // Encoder reading at the last start()
+    long baseCommanded;  // Commanded steps at the last start()
+    long baseError;      // Error carried over from before the last start()
+    long error;
+    long peak;           // Largest error since the last takePeak()
+
+public:
+    explicit PositionMonitor(PositionEncoder& encoder);
+    void begin(long stepsPerRevolution);
+
+    // Track from here: commandedSteps is the move's progress count right now
+    void start(bool clockwise, long commandedSteps);
+    void stop() { tracking = false; }
+    // Drop the error (the measured position becomes the commanded one); start() again
+    // before the next update()
+    void clear();
+    bool isTracking() const { return tracking; }
+
+    // Update with the move's current progress count; returns the following error,
+    // positive when the motor lags behind its steps
+    long update(long commandedSteps);
+    long followingError() const { return error; }
+    // Largest error (by magnitude) since the last call
+    long takePeak();
+};
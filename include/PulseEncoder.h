@@ -0,0 +1,40 @@
+#pragma once
+#include <stdint.h>
+#include "StepHal.h"
+
+// Packs planned step intervals into a burst of PulseItems for StepTimerHal::sendBurst(),
+// one tick per microsecond like the step timer.
+//
+// Each step is a pulseWidth high half followed by low until the next step's rising edge,
+// usually one item. A low time past the 15-bit duration field is spread evenly over extra
+// all-low items. finish() cuts the burst off right after the last step's pulse: the line
+// idles low, and the caller times the step after it with its own alarm.
+//
+// Runs in the step ISR: the common step is a compare, an OR and a store.
+class PulseEncoder {
+private:
+    PulseItem* items;
+    uint16_t capacity;
+    uint16_t used;
+    uint16_t lastStep;   // First item of the most recent step
+    uint32_t pulseWidth;
+    uint32_t elapsed;    // Ticks from the first rising edge to the step after the last
+
+public:
+    PulseEncoder(PulseItem* items, uint16_t capacity, uint32_t pulseWidth);
+
+    // Append a step whose next step rises interval ticks after it. Needs a free item; when
+    // the low time doesn't fit as well, the step goes in as the last one of the burst
+    // (its pulse only, as finish() leaves it) and this returns false
+    bool STEP_ISR_ATTR step(uint32_t interval);
+    // End the burst after the last step's pulse; returns the items to send
+    uint16_t STEP_ISR_ATTR finish();
+
+    uint16_t count() const { return used; }
+    bool full() const { return used >= capacity; }
+    // Ticks from the first step's rising edge to the one after the last step
+    uint32_t duration() const { return elapsed; }
+
+    // Items one step of this interval takes
+    static uint16_t itemsFor(uint32_t interval, uint32_t pulseWidth);
+};
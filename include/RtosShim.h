@@ -0,0 +1,151 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Minimal task and queue layer: FreeRTOS on the ESP32, pthreads on Linux.
+// The firmware is split into a motion task and a comms task that only talk through
+// BoundedQueues, so the same task model (and its timing) runs on a host build.
+
+#if defined(ARDUINO_ARCH_ESP32)
+    #include <freertos/FreeRTOS.h>
+    #include <freertos/task.h>
+    #include <freertos/queue.h>
+#else
+    #include <pthread.h>
+    #include <time.h>
+    #include <errno.h>
+#endif
+
+namespace Rtos {
+
+typedef void (*TaskFunction)(void* argument);
+
+// Wake time of a periodic task: scheduler ticks on the ESP32, which wrap long after the
+// milliseconds they stand for would overflow a uint32_t
+#if defined(ARDUINO_ARCH_ESP32)
+typedef TickType_t WakeTime;
+#else
+typedef uint32_t WakeTime;
+#endif
+
+// Start a task; priority is FreeRTOS-style (higher runs first), core pins it on the
+// ESP32. On Linux every task is a plain pthread and both are best effort.
+bool startTask(const char* name, TaskFunction function, void* argument,
+               uint32_t stackBytes, uint8_t priority, int core);
+uint32_t nowMillis();
+void delayMillis(uint32_t ms);
+WakeTime wakeTime();  // Now, to start delayUntil() from
+// Sleep until lastWake + periodMs and advance lastWake, so a periodic task doesn't drift.
+// After an overrun it restarts from now rather than catching up with a burst.
+void delayUntil(WakeTime& lastWake, uint32_t periodMs);
+
+}  // namespace Rtos
+
+// Fixed-depth, copy-in/copy-out queue that any task may send to or receive from.
+// Timeouts are in milliseconds; 0 never waits.
+template <typename T, size_t DEPTH>
+class BoundedQueue {
+private:
+#if defined(ARDUINO_ARCH_ESP32)
+    StaticQueue_t control;
+    uint8_t storage[DEPTH * sizeof(T)];
+    QueueHandle_t handle;
+#else
+    T items[DEPTH];
+    size_t head;
+    size_t count;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+
+    // Wait on the condition until ready() or the timeout; called with the mutex held
+    template <typename Ready>
+    bool waitFor(Ready ready, uint32_t timeoutMs) {
+        if (ready() || timeoutMs == 0) {
+            return ready();
+        }
+
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeoutMs / 1000;
+        deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (!ready()) {
+            if (pthread_cond_timedwait(&changed, &mutex, &deadline) == ETIMEDOUT) {
+                return ready();
+            }
+        }
+        return true;
+    }
+#endif
+
+public:
+#if defined(ARDUINO_ARCH_ESP32)
+    BoundedQueue() : handle(xQueueCreateStatic(DEPTH, sizeof(T), storage, &control)) {}
+
+    bool send(const T& item, uint32_t timeoutMs = 0) {
+        return xQueueSend(handle, &item, pdMS_TO_TICKS(timeoutMs)) == pdTRUE;
+    }
+    bool receive(T& item, uint32_t timeoutMs = 0) {
+        return xQueueReceive(handle, &item, pdMS_TO_TICKS(timeoutMs)) == pdTRUE;
+    }
+    bool peek(T& item) { return xQueuePeek(handle, &item, 0) == pdTRUE; }
+    size_t waiting() const { return uxQueueMessagesWaiting(handle); }
+    size_t space() const { return uxQueueSpacesAvailable(handle); }
+#else
+    BoundedQueue() : head(0), count(0) {
+        pthread_mutex_init(&mutex, nullptr);
+        pthread_cond_init(&changed, nullptr);
+    }
+    ~BoundedQueue() {
+        pthread_cond_destroy(&changed);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    bool send(const T& item, uint32_t timeoutMs = 0) {
+        pthread_mutex_lock(&mutex);
+        bool ok = waitFor([this] { return count < DEPTH; }, timeoutMs);
+        if (ok) {
+            items[(head + count) % DEPTH] = item;
+            count++;
+            pthread_cond_broadcast(&changed);
+        }
+        pthread_mutex_unlock(&mutex);
+        return ok;
+    }
+
+    bool receive(T& item, uint32_t timeoutMs = 0) {
+        pthread_mutex_lock(&mutex);
+        bool ok = waitFor([this] { return count > 0; }, timeoutMs);
+        if (ok) {
+            item = items[head];
+            head = (head + 1) % DEPTH;
+            count--;
+            pthread_cond_broadcast(&changed);
+        }
+        pthread_mutex_unlock(&mutex);
+        return ok;
+    }
+
+    bool peek(T& item) {
+        pthread_mutex_lock(&mutex);
+        bool ok = count > 0;
+        if (ok) {
+            item = items[head];
+        }
+        pthread_mutex_unlock(&mutex);
+        return ok;
+    }
+
+    size_t waiting() {
+        pthread_mutex_lock(&mutex);
+        size_t n = count;
+        pthread_mutex_unlock(&mutex);
+        return n;
+    }
+    size_t space() { return DEPTH - waiting(); }
+#endif
+};
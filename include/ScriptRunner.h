@@ -0,0 +1,78 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "MotionScript.h"
+#include "MotorController.h"
+
+class SerialManager;
+
+// Runs the stored motion script (MotionScript.h) against MotorController from the
+// motion task: update() after every MotorController::update() carries out instructions
+// until one has to wait for a move, a dwell or an input. Moves report TURN/DONE as usual;
+// the script ends with RUN DONE, RUN_ERROR LINE:{n} {reason} (a move that was refused or
+// ended other than DONE/HOMED, a SET the move can't take, a WAIT PIN timeout) or, after
+// abort(), ABORTED LINE:{n}. An error or abort ramps a running move down like CLOSE.
+class ScriptRunner {
+public:
+    static const uint8_t MAX_STEPS = 16;  // Instructions per update() that don't wait
+
+private:
+    enum class Wait : uint8_t {
+        NONE,
+        MOVE,    // Until the move started last is over
+        DWELL,
+        PIN
+    };
+
+    struct LoopFrame {
+        uint16_t body;       // Code offset after the LOOP
+        uint16_t remaining;  // Passes left, 0 = forever
+    };
+
+    MotorController& motor;
+    SerialManager& serial;
+
+    uint8_t image[Script::MAX_IMAGE];
+    size_t imageLength;       // 0 = no script
+    const uint8_t* code;
+    size_t codeLength;
+    uint16_t lines;
+
+    bool running;
+    size_t pc;                // Code offset of the next instruction
+    size_t current;           // Of the instruction being carried out
+    LoopFrame loops[Script::MAX_DEPTH];
+    uint8_t depth;
+    Wait waiting;
+    bool moving;              // A move the script started may still be running
+    size_t moveAt;            // Code offset of that move
+    unsigned long waitStart;  // ms
+    unsigned long waitLength; // ms, 0 = no limit for PIN
+    uint8_t waitPin;
+    bool waitLevel;
+
+    bool step(const Script::Instruction& instruction);
+    bool startMove(const Script::Instruction& instruction);
+    bool moveOver();
+    void fail(const char* reason);
+    void halt();
+
+public:
+    ScriptRunner(MotorController& motor, SerialManager& serial);
+    // Takes a compiled image (Script::validate); false if it isn't valid or a script runs
+    bool load(const uint8_t* data, size_t length);
+    bool hasScript() const { return imageLength > 0; }
+    const uint8_t* data() const { return image; }
+    size_t size() const { return imageLength; }
+    uint16_t lineCount() const { return lines; }
+    uint16_t crc() const;
+
+    // From the first line on axis X; false without a script, while one runs or while the
+    // motor is busy
+    bool run();
+    // Stops the script and ramps the move down; false if none was running
+    bool abort();
+    bool isRunning() const { return running; }
+    uint16_t line() const;  // Of the instruction being carried out, 1-based
+    void update();
+};
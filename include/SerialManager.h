@@ -1,17 +1,121 @@
 #pragma once
 #include <Arduino.h>
+#include <atomic>
+#include "FrameCodec.h"
+#include "CommandParser.h"
+#include "RtosShim.h"
+#include "TextWriter.h"
+
+// Everything sent to the host, kept in its binary form until the comms task writes it
+struct OutMessage {
+    static const uint8_t MAX_TEXT = 126;
+
+    uint8_t type;    // Frame::Type, or SerialManager::MODE_SWITCH
+    uint8_t length;
+    uint16_t tag;    // Request it answers (0 = none), Frame::TAG_FINAL on the request's last
+    uint8_t payload[MAX_TEXT + 1];  // Text is formatted in place, so room for its NUL
+};
+
+// Request tags. A host that pipelines commands tags each one ("#12 POS", CommandParser.h)
+// and opens the session with "HELLO TAG" (or "HELLO BIN TAG"), after which every line
+// names its channel and the request it belongs to:
+//   #{tag} {reply}    reply to a request, more follow
+//   ={tag} {reply}    the request's final reply: nothing more carries its tag
+//   !{tag} {event}    TURN, LOAD, FOLLOW, STALL, SEGDONE or DONE of the move it started
+//   * {log}           log line, no tag
+// Untagged commands and output nobody asked for carry tag 0 and are never final. Every
+// tagged request gets a reply when it is handled: its own (the last one final), OK if the
+// handler had none, UNKNOWN if no command matched, PARSE_ERROR if the line was malformed,
+// BUSY (final, not run) if the command queue was full. A request that leaves a move or script running hands its tag to what
+// they send (STARTED if it had no reply of its own) and ends with their last reply (DONE,
+// HOMED, RUN DONE, ...) or STOPPED once the station is idle again. In binary sessions the
+// tag is a frame trailer (FrameCodec.h). The tag state belongs to the motion task.
 
 class SerialManager {
 private:
+    static const size_t OUTBOX_DEPTH = 32;
+    static const uint32_t OUTBOX_WAIT_MS = 10;  // Longest a sender blocks on a full outbox
+    static const uint8_t MODE_SWITCH = 0x7F;    // Outbox marker: payload[0] = binary, [1] = tagged
+
     bool readySent;
     unsigned long readyStartTime;
-    
+
+    // Tagged replies: the request being handled, the operation it left running, and the
+    // latest reply or DONE of either, held back until it is known whether it is final
+    bool handling;
+    uint16_t requestTag;
+    uint16_t operationTag;
+    OutMessage held;
+    bool holding;
+
+    // Incoming bytes are buffered and tokenized without blocking or allocating
+    CommandParser parser;
+
+    // Binary framing (negotiated with "HELLO BIN"). binaryMode belongs to the comms task
+    // and changes when the MODE_SWITCH marker is written, so replies queued before the
+    // switch keep their old encoding; requestedBinary is what senders see. taggedMode
+    // switches with it.
+    bool binaryMode;
+    bool taggedMode;
+    std::atomic<bool> requestedBinary;
+    FrameDecoder decoder;
+
+    // Senders on any task only enqueue; pump() does the UART writes
+    BoundedQueue<OutMessage, OUTBOX_DEPTH> outbox;
+    std::atomic<unsigned long> droppedCount;
+
+    void pollFrame(uint8_t byte);
+    void post(uint8_t type, const uint8_t* payload, uint8_t length);
+    void postText(uint8_t type, const char* text);
+    void postFormatted(uint8_t type, const char* format, va_list args);
+    void postReply(uint16_t tag, const char* text);
+    void route(OutMessage& message);
+    void release(bool final);
+    void enqueue(const OutMessage& message);
+    void sendFrame(uint8_t type, const uint8_t* payload, uint8_t length);
+    void write(const OutMessage& message);
+    void writeLine(const OutMessage& message, const char* line);
+
 public:
     SerialManager();
     void begin();
-    bool hasCommand();
-    String readCommand();
-    void sendResponse(const String& response);
+    bool pollCommand(ParsedCommand& command);
+    // Write queued output while the UART has room; call from the comms task
+    void pump();
+    // Text lines are copied (or printf-formatted) straight into the outbox message, so
+    // sending never allocates; lines longer than OutMessage::MAX_TEXT are cut short
+    void sendResponse(const char* response);
+    void sendResponsef(const char* format, ...) __attribute__((format(printf, 2, 3)));
     void sendStartupReady();
-    void sendStatus(const String& status);
-};
\ No newline at end of file
+    void sendStatus(const char* status);
+
+    // Output used by MotorController so the stream stays valid in binary mode
+    void sendLog(const char* message);
+    void sendLogf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    void sendTurn(long rotations);
+    void sendLoad(uint16_t tenths);
+    void sendFollowingError(long steps);
+    void sendStall(long steps);
+    void sendDone();
+    void sendSegmentDone(uint16_t id, uint8_t freeSlots);
+    void sendStatusRecord(const Frame::StatusRecord& status);
+    void sendStream(const uint8_t* batch, uint8_t length);  // Binary mode only
+    // Room in the outbox for a burst of telemetry without blocking the sender
+    bool canSend();
+    unsigned long droppedMessages() const { return droppedCount; }
+
+    // Request tags, around each command the motion task dispatches. started: the command
+    // left a move or script running
+    void beginRequest(uint16_t tag);
+    void endRequest(bool started);
+    // The running operation is over: its held reply goes out final, else reply does
+    void finishOperation(const char* reply);
+    uint16_t runningOperation() const { return operationTag; }
+    // A held reply that is still not final goes out at the end of a motion task pass
+    void flushReplies();
+    // Final reply to a tagged command that never reached the motion task (comms task)
+    void sendRejected(uint16_t tag, const char* response);
+
+    void setBinaryMode(bool enabled, bool tagged = false);
+    bool isBinaryMode() { return requestedBinary; }
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+#include "SpeedTable.h"
+
+// Step delays of the speed levels in use and their acceleration ramps.
+//
+// With the compiled-in delays the ramps are the flash tables of SpeedTable.h. A configured
+// set of delays (CONFIG SET DELAYn:) gets its ramps computed into RAM once, when it is
+// applied, with the same formula, so running at a speed level stays a table lookup per
+// step. Not safe to rebuild while a level's ramp is being replayed.
+class SpeedLevels {
+public:
+    static const uint16_t MAX_RAMP_ENTRIES = 4096;
+
+private:
+    uint16_t delays[SpeedTable::LEVELS];
+    const uint16_t* ramps;    // SpeedTable::TABLES or built
+    const uint16_t* offsets;
+    uint16_t built[MAX_RAMP_ENTRIES];
+    uint16_t builtOffsets[SpeedTable::LEVELS + 1];
+
+public:
+    SpeedLevels();  // Compiled-in delays
+
+    // Ramp entries a set of delays needs in total
+    static uint32_t rampEntries(const uint16_t* delays);
+    // Use these delays; false (and nothing changes) if their ramps need more than
+    // MAX_RAMP_ENTRIES
+    bool build(const uint16_t* delays);
+
+    // level is 1-based, as in the SPEED: command
+    uint16_t delay(int level) const { return delays[level - 1]; }
+    const uint16_t* ramp(int level) const { return &ramps[offsets[level - 1]]; }
+    uint16_t rampSteps(int level) const { return offsets[level] - offsets[level - 1]; }
+};
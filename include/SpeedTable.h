@@ -0,0 +1,119 @@
+#pragma once
+#include <stdint.h>
+
+// Speed level tables, generated at compile time and placed in flash (.rodata).
+//
+// DELAY_US is the exact steady-state step interval of each level. The acceleration ramp
+// of a level holds the analytic constant-acceleration intervals from RAMP_START_RATE up
+// to that interval,
+//   t(k) = (sqrt(v0^2 + 2ak) - v0) / a,   interval(k) = t(k + 1) - t(k),
+// in 1/16 us, so moving at a speed level needs a table lookup per step and no division.
+namespace SpeedTable {
+
+constexpr int LEVELS = 20;
+constexpr uint32_t RAMP_ACCEL = 16000;     // steps/s^2 (300 RPM per second at 1/16 microstepping)
+constexpr uint32_t RAMP_START_RATE = 320;  // steps/s (6 RPM), first and last step
+constexpr int INTERVAL_SHIFT = 4;          // Ramp entries are Q4 microseconds
+
+// Speed level to step delay table (microseconds)
+// Level 1 (slowest) to Level 20 (fastest), RPM at 3200 steps/rev
+constexpr uint16_t DELAY_US[LEVELS] = {
+    10000,  // Level 1:  Slowest (1.875 RPM)
+    8000,   // Level 2:  (2.34 RPM)
+    6500,   // Level 3:  (2.88 RPM)
+    5000,   // Level 4:  (3.75 RPM)
+    4000,   // Level 5:  (4.69 RPM)
+    3200,   // Level 6:  (5.86 RPM)
+    2600,   // Level 7:  (7.21 RPM)
+    2100,   // Level 8:  (8.93 RPM)
+    1700,   // Level 9:  (11.0 RPM)
+    1400,   // Level 10: (13.4 RPM)
+    1150,   // Level 11: (16.3 RPM)
+    950,    // Level 12: (19.7 RPM)
+    800,    // Level 13: (23.4 RPM)
+    680,    // Level 14: (27.6 RPM)
+    580,    // Level 15: (32.3 RPM)
+    500,    // Level 16: (37.5 RPM)
+    430,    // Level 17: (43.6 RPM)
+    370,    // Level 18: (50.7 RPM)
+    320,    // Level 19: (58.6 RPM)
+    280     // Level 20: Fastest (67.0 RPM)
+};
+
+constexpr uint64_t isqrt(uint64_t x) {
+    if (x < 2) {
+        return x;
+    }
+    uint64_t r = x;
+    uint64_t y = (x >> 1) + (x & 1);  // ceil(x / 2), so isqrt(2) doesn't stop at 2
+    while (y < r) {
+        r = y;
+        y = (r + x / r) >> 1;
+    }
+    return r;
+}
+
+// Number of ramp steps before a level reaches its cruise interval
+constexpr uint32_t rampLength(uint32_t delayUs) {
+    uint64_t cruiseSquared = 1000000000000ULL / ((uint64_t)delayUs * delayUs);
+    uint64_t startSquared = (uint64_t)RAMP_START_RATE * RAMP_START_RATE;
+    if (cruiseSquared <= startSquared) {
+        return 0;
+    }
+    return (uint32_t)((cruiseSquared - startSquared) / (2 * RAMP_ACCEL));
+}
+
+// Velocity at ramp position k in steps/s, scaled by 2^10
+constexpr uint64_t rampVelocity(uint32_t k) {
+    return isqrt(((uint64_t)RAMP_START_RATE * RAMP_START_RATE + 2ULL * RAMP_ACCEL * k) << 20);
+}
+
+constexpr uint16_t rampInterval(uint32_t k, uint32_t delayUs) {
+    // (v(k + 1) - v(k)) / a seconds, in Q4 microseconds, rounded
+    uint64_t dv = rampVelocity(k + 1) - rampVelocity(k);
+    uint64_t interval = (dv * (1000000ULL << INTERVAL_SHIFT) + (RAMP_ACCEL << 9)) / ((uint64_t)RAMP_ACCEL << 10);
+    uint64_t cruise = (uint64_t)delayUs << INTERVAL_SHIFT;
+    return (uint16_t)(interval < cruise ? cruise : interval);
+}
+
+constexpr uint32_t totalRampLength() {
+    uint32_t total = 0;
+    for (int level = 0; level < LEVELS; level++) {
+        total += rampLength(DELAY_US[level]);
+    }
+    return total;
+}
+
+constexpr uint32_t RAMP_ENTRIES = totalRampLength();
+
+struct Tables {
+    uint16_t ramp[RAMP_ENTRIES];
+    uint16_t offset[LEVELS + 1];  // Level i's ramp is ramp[offset[i] .. offset[i + 1])
+};
+
+constexpr Tables build() {
+    Tables tables = {};
+    uint32_t position = 0;
+    for (int level = 0; level < LEVELS; level++) {
+        tables.offset[level] = (uint16_t)position;
+        uint32_t length = rampLength(DELAY_US[level]);
+        for (uint32_t k = 0; k < length; k++) {
+            tables.ramp[position++] = rampInterval(k, DELAY_US[level]);
+        }
+    }
+    tables.offset[LEVELS] = (uint16_t)position;
+    return tables;
+}
+
+inline constexpr Tables TABLES = build();
+
+// level is 1-based, as in the SPEED: command
+inline const uint16_t* ramp(int level) {
+    return &TABLES.ramp[TABLES.offset[level - 1]];
+}
+
+inline uint16_t rampSteps(int level) {
+    return TABLES.offset[level] - TABLES.offset[level - 1];
+}
+
+}  // namespace SpeedTable
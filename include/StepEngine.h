@@ -0,0 +1,187 @@
+#pragma once
+#include "StepHal.h"
+#include "PulseEncoder.h"
+#include "TraceLog.h"
+#include "LimitSwitch.h"
+#include "MotionPlanner.h"
+#include "EventRing.h"
+#include "Histogram.h"
+
+// Progress reported by the step ISR to loop() through the engine's event ring
+struct StepEvent {
+    enum Type : uint8_t {
+        REVOLUTION,  // value = revolutions completed since setRevolution()
+        SEGMENT,     // Switched to the queued planner, value = segments completed
+        STOPPED,     // Ran out of steps by itself (not halt()), value = step count
+        LIMIT        // Stopped before a step because the watched switch closed, value = step count
+    };
+
+    uint8_t type;
+    uint32_t value;
+    uint32_t time;   // Timer microseconds
+};
+
+// Interrupt-driven step pulse generator.
+// Each step takes two alarms: the first raises STEP, the second (PULSE_WIDTH_US later)
+// lowers it and schedules the next step relative to the previous alarm, so the pulse
+// train is independent of how long loop() takes. With a MotionPlanner attached the
+// interval is re-planned after every step; otherwise it stays constant.
+//
+// A second planner can be queued behind the running one. When the running planner
+// finishes, the ISR switches to the queued one on the very next step (setting DIR first
+// if it changed), so consecutive segments run without stopping or a loop() round trip.
+//
+// Up to MAX_AXES axes share the one alarm. The planner times the ticks of the longest
+// axis; every other axis of a coordinated move steps axisSteps times per masterSteps
+// ticks using Bresenham's error term, so all axes start and finish together.
+//
+// The ISR keeps every axis' signed position: each STEP rising edge counts up with DIR
+// low (CW) and down with DIR high, across moves, halts and queued segments alike.
+// While homing it also checks a limit switch before every step and stops on it.
+//
+// The ISR never prints: it posts StepEvents to a lock-free ring that loop() drains
+// when the serial port has room, so a slow host can't hold up the step train.
+// It also records how late each step's alarm was serviced in a fixed-bucket histogram,
+// and can log every step of axis 0 to a TraceRecorder.
+//
+// When the timer HAL takes pulse bursts and axis 0 runs alone with no input watched, one
+// alarm plans up to BURST_MAX_US of steps ahead, hands them to the pulse generator and
+// arms the next one for the step after them. The bookkeeping (position, step count,
+// events, queued segments) runs as the burst is planned, so it leads the pulses by up to
+// one burst. A stop, or a segment that turns DIR round, ends its burst; an alarm after
+// the last pulse then posts STOPPED or sets DIR, the way the falling edge does otherwise.
+// halt() has the ISR cut the burst short after the pulse under way and take back the
+// steps it had counted ahead.
+class StepEngine {
+public:
+    static const uint8_t MAX_AXES = 4;
+    static const uint32_t EVENT_RING_SIZE = 64;
+    // Slots kept free for SEGMENT and STOPPED: REVOLUTION events carry the running count
+    // and may be dropped, the others drive loop()'s state and must always arrive
+    static const uint32_t EVENT_RESERVE = 2;
+    typedef EventRing<StepEvent, EVENT_RING_SIZE> Events;
+
+private:
+    static const uint32_t PULSE_WIDTH_US = 5;      // TB6600 requires minimum 2.5us pulse
+    static const uint32_t MIN_INTERVAL_US = 2 * PULSE_WIDTH_US;
+    static const uint16_t MAX_BURST_ITEMS = 64;
+    static const uint32_t BURST_MAX_US = 1000;     // Steps planned ahead per burst
+    static const uint32_t BURST_CUT_US = PULSE_WIDTH_US;  // Steps starting sooner still go out
+
+    StepTimerHal& hal;
+    StepOutput* axes[MAX_AXES];  // axes[0] is the timer HAL's own lines
+    uint8_t axisCount;
+
+    // Shared with the timer ISR: axes in directMask step on every tick, the ones in
+    // bresenhamMask when their error term overflows
+    volatile uint8_t directMask;
+    volatile uint8_t bresenhamMask;
+    volatile uint8_t raisedMask;  // Axes whose STEP line is high
+    volatile uint8_t reverseMask; // Axes whose DIR line is high: their steps count down
+    volatile long axisPosition[MAX_AXES];
+    LimitSwitch* volatile stopInput;
+    TraceRecorder* volatile trace;
+    long axisSteps[MAX_AXES];
+    long axisError[MAX_AXES];
+    long masterSteps;
+
+    MotionPlanner* volatile planner;
+    MotionPlanner* volatile queuedPlanner;
+    volatile uint8_t queuedAxis;
+    volatile bool queuedDirection;
+    volatile uint32_t segmentCount;  // Planners finished with a successor queued
+
+    // Revolution events
+    Events eventRing;
+    volatile long revolutionSteps;   // 0 = no REVOLUTION events
+    volatile long untilRevolution;
+    volatile uint32_t revolutionCount;
+
+    Histogram stepLateness;  // Microseconds from alarm due to STEP rising edge
+
+    // Burst mode, shared with the timer ISR
+    PulseItem burst[MAX_BURST_ITEMS];
+    uint32_t burstOffsets[MAX_BURST_ITEMS];  // Each step's rising edge from burstStart
+    uint8_t burstFirstItems[MAX_BURST_ITEMS];
+    uint8_t burstSteps;
+    uint32_t burstStart;
+    volatile bool burstPending;   // A burst may still be playing; the armed alarm follows it
+    volatile bool burstTail;      // That alarm comes after its last pulse, not with a step
+    volatile bool tailStop;       // ... and ends the move
+    volatile uint32_t tailDelay;  // ... or arms the next step this long after it
+    volatile bool dirPending;     // DIR of axis 0 waiting for the burst to finish
+    volatile bool pendingDirLevel;
+    volatile bool cutRequested;   // halt() armed an alarm right away to cut the burst
+
+    // Shared with the timer ISR
+    volatile uint32_t interval;
+    volatile long stepCount;
+    volatile long stepLimit;  // 0 = run until halted
+    volatile bool active;
+    volatile bool stepHigh;
+
+    void launch(uint32_t firstInterval, MotionPlanner* motionPlanner, long limit);
+    void startAfterBurst(uint32_t delay);
+    void STEP_ISR_ATTR writeAxes(uint8_t mask, bool level);
+    void STEP_ISR_ATTR writeDir(uint8_t axis, bool level);
+    void STEP_ISR_ATTR post(uint8_t type, uint32_t value);
+    static void STEP_ISR_ATTR onAlarmThunk(void* context);
+    void STEP_ISR_ATTR onAlarm();
+    bool STEP_ISR_ATTR canBurst(uint16_t capacity) const;
+    void STEP_ISR_ATTR sendBurst(uint16_t capacity);
+    void STEP_ISR_ATTR finishBurst();
+    void STEP_ISR_ATTR cutBurst();
+    void STEP_ISR_ATTR traceBurst();
+
+public:
+    StepEngine(StepTimerHal& hal);
+    void begin();
+    // Register another axis on the same timebase; returns its index, MAX_AXES when full
+    uint8_t addAxis(StepOutput& output);
+    StepOutput& output(uint8_t axis) { return *axes[axis]; }
+    // Single-axis moves: only this axis steps (axis 0 by default)
+    void selectAxis(uint8_t axis);
+    // Coordinated moves: absolute step count per axis for the next start(); the
+    // planner must run max(steps) ticks
+    void setAxisSteps(const long* steps, uint8_t count);
+    // DIR of one axis (high = CCW); always set it here so the position counts the right way.
+    // Waits for a burst still playing on that axis
+    void setDirection(uint8_t axis, bool dirLevel);
+    // Signed steps since power-up or the last setPosition(), positive = CW
+    long position(uint8_t axis) const { return axisPosition[axis]; }
+    bool reversed(uint8_t axis) const { return (reverseMask >> axis) & 1; }  // DIR high
+    void setPosition(uint8_t axis, long steps);  // While stopped only
+    // Stop before the next step once input is triggered (nullptr: don't watch)
+    void watchInput(LimitSwitch* input) { stopInput = input; }
+    // Log axis 0's steps to recorder as they go out (nullptr: don't). Burst steps are
+    // logged by the alarm after their burst, with the times they went out at
+    void traceTo(TraceRecorder* recorder) { trace = recorder; }
+    void start(uint32_t intervalMicros, long stepLimit = 0);
+    void start(MotionPlanner& planner, long stepLimit = 0);
+    void setInterval(uint32_t intervalMicros);
+    // Move the end of the running move (steps since start); keep the planner's count in step
+    void setStepLimit(long limit) { stepLimit = limit; }
+    void halt();    // Stop after the current pulse or burst, keeping the step count
+    void resume();  // Continue towards the same step limit
+    // Ramp the running planner down to rest, ending with a STOPPED event. The queued
+    // planner is dropped unless the running one blends into it too fast to stop in time;
+    // then that one ramps down instead, right after taking over. Without a planner this
+    // is halt()
+    void rampDown();
+    MotionPlanner* runningPlanner() const { return planner; }
+    // Follow the running planner with another one; false if one is already queued
+    bool queue(MotionPlanner& planner, uint8_t axis, bool dirLevel);
+    void clearQueued() { queuedPlanner = nullptr; }
+    bool hasQueued() const { return queuedPlanner != nullptr; }
+    // Post a REVOLUTION event every stepsPerRevolution ticks, counting from now as if
+    // position steps of the move had already been made
+    void setRevolution(long stepsPerRevolution, long position = 0);
+    Events& events() { return eventRing; }
+    uint32_t revolutions() const { return revolutionCount; }
+    Histogram& lateness() { return stepLateness; }
+    long steps() const { return stepCount; }
+    // Interval of the last step in Q8 us, 0 when not stepping
+    uint32_t stepIntervalQ8() const;
+    bool isActive() const { return active; }
+    StepTimerHal& timer() { return hal; }
+};
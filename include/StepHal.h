@@ -0,0 +1,270 @@
+#pragma once
+#include <stdint.h>
+
+// Hardware abstraction for the step pulse engine.
+// The engine only needs a one-shot alarm, a microsecond clock and the STEP/DIR lines,
+// so the same engine runs on the ESP32 hardware timer and on a simulated timer on Linux.
+// The timer HAL carries the pins of the first axis; further axes are plain StepOutputs
+// driven from the same alarm. A timer HAL whose STEP line has a pulse generator behind it
+// can also take whole bursts of planned pulses at once (see PulseEncoder.h).
+
+#if defined(ARDUINO_ARCH_ESP32)
+    #include <Arduino.h>
+    #define STEP_ISR_ATTR IRAM_ATTR
+#else
+    #define STEP_ISR_ATTR
+#endif
+
+// One pulse generator item: two (duration, level) halves, laid out like the ESP32's
+// rmt_item32_t (duration0:15 level0:1 duration1:15 level1:1). A half with duration 0 ends
+// the burst there.
+struct PulseItem {
+    uint32_t value;
+
+    static const uint32_t MAX_DURATION = 32767;  // 15-bit duration field, in ticks
+
+    static PulseItem make(uint32_t duration0, bool level0, uint32_t duration1, bool level1) {
+        PulseItem item = { duration0 | (level0 ? 1u << 15 : 0) | (duration1 << 16) | (level1 ? 1u << 31 : 0) };
+        return item;
+    }
+    uint32_t duration0() const { return value & 0x7FFF; }
+    bool level0() const { return (value >> 15) & 1; }
+    uint32_t duration1() const { return (value >> 16) & 0x7FFF; }
+    bool level1() const { return value >> 31; }
+};
+
+// STEP/DIR/ENABLE lines of one axis
+class StepOutput {
+public:
+    virtual ~StepOutput() {}
+    virtual void writeStep(bool level) = 0;
+    virtual void writeDir(bool level) = 0;
+    virtual void writeEnable(bool level) = 0;
+};
+
+class StepTimerHal : public StepOutput {
+public:
+    typedef void (*AlarmCallback)(void* context);
+
+    virtual void begin(AlarmCallback callback, void* context) = 0;
+    // Arm the first alarm delayMicros from now
+    virtual void startAlarm(uint32_t delayMicros) = 0;
+    // Arm the next alarm delayMicros after the previous alarm (not after "now"),
+    // so interrupt latency never accumulates into the step train
+    virtual void armNext(uint32_t delayMicros) = 0;
+    virtual void cancelAlarm() = 0;
+    virtual uint32_t nowMicros() = 0;
+    // When the alarm being serviced was due; nowMicros() - alarmMicros() is its lateness
+    virtual uint32_t alarmMicros() = 0;
+    // Most PulseItems sendBurst() takes at once; 0 when STEP only has writeStep()
+    virtual uint16_t burstItems() { return 0; }
+    // Play a burst of pulses on STEP, one tick per microsecond, starting now. The caller
+    // keeps bursts, and DIR changes, from overlapping the one still playing
+    virtual void sendBurst(const PulseItem*, uint16_t) {}
+    // End the burst playing where this item starts; the generator must not be there yet
+    virtual void endBurstAt(uint16_t) {}
+};
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+// GPIO lines of an additional axis
+class Esp32StepOutput : public StepOutput {
+private:
+    int stepPin;
+    int dirPin;
+    int enablePin;
+
+public:
+    Esp32StepOutput(int stepPin = -1, int dirPin = -1, int enablePin = -1);
+    void begin();
+    void writeStep(bool level) override;
+    void writeDir(bool level) override;
+    void writeEnable(bool level) override;
+};
+
+// How Esp32StepHal drives its STEP line, picked at compile time (PlatformStepHal below)
+
+// STEP through the GPIO set/clear registers, one edge per alarm
+class GpioPulses {
+private:
+    int pin;
+
+public:
+    static const uint16_t BURST_ITEMS = 0;
+
+    void begin(int stepPin);
+    void write(bool level);
+    void send(const PulseItem*, uint16_t) {}
+    void end(uint16_t) {}
+};
+
+// STEP from RMT channel 0: bursts are played from the channel's memory block, single
+// edges switch the level the idle channel holds the line at
+class RmtPulses {
+public:
+    static const uint16_t BURST_ITEMS = 64;  // One memory block
+
+    void begin(int stepPin);
+    void write(bool level);
+    void send(const PulseItem* items, uint16_t count);
+    void end(uint16_t item);
+};
+
+// ESP32 hardware timer 0 at 1 MHz (80 MHz APB / 80)
+template <class Pulses>
+class Esp32StepHal : public StepTimerHal {
+private:
+    int stepPin;
+    int dirPin;
+    int enablePin;
+    Pulses pulses;
+    hw_timer_t* timer;
+    uint64_t alarmAt;
+    AlarmCallback callback;
+    void* context;
+
+    static Esp32StepHal* instance;
+    static void IRAM_ATTR onTimer();
+
+public:
+    Esp32StepHal(int stepPin, int dirPin, int enablePin);
+    // Rebind the first axis' lines; before begin() only
+    void setPins(int step, int dir, int enable) { stepPin = step; dirPin = dir; enablePin = enable; }
+    void begin(AlarmCallback callback, void* context) override;
+    void startAlarm(uint32_t delayMicros) override;
+    void armNext(uint32_t delayMicros) override;
+    void cancelAlarm() override;
+    uint32_t nowMicros() override;
+    uint32_t alarmMicros() override;
+    uint16_t burstItems() override { return Pulses::BURST_ITEMS; }
+    void sendBurst(const PulseItem* items, uint16_t count) override;
+    void endBurstAt(uint16_t item) override;
+    void writeStep(bool level) override;
+    void writeDir(bool level) override;
+    void writeEnable(bool level) override;
+};
+
+#else
+
+// Simulated axis lines for host builds: records the timestamp of every STEP rising edge
+// against the virtual clock of the running SimStepHal
+class SimStepOutput : public StepOutput {
+private:
+    static const int MAX_RECORDED_PULSES = 65536;
+
+    int stepPin;
+    int dirPin;
+    int enablePin;
+    bool stepLevel;
+    bool dirLevel;
+    bool enableLevel;
+    uint64_t pulseTimes[MAX_RECORDED_PULSES];
+    long pulseCount;
+    long position;  // Net steps, counting DIR low as forward
+
+public:
+    SimStepOutput(int stepPin = -1, int dirPin = -1, int enablePin = -1);
+    void setPins(int step, int dir, int enable) { stepPin = step; dirPin = dir; enablePin = enable; }
+    void begin() {}
+    void writeStep(bool level) override;
+    void writeDir(bool level) override;
+    void writeEnable(bool level) override;
+
+    long recordedPulses() const { return pulseCount; }
+    uint64_t pulseTime(long index) const { return pulseTimes[index % MAX_RECORDED_PULSES]; }
+    void clearPulses() { pulseCount = 0; }
+    long netSteps() const { return position; }
+    bool dir() const { return dirLevel; }
+    bool enabled() const { return enableLevel; }
+};
+
+// Simulated timer for host builds: a virtual microsecond clock that fires the alarm
+// callback when advanced. begin() attaches it to the fake Arduino layer, so Sim::advance()
+// drives it together with micros()/millis(). The first axis' lines are recorded like a
+// SimStepOutput.
+//
+// setBurstItems() gives it a pulse generator like RmtPulses: sendBurst() decodes the items
+// into rising edges that advance() plays at their times, between the alarms.
+class SimStepHal : public StepTimerHal {
+private:
+    static const int MAX_BURST_PULSES = 256;
+
+    uint64_t now;
+    uint64_t alarmAt;
+    bool alarmArmed;
+    uint32_t alarmLatency;  // Simulated interrupt entry latency
+    uint32_t alarmJitter;   // Extra pseudo-random latency, 0..alarmJitter
+    uint32_t jitterSeed;
+    uint64_t alarmFiresAt;  // alarmAt (just after now if that has passed) plus the latency
+    long alarmCount;        // Alarms fired
+    AlarmCallback callback;
+    void* context;
+    SimStepOutput pins;
+    uint16_t burstCapacity;  // 0 = edges only
+    struct BurstPulse {
+        uint64_t time;  // Rising edge
+        uint16_t item;  // Of the burst that holds it
+    };
+    BurstPulse burstPulses[MAX_BURST_PULSES];  // Still to play, in time order
+    long burstHead;
+    long burstTail;
+    uint64_t burstEnd;       // When the last burst's final pulse is over
+    long burstErrorCount;
+
+    static void advanceTimer(void* hal, uint64_t micros);
+    void arm(uint64_t at);
+
+public:
+    static const SimStepHal* clock;  // Timestamps recorded by every SimStepOutput
+
+    SimStepHal(int stepPin = -1, int dirPin = -1, int enablePin = -1);
+    void setPins(int step, int dir, int enable) { pins.setPins(step, dir, enable); }
+    void begin(AlarmCallback callback, void* context) override;
+    void startAlarm(uint32_t delayMicros) override;
+    void armNext(uint32_t delayMicros) override;
+    void cancelAlarm() override;
+    uint32_t nowMicros() override;
+    uint32_t alarmMicros() override;
+    uint16_t burstItems() override { return burstCapacity; }
+    void sendBurst(const PulseItem* items, uint16_t count) override;
+    void endBurstAt(uint16_t item) override;
+    void writeStep(bool level) override;
+    void writeDir(bool level) override;
+    void writeEnable(bool level) override;
+
+    // Advance the virtual clock, firing every alarm that falls due on the way.
+    // Called through Sim::advance() once begin() has run.
+    void advance(uint64_t micros);
+    void setAlarmLatency(uint32_t micros) { alarmLatency = micros; }
+    // Vary the latency of each alarm by 0..micros, reproducibly for a given seed
+    void setAlarmJitter(uint32_t micros, uint32_t seed = 1) { alarmJitter = micros; jitterSeed = seed; }
+    // Take bursts of up to items PulseItems (RmtPulses: 64); 0 = edges only (GpioPulses)
+    void setBurstItems(uint16_t items) { burstCapacity = items; }
+    // Bursts sent, and STEP or DIR written, while a burst was still playing, plus bursts
+    // without an end marker and bursts ended where they had already got to
+    long burstErrors() const { return burstErrorCount; }
+    uint64_t now64() const { return now; }
+    long alarms() const { return alarmCount; }
+    long recordedPulses() const { return pins.recordedPulses(); }
+    uint64_t pulseTime(long index) const { return pins.pulseTime(index); }
+    void clearPulses() { pins.clearPulses(); }
+    long netSteps() const { return pins.netSteps(); }
+    bool dir() const { return pins.dir(); }
+    bool enabled() const { return pins.enabled(); }
+};
+
+#endif
+
+// HAL used by MotorController on the current build target. On the ESP32 the RMT drives
+// STEP unless the build sets -D STEP_PULSES_GPIO
+#if defined(ARDUINO_ARCH_ESP32)
+#if defined(STEP_PULSES_GPIO)
+typedef Esp32StepHal<GpioPulses> PlatformStepHal;
+#else
+typedef Esp32StepHal<RmtPulses> PlatformStepHal;
+#endif
+typedef Esp32StepOutput PlatformStepOutput;
+#else
+typedef SimStepHal PlatformStepHal;
+typedef SimStepOutput PlatformStepOutput;
+#endif
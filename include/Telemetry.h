@@ -0,0 +1,118 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// STREAM telemetry: fixed-layout samples of the fields the host picked, taken at a fixed
+// rate and sent in batches, one STREAM frame per batch (binary mode only).
+//
+// Batch payload, little endian:
+//   uint16 sequence   first sample, in sample periods since STREAM was started (wraps)
+//   uint8  stride     sample periods from one sample of the batch to the next
+//   uint8  count
+//   uint8  fields     Field bits: the layout of every sample
+//   count x sample    the selected fields, in bit order:
+//     POS   int32   steps into the current move (what TURN counts)
+//     FRAC  uint16  position within the current revolution, 1/65536
+//     RPM   uint16  speed at the last step, 0.1 RPM
+//     LOAD  uint16  0.1 % of rated driver current
+//     ERR   int16   following error, steps (saturated)
+//     STATE uint8   Frame::State
+//
+// Sample i of a batch was taken at sequence + i * stride periods. Plain C++, so the host
+// decodes batches with the same code.
+namespace Telemetry {
+
+enum Field : uint8_t {
+    POS = 0x01,
+    FRAC = 0x02,
+    RPM = 0x04,
+    LOAD = 0x08,
+    ERR = 0x10,
+    STATE = 0x20,
+    ALL = 0x3F
+};
+
+const uint8_t FIELD_COUNT = 6;
+const size_t HEADER_SIZE = 5;
+
+struct Sample {
+    int32_t position;
+    uint16_t fraction;
+    uint16_t rpmTenths;
+    uint16_t loadTenths;
+    int16_t followingError;
+    uint8_t state;
+};
+
+struct Batch {
+    uint16_t sequence;
+    uint8_t stride;
+    uint8_t count;
+    uint8_t fields;
+};
+
+// Field by name ("POS", ...), 0 if unknown
+uint8_t fieldByName(const char* name);
+const char* fieldName(uint8_t field);
+size_t sampleSize(uint8_t fields);
+// Samples per batch: as many as fit one frame, rounded down to even so a batch can be
+// halved without losing its spacing
+uint8_t batchCapacity(uint8_t fields);
+
+// Returns the payload length
+size_t encode(const Batch& batch, const Sample* samples, uint8_t* payload);
+// false if the payload is malformed or holds more than maxSamples samples
+bool decode(const uint8_t* payload, size_t length, Batch& batch, Sample* samples, size_t maxSamples);
+
+}  // namespace Telemetry
+
+// Device side: samples go into a preallocated batch, which is sent when it is full or its
+// first sample is FLUSH_MICROS old, and only while the outbox has room. Until then samples
+// keep accumulating; a full batch that still can't go out is coalesced - every other
+// sample dropped, stride doubled - so a saturated link gets fewer samples, evenly spaced,
+// instead of stale or blocked ones. Motion task only.
+class TelemetryStream {
+public:
+    static const uint16_t MAX_RATE = 1000;        // Hz: at most one sample per motion task pass
+    static const uint32_t FLUSH_MICROS = 50000;   // Longest a sample waits for its batch to fill
+    static const uint8_t MAX_STRIDE = 128;
+    static const uint8_t MAX_BATCH = 58;          // STATE only: (64 - 5) / 1, rounded to even
+
+private:
+    bool active;
+    uint8_t fields;
+    uint32_t period;       // us
+    uint32_t nextSample;   // micros() the next sample is due
+    uint16_t sequence;     // Of the next sample due
+    uint8_t capacity;
+
+    Telemetry::Sample batch[MAX_BATCH];
+    uint8_t count;
+    uint8_t stride;
+    uint16_t batchSequence;
+    uint32_t batchStart;
+
+    uint32_t taken;        // Sample periods since start()
+    uint32_t sent;         // Samples that went out
+    uint32_t batches;
+
+public:
+    TelemetryStream();
+    void start(uint8_t fields, uint16_t rate, uint32_t now);
+    void stop();
+    bool isActive() const { return active; }
+    bool includes(uint8_t field) const { return active && (fields & field) != 0; }
+    uint8_t selectedFields() const { return fields; }
+    uint8_t batchSize() const { return capacity; }
+
+    // True once for every sample period that has come due; add() a sample for each
+    bool due(uint32_t now);
+    void add(const Telemetry::Sample& sample, uint32_t now);
+    // Encodes the batch into payload (Frame::MAX_PAYLOAD bytes) if it should go out now and
+    // the outbox has room; returns the length, 0 when there is nothing to send
+    size_t take(uint8_t* payload, uint32_t now, bool canSend);
+
+    uint32_t samplesTaken() const { return taken; }
+    uint32_t samplesSent() const { return sent; }
+    uint32_t batchesSent() const { return batches; }
+};
@@ -0,0 +1,40 @@
+#pragma once
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Builds a line of text in a buffer the caller owns, without allocating.
+//
+// Appends stop at the end of the buffer, so an over-long line is cut short rather than
+// overrunning it; the text is always NUL-terminated. Replaces String concatenation on
+// every output path, which allocated (and fragmented the heap) for each piece.
+class TextWriter {
+private:
+    char* buffer;
+    size_t capacity;  // Including the NUL
+    size_t used;
+
+public:
+    TextWriter(char* buffer, size_t capacity);
+
+    TextWriter& append(const char* text);
+    // printf-style, into what is left of the buffer
+    TextWriter& appendf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    TextWriter& appendv(const char* format, va_list args);
+    void clear();
+
+    const char* c_str() const { return buffer; }
+    size_t length() const { return used; }
+};
+
+// A TextWriter with its own buffer, on the stack of whoever formats the line
+template <size_t SIZE>
+class TextBuffer : public TextWriter {
+private:
+    char storage[SIZE];
+
+public:
+    TextBuffer() : TextWriter(storage, SIZE) {}
+    TextBuffer(const TextBuffer&) = delete;
+    TextBuffer& operator=(const TextBuffer&) = delete;
+};
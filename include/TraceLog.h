@@ -0,0 +1,138 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "StepHal.h"
+
+// Motion trace: every STEP rising edge of axis 0 with its time, position and direction,
+// and every state the controller enters, kept in RAM so TRACE DUMP can show afterwards
+// what the step train of a misbehaving station actually looked like.
+//
+// Steps go into a ring of BLOCK_SIZE-byte blocks. A full ring drops its oldest block; each
+// block starts from a header of its own, so whatever is left still decodes:
+//   uint16 sequence   blocks since the trace was started (wraps)
+//   uint16 length     record bytes after the header
+//   uint32 time       step timer microseconds of the step before the block
+//   uint32 interval   microseconds from the step before that one
+//   int32  position   axis 0 after the step before the block
+//   uint8  reverse    1 if that step went CCW (DIR high)
+// Records are unsigned LEB128 varints v:
+//   v even   a step: its interval minus the one before = zigzag(v >> 1), so steps at
+//            constant speed and through most of a ramp take one byte
+//   v odd    marker v >> 1: DIR_CW or DIR_CCW (the steps after it go that way), or
+//            POSITION followed by a zigzag varint: the next step lands that far from
+//            where counting on would put it (setPosition, homing)
+// Times are the step timer's 32-bit microseconds, so a standstill of more than about 71
+// minutes between two steps loses whole 2^32 us.
+//
+// States are kept apart in a ring of MARKS fixed records, since they come from the motion
+// task and steps from the step ISR: each ring has a single writer and needs no lock.
+//
+// TRACE DUMP sends an image of both, little endian:
+//   "TRC" uint8 version
+//   uint16 blocks     oldest first, each its header and length record bytes
+//   uint16 marks      oldest first, MARK_SIZE bytes each: uint32 time, int32 position,
+//                     uint8 MotorState
+//   uint32 steps      recorded since the trace was started, dropped blocks included
+// Plain C++, so the host decodes images with the same code.
+namespace Trace {
+
+const uint8_t VERSION = 1;
+const size_t IMAGE_HEADER_SIZE = 12;
+const size_t BLOCK_SIZE = 256;
+const size_t BLOCK_HEADER_SIZE = 17;
+const size_t MARK_SIZE = 9;
+const size_t MAX_BLOCK_STEPS = BLOCK_SIZE - BLOCK_HEADER_SIZE;  // A step is at least a byte
+
+enum Marker : uint8_t {
+    DIR_CW = 0,
+    DIR_CCW = 1,
+    POSITION = 2
+};
+
+struct ImageHeader {
+    uint16_t blocks;
+    uint16_t marks;
+    uint32_t steps;
+};
+
+struct BlockHeader {
+    uint16_t sequence;
+    uint16_t length;
+    uint32_t time;
+    uint32_t interval;
+    int32_t position;
+    bool reverse;
+};
+
+struct Step {
+    uint32_t time;
+    uint32_t interval;  // From the step before
+    int32_t position;   // After this step
+    bool reverse;
+};
+
+struct Mark {
+    uint32_t time;
+    int32_t position;
+    uint8_t state;
+};
+
+// false if this isn't a trace image of this version
+bool decodeImageHeader(const uint8_t* in, size_t length, ImageHeader& header);
+void decodeBlockHeader(const uint8_t* in, BlockHeader& header);
+// Steps of a block, header.length record bytes at records; -1 if they are malformed
+long decodeBlock(const BlockHeader& header, const uint8_t* records, Step* steps, size_t maxSteps);
+void decodeMark(const uint8_t* in, Mark& mark);
+
+}  // namespace Trace
+
+// Device side. step() runs in the step ISR: a subtraction, a compare and a one-byte store
+// at steady speed, plus a 17-byte header every block. mark() runs in the motion task.
+// start(), stop() and the image readers run in the motion task too; stop() the trace
+// before reading it, so it holds still.
+class TraceRecorder {
+public:
+    static const size_t BLOCKS = 64;     // 16 KB, some 15000 steps at running speed
+    static const uint16_t MARKS = 64;
+
+private:
+    static const size_t MAX_RECORD = 12;  // DIR, POSITION with its jump, and the step
+
+    uint8_t blocks[BLOCKS][Trace::BLOCK_SIZE];
+    Trace::Mark marks[MARKS];
+    volatile bool recording;
+
+    // Step ISR
+    uint32_t head;          // Sequence of the block being written
+    uint16_t used;          // Record bytes in it
+    uint32_t lastTime;
+    uint32_t lastInterval;
+    long lastPosition;
+    bool lastReverse;
+    uint32_t stepCount;
+
+    // Motion task
+    uint32_t markCount;
+
+    void STEP_ISR_ATTR open();
+    size_t blockBytes(uint32_t block) const;
+
+public:
+    TraceRecorder();
+    // Drop what was recorded and record from now on; reverse and position are axis 0's
+    void start(uint32_t now, long position, bool reverse);
+    void stop();
+    bool isRecording() const { return recording; }
+
+    void STEP_ISR_ATTR step(uint32_t time, bool reverse, long position);
+    void mark(uint32_t time, long position, uint8_t state);
+
+    uint32_t steps() const { return stepCount; }
+    uint16_t blocksHeld() const { return (uint16_t)(head < BLOCKS ? head + 1 : BLOCKS); }
+    uint16_t marksHeld() const { return (uint16_t)(markCount < MARKS ? markCount : MARKS); }
+
+    // The image TRACE DUMP sends, while stopped
+    size_t imageSize() const;
+    // Copies up to length bytes of the image from offset; returns how many
+    size_t readImage(size_t offset, uint8_t* out, size_t length) const;
+};
@@ -0,0 +1,345 @@
+#include "Arduino.h"
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+
+HardwareSerial Serial;
+
+namespace {
+
+const int PIN_COUNT = 64;
+
+std::atomic<uint64_t> clockMicros(0);
+std::atomic<bool> freeRunning(false);
+std::recursive_mutex interruptLock;
+
+Sim::TimerAdvance timerAdvance = nullptr;
+void* timerContext = nullptr;
+
+std::mutex pinLock;
+uint8_t pinLevels[PIN_COUNT];
+Sim::Edge edges[Sim::MAX_EDGES];
+size_t recordedEdges = 0;
+
+std::mutex serialLock;
+std::deque<uint8_t> serialIn;
+std::string serialOut;
+bool echo = false;
+int txSpace = 128;
+unsigned long txBaud = 0;   // 0: the TX FIFO drains instantly
+uint64_t txQueued = 0;      // Bytes still in the FIFO
+uint64_t txDrainedAt = 0;   // Virtual time the FIFO was last drained to
+
+// Take out of the FIFO what the line has sent since the last call, ten bits per byte.
+// Call with serialLock held.
+void drainTx() {
+    if (txBaud == 0) {
+        txQueued = 0;
+        return;
+    }
+    uint64_t now = clockMicros;
+    uint64_t sent = (now - txDrainedAt) * txBaud / 10000000ULL;
+    if (sent >= txQueued) {
+        txQueued = 0;
+        txDrainedAt = now;
+    } else {
+        txQueued -= sent;
+        txDrainedAt += sent * 10000000ULL / txBaud;
+    }
+}
+
+void waitUntil(uint64_t target) {
+    while (clockMicros < target) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+}  // namespace
+
+// String
+
+String::String(double value, unsigned int decimals) {
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "%.*f", (int)decimals, value);
+    text = buffer;
+}
+
+int String::indexOf(char value, unsigned int from) const {
+    size_t found = text.find(value, from);
+    return found == std::string::npos ? -1 : (int)found;
+}
+
+int String::indexOf(const String& value, unsigned int from) const {
+    size_t found = text.find(value.text, from);
+    return found == std::string::npos ? -1 : (int)found;
+}
+
+String String::substring(unsigned int from) const {
+    return from < text.size() ? String(text.substr(from)) : String();
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+    if (from > to) {
+        unsigned int swap = from;
+        from = to;
+        to = swap;
+    }
+    return from < text.size() ? String(text.substr(from, to - from)) : String();
+}
+
+void String::trim() {
+    size_t first = text.find_first_not_of(" \t\r\n");
+    size_t last = text.find_last_not_of(" \t\r\n");
+    text = first == std::string::npos ? std::string() : text.substr(first, last - first + 1);
+}
+
+void String::toUpperCase() {
+    for (char& c : text) {
+        if (c >= 'a' && c <= 'z') {
+            c = (char)(c - 'a' + 'A');
+        }
+    }
+}
+
+// Time
+
+unsigned long millis() {
+    return (unsigned long)(clockMicros / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long)(uint32_t)clockMicros;  // Wraps at 32 bits like the ESP32 core
+}
+
+void delay(unsigned long ms) {
+    if (freeRunning) {
+        waitUntil(clockMicros + ms * 1000ULL);
+    } else {
+        Sim::advance(ms * 1000ULL);
+    }
+}
+
+void delayMicroseconds(unsigned int us) {
+    if (freeRunning) {
+        waitUntil(clockMicros + us);
+    } else {
+        Sim::advance(us);
+    }
+}
+
+// Pins
+
+void pinMode(uint8_t, uint8_t) {}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+    if (pin >= PIN_COUNT) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(pinLock);
+    level = level ? HIGH : LOW;
+    if (pinLevels[pin] == level) {
+        return;
+    }
+    pinLevels[pin] = level;
+    edges[recordedEdges % Sim::MAX_EDGES] = { clockMicros, pin, level };
+    recordedEdges++;
+}
+
+int digitalRead(uint8_t pin) {
+    return Sim::pinLevel(pin);
+}
+
+int analogRead(uint8_t) {
+    return 0;
+}
+
+long random(long max) {
+    return max > 0 ? rand() % max : 0;
+}
+
+long random(long min, long max) {
+    return max > min ? min + rand() % (max - min) : min;
+}
+
+void randomSeed(unsigned long seed) {
+    srand((unsigned int)seed);
+}
+
+void noInterrupts() {
+    interruptLock.lock();
+}
+
+void interrupts() {
+    interruptLock.unlock();
+}
+
+// Serial
+
+void HardwareSerial::begin(unsigned long) {}
+
+int HardwareSerial::available() {
+    std::lock_guard<std::mutex> guard(serialLock);
+    return (int)serialIn.size();
+}
+
+int HardwareSerial::read() {
+    std::lock_guard<std::mutex> guard(serialLock);
+    if (serialIn.empty()) {
+        return -1;
+    }
+    int byte = serialIn.front();
+    serialIn.pop_front();
+    return byte;
+}
+
+int HardwareSerial::peek() {
+    std::lock_guard<std::mutex> guard(serialLock);
+    return serialIn.empty() ? -1 : serialIn.front();
+}
+
+int HardwareSerial::availableForWrite() {
+    std::lock_guard<std::mutex> guard(serialLock);
+    drainTx();
+    return txQueued < (uint64_t)txSpace ? txSpace - (int)txQueued : 0;
+}
+
+size_t HardwareSerial::write(const uint8_t* data, size_t length) {
+    std::lock_guard<std::mutex> guard(serialLock);
+    drainTx();
+    txQueued += length;
+    serialOut.append((const char*)data, length);
+    if (echo) {
+        fwrite(data, 1, length, stdout);
+        fflush(stdout);
+    }
+    return length;
+}
+
+size_t HardwareSerial::write(uint8_t byte) {
+    return write(&byte, 1);
+}
+
+size_t HardwareSerial::print(const char* text) {
+    return write((const uint8_t*)text, strlen(text));
+}
+
+size_t HardwareSerial::print(const String& text) {
+    return print(text.c_str());
+}
+
+size_t HardwareSerial::println(const char* text) {
+    size_t written = print(text);
+    return written + print("\r\n");
+}
+
+size_t HardwareSerial::println(const String& text) {
+    return println(text.c_str());
+}
+
+// Simulation controls
+
+namespace Sim {
+
+uint64_t now() {
+    return clockMicros;
+}
+
+void advance(uint64_t micros) {
+    std::lock_guard<std::recursive_mutex> guard(interruptLock);
+    if (timerAdvance != nullptr) {
+        timerAdvance(timerContext, micros);
+    }
+    clockMicros += micros;
+}
+
+void setFreeRunning(bool enabled) {
+    freeRunning = enabled;
+}
+
+bool isFreeRunning() {
+    return freeRunning;
+}
+
+void attachTimer(TimerAdvance advance, void* context) {
+    std::lock_guard<std::recursive_mutex> guard(interruptLock);
+    timerAdvance = advance;
+    timerContext = context;
+}
+
+int pinLevel(uint8_t pin) {
+    std::lock_guard<std::mutex> guard(pinLock);
+    return pin < PIN_COUNT ? pinLevels[pin] : LOW;
+}
+
+size_t edgeCount() {
+    std::lock_guard<std::mutex> guard(pinLock);
+    return recordedEdges;
+}
+
+Edge edge(size_t index) {
+    std::lock_guard<std::mutex> guard(pinLock);
+    return edges[index % MAX_EDGES];
+}
+
+void clearEdges() {
+    std::lock_guard<std::mutex> guard(pinLock);
+    recordedEdges = 0;
+}
+
+void serialInput(const uint8_t* data, size_t length) {
+    std::lock_guard<std::mutex> guard(serialLock);
+    serialIn.insert(serialIn.end(), data, data + length);
+}
+
+void serialInput(const char* text) {
+    serialInput((const uint8_t*)text, strlen(text));
+}
+
+std::string serialOutput() {
+    std::lock_guard<std::mutex> guard(serialLock);
+    return serialOut;
+}
+
+void clearSerialOutput() {
+    std::lock_guard<std::mutex> guard(serialLock);
+    serialOut.clear();
+}
+
+void setEcho(bool enabled) {
+    std::lock_guard<std::mutex> guard(serialLock);
+    echo = enabled;
+}
+
+void setTxSpace(int bytes) {
+    std::lock_guard<std::mutex> guard(serialLock);
+    txSpace = bytes;
+}
+
+void setBaudRate(unsigned long baud) {
+    std::lock_guard<std::mutex> guard(serialLock);
+    drainTx();
+    txBaud = baud;
+    txDrainedAt = clockMicros;
+}
+
+void reset() {
+    attachTimer(nullptr, nullptr);
+    clockMicros = 0;
+    clearEdges();
+    {
+        std::lock_guard<std::mutex> guard(pinLock);
+        memset(pinLevels, 0, sizeof(pinLevels));
+    }
+    std::lock_guard<std::mutex> guard(serialLock);
+    serialIn.clear();
+    serialOut.clear();
+    txSpace = 128;
+    txBaud = 0;
+    txQueued = 0;
+    txDrainedAt = 0;
+}
+
+}  // namespace Sim
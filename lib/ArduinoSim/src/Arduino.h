@@ -0,0 +1,98 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+// Host stand-in for the subset of the Arduino core this firmware uses.
+// Time is virtual (see ArduinoSim.h): micros()/millis() only move when the simulation
+// advances them, so the real step path runs deterministically on Linux.
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+typedef uint8_t byte;
+
+class String {
+private:
+    std::string text;
+
+public:
+    String(const char* value = "") : text(value != nullptr ? value : "") {}
+    String(const std::string& value) : text(value) {}
+    explicit String(char value) : text(1, value) {}
+    String(int value) : text(std::to_string(value)) {}
+    String(unsigned int value) : text(std::to_string(value)) {}
+    String(long value) : text(std::to_string(value)) {}
+    String(unsigned long value) : text(std::to_string(value)) {}
+    String(float value, unsigned int decimals = 2) : String((double)value, decimals) {}
+    String(double value, unsigned int decimals = 2);
+
+    unsigned int length() const { return (unsigned int)text.size(); }
+    const char* c_str() const { return text.c_str(); }
+    char operator[](unsigned int index) const { return index < text.size() ? text[index] : '\0'; }
+
+    String& operator+=(const String& other) { text += other.text; return *this; }
+    friend String operator+(const String& left, const String& right) { return String(left.text + right.text); }
+    friend String operator+(const char* left, const String& right) { return String(left + right.text); }
+    bool operator==(const String& other) const { return text == other.text; }
+    bool operator==(const char* other) const { return text == other; }
+    bool operator!=(const String& other) const { return text != other.text; }
+    bool operator!=(const char* other) const { return text != other; }
+    bool equals(const String& other) const { return text == other.text; }
+
+    int indexOf(char value, unsigned int from = 0) const;
+    int indexOf(const String& value, unsigned int from = 0) const;
+    bool startsWith(const String& prefix) const { return text.compare(0, prefix.text.size(), prefix.text) == 0; }
+    String substring(unsigned int from) const;
+    String substring(unsigned int from, unsigned int to) const;
+    long toInt() const { return atol(text.c_str()); }
+    float toFloat() const { return (float)atof(text.c_str()); }
+    void trim();
+    void toUpperCase();
+};
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+// Masks the simulated timer interrupt (see Sim::advance)
+void noInterrupts();
+void interrupts();
+
+class HardwareSerial {
+public:
+    void begin(unsigned long baud);
+    int available();
+    int read();
+    int peek();
+    int availableForWrite();
+    size_t write(uint8_t byte);
+    size_t write(const uint8_t* data, size_t length);
+    size_t print(const String& text);
+    size_t print(const char* text);
+    size_t println(const String& text);
+    size_t println(const char* text = "");
+    void flush() {}
+    operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#include "ArduinoSim.h"
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+// Controls for the fake Arduino layer.
+//
+// Stepped mode (the default) is fully deterministic: the clock only moves through
+// advance(), and delay() advances it itself. Free-running mode (the native program in
+// SimMain.cpp) drives the clock from wall time on its own thread and delay() waits for it.
+namespace Sim {
+
+// One recorded digitalWrite() level change
+struct Edge {
+    uint64_t time;  // Virtual microseconds
+    uint8_t pin;
+    uint8_t level;
+};
+
+typedef void (*TimerAdvance)(void* context, uint64_t micros);
+
+const size_t MAX_EDGES = 4096;  // Oldest edges are overwritten
+
+// Virtual clock
+uint64_t now();
+// Move the clock forward, running the attached timer (the step ISR) on the way.
+// Holds the interrupt lock, so noInterrupts() sections never see a half-run alarm.
+void advance(uint64_t micros);
+void setFreeRunning(bool enabled);
+bool isFreeRunning();
+// The simulated hardware timer; SimStepHal attaches itself in begin()
+void attachTimer(TimerAdvance advance, void* context);
+
+// Pins
+int pinLevel(uint8_t pin);
+size_t edgeCount();       // Total recorded, including overwritten ones
+Edge edge(size_t index);
+void clearEdges();
+
+// Serial: input is scripted, output is captured (and optionally echoed to stdout)
+void serialInput(const char* text);
+void serialInput(const uint8_t* data, size_t length);
+std::string serialOutput();
+void clearSerialOutput();
+void setEcho(bool enabled);
+void setTxSpace(int bytes);  // Size of the TX FIFO Serial.availableForWrite() reports, 128 by default
+// Drain the TX FIFO at this line rate in virtual time (8N1, ten bits a byte) instead of
+// instantly. Writes never block; a FIFO written past full just takes longer to drain.
+void setBaudRate(unsigned long baud);
+
+// Back to time zero with no pins, edges, serial data or timer
+void reset();
+
+}  // namespace Sim
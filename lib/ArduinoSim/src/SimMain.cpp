@@ -0,0 +1,72 @@
+// Entry point of the native program: runs the firmware against the fake Arduino layer in
+// real time, with stdin as the serial input and stdout as its output.
+//
+//   .pio/build/native/program [seconds [baud]]
+//
+// Without an argument it runs until interrupted; with one it exits after that many
+// seconds (0 for no limit), so a scripted session can be piped in. A baud rate makes
+// Serial drain at that line rate instead of instantly. Unit tests and the benchmark
+// (SIM_NO_MAIN) bring their own main().
+#if !defined(PIO_UNIT_TESTING) && !defined(SIM_NO_MAIN)
+
+#include "Arduino.h"
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+
+void setup();
+void loop();
+
+namespace {
+
+const uint64_t CLOCK_SLICE_MICROS = 100;
+
+// Raw reads, since binary frames may carry NUL bytes and need not end a line
+void readInput() {
+    uint8_t buffer[256];
+    ssize_t length;
+    while ((length = read(0, buffer, sizeof(buffer))) > 0) {
+        Sim::serialInput(buffer, (size_t)length);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    uint64_t limitMicros = argc > 1 ? (uint64_t)(atof(argv[1]) * 1000000.0) : 0;
+    if (argc > 2) {
+        Sim::setBaudRate(strtoul(argv[2], nullptr, 10));
+    }
+
+    Sim::setEcho(true);
+    Sim::setFreeRunning(true);
+
+    std::thread input(readInput);
+    input.detach();
+
+    // Arduino's loopTask: setup() once, then loop() forever
+    std::thread arduino([] {
+        setup();
+        for (;;) {
+            loop();
+        }
+    });
+    arduino.detach();
+
+    // Drive the virtual clock from wall time in small slices so alarms fire close to on time
+    auto start = std::chrono::steady_clock::now();
+    while (limitMicros == 0 || Sim::now() < limitMicros) {
+        std::this_thread::sleep_for(std::chrono::microseconds(CLOCK_SLICE_MICROS));
+        uint64_t elapsed = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        if (elapsed > Sim::now()) {
+            Sim::advance(elapsed - Sim::now());
+        }
+    }
+
+    // The firmware tasks never return; skip static destructors they may still be using
+    fflush(stdout);
+    _Exit(0);
+}
+
+#endif
@@ -0,0 +1,441 @@
+#include "StationClient.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace {
+
+const uint16_t MAX_TAG = Frame::TAG_FINAL - 1;
+const size_t READ_CHUNK = 4096;
+
+struct BaudRate {
+    unsigned long baud;
+    speed_t speed;
+};
+
+const BaudRate BAUD_RATES[] = {
+    { 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 }, { 115200, B115200 },
+    { 230400, B230400 }, { 460800, B460800 }, { 921600, B921600 },
+};
+
+}  // namespace
+
+StationClient::StationClient() :
+    fd(-1),
+    binary(false),
+    window(DEFAULT_WINDOW),
+    inFlight(0),
+    nextTag(1),
+    sentBytes(0),
+    receivedBytes(0),
+    strays(0) {}
+
+StationClient::~StationClient() {
+    close();
+}
+
+bool StationClient::open(const char* device, unsigned long baud) {
+    const BaudRate* rate = nullptr;
+    for (const BaudRate& known : BAUD_RATES) {
+        if (known.baud == baud) {
+            rate = &known;
+        }
+    }
+    int port = ::open(device, O_RDWR | O_NOCTTY);
+    if (rate == nullptr || port < 0) {
+        if (port >= 0) {
+            ::close(port);
+        }
+        return false;
+    }
+
+    struct termios settings;
+    if (tcgetattr(port, &settings) != 0) {
+        ::close(port);
+        return false;
+    }
+    cfmakeraw(&settings);
+    cfsetispeed(&settings, rate->speed);
+    cfsetospeed(&settings, rate->speed);
+    settings.c_cflag |= CLOCAL | CREAD;
+    settings.c_cc[VMIN] = 1;
+    settings.c_cc[VTIME] = 0;
+    if (tcsetattr(port, TCSANOW, &settings) != 0) {
+        ::close(port);
+        return false;
+    }
+    attach(port);
+    return true;
+}
+
+void StationClient::attach(int descriptor) {
+    close();
+    fd = descriptor;
+    binary = false;
+    line.clear();
+    decoder.reset();
+}
+
+void StationClient::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    pending.clear();
+    unsent.clear();
+    inFlight = 0;
+}
+
+bool StationClient::hello(bool wantBinary, int timeoutMs) {
+    const char* command = wantBinary ? "HELLO BIN TAG" : "HELLO TAG";
+    const char* ready = wantBinary ? "READY BIN TAG\r\n" : "READY TAG\r\n";
+
+    // A binary session takes the HELLO as a frame; its reply is text either way
+    if (binary) {
+        uint8_t frame[Frame::MAX_FRAME];
+        size_t size = Frame::encode(Frame::COMMAND, (const uint8_t*)command, (uint8_t)strlen(command), frame);
+        binary = false;
+        if (!writeAll(frame, size)) {
+            return false;
+        }
+    } else {
+        std::string text = std::string(command) + "\n";
+        if (!writeAll(text.data(), text.size())) {
+            return false;
+        }
+    }
+    line.clear();
+    decoder.reset();
+
+    std::string text;
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (Clock::now() < deadline) {
+        std::string received;
+        if (!readLink(100, received)) {
+            return false;
+        }
+        text += received;
+        size_t found = text.find(ready);
+        if (found != std::string::npos) {
+            binary = wantBinary;
+            receive(text.substr(found + strlen(ready)));
+            return true;
+        }
+    }
+    return false;
+}
+
+uint16_t StationClient::allocateTag() {
+    for (;;) {
+        uint16_t tag = nextTag;
+        nextTag = nextTag >= MAX_TAG ? 1 : nextTag + 1;
+        if (pending.find(tag) == pending.end()) {
+            return tag;
+        }
+    }
+}
+
+uint16_t StationClient::submit(const std::string& command, Completion done) {
+    uint16_t tag = allocateTag();
+    Request& request = pending[tag];
+    request.result.tag = tag;
+    request.result.command = command;
+    request.result.retries = 0;
+    request.result.answerSeconds = 0;
+    request.result.seconds = 0;
+    request.done = done;
+    request.sent = false;
+    request.answered = false;
+    unsent.push_back(tag);
+    return tag;
+}
+
+bool StationClient::writeAll(const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        bytes += written;
+        length -= (size_t)written;
+        sentBytes += (uint64_t)written;
+    }
+    return true;
+}
+
+void StationClient::sendWaiting() {
+    while (!unsent.empty() && inFlight < window) {
+        uint16_t tag = unsent.front();
+        unsent.pop_front();
+        Request& request = pending[tag];
+
+        char prefix[8];
+        snprintf(prefix, sizeof(prefix), "#%u ", (unsigned)tag);
+        std::string text = prefix + request.result.command;
+        if (binary) {
+            uint8_t frame[Frame::MAX_FRAME];
+            size_t size = text.size() <= Frame::MAX_PAYLOAD
+                ? Frame::encode(Frame::COMMAND, (const uint8_t*)text.data(), (uint8_t)text.size(), frame) : 0;
+            if (size == 0) {
+                // Doesn't fit a frame, so the station would never see it
+                Message tooLong = { REPLY, tag, true, Frame::RESPONSE, "TOO_LONG" };
+                request.sent = true;
+                request.sentAt = Clock::now();
+                inFlight++;
+                deliver(tooLong);
+                continue;
+            }
+            writeAll(frame, size);
+        } else {
+            text += '\n';
+            writeAll(text.data(), text.size());
+        }
+        request.sent = true;
+        request.sentAt = Clock::now();
+        inFlight++;
+    }
+}
+
+bool StationClient::readLink(int timeoutMs, std::string& received) {
+    struct pollfd ready = { fd, POLLIN, 0 };
+    if (::poll(&ready, 1, timeoutMs) <= 0) {
+        return fd >= 0;
+    }
+    char buffer[READ_CHUNK];
+    ssize_t got = read(fd, buffer, sizeof(buffer));
+    if (got < 0 && errno == EINTR) {
+        return true;
+    }
+    if (got <= 0) {
+        return false;
+    }
+    receivedBytes += (uint64_t)got;
+    received.assign(buffer, (size_t)got);
+    return true;
+}
+
+void StationClient::receive(const std::string& received) {
+    for (char byte : received) {
+        if (binary) {
+            if (decoder.push((uint8_t)byte)) {
+                receiveFrame();
+            }
+        } else if (byte == '\n') {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty()) {
+                receiveLine(line);
+            }
+            line.clear();
+        } else {
+            line += byte;
+        }
+    }
+}
+
+// "#{tag} reply", "={tag} final reply", "!{tag} event", "* log"; anything else is from
+// before the session was tagged
+void StationClient::receiveLine(const std::string& text) {
+    Message message = { REPLY, 0, false, Frame::RESPONSE, text };
+    char channel = text[0];
+    if (channel == '*' && text.size() >= 2 && text[1] == ' ') {
+        message.channel = LOG;
+        message.type = Frame::LOG;
+        message.text = text.substr(2);
+    } else if ((channel == '#' || channel == '=' || channel == '!') && text.size() >= 2 && text[1] >= '0' &&
+               text[1] <= '9') {
+        size_t space = text.find(' ');
+        message.channel = channel == '!' ? EVENT : REPLY;
+        message.tag = (uint16_t)strtoul(text.c_str() + 1, nullptr, 10);
+        message.final = channel == '=';
+        message.text = space == std::string::npos ? std::string() : text.substr(space + 1);
+    }
+    deliver(message);
+}
+
+void StationClient::receiveFrame() {
+    Message message = { EVENT, 0, false, decoder.type(), std::string() };
+    const uint8_t* payload = decoder.payload();
+    size_t length = decoder.length();
+    if (message.type != Frame::LOG && message.type != Frame::STREAM) {
+        if (length < Frame::TAG_SIZE) {
+            return;
+        }
+        length -= Frame::TAG_SIZE;
+        uint16_t trailer = Frame::get16(payload + length);
+        message.tag = trailer & MAX_TAG;
+        message.final = (trailer & Frame::TAG_FINAL) != 0;
+    }
+
+    // Events as the text session would show them
+    char text[96];
+    text[0] = '\0';
+    switch (message.type) {
+        case Frame::RESPONSE:
+        case Frame::LOG:
+            message.channel = message.type == Frame::LOG ? LOG : REPLY;
+            message.text.assign((const char*)payload, length);
+            deliver(message);
+            return;
+        case Frame::STREAM:
+            message.text.assign((const char*)payload, length);
+            deliver(message);
+            return;
+        case Frame::TURN:
+        case Frame::FOLLOW:
+        case Frame::STALL:
+            if (length >= 4) {
+                const char* name = message.type == Frame::TURN ? "TURN" : message.type == Frame::FOLLOW ? "FOLLOW" : "STALL";
+                snprintf(text, sizeof(text), "%s:%ld", name, (long)(int32_t)Frame::get32(payload));
+            }
+            break;
+        case Frame::LOAD:
+            if (length >= 2) {
+                snprintf(text, sizeof(text), "LOAD:%.1f%%", Frame::get16(payload) / 10.0f);
+            }
+            break;
+        case Frame::DONE:
+            snprintf(text, sizeof(text), "DONE");
+            break;
+        case Frame::SEGDONE:
+            if (length >= 3) {
+                snprintf(text, sizeof(text), "SEGDONE:%u FREE:%u", (unsigned)Frame::get16(payload), (unsigned)payload[2]);
+            }
+            break;
+        case Frame::STATUS:
+            if (length >= Frame::STATUS_SIZE) {
+                Frame::StatusRecord status;
+                Frame::decodeStatus(payload, status);
+                message.channel = REPLY;
+                snprintf(text, sizeof(text), "STATUS STATE:%u RPM:%u ROT:%lu/%lu MS:%lu FOLLOW:%d LOAD:%.1f%%",
+                         (unsigned)status.state, (unsigned)status.rpm, (unsigned long)status.completedRotations,
+                         (unsigned long)status.targetRotations, (unsigned long)status.elapsedMillis,
+                         (int)status.followingError, status.loadTenths / 10.0f);
+            }
+            break;
+        default:
+            return;
+    }
+    if (text[0] == '\0') {
+        return;  // Cut short
+    }
+    message.text = text;
+    deliver(message);
+}
+
+void StationClient::deliver(const Message& message) {
+    if (message.tag == 0 || message.channel == LOG) {
+        if (listener) {
+            listener(message);
+        }
+        return;
+    }
+
+    auto found = pending.find(message.tag);
+    if (found == pending.end() || !found->second.sent) {
+        strays++;
+        if (listener) {
+            listener(message);
+        }
+        return;
+    }
+
+    Request& request = found->second;
+    auto now = Clock::now();
+    if (!request.answered) {
+        request.answered = true;
+        inFlight--;
+        request.result.answerSeconds = std::chrono::duration<double>(now - request.sentAt).count();
+    }
+    if (!message.final) {
+        (message.channel == EVENT ? request.result.events : request.result.replies).push_back(message.text);
+        return;
+    }
+
+    // The command queue was full and the command never ran
+    if (message.text == "BUSY" && request.result.retries < MAX_RETRIES) {
+        request.result.retries++;
+        request.sent = false;
+        request.answered = false;
+        unsent.push_front(message.tag);
+        return;
+    }
+
+    request.result.reply = message.text;
+    request.result.seconds = std::chrono::duration<double>(now - request.sentAt).count();
+    Result result = std::move(request.result);
+    Completion done = std::move(request.done);
+    pending.erase(found);
+    if (done) {
+        done(result);
+    }
+}
+
+bool StationClient::poll(int timeoutMs) {
+    if (fd < 0) {
+        return false;
+    }
+    sendWaiting();
+    std::string received;
+    if (!readLink(timeoutMs, received)) {
+        return false;
+    }
+    receive(received);
+    sendWaiting();
+    return true;
+}
+
+bool StationClient::drain(int timeoutMs) {
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (!pending.empty() && Clock::now() < deadline) {
+        if (!poll(10)) {
+            return false;
+        }
+    }
+    return pending.empty();
+}
+
+bool StationClient::request(const std::string& command, Result& result, int timeoutMs) {
+    bool finished = false;
+    uint16_t tag = submit(command, [&](const Result& reply) {
+        result = reply;
+        finished = true;
+    });
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (!finished && Clock::now() < deadline) {
+        if (!poll(10)) {
+            break;
+        }
+    }
+    if (!finished) {
+        forget(tag);  // Its completion refers to this frame
+    }
+    return finished;
+}
+
+void StationClient::forget(uint16_t tag) {
+    auto found = pending.find(tag);
+    if (found == pending.end()) {
+        return;
+    }
+    if (found->second.sent && !found->second.answered) {
+        inFlight--;
+    }
+    pending.erase(found);
+    for (auto at = unsent.begin(); at != unsent.end(); ++at) {
+        if (*at == tag) {
+            unsent.erase(at);
+            break;
+        }
+    }
+}
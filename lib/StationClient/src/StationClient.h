@@ -0,0 +1,127 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "FrameCodec.h"
+
+// Linux host side of the station's tagged requests (SerialManager.h): commands are
+// pipelined instead of sent one at a time, and every reply, event and final answer comes
+// back to the request it belongs to.
+//
+//   StationClient client;
+//   client.open("/dev/ttyUSB0", 115200);
+//   client.hello(false, 5000);
+//   client.submit("RPM:300 ROT:2", [](const StationClient::Result& move) { ... DONE ... });
+//   client.submit("POS", [](const StationClient::Result& pos) { ... POS:{steps} ... });
+//   client.drain(10000);
+//
+// Requests are tagged and written as long as fewer than the window are unanswered, the
+// window being the station's command queue; a request is answered by its first reply,
+// which the station sends once the command has run. BUSY is resent. Completions, logs and
+// the rest run from poll(), on the caller's thread. Text and binary (HELLO BIN TAG)
+// sessions look the same from here: binary events and STATUS records are turned into
+// the text lines a text session would show.
+class StationClient {
+public:
+    enum Channel : uint8_t { REPLY, EVENT, LOG };
+
+    // One line or frame from the station
+    struct Message {
+        Channel channel;
+        uint16_t tag;      // 0 when untagged
+        bool final;        // The tagged request's last
+        uint8_t type;      // Frame::Type in binary sessions; RESPONSE or LOG in text ones
+        std::string text;  // Reply, event ("TURN:2") or log line; a STREAM frame's raw batch
+    };
+
+    // A request that has had its final reply
+    struct Result {
+        uint16_t tag;
+        std::string command;
+        std::string reply;                 // The final one
+        std::vector<std::string> replies;  // Those before it (STARTED, HOMING, CONFIG lines, ...)
+        std::vector<std::string> events;   // TURN, SEGDONE, LOAD, ... of a move it started
+        uint32_t retries;                  // Sent again after BUSY
+        double answerSeconds;              // From the last sending to the first reply
+        double seconds;                    // ... to the final reply
+    };
+
+    typedef std::function<void(const Result& result)> Completion;
+    typedef std::function<void(const Message& message)> Listener;
+
+    static const size_t DEFAULT_WINDOW = 8;  // The station's command queue
+    static const uint32_t MAX_RETRIES = 100;
+
+    StationClient();
+    ~StationClient();
+
+    // A serial port in raw mode at baud; false if it can't be opened or the rate is unknown
+    bool open(const char* device, unsigned long baud);
+    // A descriptor that is already set up, such as a pty; closed by close()
+    void attach(int fd);
+    void close();
+    // HELLO TAG (or HELLO BIN TAG) from a text session, as after a reset; false if READY
+    // doesn't come within timeoutMs
+    bool hello(bool binary, int timeoutMs);
+
+    void setWindow(size_t requests) { window = requests > 0 ? requests : 1; }
+    // Logs, untagged output and anything tagged that no request is waiting for
+    void setListener(Listener handler) { listener = handler; }
+
+    // Queues a command line (no tag, no newline) and returns its tag; done runs once it
+    // has its final reply
+    uint16_t submit(const std::string& command, Completion done = nullptr);
+    // Sends what the window allows and handles what arrives within timeoutMs; false once
+    // the link is gone
+    bool poll(int timeoutMs);
+    // Polls until every request has its final reply; false on timeout or a lost link
+    bool drain(int timeoutMs);
+    // One request, waited for; dropped if it times out
+    bool request(const std::string& command, Result& result, int timeoutMs);
+
+    size_t waiting() const { return pending.size(); }  // Submitted, no final reply yet
+    size_t unanswered() const { return inFlight; }      // Sent, no reply yet
+    uint64_t bytesSent() const { return sentBytes; }
+    uint64_t bytesReceived() const { return receivedBytes; }
+    unsigned long strayMessages() const { return strays; }  // Tagged, but not for a request
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Request {
+        Result result;
+        Completion done;
+        Clock::time_point sentAt;
+        bool sent;
+        bool answered;
+    };
+
+    int fd;
+    bool binary;
+    size_t window;
+    size_t inFlight;
+    uint16_t nextTag;
+    uint64_t sentBytes;
+    uint64_t receivedBytes;
+    unsigned long strays;
+    std::unordered_map<uint16_t, Request> pending;
+    std::deque<uint16_t> unsent;
+    std::string line;  // Text received since the last newline
+    FrameDecoder decoder;
+    Listener listener;
+
+    uint16_t allocateTag();
+    bool writeAll(const void* data, size_t length);
+    void sendWaiting();
+    bool readLink(int timeoutMs, std::string& received);
+    void receive(const std::string& received);
+    void receiveLine(const std::string& text);
+    void receiveFrame();
+    void deliver(const Message& message);
+    void forget(uint16_t tag);
+};
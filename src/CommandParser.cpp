@@ -0,0 +1,259 @@
+#include "CommandParser.h"
+#include <string.h>
+
+const CommandField* ParsedCommand::find(const char* key) const {
+    for (uint8_t i = 0; i < count; i++) {
+        if (strcmp(fields[i].key, key) == 0) {
+            return &fields[i];
+        }
+    }
+    return nullptr;
+}
+
+long ParsedCommand::getInt(const char* key, long fallback) const {
+    const CommandField* field = find(key);
+    return field != nullptr && field->hasValue ? field->number : fallback;
+}
+
+const char* ParsedCommand::getText(const char* key, const char* fallback) const {
+    const CommandField* field = find(key);
+    return field != nullptr && field->hasValue ? field->value : fallback;
+}
+
+CommandParser::CommandParser() :
+    head(0),
+    tail(0),
+    overflowCount(0),
+    rejectedCount(0),
+    state(SKIP_SPACE),
+    keyLength(0),
+    valueLength(0),
+    negative(false),
+    digits(true) {}
+
+void CommandParser::reset() {
+    head = 0;
+    tail = 0;
+    state = SKIP_SPACE;
+    current.count = 0;
+    current.tag = 0;
+    current.malformed = false;
+}
+
+bool CommandParser::feed(uint8_t byte) {
+    size_t next = (head + 1) & (RING_SIZE - 1);
+    if (next == tail) {
+        overflowCount++;
+        return false;
+    }
+    ring[head] = byte;
+    head = next;
+    return true;
+}
+
+size_t CommandParser::feed(const uint8_t* data, size_t length) {
+    size_t accepted = 0;
+    while (accepted < length && feed(data[accepted])) {
+        accepted++;
+    }
+    overflowCount += length - accepted - (accepted < length ? 1 : 0);
+    return accepted;
+}
+
+bool CommandParser::poll(ParsedCommand& command) {
+    while (tail != head) {
+        uint8_t byte = ring[tail];
+        tail = (tail + 1) & (RING_SIZE - 1);
+
+        if (consume(byte)) {
+            command = current;
+            current.count = 0;
+            current.tag = 0;
+            current.malformed = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CommandParser::startField() {
+    if (current.count >= ParsedCommand::MAX_FIELDS) {
+        discard();
+        return;
+    }
+
+    CommandField& field = current.fields[current.count];
+    field.key[0] = '\0';
+    field.value[0] = '\0';
+    field.hasValue = false;
+    field.number = 0;
+    keyLength = 0;
+    valueLength = 0;
+    negative = false;
+    digits = true;
+    state = READ_KEY;
+}
+
+void CommandParser::finishField() {
+    CommandField& field = current.fields[current.count];
+    field.key[keyLength] = '\0';
+    field.value[valueLength] = '\0';
+    if (negative) {
+        field.number = -field.number;
+    }
+    state = SKIP_SPACE;
+    if (current.count == 0 && current.tag == 0 && field.key[0] == '#' && !field.hasValue) {
+        if (!takeTag(field)) {
+            discard();
+        }
+        return;
+    }
+    current.count++;
+}
+
+// "#{tag}" in front of the command; false if it isn't 1..MAX_TAG
+bool CommandParser::takeTag(const CommandField& field) {
+    long tag = 0;
+    for (const char* digit = field.key + 1; *digit != '\0'; digit++) {
+        if (*digit < '0' || *digit > '9' || tag > ParsedCommand::MAX_TAG) {
+            return false;
+        }
+        tag = tag * 10 + (*digit - '0');
+    }
+    if (tag < 1 || tag > ParsedCommand::MAX_TAG) {
+        return false;
+    }
+    current.tag = (uint16_t)tag;
+    return true;
+}
+
+// The line is still handed on, without fields, so the host hears back about it
+void CommandParser::discard() {
+    rejectedCount++;
+    current.count = 0;
+    current.malformed = true;
+    state = DISCARD_LINE;
+}
+
+// Returns true when byte completes a non-empty, tagged or malformed command line
+bool CommandParser::consume(uint8_t byte) {
+    if (byte == '\r') {
+        return false;
+    }
+
+    if (byte == '\n') {
+        if (state == READ_KEY || state == READ_VALUE) {
+            finishField();
+        }
+        bool complete = current.count > 0 || current.tag != 0 || current.malformed;
+        if (!complete) {
+            current.count = 0;
+            current.tag = 0;
+        }
+        state = SKIP_SPACE;
+        return complete;
+    }
+
+    bool space = byte == ' ' || byte == '\t';
+
+    switch (state) {
+        case SKIP_SPACE:
+            if (!space) {
+                startField();
+                return state == READ_KEY ? consume(byte) : false;
+            }
+            return false;
+
+        case READ_KEY: {
+            if (space) {
+                finishField();
+                return false;
+            }
+            CommandField& field = current.fields[current.count];
+            if (byte == ':') {
+                field.hasValue = true;
+                state = READ_VALUE;
+                return false;
+            }
+            if (keyLength >= CommandField::MAX_KEY) {
+                discard();
+                return false;
+            }
+            field.key[keyLength++] = (char)byte;
+            return false;
+        }
+
+        case READ_VALUE: {
+            if (space) {
+                finishField();
+                return false;
+            }
+            if (valueLength >= CommandField::MAX_VALUE) {
+                discard();
+                return false;
+            }
+            CommandField& field = current.fields[current.count];
+            field.value[valueLength++] = (char)byte;
+
+            // Leading integer, parsed on the fly
+            if (digits) {
+                if (byte >= '0' && byte <= '9') {
+                    // Refused rather than wrapped
+                    if (field.number > (CommandField::MAX_NUMBER - (byte - '0')) / 10) {
+                        discard();
+                        return false;
+                    }
+                    field.number = field.number * 10 + (byte - '0');
+                } else if (byte == '-' && valueLength == 1) {
+                    negative = true;
+                } else {
+                    digits = false;
+                }
+            }
+            return false;
+        }
+
+        case DISCARD_LINE:
+            return false;
+    }
+
+    return false;
+}
+
+bool CommandParser::matches(const char* pattern, const ParsedCommand& command) {
+    char token[CommandField::MAX_KEY + 2];
+
+    while (*pattern != '\0') {
+        while (*pattern == ' ') {
+            pattern++;
+        }
+
+        size_t length = 0;
+        while (*pattern != '\0' && *pattern != ' ' && length < sizeof(token) - 1) {
+            token[length++] = *pattern++;
+        }
+        if (length == 0) {
+            break;
+        }
+
+        bool needsValue = token[length - 1] == ':';
+        token[needsValue ? length - 1 : length] = '\0';
+
+        const CommandField* field = command.find(token);
+        if (field == nullptr || field->hasValue != needsValue) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool CommandParser::dispatch(const CommandEntry* table, size_t count, const ParsedCommand& command) {
+    for (size_t i = 0; i < count; i++) {
+        if (matches(table[i].pattern, command)) {
+            table[i].handler(command);
+            return true;
+        }
+    }
+    return false;
+}
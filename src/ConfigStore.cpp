@@ -0,0 +1,242 @@
+#include "ConfigStore.h"
+#include "SpeedLevels.h"
+#include "FrameCodec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <Preferences.h>
+#endif
+
+namespace {
+
+const uint32_t MAGIC = 0x4746434D;  // "MCFG"
+const size_t HEADER = 8;
+const size_t CRC = 2;
+
+struct FieldInfo {
+    const char* name;
+    uint16_t MotorConfig::* member;
+    uint16_t minimum;
+    uint16_t maximum;
+};
+
+// Stored in this order: append only
+const FieldInfo SCALARS[] = {
+    { "STEPPIN",    &MotorConfig::stepPin,            0, 33 },  // GPIO34-39 are input only
+    { "DIRPIN",     &MotorConfig::dirPin,             0, 33 },
+    { "ENAPIN",     &MotorConfig::enablePin,          0, 33 },
+    { "STEPS",      &MotorConfig::stepsPerRevolution, 1, 10000 },
+    { "MICROSTEPS", &MotorConfig::microsteps,         1, 256 },
+    { "MINRPM",     &MotorConfig::minRpm,             1, 6000 },
+    { "MAXRPM",     &MotorConfig::maxRpm,             1, 6000 },
+    { "LOADZERO",   &MotorConfig::loadZeroLevel,      0, 4095 },
+    { "LOADFULL",   &MotorConfig::loadFullLevel,      0, 4095 },
+};
+
+const uint8_t SCALAR_FIELDS = sizeof(SCALARS) / sizeof(SCALARS[0]);
+static_assert(SCALAR_FIELDS + SpeedTable::LEVELS == ConfigStore::FIELDS, "ConfigStore::FIELDS is out of date");
+
+// Speed level delays: one step per 16 us is as fast as MAX_STEP_RATE allows
+const uint16_t DELAY_MINIMUM = 16;
+const uint16_t DELAY_MAXIMUM = 65535;
+
+}  // namespace
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+NvsConfigStorage::NvsConfigStorage(const char* space, const char* key) :
+    space(space),
+    key(key) {}
+
+size_t NvsConfigStorage::read(uint8_t* data, size_t capacity) {
+    Preferences preferences;
+    if (!preferences.begin(space, true)) {
+        return 0;  // Namespace not created yet
+    }
+    size_t length = preferences.getBytesLength(key);
+    size_t read = length > 0 && length <= capacity ? preferences.getBytes(key, data, length) : 0;
+    preferences.end();
+    return read;
+}
+
+bool NvsConfigStorage::write(const uint8_t* data, size_t length) {
+    Preferences preferences;
+    if (!preferences.begin(space, false)) {
+        return false;
+    }
+    bool written = preferences.putBytes(key, data, length) == length;
+    preferences.end();
+    return written;
+}
+
+#else
+
+FileConfigStorage::FileConfigStorage(const char* path) :
+    path(path) {}
+
+size_t FileConfigStorage::read(uint8_t* data, size_t capacity) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return 0;
+    }
+    size_t length = fread(data, 1, capacity, file);
+    fclose(file);
+    return length;
+}
+
+bool FileConfigStorage::write(const uint8_t* data, size_t length) {
+    // Write a temporary file and rename it over the old one, so a crash never leaves half
+    // a blob behind
+    char temporary[256];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    FILE* file = fopen(temporary, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool written = fwrite(data, 1, length, file) == length;
+    written = fclose(file) == 0 && written;
+    return written && rename(temporary, path) == 0;
+}
+
+#endif
+
+ConfigStore::ConfigStore(ConfigStorage& storage) :
+    storage(storage) {}
+
+ConfigStore::Result ConfigStore::load(MotorConfig& config) {
+    uint8_t blob[MAX_BLOB];
+    size_t length = storage.read(blob, sizeof(blob));
+    if (length == 0) {
+        return MISSING;
+    }
+    if (length < HEADER + CRC || Frame::get32(blob) != MAGIC) {
+        return CORRUPT;
+    }
+    uint16_t count = Frame::get16(blob + 6);
+    if (length != HEADER + 2 * (size_t)count + CRC ||
+        Frame::crc16(blob, length - CRC) != Frame::get16(blob + length - CRC)) {
+        return CORRUPT;
+    }
+    if (Frame::get16(blob + 4) > VERSION) {
+        return UNSUPPORTED;
+    }
+
+    // Fields an older version didn't have keep their current values
+    MotorConfig loaded = config;
+    for (uint8_t field = 0; field < count && field < FIELDS; field++) {
+        if (!setField(loaded, field, Frame::get16(blob + HEADER + 2 * field))) {
+            return INVALID;
+        }
+    }
+    if (validate(loaded) != nullptr) {
+        return INVALID;
+    }
+
+    config = loaded;
+    return LOADED;
+}
+
+bool ConfigStore::save(const MotorConfig& config) {
+    uint8_t blob[HEADER + 2 * FIELDS + CRC];
+    Frame::put32(blob, MAGIC);
+    Frame::put16(blob + 4, VERSION);
+    Frame::put16(blob + 6, FIELDS);
+    for (uint8_t field = 0; field < FIELDS; field++) {
+        Frame::put16(blob + HEADER + 2 * field, getField(config, field));
+    }
+    Frame::put16(blob + sizeof(blob) - CRC, Frame::crc16(blob, sizeof(blob) - CRC));
+    return storage.write(blob, sizeof(blob));
+}
+
+const char* ConfigStore::resultName(Result result) {
+    switch (result) {
+        case LOADED:      return "LOADED";
+        case MISSING:     return "MISSING";
+        case CORRUPT:     return "CORRUPT";
+        case UNSUPPORTED: return "UNSUPPORTED";
+        default:          return "INVALID";
+    }
+}
+
+void ConfigStore::fieldName(uint8_t field, char* name, size_t size) {
+    if (field < SCALAR_FIELDS) {
+        snprintf(name, size, "%s", SCALARS[field].name);
+    } else {
+        snprintf(name, size, "DELAY%d", field - SCALAR_FIELDS + 1);
+    }
+}
+
+int ConfigStore::findField(const char* name) {
+    for (uint8_t field = 0; field < SCALAR_FIELDS; field++) {
+        if (strcmp(name, SCALARS[field].name) == 0) {
+            return field;
+        }
+    }
+    if (strncmp(name, "DELAY", 5) == 0 && name[5] >= '1' && name[5] <= '9') {
+        char* end;
+        long level = strtol(name + 5, &end, 10);
+        if (*end == '\0' && level <= SpeedTable::LEVELS) {
+            return SCALAR_FIELDS + (int)level - 1;
+        }
+    }
+    return -1;
+}
+
+uint16_t ConfigStore::getField(const MotorConfig& config, uint8_t field) {
+    if (field < SCALAR_FIELDS) {
+        return config.*SCALARS[field].member;
+    }
+    return config.speedDelay[field - SCALAR_FIELDS];
+}
+
+void ConfigStore::fieldRange(uint8_t field, uint16_t& minimum, uint16_t& maximum) {
+    if (field < SCALAR_FIELDS) {
+        minimum = SCALARS[field].minimum;
+        maximum = SCALARS[field].maximum;
+    } else {
+        minimum = DELAY_MINIMUM;
+        maximum = DELAY_MAXIMUM;
+    }
+}
+
+bool ConfigStore::setField(MotorConfig& config, uint8_t field, long value) {
+    if (field >= FIELDS) {
+        return false;
+    }
+    uint16_t minimum;
+    uint16_t maximum;
+    fieldRange(field, minimum, maximum);
+    if (value < minimum || value > maximum) {
+        return false;
+    }
+
+    if (field < SCALAR_FIELDS) {
+        config.*SCALARS[field].member = (uint16_t)value;
+    } else {
+        config.speedDelay[field - SCALAR_FIELDS] = (uint16_t)value;
+    }
+    return true;
+}
+
+const char* ConfigStore::validate(const MotorConfig& config) {
+    if (config.stepPin == config.dirPin || config.stepPin == config.enablePin ||
+        config.dirPin == config.enablePin) {
+        return "STEPPIN, DIRPIN and ENAPIN must differ";
+    }
+    if (config.minRpm > config.maxRpm) {
+        return "MINRPM above MAXRPM";
+    }
+    uint64_t maxStepRate = (uint64_t)config.maxRpm * config.stepsPerRevolution * config.microsteps / 60;
+    if (maxStepRate > MAX_STEP_RATE) {
+        return "MAXRPM too fast for STEPS x MICROSTEPS";
+    }
+    if (config.loadFullLevel <= config.loadZeroLevel) {
+        return "LOADFULL must be above LOADZERO";
+    }
+    if (SpeedLevels::rampEntries(config.speedDelay) > SpeedLevels::MAX_RAMP_ENTRIES) {
+        return "speed level ramps too long, raise the fastest DELAYs";
+    }
+    return nullptr;
+}
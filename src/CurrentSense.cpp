@@ -0,0 +1,124 @@
+#include "CurrentSense.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+Esp32CurrentSense::Esp32CurrentSense(int pin, uint32_t sampleRate) :
+    pin(pin),
+    rate(sampleRate),
+    channel(-1) {}
+
+bool Esp32CurrentSense::begin() {
+    channel = digitalPinToAnalogChannel(pin);
+    if (channel < 0 || channel >= ADC1_CHANNEL_MAX) {
+        return false;  // Continuous mode only runs on ADC1
+    }
+
+    adc_digi_init_config_t init = {};
+    init.max_store_buf_size = BUFFER_BYTES;
+    init.conv_num_each_intr = FRAME_BYTES / sizeof(adc_digi_output_data_t);
+    init.adc1_chan_mask = 1 << channel;
+    init.adc2_chan_mask = 0;
+    if (adc_digi_initialize(&init) != ESP_OK) {
+        return false;
+    }
+
+    adc_digi_pattern_config_t pattern = {};
+    pattern.atten = ADC_ATTEN_DB_11;  // Full 0-3.1 V range
+    pattern.channel = channel;
+    pattern.unit = 0;                 // ADC1
+    pattern.bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+
+    adc_digi_configuration_t config = {};
+    config.conv_limit_en = 1;
+    config.conv_limit_num = 250;
+    config.pattern_num = 1;
+    config.adc_pattern = &pattern;
+    config.sample_freq_hz = rate;
+    config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+    config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+    if (adc_digi_controller_configure(&config) != ESP_OK) {
+        return false;
+    }
+
+    return adc_digi_start() == ESP_OK;
+}
+
+size_t Esp32CurrentSense::read(uint16_t* samples, size_t maxSamples) {
+    if (channel < 0) {
+        return 0;
+    }
+
+    uint32_t wanted = maxSamples * sizeof(adc_digi_output_data_t);
+    uint32_t received = 0;
+    if (adc_digi_read_bytes(frame, wanted < FRAME_BYTES ? wanted : FRAME_BYTES, &received, 0) != ESP_OK) {
+        return 0;  // Nothing converted yet
+    }
+
+    const adc_digi_output_data_t* data = (const adc_digi_output_data_t*)frame;
+    size_t count = 0;
+    for (uint32_t i = 0; i < received / sizeof(adc_digi_output_data_t); i++) {
+        if (data[i].type1.channel == (uint32_t)channel) {
+            samples[count++] = data[i].type1.data;
+        }
+    }
+    return count;
+}
+
+#else
+
+#include <Arduino.h>
+
+SimCurrentSense::SimCurrentSense(int, uint32_t sampleRate) :
+    rate(sampleRate),
+    produced(0),
+    startMicros(0),
+    level(0),
+    noise(0),
+    seed(1),
+    script(nullptr),
+    scriptLength(0),
+    scriptPosition(0) {}
+
+bool SimCurrentSense::begin() {
+    produced = 0;
+    startMicros = Sim::now();
+    return true;
+}
+
+uint16_t SimCurrentSense::next() {
+    if (scriptPosition < scriptLength) {
+        level = script[scriptPosition++];
+        return level;
+    }
+    if (noise == 0) {
+        return level;
+    }
+
+    seed = seed * 1664525u + 1013904223u;  // LCG, reproducible
+    int32_t value = (int32_t)level + (int32_t)((seed >> 8) % (2u * noise + 1)) - noise;
+    return (uint16_t)(value < 0 ? 0 : value > 4095 ? 4095 : value);
+}
+
+size_t SimCurrentSense::read(uint16_t* samples, size_t maxSamples) {
+    uint64_t due = (Sim::now() - startMicros) * rate / 1000000ULL - produced;
+    size_t count = due < maxSamples ? (size_t)due : maxSamples;
+    for (size_t i = 0; i < count; i++) {
+        samples[i] = next();
+    }
+    produced += count;
+    return count;
+}
+
+void SimCurrentSense::setLevel(uint16_t raw, uint16_t range) {
+    level = raw;
+    noise = range;
+    scriptLength = 0;
+}
+
+void SimCurrentSense::play(const uint16_t* samples, size_t count) {
+    script = samples;
+    scriptLength = count;
+    scriptPosition = 0;
+}
+
+#endif
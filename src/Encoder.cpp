@@ -0,0 +1,120 @@
+#include "Encoder.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+Esp32Encoder::Esp32Encoder(int pinA, int pinB, long countsPerRevolution) :
+    PositionEncoder(countsPerRevolution),
+    pinA(pinA),
+    pinB(pinB),
+    overflow(0) {}
+
+void IRAM_ATTR Esp32Encoder::onLimit(void* encoder) {
+    Esp32Encoder* self = static_cast<Esp32Encoder*>(encoder);
+    uint32_t status = 0;
+    pcnt_get_event_status(UNIT, &status);
+    if (status & PCNT_EVT_H_LIM) {
+        self->overflow = self->overflow + LIMIT;
+    } else if (status & PCNT_EVT_L_LIM) {
+        self->overflow = self->overflow - LIMIT;
+    }
+}
+
+void Esp32Encoder::begin(long) {
+    // Channel 0 counts edges of A with B as direction, channel 1 edges of B with A:
+    // together every edge of both lines, i.e. 4x decoding
+    pcnt_config_t config = {};
+    config.unit = UNIT;
+    config.counter_h_lim = LIMIT;
+    config.counter_l_lim = -LIMIT;
+
+    config.channel = PCNT_CHANNEL_0;
+    config.pulse_gpio_num = pinA;
+    config.ctrl_gpio_num = pinB;
+    config.pos_mode = PCNT_COUNT_DEC;
+    config.neg_mode = PCNT_COUNT_INC;
+    config.lctrl_mode = PCNT_MODE_REVERSE;
+    config.hctrl_mode = PCNT_MODE_KEEP;
+    pcnt_unit_config(&config);
+
+    config.channel = PCNT_CHANNEL_1;
+    config.pulse_gpio_num = pinB;
+    config.ctrl_gpio_num = pinA;
+    config.pos_mode = PCNT_COUNT_INC;
+    config.neg_mode = PCNT_COUNT_DEC;
+    pcnt_unit_config(&config);
+
+    // Ignore glitches shorter than 1 us (80 APB cycles)
+    pcnt_set_filter_value(UNIT, 80);
+    pcnt_filter_enable(UNIT);
+
+    pcnt_event_enable(UNIT, PCNT_EVT_H_LIM);
+    pcnt_event_enable(UNIT, PCNT_EVT_L_LIM);
+    pcnt_counter_pause(UNIT);
+    pcnt_counter_clear(UNIT);
+    pcnt_isr_service_install(0);
+    pcnt_isr_handler_add(UNIT, &Esp32Encoder::onLimit, this);
+    pcnt_counter_resume(UNIT);
+}
+
+long Esp32Encoder::count() {
+    // Re-read if the limit interrupt moved the overflow while we read the counter
+    long before;
+    int16_t counter;
+    do {
+        before = overflow;
+        pcnt_get_counter_value(UNIT, &counter);
+    } while (before != overflow);
+    return before + counter;
+}
+
+#else
+
+SimEncoder::SimEncoder(int, int, long countsPerRevolution) :
+    PositionEncoder(countsPerRevolution),
+    stepsPerRevolution(1),
+    lostSteps(0),
+    stalled(false),
+    stalledAt(0) {}
+
+void SimEncoder::begin(long steps) {
+    stepsPerRevolution = steps > 0 ? steps : 1;
+    lostSteps = 0;
+    stalled = false;
+}
+
+long SimEncoder::shaftSteps() const {
+    if (stalled) {
+        return stalledAt;
+    }
+    long commanded = SimStepHal::clock != nullptr ? SimStepHal::clock->netSteps() : 0;
+    return commanded - lostSteps;
+}
+
+long SimEncoder::count() {
+    return (long)((int64_t)shaftSteps() * countsPerRevolution() / stepsPerRevolution);
+}
+
+void SimEncoder::slip(long steps) {
+    // Lost in the direction of travel
+    bool reverse = SimStepHal::clock != nullptr && SimStepHal::clock->dir();
+    lostSteps += reverse ? -steps : steps;
+    if (stalled) {
+        stalledAt -= reverse ? -steps : steps;
+    }
+}
+
+void SimEncoder::setStalled(bool stall) {
+    if (stall == stalled) {
+        return;
+    }
+    if (stall) {
+        stalledAt = shaftSteps();
+    } else {
+        // Everything commanded while stalled was lost
+        long commanded = SimStepHal::clock != nullptr ? SimStepHal::clock->netSteps() : 0;
+        lostSteps = commanded - stalledAt;
+    }
+    stalled = stall;
+}
+
+#endif
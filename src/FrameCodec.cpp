@@ -0,0 +1,140 @@
+#include "FrameCodec.h"
+#include <string.h>
+
+namespace Frame {
+
+uint16_t crc16(const uint8_t* data, size_t length, uint16_t crc) {
+    for (size_t i = 0; i < length; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+size_t encode(uint8_t type, const uint8_t* payload, uint8_t length, uint8_t* out) {
+    if (length > MAX_PAYLOAD) {
+        return 0;
+    }
+
+    out[0] = SYNC;
+    out[1] = length;
+    out[2] = type;
+    if (length > 0) {
+        memcpy(out + 3, payload, length);
+    }
+
+    uint16_t crc = crc16(out + 1, (size_t)length + 2);
+    put16(out + 3 + length, crc);
+    return (size_t)length + OVERHEAD;
+}
+
+void put16(uint8_t* out, uint16_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+}
+
+void put32(uint8_t* out, uint32_t value) {
+    put16(out, (uint16_t)value);
+    put16(out + 2, (uint16_t)(value >> 16));
+}
+
+uint16_t get16(const uint8_t* in) {
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+uint32_t get32(const uint8_t* in) {
+    return (uint32_t)get16(in) | ((uint32_t)get16(in + 2) << 16);
+}
+
+void encodeStatus(const StatusRecord& status, uint8_t* out) {
+    out[0] = status.state;
+    put16(out + 1, status.rpm);
+    put32(out + 3, status.completedRotations);
+    put32(out + 7, status.targetRotations);
+    put32(out + 11, status.elapsedMillis);
+    put16(out + 15, (uint16_t)status.followingError);
+    put16(out + 17, status.loadTenths);
+}
+
+void decodeStatus(const uint8_t* in, StatusRecord& status) {
+    status.state = in[0];
+    status.rpm = get16(in + 1);
+    status.completedRotations = get32(in + 3);
+    status.targetRotations = get32(in + 7);
+    status.elapsedMillis = get32(in + 11);
+    status.followingError = (int16_t)get16(in + 15);
+    status.loadTenths = get16(in + 17);
+}
+
+}  // namespace Frame
+
+FrameDecoder::FrameDecoder() :
+    state(WAIT_SYNC),
+    frameType(0),
+    frameLength(0),
+    received(0),
+    crc(0),
+    crcLow(0),
+    crcErrorCount(0),
+    droppedByteCount(0) {}
+
+void FrameDecoder::reset() {
+    state = WAIT_SYNC;
+    received = 0;
+}
+
+bool FrameDecoder::push(uint8_t byte) {
+    switch (state) {
+        case WAIT_SYNC:
+            if (byte == Frame::SYNC) {
+                state = READ_LENGTH;
+            } else {
+                droppedByteCount++;
+            }
+            return false;
+
+        case READ_LENGTH:
+            if (byte > Frame::MAX_PAYLOAD) {
+                // Can't be a frame of ours; resynchronise on the next sync byte
+                droppedByteCount += 2;
+                state = byte == Frame::SYNC ? READ_LENGTH : WAIT_SYNC;
+                return false;
+            }
+            frameLength = byte;
+            received = 0;
+            crc = Frame::crc16(&byte, 1);
+            state = READ_TYPE;
+            return false;
+
+        case READ_TYPE:
+            frameType = byte;
+            crc = Frame::crc16(&byte, 1, crc);
+            state = frameLength > 0 ? READ_PAYLOAD : READ_CRC_LOW;
+            return false;
+
+        case READ_PAYLOAD:
+            buffer[received++] = byte;
+            if (received >= frameLength) {
+                crc = Frame::crc16(buffer, frameLength, crc);
+                state = READ_CRC_LOW;
+            }
+            return false;
+
+        case READ_CRC_LOW:
+            crcLow = byte;
+            state = READ_CRC_HIGH;
+            return false;
+
+        case READ_CRC_HIGH:
+            state = WAIT_SYNC;
+            if ((uint16_t)(crcLow | (byte << 8)) != crc) {
+                crcErrorCount++;
+                return false;
+            }
+            return true;
+    }
+
+    return false;
+}
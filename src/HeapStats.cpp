@@ -0,0 +1,120 @@
+#include "HeapStats.h"
+#include <atomic>
+#include <stddef.h>
+#include <stdlib.h>
+
+namespace {
+
+std::atomic<uint32_t> allocationCount(0);
+
+}  // namespace
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+#include <esp_heap_caps.h>
+
+// Linked in place of the allocator entry points by -Wl,--wrap; __real_* are the originals
+extern "C" {
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size) {
+    // String grows its buffer this way; realloc(p, 0) only frees
+    if (size > 0) {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    return __real_realloc(pointer, size);
+}
+
+}  // extern "C"
+
+void Heap::read(Stats& stats) {
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+    stats.freeBytes = (uint32_t)info.total_free_bytes;
+    stats.minimumFreeBytes = (uint32_t)info.minimum_free_bytes;
+    stats.largestFreeBlock = (uint32_t)info.largest_free_block;
+    stats.usedBlocks = (uint32_t)info.allocated_blocks;
+    stats.allocations = allocationCount.load(std::memory_order_relaxed);
+}
+
+#else
+
+#include <new>
+
+namespace {
+
+std::atomic<uint32_t> liveBlocks(0);
+
+}  // namespace
+
+// Host builds count C++ allocations, which is what the fake Arduino layer makes
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void* block = malloc(size > 0 ? size : 1);
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+    liveBlocks.fetch_add(1, std::memory_order_relaxed);
+    return block;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* block) noexcept {
+    if (block != nullptr) {
+        liveBlocks.fetch_sub(1, std::memory_order_relaxed);
+        free(block);
+    }
+}
+
+void operator delete[](void* block) noexcept {
+    operator delete(block);
+}
+
+void operator delete(void* block, size_t) noexcept {
+    operator delete(block);
+}
+
+void operator delete[](void* block, size_t) noexcept {
+    operator delete(block);
+}
+
+void Heap::read(Stats& stats) {
+    stats.freeBytes = 0;
+    stats.minimumFreeBytes = 0;
+    stats.largestFreeBlock = 0;
+    stats.usedBlocks = liveBlocks.load(std::memory_order_relaxed);
+    stats.allocations = allocationCount.load(std::memory_order_relaxed);
+}
+
+#endif
+
+uint32_t Heap::allocations() {
+    return allocationCount.load(std::memory_order_relaxed);
+}
+
+void Heap::resetAllocations() {
+    allocationCount.store(0, std::memory_order_relaxed);
+}
+
+uint8_t Heap::fragmentation(const Stats& stats) {
+    if (stats.freeBytes == 0) {
+        return 0;
+    }
+    return (uint8_t)(100 - (uint64_t)stats.largestFreeBlock * 100 / stats.freeBytes);
+}
@@ -0,0 +1,26 @@
+#include "LimitSwitch.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+Esp32LimitSwitch::Esp32LimitSwitch(int pin) :
+    pin(pin) {}
+
+void Esp32LimitSwitch::begin() {
+    pinMode(pin, INPUT);
+}
+
+bool IRAM_ATTR Esp32LimitSwitch::triggered() {
+    return digitalRead(pin) == LOW;
+}
+
+#else
+
+SimLimitSwitch::SimLimitSwitch(int) :
+    placed(false),
+    closesAt(0) {}
+
+bool SimLimitSwitch::triggered() {
+    return placed && SimStepHal::clock != nullptr && SimStepHal::clock->netSteps() <= closesAt;
+}
+
+#endif
@@ -0,0 +1,76 @@
+#include "LoadFilter.h"
+
+LoadFilter::LoadFilter() :
+    blockSum(0),
+    blockCount(0),
+    reciprocal(0),
+    level(0),
+    primed(false),
+    outputs(0) {
+    Config defaults = { 64, 4, 0, 4095 };
+    configure(defaults);
+}
+
+void LoadFilter::configure(const Config& requested) {
+    config = requested;
+    if (config.decimation < 1) config.decimation = 1;
+    if (config.decimation > 4096) config.decimation = 4096;  // 4096 * 4095 fits the 24-bit block sum
+    if (config.smoothingShift > 12) config.smoothingShift = 12;
+    if (config.fullLevel <= config.zeroLevel) config.fullLevel = config.zeroLevel + 1;
+
+    reciprocal = (0xFFFFFFFFULL + config.decimation) / config.decimation;
+    reset();
+}
+
+void LoadFilter::setCalibration(uint16_t zeroLevel, uint16_t fullLevel) {
+    config.zeroLevel = zeroLevel;
+    config.fullLevel = fullLevel > zeroLevel ? fullLevel : zeroLevel + 1;
+}
+
+void LoadFilter::reset() {
+    blockSum = 0;
+    blockCount = 0;
+    level = 0;
+    primed = false;
+    outputs = 0;
+}
+
+size_t LoadFilter::push(const uint16_t* samples, size_t count) {
+    size_t completed = 0;
+    uint32_t sum = blockSum;
+    uint16_t filled = blockCount;
+
+    for (size_t i = 0; i < count; i++) {
+        sum += samples[i] & 0x0FFF;
+        if (++filled < config.decimation) {
+            continue;
+        }
+
+        // Block average in Q16 without a division: sum * (2^32 / n) >> 16
+        int32_t average = (int32_t)((sum * reciprocal) >> 16);
+        if (primed) {
+            level += (average - level) >> config.smoothingShift;
+        } else {
+            level = average;
+            primed = true;
+        }
+        sum = 0;
+        filled = 0;
+        completed++;
+    }
+
+    blockSum = sum;
+    blockCount = filled;
+    outputs += completed;
+    return completed;
+}
+
+uint16_t LoadFilter::loadTenths() const {
+    int32_t zero = (int32_t)config.zeroLevel << 16;
+    if (level <= zero) {
+        return 0;
+    }
+    uint32_t span = (uint32_t)(config.fullLevel - config.zeroLevel);
+    uint32_t tenths = (uint32_t)(((uint64_t)(level - zero) * 1000 + ((uint64_t)span << 15)) / ((uint64_t)span << 16));
+    return tenths > 0xFFFF ? 0xFFFF : (uint16_t)tenths;
+}
@@ -0,0 +1,573 @@
+#include "MotionPlanner.h"
+#include <limits.h>
+#include <math.h>
+
+// Fixed-point scale factors (see MotionPlanner.h)
+static const double VELOCITY_SCALE = 4294967296.0 / 1e6;            // steps/s    -> steps/us Q32
+static const double ACCEL_SCALE = 281474976710656.0 / 1e12;          // steps/s^2  -> steps/us^2 Q48
+static const double JERK_SCALE = 18446744073709551616.0 / 1e18;      // steps/s^3  -> steps/us^3 Q64
+static const double INTERVAL_SCALE = 4294967296.0 * 1e6;             // steps/s    -> us/step Q32 (divided by)
+
+// Seconds a retarget may wait for the ISR to take it over: a motion task period or two
+static const float RETARGET_LEAD = 0.002f;
+
+MotionPlanner::MotionPlanner() :
+    startVelocity(0),
+    cruiseVelocity(0),
+    exitVelocity(0),
+    maxAccel(0),
+    jerk(0),
+    velocity(0),
+    accel(0),
+    phase(PHASE_DONE),
+    stepIndex(0),
+    totalSteps(0),
+    decelStart(LONG_MAX),
+    cruiseInterval(0),
+    intervalFraction(0),
+    lastInterval(0),
+    rampTable(nullptr),
+    rampTableLength(0),
+    tableRampMicros(0),
+    retargetPending(false),
+    pendingCruiseVelocity(0),
+    pendingExitVelocity(0),
+    pendingCruiseInterval(0),
+    pendingDecelStart(LONG_MAX),
+    pendingTotalSteps(0),
+    decelPending(false),
+    pendingStopSteps(0) {
+    RampConfig defaults = { RampProfile::NONE, 0, 0, 1 };
+    setConfig(defaults);
+}
+
+void MotionPlanner::setConfig(const RampConfig& newConfig) {
+    config = newConfig;
+    if (config.accel == 0) {
+        config.profile = RampProfile::NONE;
+    }
+    if (config.profile == RampProfile::SCURVE && config.jerk == 0) {
+        config.profile = RampProfile::TRAPEZOIDAL;
+    }
+    if (config.startRate == 0) {
+        config.startRate = 1;
+    }
+
+    maxAccel = (int64_t)(config.accel * ACCEL_SCALE);
+    jerk = (int64_t)(config.jerk * JERK_SCALE);
+    if (maxAccel < 1) maxAccel = 1;
+    if (jerk < 1) jerk = 1;
+}
+
+// Interval in 1/256 us (Q8) so the integrator and the emitted schedule keep the fraction
+uint32_t STEP_ISR_ATTR MotionPlanner::intervalFromVelocity(int64_t v) const {
+    if (v <= 0) {
+        return UINT32_MAX;
+    }
+    uint64_t interval = (1ULL << 40) / (uint64_t)v;
+    return interval > UINT32_MAX ? UINT32_MAX : (uint32_t)interval;
+}
+
+// Seconds to ramp between two speeds (fromRate below toRate)
+float MotionPlanner::rampTime(float fromRate, float toRate) const {
+    float dv = toRate - fromRate;
+    if (dv <= 0 || config.profile == RampProfile::NONE) {
+        return 0;
+    }
+
+    float a = (float)config.accel;
+    if (config.profile == RampProfile::TRAPEZOIDAL) {
+        return dv / a;
+    }
+
+    float j = (float)config.jerk;
+    if (dv >= a * a / j) {
+        return dv / a + a / j;    // Reaches max acceleration
+    }
+    return 2.0f * sqrtf(dv / j);
+}
+
+float MotionPlanner::rampDistance(float fromRate, float toRate) const {
+    // Both profiles are symmetric, so distance = average speed * ramp time
+    return (fromRate + toRate) * 0.5f * rampTime(fromRate, toRate);
+}
+
+// Highest speed reachable from fromRate within the given distance, capped at limitRate
+float MotionPlanner::reachableRate(float fromRate, float limitRate, float steps) const {
+    if (rampDistance(fromRate, limitRate) <= steps) {
+        return limitRate;
+    }
+
+    float low = fromRate;
+    float high = limitRate;
+    for (int i = 0; i < 24; i++) {
+        float mid = 0.5f * (low + high);
+        if (rampDistance(fromRate, mid) > steps) {
+            high = mid;
+        } else {
+            low = mid;
+        }
+    }
+    return low;
+}
+
+float MotionPlanner::cruiseRate() const {
+    return (float)(INTERVAL_SCALE / (double)cruiseInterval);
+}
+
+// Speed of the running move in steps/s
+float MotionPlanner::currentRate() const {
+    if (rampTable != nullptr) {
+        uint32_t last = lastInterval;
+        return last > 0 ? 256e6f / (float)last : (float)config.startRate;
+    }
+
+    // 64-bit reads are not atomic on the ESP32; retry until the ISR left it alone
+    int64_t v;
+    do {
+        v = velocity;
+    } while (v != velocity);
+    return (float)v / (float)VELOCITY_SCALE;
+}
+
+void MotionPlanner::plan(uint64_t cruiseIntervalQ32, long steps) {
+    plan(cruiseIntervalQ32, steps, 0, 0);
+}
+
+void MotionPlanner::plan(uint64_t cruiseIntervalQ32, long steps, uint32_t entryInterval, uint32_t exitInterval) {
+    phase = PHASE_DONE;  // Keep the ISR out while we rewrite the state
+    retargetPending = false;
+    decelPending = false;
+
+    cruiseInterval = cruiseIntervalQ32 > 0 ? cruiseIntervalQ32 : 1;
+    float cruiseRate = this->cruiseRate();
+    float requestedRate = cruiseRate;
+    // Moves slower than the start speed start and stop at cruise speed
+    float restRate = (float)config.startRate < cruiseRate ? (float)config.startRate : cruiseRate;
+    float entryRate = entryInterval > 0 ? 1e6f / (float)entryInterval : restRate;
+    float exitRate = exitInterval > 0 ? 1e6f / (float)exitInterval : restRate;
+    if (exitRate > cruiseRate) exitRate = cruiseRate;
+
+    if (config.profile == RampProfile::NONE) {
+        entryRate = cruiseRate;
+        exitRate = cruiseRate;
+    } else if (steps > 0 &&
+               rampDistance(entryRate, cruiseRate) + rampDistance(exitRate, cruiseRate) > (float)steps) {
+        // Short moves never reach cruise: lower the peak so both ramps fit in the move
+        float low = entryRate > exitRate ? entryRate : exitRate;
+        float high = cruiseRate;
+        if (rampDistance(entryRate, low) > (float)steps) {
+            // Can't even reach the exit speed: accelerate all the way and leave at whatever
+            // the move gets to
+            exitRate = reachableRate(entryRate, exitRate, (float)steps);
+            low = exitRate;
+            high = exitRate;
+        }
+        for (int i = 0; i < 24; i++) {
+            float mid = 0.5f * (low + high);
+            if (rampDistance(entryRate, mid) + rampDistance(exitRate, mid) > (float)steps) {
+                high = mid;
+            } else {
+                low = mid;
+            }
+        }
+        cruiseRate = low > exitRate ? low : exitRate;
+    }
+    if (cruiseRate != requestedRate) {
+        cruiseInterval = (uint64_t)(INTERVAL_SCALE / (double)cruiseRate);
+    }
+
+    cruiseVelocity = (int64_t)(cruiseRate * VELOCITY_SCALE);
+    startVelocity = (int64_t)(restRate * VELOCITY_SCALE);
+    exitVelocity = (int64_t)(exitRate * VELOCITY_SCALE);
+    if (cruiseVelocity < 1) cruiseVelocity = 1;
+    if (exitVelocity < 1) exitVelocity = 1;
+
+    stepIndex = 0;
+    intervalFraction = 0;
+    totalSteps = steps;
+    accel = 0;
+    rampTable = nullptr;
+
+    if (steps > 0 && exitVelocity < cruiseVelocity) {
+        long rampSteps = (long)(rampDistance(exitRate, cruiseRate) + 0.5f);
+        decelStart = steps - rampSteps;
+    } else {
+        decelStart = steps > 0 ? steps : LONG_MAX;
+    }
+
+    int64_t entryVelocity = (int64_t)(entryRate * VELOCITY_SCALE);
+    velocity = entryVelocity > 0 ? entryVelocity : 1;
+    phase = entryVelocity == cruiseVelocity ? PHASE_CRUISE : PHASE_ACCEL;
+}
+
+void MotionPlanner::planTable(const uint16_t* ramp, uint16_t rampSteps, uint32_t cruiseIntervalUs, long steps) {
+    phase = PHASE_DONE;  // Keep the ISR out while we rewrite the state
+    retargetPending = false;
+    decelPending = false;
+
+    uint32_t rampMicrosQ4 = 0;
+    for (uint16_t k = 0; k < rampSteps; k++) {
+        rampMicrosQ4 += ramp[k];
+    }
+
+    rampTable = ramp;
+    rampTableLength = rampSteps;
+    cruiseInterval = (uint64_t)cruiseIntervalUs << 32;
+    tableRampMicros = rampMicrosQ4 >> 4;
+
+    // Short moves mirror the ramp around the midpoint and never reach cruise
+    long rampSpan = steps > 0 && 2L * rampSteps > steps ? steps / 2 : rampSteps;
+
+    stepIndex = 0;
+    intervalFraction = 0;
+    totalSteps = steps;
+    decelStart = steps > 0 ? steps - rampSpan : LONG_MAX;
+    phase = rampSteps > 0 ? PHASE_ACCEL : PHASE_CRUISE;
+}
+
+// Advance velocity by one step towards target and return the step's interval (Q8 us).
+// The interval is taken at the mean of the old and new velocity (predicted with a plain
+// Euler step first), which makes the update time-symmetric: a deceleration replays the
+// matching acceleration almost exactly and lands on the start speed at the last step.
+// For the S-curve, acceleration is ramped down once the velocity still gained while
+// removing it (a^2 / 2j) covers the remaining gap.
+uint32_t STEP_ISR_ATTR MotionPlanner::integrate(int64_t target, bool up) {
+    int64_t v = velocity;
+    int64_t previous = accel;  // Magnitude; direction comes from "up"
+    int64_t a = previous;
+    int64_t remaining = up ? target - v : v - target;
+    uint32_t dt = intervalFromVelocity(v);
+
+    if (config.profile == RampProfile::SCURVE) {
+        if (remaining * 2 * jerk <= a * a) {
+            a -= (jerk * dt) >> 24;
+            if (a < maxAccel / 64) a = maxAccel / 64;  // Never stall short of the target
+        } else {
+            a += (jerk * dt) >> 24;
+            if (a > maxAccel) a = maxAccel;
+        }
+    } else {
+        a = maxAccel;
+        previous = maxAccel;
+    }
+
+    int64_t meanAccel = (previous + a) >> 1;
+    int64_t predicted = (meanAccel * dt) >> 24;
+    if (predicted > remaining) predicted = remaining;
+    dt = intervalFromVelocity(up ? v + (predicted >> 1) : v - (predicted >> 1));
+
+    int64_t dv = (meanAccel * dt) >> 24;
+    if (dv >= remaining) {
+        v = target;
+        a = 0;
+        if (phase == PHASE_ACCEL) {
+            phase = PHASE_CRUISE;
+        }
+    } else {
+        v = up ? v + dv : v - dv;
+    }
+
+    velocity = v;
+    accel = a;
+    return dt;
+}
+
+uint32_t STEP_ISR_ATTR MotionPlanner::nextInterval() {
+    if (phase == PHASE_DONE) {
+        return 0;
+    }
+    if (decelPending) {
+        applyDecel();
+    } else if (retargetPending) {
+        applyRetarget();
+    }
+
+    long n = stepIndex;
+    if (totalSteps > 0 && n >= totalSteps) {
+        phase = PHASE_DONE;
+        return 0;
+    }
+
+    if (phase != PHASE_DECEL && n >= decelStart) {
+        phase = PHASE_DECEL;
+        accel = 0;
+    }
+
+    uint64_t dt;  // Q32
+    if (rampTable != nullptr) {
+        // Distance from the nearer end of the move picks the ramp entry
+        long k = n;
+        if (totalSteps > 0 && totalSteps - 1 - n < k) {
+            k = totalSteps - 1 - n;
+        }
+        if (k < rampTableLength) {
+            dt = (uint64_t)rampTable[k] << 28;
+        } else {
+            dt = cruiseInterval;
+            if (phase == PHASE_ACCEL) {
+                phase = PHASE_CRUISE;
+            }
+        }
+    } else if (phase == PHASE_ACCEL) {
+        // A blended segment may enter faster than its cruise and slow down to it
+        dt = (uint64_t)integrate(cruiseVelocity, velocity < cruiseVelocity) << 24;
+    } else if (phase == PHASE_DECEL) {
+        dt = (uint64_t)integrate(exitVelocity, false) << 24;
+    } else {
+        dt = cruiseInterval;
+    }
+
+    lastInterval = (uint32_t)(dt >> 24);
+
+    // Emit whole microseconds and carry the fraction into the next step
+    dt += intervalFraction;
+    intervalFraction = (uint32_t)dt;
+
+    stepIndex = n + 1;
+    return (uint32_t)(dt >> 32);
+}
+
+long MotionPlanner::stoppingSteps() const {
+    if (rampTable != nullptr) {
+        long n = stepIndex;
+        return (n < rampTableLength ? n : rampTableLength) + 1;
+    }
+    return (long)(rampDistance((float)config.startRate, currentRate()) + 0.5f) + 1;
+}
+
+void MotionPlanner::requestDecel() {
+    if (phase == PHASE_DONE) {
+        return;
+    }
+
+    // Handed over like a retarget, which it replaces
+    long steps = stoppingSteps();
+    retargetPending = false;
+    decelPending = false;
+    pendingStopSteps = steps;
+    decelPending = true;
+}
+
+// Take over the decel requestDecel() prepared, in the ISR between two steps. Steps made
+// since it looked just shift the decel along; a move that already stops at rest no later
+// is left alone, and a blended segment stops instead of leaving at speed.
+void STEP_ISR_ATTR MotionPlanner::applyDecel() {
+    decelPending = false;
+    retargetPending = false;
+
+    long n = stepIndex;
+    long total = n + pendingStopSteps;
+    bool toRest = rampTable != nullptr || exitVelocity == startVelocity;
+    if (toRest && (phase == PHASE_DECEL || (totalSteps > 0 && totalSteps <= total))) {
+        return;
+    }
+
+    if (!toRest && totalSteps > 0 && total > totalSteps) {
+        total = totalSteps;  // Never past the segment's end; the caller checked it fits
+    }
+    exitVelocity = startVelocity;
+    totalSteps = total;
+    if (phase != PHASE_DECEL) {
+        decelStart = n;
+    }
+}
+
+bool MotionPlanner::retarget(uint64_t cruiseIntervalQ32, long steps) {
+    if (phase == PHASE_DECEL || phase == PHASE_DONE || decelPending) {
+        return false;
+    }
+
+    uint64_t interval = cruiseIntervalQ32 > 0 ? cruiseIntervalQ32 : 1;
+    float rate = (float)(INTERVAL_SCALE / (double)interval);
+    float requestedRate = rate;
+    float fromRate = currentRate();
+    long n = stepIndex;
+    long total = steps > 0 ? steps : totalSteps;
+    if (total > 0 && total <= n) {
+        total = n + 1;
+    }
+
+    long decel = total > 0 ? total : LONG_MAX;
+    float exitRate = rate;
+    if (config.profile != RampProfile::NONE) {
+        exitRate = (float)config.startRate < rate ? (float)config.startRate : rate;
+    }
+    if (total > 0 && config.profile != RampProfile::NONE) {
+        float room = (float)(total - n);
+        float stopFrom = rate;
+        if (rate > fromRate && rampDistance(fromRate, rate) + rampDistance(exitRate, rate) > room) {
+            // Not enough room left to reach the new speed: lower it so the decel still fits
+            float low = fromRate;
+            float high = rate;
+            for (int i = 0; i < 24; i++) {
+                float mid = 0.5f * (low + high);
+                if (rampDistance(fromRate, mid) + rampDistance(exitRate, mid) > room) {
+                    high = mid;
+                } else {
+                    low = mid;
+                }
+            }
+            rate = low;
+            stopFrom = low;
+        } else if (rate < fromRate && rampDistance(rate, fromRate) + rampDistance(exitRate, rate) > room) {
+            stopFrom = fromRate;  // Slowing down runs into the decel: stop from where it is
+        }
+        decel = total - (long)(rampDistance(exitRate, stopFrom) + 0.5f);
+        if (decel < n + (long)(fromRate * RETARGET_LEAD) + 1) {
+            return false;  // The decel would start before the ISR could take the change over
+        }
+    }
+
+    retargetPending = false;  // Keep the ISR off the pending fields while they change
+    pendingCruiseInterval = rate != requestedRate ? (uint64_t)(INTERVAL_SCALE / (double)rate) : interval;
+    pendingCruiseVelocity = (int64_t)(rate * VELOCITY_SCALE);
+    pendingExitVelocity = (int64_t)(exitRate * VELOCITY_SCALE);
+    if (pendingCruiseVelocity < 1) pendingCruiseVelocity = 1;
+    if (pendingExitVelocity < 1) pendingExitVelocity = 1;
+    pendingDecelStart = decel;
+    pendingTotalSteps = total;
+    retargetPending = true;
+    return true;
+}
+
+// Take over the targets retarget() prepared, in the ISR between two steps
+void STEP_ISR_ATTR MotionPlanner::applyRetarget() {
+    retargetPending = false;
+    if (phase == PHASE_DECEL || stepIndex > pendingDecelStart) {
+        return;  // Too late, the move is already stopping
+    }
+
+    int64_t target = pendingCruiseVelocity;
+    if (rampTable != nullptr) {
+        // Carry on integrating from the speed the table had reached
+        uint32_t last = lastInterval;
+        velocity = last > 0 ? (int64_t)((1ULL << 40) / last) : pendingExitVelocity;
+        accel = 0;
+        rampTable = nullptr;
+    } else if (phase != PHASE_ACCEL || (velocity < cruiseVelocity) != (velocity < target)) {
+        accel = 0;  // The S-curve starts the new ramp from zero acceleration
+    }
+    if (config.profile == RampProfile::NONE) {
+        velocity = target;
+    }
+
+    cruiseVelocity = target;
+    cruiseInterval = pendingCruiseInterval;
+    startVelocity = pendingExitVelocity;
+    exitVelocity = pendingExitVelocity;
+    totalSteps = pendingTotalSteps;
+    decelStart = pendingDecelStart;
+    phase = velocity == target ? PHASE_CRUISE : PHASE_ACCEL;
+}
+
+long MotionPlanner::retargetSteps(uint64_t cruiseIntervalQ32, uint64_t micros) const {
+    float rate = (float)(INTERVAL_SCALE / (double)(cruiseIntervalQ32 > 0 ? cruiseIntervalQ32 : 1));
+    float seconds = (float)((double)micros / 1e6);
+    if (config.profile == RampProfile::NONE) {
+        return (long)(seconds * rate + 0.5f);
+    }
+
+    float fromRate = currentRate();
+    float exitRate = (float)config.startRate < rate ? (float)config.startRate : rate;
+    float peak = rate;
+    if (rate > fromRate && rampTime(fromRate, rate) + rampTime(exitRate, rate) > seconds) {
+        // Too little time left to reach the new speed: the highest one that still stops in time
+        float low = fromRate;
+        float high = rate;
+        for (int i = 0; i < 24; i++) {
+            float mid = 0.5f * (low + high);
+            if (rampTime(fromRate, mid) + rampTime(exitRate, mid) > seconds) {
+                high = mid;
+            } else {
+                low = mid;
+            }
+        }
+        peak = low;
+    }
+
+    float changeTime = peak > fromRate ? rampTime(fromRate, peak) : rampTime(peak, fromRate);
+    float changeSteps = peak > fromRate ? rampDistance(fromRate, peak) : rampDistance(peak, fromRate);
+    float stopTime = rampTime(exitRate, peak);
+    float steps = changeSteps + rampDistance(exitRate, peak);
+    if (changeTime + stopTime < seconds) {
+        steps += (seconds - changeTime - stopTime) * peak;
+    } else if (peak < fromRate) {
+        steps = rampDistance(exitRate, fromRate);  // Can't stop in time: stop from here
+    }
+    return (long)(steps + 0.5f) + 1;
+}
+
+long MotionPlanner::decelSteps() const {
+    if (rampTable != nullptr) {
+        return rampTableLength;
+    }
+
+    return (long)(rampDistance((float)config.startRate, cruiseRate()) + 0.5f);
+}
+
+uint32_t MotionPlanner::exitInterval() const {
+    if (rampTable != nullptr) {
+        return rampTable[0] >> 4;
+    }
+    return intervalFromVelocity(exitVelocity) >> 8;
+}
+
+uint32_t MotionPlanner::stoppingInterval(long steps) const {
+    if (config.profile == RampProfile::NONE) {
+        return 0;  // No ramp, any speed stops immediately
+    }
+
+    float maxRate = reachableRate((float)config.startRate, 1e6f, (float)steps);
+    return (uint32_t)ceilf(1e6f / maxRate);
+}
+
+uint32_t MotionPlanner::decelTimeMillis() const {
+    if (rampTable != nullptr) {
+        return tableRampMicros / 1000;
+    }
+
+    float rate = cruiseRate();
+    float steps = rampDistance((float)config.startRate, rate);
+
+    // Average speed over a symmetric ramp is the mean of the end speeds
+    float averageRate = 0.5f * ((float)config.startRate + rate);
+    return (uint32_t)(steps / averageRate * 1000.0f);
+}
+
+uint64_t MotionPlanner::stepsForDuration(uint64_t micros) const {
+    // One ramp: its steps and how long they take
+    double rampSteps;
+    double rampMicros;
+    if (rampTable != nullptr) {
+        rampSteps = rampTableLength;
+        rampMicros = tableRampMicros;
+    } else {
+        float rate = cruiseRate();
+        float startRate = (float)config.startRate < rate ? (float)config.startRate : rate;
+        rampSteps = rampDistance(startRate, rate);
+        rampMicros = rampSteps > 0 ? rampSteps / (0.5 * (startRate + rate)) * 1e6 : 0;
+    }
+
+    // Too short to reach cruise: the peak whose ramp up and down fill the time
+    if (micros <= 2 * rampMicros) {
+        float rate = cruiseRate();
+        float startRate = (float)config.startRate < rate ? (float)config.startRate : rate;
+        float seconds = (float)((double)micros / 1e6);
+        float low = startRate;
+        float high = rate;
+        for (int i = 0; i < 24; i++) {
+            float mid = 0.5f * (low + high);
+            if (2.0f * rampTime(startRate, mid) > seconds) {
+                high = mid;
+            } else {
+                low = mid;
+            }
+        }
+        return (uint64_t)(2.0f * rampDistance(startRate, low) + 0.5f);
+    }
+
+    // Ramps plus cruise at the exact Q32 interval
+    double cruiseSteps = ((double)micros - 2 * rampMicros) * 4294967296.0 / (double)cruiseInterval;
+    return (uint64_t)(2 * rampSteps + cruiseSteps + 0.5);
+}
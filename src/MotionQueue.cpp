@@ -0,0 +1,28 @@
+#include "MotionQueue.h"
+
+MotionQueue::MotionQueue() :
+    head(0),
+    count(0) {}
+
+bool MotionQueue::push(const MotionSegment& segment) {
+    if (count >= CAPACITY) {
+        return false;
+    }
+    segments[(head + count) % CAPACITY] = segment;
+    count++;
+    return true;
+}
+
+bool MotionQueue::pop(MotionSegment& segment) {
+    if (count == 0) {
+        return false;
+    }
+    segment = segments[head];
+    head = (head + 1) % CAPACITY;
+    count--;
+    return true;
+}
+
+const MotionSegment* MotionQueue::peek() const {
+    return count > 0 ? &segments[head] : nullptr;
+}
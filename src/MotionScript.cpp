@@ -0,0 +1,458 @@
+#include "MotionScript.h"
+#include "FrameCodec.h"
+#include "SpeedTable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+namespace {
+
+const uint32_t MAGIC = 0x5243534D;  // "MSCR"
+const size_t CRC = 2;
+
+const long MAX_RPM = 6000;           // CONFIG MAXRPM's range
+const long MAX_ROTATIONS = 10000;
+const long MAX_SECONDS = 65535;
+const long MAX_MILLIS = 86400000;    // A day
+const long MIN_PIN = 34;             // WAIT PIN: the input-only GPIOs, which a script can't
+const long MAX_PIN = 39;             // turn into anything else
+const double MAX_DEGREES = 2000000.0;  // Millidegrees still fit an int32
+
+// Code bytes of each op, 0 = not an op
+const uint8_t SIZES[] = { 1, 6, 6, 8, 4, 5, 3, 3, 1, 7, 1 };
+
+uint8_t sizeOf(uint8_t op) {
+    return op < sizeof(SIZES) ? SIZES[op] : 0;
+}
+
+// value as a whole number in [minimum, maximum]
+bool wholeNumber(const CommandField* field, long minimum, long maximum, long& value) {
+    if (field == nullptr || !field->hasValue || field->value[0] == '\0') {
+        return false;
+    }
+    char* end;
+    value = strtol(field->value, &end, 10);
+    return *end == '\0' && value >= minimum && value <= maximum;
+}
+
+// Keys the statement may have besides PROG, space separated
+const CommandField* unexpected(const ParsedCommand& statement, const char* allowed) {
+    for (uint8_t i = 0; i < statement.count; i++) {
+        const char* key = statement.fields[i].key;
+        if (strcmp(key, "PROG") == 0) {
+            continue;
+        }
+        size_t length = strlen(key);
+        const char* at = allowed;
+        bool found = false;
+        while (!found && (at = strstr(at, key)) != nullptr) {
+            found = (at == allowed || at[-1] == ' ') && (at[length] == ' ' || at[length] == '\0');
+            at += length;
+        }
+        if (!found) {
+            return &statement.fields[i];
+        }
+    }
+    return nullptr;
+}
+
+}  // namespace
+
+namespace Script {
+
+bool decode(const uint8_t* code, size_t length, size_t offset, Instruction& instruction) {
+    if (offset >= length) {
+        return false;
+    }
+    const uint8_t* in = code + offset;
+    instruction.op = in[0];
+    instruction.size = sizeOf(in[0]);
+    if (instruction.size == 0 || offset + instruction.size > length) {
+        return false;
+    }
+    instruction.flags = 0;
+    instruction.speed = 0;
+    instruction.pin = 0;
+    instruction.value = 0;
+
+    switch (instruction.op) {
+        case ROTATE:
+        case TIMED:
+            instruction.flags = in[1];
+            instruction.speed = Frame::get16(in + 2);
+            instruction.value = Frame::get16(in + 4);
+            break;
+        case MOVE:
+            instruction.flags = in[1];
+            instruction.speed = Frame::get16(in + 2);
+            instruction.value = (int32_t)Frame::get32(in + 4);
+            break;
+        case SET:
+            instruction.flags = in[1];
+            instruction.speed = Frame::get16(in + 2);
+            break;
+        case DWELL:
+            instruction.value = (int32_t)Frame::get32(in + 1);
+            break;
+        case LOOP:
+        case NEXT:
+            instruction.value = Frame::get16(in + 1);
+            break;
+        case WAIT_PIN:
+            instruction.flags = in[1];
+            instruction.pin = in[2];
+            instruction.value = (int32_t)Frame::get32(in + 3);
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+bool validate(const uint8_t* image, size_t length, const uint8_t*& code, size_t& codeLength, uint16_t& lines) {
+    if (length < HEADER_SIZE + CRC || Frame::get32(image) != MAGIC || Frame::get16(image + 4) != VERSION) {
+        return false;
+    }
+    size_t size = Frame::get16(image + 8);
+    if (size == 0 || size > MAX_CODE || length != HEADER_SIZE + size + CRC ||
+        Frame::crc16(image, length - CRC) != Frame::get16(image + length - CRC)) {
+        return false;
+    }
+
+    // Every instruction decodes, loops nest and each NEXT goes back to its own LOOP's body
+    const uint8_t* body = image + HEADER_SIZE;
+    uint16_t open[MAX_DEPTH];
+    uint8_t depth = 0;
+    uint16_t count = 0;
+    size_t offset = 0;
+    Instruction instruction;
+    while (offset < size) {
+        if (!decode(body, size, offset, instruction)) {
+            return false;
+        }
+        offset += instruction.size;
+        count++;
+        if (instruction.op == LOOP) {
+            if (depth == MAX_DEPTH) {
+                return false;
+            }
+            open[depth++] = (uint16_t)offset;
+        } else if (instruction.op == NEXT) {
+            if (depth == 0 || open[--depth] != (uint16_t)instruction.value) {
+                return false;
+            }
+        } else if (instruction.op == WAIT_PIN && (instruction.pin < MIN_PIN || instruction.pin > MAX_PIN)) {
+            return false;
+        } else if (instruction.op == END && offset != size) {
+            return false;
+        }
+    }
+    if (depth != 0 || instruction.op != END || count != Frame::get16(image + 6) + 1) {
+        return false;
+    }
+
+    code = body;
+    codeLength = size;
+    lines = Frame::get16(image + 6);
+    return true;
+}
+
+void describe(const Instruction& instruction, char* text, size_t size) {
+    char speed[16] = "";
+    if (instruction.speed > 0) {
+        snprintf(speed, sizeof(speed), " %s:%u", (instruction.flags & LEVEL) ? "SPEED" : "RPM",
+                 (unsigned)instruction.speed);
+    }
+    const char* direction = (instruction.flags & CCW) ? " DIR:CCW" : "";
+    const char* nowait = (instruction.flags & NOWAIT) ? " NOWAIT" : "";
+
+    switch (instruction.op) {
+        case END:
+            snprintf(text, size, "END");
+            break;
+        case ROTATE:
+            snprintf(text, size, "%s ROT:%ld%s%s", speed + 1, (long)instruction.value, direction, nowait);
+            break;
+        case TIMED:
+            snprintf(text, size, "%s TIME:%ld%s%s", speed + 1, (long)instruction.value, direction, nowait);
+            break;
+        case MOVE:
+            if (instruction.flags & DEGREES) {
+                snprintf(text, size, "MOVE:%.3f%s DEG%s%s", instruction.value / 1000.0,
+                         (instruction.flags & RELATIVE) ? " REL" : "", speed, nowait);
+            } else {
+                snprintf(text, size, "MOVE:%ld%s%s%s", (long)instruction.value,
+                         (instruction.flags & RELATIVE) ? " REL" : "", speed, nowait);
+            }
+            break;
+        case SET:
+            snprintf(text, size, "SET%s", speed);
+            break;
+        case DWELL:
+            snprintf(text, size, "DWELL:%ld", (long)instruction.value);
+            break;
+        case LOOP:
+            if (instruction.value > 0) {
+                snprintf(text, size, "LOOP:%ld", (long)instruction.value);
+            } else {
+                snprintf(text, size, "LOOP");
+            }
+            break;
+        case NEXT:
+            snprintf(text, size, "NEXT (to %ld)", (long)instruction.value);
+            break;
+        case WAIT_MOVE:
+            snprintf(text, size, "WAIT");
+            break;
+        case WAIT_PIN:
+            snprintf(text, size, "WAIT PIN:%u %s TIMEOUT:%ld", (unsigned)instruction.pin,
+                     (instruction.flags & HIGH_LEVEL) ? "HIGH" : "LOW", (long)instruction.value);
+            break;
+        case HOME:
+            snprintf(text, size, "HOME");
+            break;
+        default:
+            snprintf(text, size, "?");
+            break;
+    }
+}
+
+}  // namespace Script
+
+ScriptCompiler::ScriptCompiler() :
+    image{},
+    used(0),
+    lines(0),
+    loops{},
+    loopLines{},
+    depth(0),
+    failure(nullptr),
+    failedLine(0),
+    reason{} {}
+
+void ScriptCompiler::begin() {
+    used = 0;
+    lines = 0;
+    depth = 0;
+    failure = nullptr;
+    failedLine = 0;
+}
+
+bool ScriptCompiler::emit(const uint8_t* bytes, size_t length) {
+    if (used + length > Script::MAX_CODE - 1) {  // Room for END
+        return false;
+    }
+    memcpy(image + Script::HEADER_SIZE + used, bytes, length);
+    used += length;
+    return true;
+}
+
+const char* ScriptCompiler::fail(const char* format, const char* detail) {
+    snprintf(reason, sizeof(reason), format, detail);
+    return reason;
+}
+
+// Speed from RPM: or SPEED:, into code[1] (flags) and code[2..3]; nullptr if fine
+const char* ScriptCompiler::speedOf(const ParsedCommand& statement, bool required, uint8_t* code) {
+    const CommandField* rpm = statement.find("RPM");
+    const CommandField* level = statement.find("SPEED");
+    long value = 0;
+    if (rpm != nullptr && level != nullptr) {
+        return "RPM_OR_SPEED";
+    } else if (level != nullptr) {
+        if (!wholeNumber(level, 1, SpeedTable::LEVELS, value)) {
+            return "SPEED:1..20";
+        }
+        code[1] |= Script::LEVEL;
+    } else if (rpm != nullptr) {
+        if (!wholeNumber(rpm, 1, MAX_RPM, value)) {
+            return "RPM:1..6000";
+        }
+    } else if (required) {
+        return "NO_SPEED";
+    }
+    Frame::put16(code + 2, (uint16_t)value);
+    return nullptr;
+}
+
+// DIR and NOWAIT into code[1]
+const char* ScriptCompiler::flagsOf(const ParsedCommand& statement, uint8_t* code) {
+    const char* direction = statement.getText("DIR", "CW");
+    if (strcmp(direction, "CCW") == 0) {
+        code[1] |= Script::CCW;
+    } else if (strcmp(direction, "CW") != 0) {
+        return "DIR:CW|CCW";
+    }
+    if (statement.has("NOWAIT")) {
+        code[1] |= Script::NOWAIT;
+    }
+    return nullptr;
+}
+
+const char* ScriptCompiler::compile(const ParsedCommand& statement) {
+    uint8_t code[8] = {};
+    size_t size = 0;
+    const char* allowed;
+    const char* problem = nullptr;
+    long value = 0;
+
+    if (statement.has("NEXT")) {
+        allowed = "NEXT";
+        if (depth == 0) {
+            return "NEXT_WITHOUT_LOOP";
+        }
+        uint16_t body = loops[depth - 1];
+        if (body == used) {
+            return "EMPTY_LOOP";
+        }
+        code[0] = Script::NEXT;
+        Frame::put16(code + 1, body);
+        size = 3;
+    } else if (statement.has("LOOP")) {
+        allowed = "LOOP";
+        const CommandField* count = statement.find("LOOP");
+        if (count->hasValue && !wholeNumber(count, 1, 65535, value)) {
+            return "LOOP:1..65535";
+        }
+        if (depth == Script::MAX_DEPTH) {
+            return "TOO_DEEP";
+        }
+        code[0] = Script::LOOP;
+        Frame::put16(code + 1, (uint16_t)value);
+        size = 3;
+    } else if (statement.has("DWELL")) {
+        allowed = "DWELL";
+        if (!wholeNumber(statement.find("DWELL"), 0, MAX_MILLIS, value)) {
+            return "DWELL:0..86400000";
+        }
+        code[0] = Script::DWELL;
+        Frame::put32(code + 1, (uint32_t)value);
+        size = 5;
+    } else if (statement.has("WAIT") && statement.has("PIN")) {
+        allowed = "WAIT PIN HIGH LOW TIMEOUT";
+        if (!wholeNumber(statement.find("PIN"), MIN_PIN, MAX_PIN, value)) {
+            return "PIN:34..39";
+        }
+        code[0] = Script::WAIT_PIN;
+        code[2] = (uint8_t)value;
+        if (statement.has("HIGH") == statement.has("LOW")) {
+            return "HIGH|LOW";
+        }
+        code[1] = statement.has("HIGH") ? Script::HIGH_LEVEL : 0;
+        value = 0;
+        if (statement.has("TIMEOUT") && !wholeNumber(statement.find("TIMEOUT"), 0, MAX_MILLIS, value)) {
+            return "TIMEOUT:0..86400000";
+        }
+        Frame::put32(code + 3, (uint32_t)value);
+        size = 7;
+    } else if (statement.has("WAIT")) {
+        allowed = "WAIT";
+        code[0] = Script::WAIT_MOVE;
+        size = 1;
+    } else if (statement.has("HOME")) {
+        allowed = "HOME";
+        code[0] = Script::HOME;
+        size = 1;
+    } else if (statement.has("SET")) {
+        allowed = "SET RPM SPEED";
+        code[0] = Script::SET;
+        problem = speedOf(statement, true, code);
+        size = 4;
+    } else if (statement.has("MOVE")) {
+        allowed = "MOVE REL DEG RPM SPEED NOWAIT";
+        const CommandField* target = statement.find("MOVE");
+        code[0] = Script::MOVE;
+        if (statement.has("DEG")) {
+            char* end;
+            double degrees = target->hasValue ? strtod(target->value, &end) : 0;
+            if (!target->hasValue || *end != '\0' || fabs(degrees) > MAX_DEGREES) {
+                return "MOVE:DEGREES";
+            }
+            code[1] |= Script::DEGREES;
+            value = lround(degrees * 1000.0);
+        } else if (!wholeNumber(target, INT32_MIN, INT32_MAX, value)) {
+            return "MOVE:STEPS";
+        }
+        if (statement.has("REL")) {
+            code[1] |= Script::RELATIVE;
+        }
+        problem = speedOf(statement, false, code);
+        if (problem == nullptr) {
+            problem = flagsOf(statement, code);
+        }
+        Frame::put32(code + 4, (uint32_t)value);
+        size = 8;
+    } else if (statement.has("ROT") || statement.has("TIME")) {
+        bool rotation = statement.has("ROT");
+        allowed = rotation ? "ROT RPM SPEED DIR NOWAIT" : "TIME RPM SPEED DIR NOWAIT";
+        code[0] = rotation ? Script::ROTATE : Script::TIMED;
+        if (rotation && !wholeNumber(statement.find("ROT"), 1, MAX_ROTATIONS, value)) {
+            return "ROT:1..10000";
+        }
+        if (!rotation && !wholeNumber(statement.find("TIME"), 1, MAX_SECONDS, value)) {
+            return "TIME:1..65535";
+        }
+        problem = speedOf(statement, true, code);
+        if (problem == nullptr) {
+            problem = flagsOf(statement, code);
+        }
+        Frame::put16(code + 4, (uint16_t)value);
+        size = 6;
+    } else {
+        return "UNKNOWN_STATEMENT";
+    }
+
+    const CommandField* extra = unexpected(statement, allowed);
+    if (extra != nullptr) {
+        return fail("UNKNOWN:%s", extra->key);
+    }
+    if (problem != nullptr) {
+        return problem;
+    }
+    if (!emit(code, size)) {
+        return "TOO_LONG";
+    }
+    if (code[0] == Script::LOOP) {
+        loopLines[depth] = (uint16_t)(lines + 1);
+        loops[depth++] = (uint16_t)used;
+    } else if (code[0] == Script::NEXT) {
+        depth--;
+    }
+    return nullptr;
+}
+
+const char* ScriptCompiler::add(const ParsedCommand& statement) {
+    if (failure != nullptr) {
+        return failure;
+    }
+    failure = compile(statement);
+    if (failure != nullptr) {
+        failedLine = (uint16_t)(lines + 1);
+        return failure;
+    }
+    lines++;
+    return nullptr;
+}
+
+const char* ScriptCompiler::finish() {
+    if (failure != nullptr) {
+        return failure;
+    }
+    if (depth > 0) {
+        failedLine = loopLines[depth - 1];
+        return failure = "LOOP_NOT_CLOSED";
+    }
+    if (lines == 0) {
+        failedLine = 1;
+        return failure = "EMPTY";
+    }
+
+    image[Script::HEADER_SIZE + used++] = Script::END;  // emit() kept room for it
+    Frame::put32(image, MAGIC);
+    Frame::put16(image + 4, Script::VERSION);
+    Frame::put16(image + 6, lines);
+    Frame::put16(image + 8, (uint16_t)used);
+    Frame::put16(image + Script::HEADER_SIZE + used, Frame::crc16(image, Script::HEADER_SIZE + used));
+    return nullptr;
+}
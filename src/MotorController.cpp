@@ -1,35 +1,18 @@
 #include "MotorController.h"
+#include "SerialManager.h"
+#include <limits.h>
+#include <math.h>
+#include <string.h>
 
-// Speed level to step delay table (microseconds)
-// Level 1 (slowest) to Level 20 (fastest)
-const int MotorController::SPEED_DELAY_TABLE[SPEED_LEVELS] = {
-    10000,  // Level 1:  Slowest (6 RPM)
-    8000,   // Level 2:  (7.5 RPM)
-    6500,   // Level 3:  (9.2 RPM)
-    5000,   // Level 4:  (12 RPM)
-    4000,   // Level 5:  (15 RPM)
-    3200,   // Level 6:  (18.75 RPM)
-    2600,   // Level 7:  (23 RPM)
-    2100,   // Level 8:  (28.6 RPM)
-    1700,   // Level 9:  (35.3 RPM)
-    1400,   // Level 10: (42.9 RPM)
-    1150,   // Level 11: (52.2 RPM)
-    950,    // Level 12: (63.2 RPM)
-    800,    // Level 13: (75 RPM)
-    680,    // Level 14: (88.2 RPM)
-    580,    // Level 15: (103.4 RPM)
-    500,    // Level 16: (120 RPM)
-    430,    // Level 17: (139.5 RPM)
-    370,    // Level 18: (162.2 RPM)
-    320,    // Level 19: (187.5 RPM)
-    280     // Level 20: Fastest (214.3 RPM)
-};
-
-MotorController::MotorController() : 
+template <class Driver, class Motor>
+BasicMotorController<Driver, Motor>::BasicMotorController(const AxisConfig& axis) : 
+    settings(),
+    speedLevels(),
+    started(false),
     isRunning(false), 
     isPaused(false),
-    currentStatus("IDLE"),
-    pausedStatus(""),
+    currentState(MotorState::IDLE),
+    pausedState(MotorState::IDLE),
     currentRPM(0),
     targetRotations(0),
     completedRotations(0),
@@ -38,150 +21,376 @@ MotorController::MotorController() :
     pausedTime(0),
     totalPausedDuration(0),
     stepInterval(0),
-    lastStepTime(0),
+    serial(nullptr),
     totalSteps(0),
     currentSteps(0),
     isTimeMode(false),
+    axisConfig{ axis },
+    axisCount(1),
+    currentAxis(0),
+    revolutionSteps((long)axis.stepsPerRevolution * axis.microsteps),
+    stepHal(axis.stepPin, axis.dirPin, axis.enablePin),
+    axisOutputs(),
+    stepEngine(stepHal),
+    planner(),
+    motionQueue(),
+    segmentPlanner(),
+    sparePlanner(&segmentPlanner),
+    isQueueMode(false),
+    headCommitted(false),
+    runningSegment(),
+    stagedSegment(),
+    nextSegmentId(1),
+    stagedPending(false),
+    segmentStartTime(0),
+    stepBase(0),
+    encoder(ENCODER_A_PIN, ENCODER_B_PIN, ENCODER_COUNTS_PER_REV),
+    positionMonitor(encoder),
+    stallPolicy(StallPolicy::OFF),
+    stallLimit((long)STALL_FULL_STEPS * axis.microsteps),
+    canRetry(false),
+    retryPending(false),
+    retriesLeft(0),
+    stallTime(0),
+    currentSpeedLevel(0),
+    moveClockwise(true),
+    homeSwitch(HOME_SWITCH_PIN),
+    homingPhase(HomingPhase::NONE),
+    homed(false),
+    softLimits(),
+    haltPhase(HaltPhase::NONE),
+    pausedAtSwitch(false),
+    lineAxes(0),
+    lineTarget(),
     lastSimulationUpdate(0),
     simulationUpdateInterval(1000),
-    simulatedLoad(0.0),
-    lastLoadReport(0) {}
-
-void MotorController::begin() {
-    #ifndef TEST_MODE
-        // Initialize TB6600 driver pins for real motor
-        pinMode(STEP_PIN, OUTPUT);
-        pinMode(DIR_PIN, OUTPUT);
-        pinMode(ENABLE_PIN, OUTPUT);
-        
-        // Set initial states for TB6600 driver
-        digitalWrite(STEP_PIN, LOW);       // Step signal idle state
-        digitalWrite(DIR_PIN, LOW);        // Forward direction (CW)
-        digitalWrite(ENABLE_PIN, HIGH);    // Disable driver initially (active low)
-        
-        // Add small delay for TB6600 initialization
-        delay(100);
-        
-        currentStatus = "READY";
-        Serial.println("Motor Controller initialized - TB6600 + Nema23 5756");
-        Serial.println("Microsteps: 1/16, Steps per revolution: 3200");
-    #else
-        currentStatus = "TEST_MODE_READY";
-        Serial.println("Motor Controller initialized in TEST mode");
-    #endif
+    lastFollowReport(0),
+    currentSense(CURRENT_SENSE_PIN, LOAD_SAMPLE_RATE),
+    loadFilter(),
+    loadTenths(0),
+    loadReportInterval(1000),
+    lastLoadReport(0),
+    telemetry(),
+    traceRecorder(),
+    traceDumping(false),
+    traceOffset(0),
+    traceSize(0),
+    traceCrc(0),
+    reportedOverflows(0) {
+    settings.stepPin = (uint16_t)axis.stepPin;
+    settings.dirPin = (uint16_t)axis.dirPin;
+    settings.enablePin = (uint16_t)axis.enablePin;
+    settings.stepsPerRevolution = (uint16_t)axis.stepsPerRevolution;
+    settings.microsteps = (uint16_t)axis.microsteps;
+    settings.minRpm = Motor::MIN_RPM;
+    settings.maxRpm = Motor::MAX_RPM;
+    settings.loadZeroLevel = LOAD_ZERO_LEVEL;
+    settings.loadFullLevel = LOAD_FULL_LEVEL;
+    memcpy(settings.speedDelay, SpeedTable::DELAY_US, sizeof(settings.speedDelay));
+}
+
+template <class Driver, class Motor>
+bool BasicMotorController<Driver, Motor>::configure(const MotorConfig& config) {
+    if (isRunning || !speedLevels.build(config.speedDelay)) {
+        return false;
+    }
+    
+    if (!started) {
+        axisConfig[0].stepPin = config.stepPin;
+        axisConfig[0].dirPin = config.dirPin;
+        axisConfig[0].enablePin = config.enablePin;
+        stepHal.setPins(config.stepPin, config.dirPin, config.enablePin);
+    }
+    if (config.stepsPerRevolution != settings.stepsPerRevolution || config.microsteps != settings.microsteps) {
+        homed = false;  // Positions were counted in the old steps
+    }
+    axisConfig[0].stepsPerRevolution = config.stepsPerRevolution;
+    axisConfig[0].microsteps = config.microsteps;
+    settings = config;
+    
+    // Derived once here rather than per move
+    revolutionSteps = axisStepsPerRev(currentAxis);
+    stallLimit = (long)STALL_FULL_STEPS * config.microsteps;
+    loadFilter.setCalibration(config.loadZeroLevel, config.loadFullLevel);
+    if (!Driver::SIMULATED && started) {
+        positionMonitor.begin(axisStepsPerRev(0));
+        positionMonitor.clear();
+    }
+    return true;
+}
+
+template <class Driver, class Motor>
+int BasicMotorController<Driver, Motor>::addAxis(const AxisConfig& axis) {
+    if (axisCount >= MAX_AXES || isRunning) {
+        return -1;
+    }
+    
+    PlatformStepOutput& output = axisOutputs[axisCount - 1];
+    output = PlatformStepOutput(axis.stepPin, axis.dirPin, axis.enablePin);
+    stepEngine.addAxis(output);
+    axisConfig[axisCount] = axis;
+    return axisCount++;
+}
+
+template <class Driver, class Motor>
+bool BasicMotorController<Driver, Motor>::selectAxis(uint8_t axis) {
+    if (axis >= axisCount) {
+        return false;
+    }
+    currentAxis = axis;
+    return true;
+}
+
+template <class Driver, class Motor>
+long BasicMotorController<Driver, Motor>::axisStepsPerRev(uint8_t axis) const {
+    return (long)axisConfig[axis].stepsPerRevolution * axisConfig[axis].microsteps;
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::setDirection(uint8_t axis, bool clockwise) {
+    stepEngine.setDirection(axis, !clockwise);  // LOW = CW, HIGH = CCW
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::enableAxes(bool enabled) {
+    for (uint8_t axis = 0; axis < axisCount; axis++) {
+        stepEngine.output(axis).writeEnable(Driver::ENABLE_ACTIVE_LOW ? !enabled : enabled);
+    }
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::begin(SerialManager& serialManager) {
+    serial = &serialManager;
+    started = true;
+    
+    if (Driver::SIMULATED) {
+        setState(MotorState::READY);
+        serial->sendLog("Motor Controller initialized in TEST mode");
+        return;
+    }
+    
+    // Initialize driver pins and the step timer for real motor
+    for (uint8_t axis = 1; axis < axisCount; axis++) {
+        axisOutputs[axis - 1].begin();
+    }
+    stepEngine.begin();                // Step signal idle state
+    stepEngine.traceTo(&traceRecorder);
+    
+    // Set initial states for the drivers
+    for (uint8_t axis = 0; axis < axisCount; axis++) {
+        setDirection(axis, true);      // Forward direction (CW)
+    }
+    enableAxes(false);                 // Disable drivers initially
+    positionMonitor.begin(axisStepsPerRev(0));
+    homeSwitch.begin();
+    
+    LoadFilter::Config filter = { LOAD_DECIMATION, LOAD_SMOOTHING_SHIFT, settings.loadZeroLevel, settings.loadFullLevel };
+    loadFilter.configure(filter);
+    if (!currentSense.begin()) {
+        serial->sendLog("Current sense unavailable, LOAD stays 0");
+    }
+    
+    RampConfig ramp = { RampProfile::TRAPEZOIDAL, RAMP_ACCEL, RAMP_JERK, RAMP_START_RATE };
+    planner.setConfig(ramp);
+    segmentPlanner.setConfig(ramp);
+    
+    // Add small delay for driver initialization
+    delay(Driver::POWER_UP_MS);
+    
+    startTrace();
+    setState(MotorState::READY);
+    serial->sendLogf("Motor Controller initialized - %s + %s", Driver::name(), Motor::name());
+    for (uint8_t axis = 0; axis < axisCount; axis++) {
+        serial->sendLogf("Axis %u: microsteps 1/%d, steps per revolution: %ld", (unsigned)axis,
+                         axisConfig[axis].microsteps, axisStepsPerRev(axis));
+    }
 }
 
-void MotorController::updateStepInterval(int rpm) {
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::updateStepInterval(int rpm) {
     // Calculate microseconds per step
     // (60 seconds * 1,000,000 microseconds) / (rpm * steps_per_revolution)
-    stepInterval = (60L * 1000000L) / (rpm * TOTAL_STEPS_PER_REV);
+    stepInterval = intervalForRPM(rpm, currentAxis);
     
-    // In test mode, calculate simulation update interval (1 rotation per second for visualization)
-    #ifdef TEST_MODE
-        simulationUpdateInterval = 60000 / rpm;  // milliseconds per rotation
-    #endif
+    // A simulated driver reports a rotation per this many milliseconds
+    if (Driver::SIMULATED) {
+        simulationUpdateInterval = 60000 / rpm;
+    }
 }
 
-float MotorController::calculateSimulatedLoad() {
-    // Return random load value between 10% and 50%
-    return (float)(random(100, 500)) / 10.0;  // 10.0 to 50.0
+template <class Driver, class Motor>
+uint64_t BasicMotorController<Driver, Motor>::intervalForRPM(int rpm, uint8_t axis) {
+    // (60 seconds * 1,000,000 microseconds) / (rpm * steps_per_revolution), in Q32 so the
+    // fraction isn't lost: 1000 RPM at 3200 steps is 18.75 us, not 18
+    return (60000000ULL << 32) / ((uint64_t)rpm * axisStepsPerRev(axis));
 }
 
-int MotorController::validateRPM(int rpm) {
-    if (rpm < MIN_RPM) {
-        Serial.println("Warning: RPM too low, setting to minimum: " + String(MIN_RPM));
-        return MIN_RPM;
+template <class Driver, class Motor>
+int BasicMotorController<Driver, Motor>::validateRPM(int rpm) {
+    if (rpm < settings.minRpm) {
+        serial->sendLogf("Warning: RPM too low, setting to minimum: %d", settings.minRpm);
+        return settings.minRpm;
     }
     
-    if (rpm > MAX_RPM) {
-        Serial.println("Warning: RPM too high, setting to maximum: " + String(MAX_RPM));
-        return MAX_RPM;
+    if (rpm > settings.maxRpm) {
+        serial->sendLogf("Warning: RPM too high, setting to maximum: %d", settings.maxRpm);
+        return settings.maxRpm;
     }
     
     // Provide feedback for optimal range
-    if (rpm >= OPTIMAL_RPM_LOW && rpm <= OPTIMAL_RPM_HIGH) {
-        Serial.println("RPM " + String(rpm) + " is in optimal range");
+    if (rpm >= Motor::OPTIMAL_RPM_LOW && rpm <= Motor::OPTIMAL_RPM_HIGH) {
+        serial->sendLogf("RPM %d is in optimal range", rpm);
     } else {
-        Serial.println("RPM " + String(rpm) + " is outside optimal range (" + 
-                      String(OPTIMAL_RPM_LOW) + "-" + String(OPTIMAL_RPM_HIGH) + ")");
+        serial->sendLogf("RPM %d is outside optimal range (%d-%d)", rpm, Motor::OPTIMAL_RPM_LOW, Motor::OPTIMAL_RPM_HIGH);
     }
     
     return rpm;
 }
 
-void MotorController::generateStep() {
-    #ifndef TEST_MODE
-        // TB6600 step pulse generation
-        digitalWrite(STEP_PIN, HIGH);
-        delayMicroseconds(5);   // TB6600 requires minimum 2.5us pulse, use 5us for safety
-        digitalWrite(STEP_PIN, LOW);
-        delayMicroseconds(5);   // Additional delay for clean signal
-    #endif
-}
-
-void MotorController::simulateProgress() {
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::simulateProgress() {
     // Simulate rotation progress in test mode
     unsigned long currentTime = millis();
     
     if (currentTime - lastSimulationUpdate >= simulationUpdateInterval) {
-        completedRotations++;
         lastSimulationUpdate = currentTime;
         
-        // Send progress update
-        Serial.println("TURN:" + String(completedRotations));
+        // Send progress update for whole revolutions only, as the step engine does; a part
+        // revolution at the end of a move takes a rotation's time too
+        bool whole = isTimeMode || (long)(completedRotations + 1) * revolutionSteps <= totalSteps;
+        if (whole) {
+            completedRotations++;
+            serial->sendTurn(completedRotations);
+        }
         
         // Check if target reached
-        if (!isTimeMode && completedRotations >= targetRotations) {
+        if (!isTimeMode && (!whole || completedRotations >= targetRotations)) {
             isRunning = false;
-            currentStatus = "DONE";
-            Serial.println("DONE");
+            setState(MotorState::DONE);
+            serial->sendDone();
         }
     }
     
     // For time mode, check duration (excluding paused time)
     if (isTimeMode && (currentTime - startTime - totalPausedDuration >= targetDuration)) {
         isRunning = false;
-        currentStatus = "DONE";
-        Serial.println("DONE");
+        setState(MotorState::DONE);
+        serial->sendDone();
     }
 }
 
-void MotorController::executeRotation(int rpm, int rotations, bool clockwise) {
+template <class Driver, class Motor>
+MoveResult BasicMotorController<Driver, Motor>::executeRotation(int rpm, int rotations, bool clockwise) {
+    return startRotation(rpm, 0, rotations, clockwise);
+}
+
+template <class Driver, class Motor>
+MoveResult BasicMotorController<Driver, Motor>::executeTime(int rpm, int duration, bool clockwise) {
+    return startTimed(rpm, 0, duration, clockwise);
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::useSpeed(int rpm, int speedLevel) {
+    if (speedLevel > 0) {
+        // Speed levels run at their exact table delay rather than the rounded RPM
+        stepInterval = (uint64_t)speedLevels.delay(speedLevel) << 32;
+        if (Driver::SIMULATED) {
+            simulationUpdateInterval = (unsigned long)((stepInterval * revolutionSteps) >> 32) / 1000;
+        }
+    } else {
+        updateStepInterval(rpm);
+    }
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::planMove(int speedLevel, long steps) {
+    // The speed level ramp tables are built for the default trapezoid; any other RAMP: setting
+    // falls back to computing the ramp per step
+    const RampConfig& ramp = planner.getConfig();
+    bool defaultRamp = ramp.profile == RampProfile::TRAPEZOIDAL &&
+                       ramp.accel == SpeedTable::RAMP_ACCEL &&
+                       ramp.startRate == SpeedTable::RAMP_START_RATE;
+    
+    if (speedLevel > 0 && defaultRamp) {
+        planner.planTable(speedLevels.ramp(speedLevel), speedLevels.rampSteps(speedLevel),
+                          (uint32_t)(stepInterval >> 32), steps);
+    } else {
+        planner.plan(stepInterval, steps);
+    }
+}
+
+template <class Driver, class Motor>
+MoveResult BasicMotorController<Driver, Motor>::startRotation(int rpm, int speedLevel, int rotations, bool clockwise) {
     if (isRunning) {
-        return;  // Already running
+        return MoveResult::BUSY;
+    }
+    // Nothing to turn would never see its last step; past LONG_MAX the count wraps
+    if (rotations <= 0 || rotations > LONG_MAX / axisStepsPerRev(currentAxis)) {
+        serial->sendLogf("Move refused: %d rotations", rotations);
+        return MoveResult::INVALID;
+    }
+    long steps = (long)rotations * axisStepsPerRev(currentAxis);
+    if (!checkLimits(currentAxis, clockwise ? steps : -steps)) {
+        return MoveResult::LIMIT;
     }
     
     // Validate and limit RPM to safe range
     currentRPM = validateRPM(rpm);
-    targetRotations = rotations;
+    startSteps(speedLevel, steps, clockwise);
+    
+    serial->sendLogf("Starting rotation: %d RPM, %d rotations, Direction: %s", rpm, rotations, clockwise ? "CW" : "CCW");
+    return MoveResult::STARTED;
+}
+
+// Run a known number of steps on the selected axis at currentRPM / speedLevel, from rest
+// to rest, reporting TURN per revolution and DONE at the end
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::startSteps(int speedLevel, long steps, bool clockwise) {
+    revolutionSteps = axisStepsPerRev(currentAxis);
+    totalSteps = steps;
+    targetRotations = (int)((steps + revolutionSteps - 1) / revolutionSteps);
     completedRotations = 0;
-    totalSteps = (long)rotations * TOTAL_STEPS_PER_REV;
     currentSteps = 0;
+    stepBase = 0;
+    currentSpeedLevel = speedLevel;
+    moveClockwise = clockwise;
     isTimeMode = false;
     isPaused = false;
+    haltPhase = HaltPhase::NONE;
+    lineAxes = 0;
     totalPausedDuration = 0;
     
-    updateStepInterval(rpm);
+    useSpeed(currentRPM, speedLevel);
     
     isRunning = true;
-    lastStepTime = micros();
     lastSimulationUpdate = millis();
     startTime = millis();
-    currentStatus = "ROTATING";
+    setState(MotorState::ROTATING);
     
-    // Enable TB6600 driver (active low)
-    #ifndef TEST_MODE
-        digitalWrite(DIR_PIN, clockwise ? LOW : HIGH);  // Set direction: LOW = CW, HIGH = CCW
-        digitalWrite(ENABLE_PIN, LOW);
-        delay(10);  // Small delay for driver to stabilize
-    #endif
-    
-    Serial.println("Starting rotation: " + String(rpm) + " RPM, " + String(rotations) + " rotations, Direction: " + String(clockwise ? "CW" : "CCW"));
+    // Enable the driver
+    if (!Driver::SIMULATED) {
+        stepEngine.selectAxis(currentAxis);
+        setDirection(currentAxis, clockwise);
+        resetEvents();
+        enableAxes(true);
+        delay(Driver::ENABLE_SETTLE_MS);  // Small delay for driver to stabilize
+        trackMove(currentAxis == 0, clockwise, homingPhase == HomingPhase::NONE);
+        planMove(speedLevel, totalSteps);
+        stepEngine.start(planner, totalSteps);
+    } else {
+        // Nothing steps: the axis is at the end of the move right away
+        stepEngine.setPosition(currentAxis, stepEngine.position(currentAxis) + (clockwise ? steps : -steps));
+    }
 }
 
-void MotorController::executeTime(int rpm, int duration, bool clockwise) {
+template <class Driver, class Motor>
+MoveResult BasicMotorController<Driver, Motor>::startTimed(int rpm, int speedLevel, int duration, bool clockwise) {
     if (isRunning) {
-        return;  // Already running
+        return MoveResult::BUSY;
+    }
+    if (duration <= 0) {
+        serial->sendLogf("Move refused: %d seconds", duration);
+        return MoveResult::INVALID;
     }
     
     // Validate and limit RPM to safe range
@@ -189,218 +398,1347 @@ void MotorController::executeTime(int rpm, int duration, bool clockwise) {
     targetDuration = (unsigned long)duration * 1000;  // Convert to milliseconds
     startTime = millis();
     currentSteps = 0;
+    stepBase = 0;
+    currentSpeedLevel = speedLevel;
+    moveClockwise = clockwise;
     completedRotations = 0;
     isTimeMode = true;
     isPaused = false;
+    haltPhase = HaltPhase::NONE;
+    lineAxes = 0;
     totalPausedDuration = 0;
+    revolutionSteps = axisStepsPerRev(currentAxis);
     
-    updateStepInterval(rpm);
+    useSpeed(currentRPM, speedLevel);
+    
+    if (!Driver::SIMULATED) {
+        // The move ends on the step count that fills the duration, ramps included, so
+        // it is timed by the step timer itself rather than by millis() in update()
+        planMove(speedLevel, 0);
+        uint64_t steps = planner.stepsForDuration((uint64_t)duration * 1000000ULL);
+        if (steps == 0 || steps > (uint64_t)LONG_MAX) {
+            serial->sendLog("Invalid duration for this speed");
+            return MoveResult::INVALID;
+        }
+        totalSteps = (long)steps;
+        if (!checkLimits(currentAxis, clockwise ? totalSteps : -totalSteps)) {
+            return MoveResult::LIMIT;
+        }
+    }
     
     isRunning = true;
-    lastStepTime = micros();
     lastSimulationUpdate = millis();
-    currentStatus = "TIME_MODE";
+    setState(MotorState::TIME_MODE);
     
-    // Enable TB6600 driver (active low)
-    #ifndef TEST_MODE
-        digitalWrite(DIR_PIN, clockwise ? LOW : HIGH);  // Set direction: LOW = CW, HIGH = CCW
-        digitalWrite(ENABLE_PIN, LOW);
-        delay(10);  // Small delay for driver to stabilize
-    #endif
+    // Enable the driver
+    if (!Driver::SIMULATED) {
+        stepEngine.selectAxis(currentAxis);
+        setDirection(currentAxis, clockwise);
+        resetEvents();
+        enableAxes(true);
+        delay(Driver::ENABLE_SETTLE_MS);  // Small delay for driver to stabilize
+        startTime = millis();
+        trackMove(currentAxis == 0, clockwise, true);
+        planMove(speedLevel, totalSteps);
+        stepEngine.start(planner, totalSteps);
+    }
     
-    Serial.println("Starting time mode: " + String(rpm) + " RPM for " + String(duration) + " seconds, Direction: " + String(clockwise ? "CW" : "CCW"));
+    serial->sendLogf("Starting time mode: %d RPM for %d seconds, Direction: %s", rpm, duration, clockwise ? "CW" : "CCW");
+    return MoveResult::STARTED;
 }
 
-void MotorController::stop() {
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::stop() {
+    if (!Driver::SIMULATED) {
+        if (isRunning && stepEngine.isActive()) {
+            // Nothing more starts; the move ramps down and rampedDown() disables the drivers
+            motionQueue.clear();
+            headCommitted = false;
+            if (haltPhase != HaltPhase::STOPPING) {
+                haltPhase = HaltPhase::STOPPING;
+                isPaused = false;
+                pausedState = MotorState::IDLE;
+                setState(MotorState::STOPPING);
+                stepEngine.rampDown();
+                serial->sendLog("Motor stopping");
+            }
+            return;
+        }
+    }
+    
+    haltAndDisable(MotorState::STOPPED);
+    serial->sendLogf("Motor stopped - %s driver disabled", Driver::name());
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::emergencyStop() {
+    haltAndDisable(MotorState::STOPPED);
+    serial->sendLogf("Emergency stop - %s driver disabled", Driver::name());
+}
+
+// Stop stepping right away and end whatever was running
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::haltAndDisable(MotorState state) {
     isRunning = false;
     isPaused = false;
-    currentStatus = "STOPPED";
-    pausedStatus = "";
+    isQueueMode = false;
+    headCommitted = false;
+    stagedPending = false;
+    motionQueue.clear();
+    setState(state);
+    pausedState = MotorState::IDLE;
     totalPausedDuration = 0;
+    retryPending = false;
+    homingPhase = HomingPhase::NONE;
+    haltPhase = HaltPhase::NONE;
     
-    // Disable TB6600 driver (active low, so HIGH disables)
-    #ifndef TEST_MODE
-        digitalWrite(ENABLE_PIN, HIGH);
-        delay(5);  // Small delay for clean shutdown
-    #endif
-    
-    Serial.println("Motor stopped - TB6600 driver disabled");
+    // Disable the driver
+    if (!Driver::SIMULATED) {
+        stepEngine.watchInput(nullptr);
+        positionMonitor.stop();
+        stepEngine.halt();
+        stepEngine.clearQueued();
+        enableAxes(false);
+        delay(Driver::DISABLE_SETTLE_MS);  // Small delay for clean shutdown
+    }
 }
 
-void MotorController::pause() {
-    if (!isRunning || isPaused) {
-        return;  // Not running or already paused
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::pause() {
+    if (!isRunning || isPaused || haltPhase == HaltPhase::STOPPING) {
+        return;  // Not running, already paused or stopping
     }
     
     isPaused = true;
     pausedTime = millis();
-    pausedStatus = currentStatus;  // Save current status
-    currentStatus = "PAUSED";
+    pausedState = currentState;  // Save current status
+    setState(MotorState::PAUSED);
     
-    // Keep TB6600 driver enabled but stop stepping
-    Serial.println("Motor paused");
+    // Keep the driver enabled and ramp down to rest; a pending stall retry is at rest already
+    if (!Driver::SIMULATED) {
+        if (haltPhase == HaltPhase::RESUMING) {
+            haltPhase = HaltPhase::PAUSING;  // Still on the way down
+        } else if (stepEngine.isActive()) {
+            haltPhase = HaltPhase::PAUSING;
+            stepEngine.rampDown();
+        }
+    }
+    serial->sendLog("Motor paused");
 }
 
-void MotorController::resume() {
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::resume() {
     if (!isRunning || !isPaused) {
         return;  // Not running or not paused
     }
     
     isPaused = false;
     
+    // Restore the previous status
+    setState(pausedState);
+    pausedState = MotorState::IDLE;
+    
+    if (haltPhase == HaltPhase::PAUSING) {
+        // Never came to rest, so no time was lost: restart as soon as it does
+        haltPhase = HaltPhase::RESUMING;
+        serial->sendLog("Motor resumed");
+        return;
+    }
+    
     // Calculate how long we were paused and add to total paused time
     unsigned long pauseDuration = millis() - pausedTime;
     totalPausedDuration += pauseDuration;
-    
-    // Restore the previous status
-    currentStatus = pausedStatus;
-    pausedStatus = "";
+    segmentStartTime += pauseDuration;
+    stallTime += pauseDuration;
     
     // Reset timing for smooth resumption
-    lastStepTime = micros();
     lastSimulationUpdate = millis();
-    
-    Serial.println("Motor resumed");
+    serial->sendLog("Motor resumed");
+    if (!Driver::SIMULATED) {
+        if (haltPhase == HaltPhase::PAUSED) {
+            haltPhase = HaltPhase::NONE;
+            restartMove();
+        } else if (!retryPending) {
+            stepEngine.resume();  // A pending stall retry restarts the move itself
+        }
+    }
 }
 
-void MotorController::update() {
-    if (!isRunning || isPaused) {
+// The engine came to rest after pause() or stop() ramped it down (or the move ended
+// by itself on the way); atSwitch when the homing switch stopped it
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::rampedDown(bool atSwitch) {
+    switch (haltPhase) {
+        case HaltPhase::STOPPING:
+            haltAndDisable(MotorState::STOPPED);
+            serial->sendLogf("Motor stopped - %s driver disabled", Driver::name());
+            break;
+        case HaltPhase::PAUSING:
+            if (!isQueueMode && homingPhase == HomingPhase::NONE && stepBase + stepEngine.steps() >= totalSteps) {
+                haltPhase = HaltPhase::NONE;
+                isPaused = false;
+                finishMove();  // Paused on its final ramp: nothing left to resume
+                break;
+            }
+            haltPhase = HaltPhase::PAUSED;
+            pausedAtSwitch = atSwitch;
+            pausedTime = millis();  // Timed moves count the ramp down as running time
+            break;
+        case HaltPhase::RESUMING:
+            haltPhase = HaltPhase::NONE;
+            pausedAtSwitch = atSwitch;
+            restartMove();
+            break;
+        default:
+            break;
+    }
+}
+
+// Run the rest of a move that was paused to rest, ramping up again from there
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::restartMove() {
+    long done = stepBase + stepEngine.steps();
+    if (homingPhase != HomingPhase::NONE) {
+        // The current phase is rerun in full, unless it already got where it was going
+        if (pausedAtSwitch || done >= totalSteps) {
+            homingStopped(pausedAtSwitch);
+        } else {
+            startHomingPhase(homingPhase);
+        }
         return;
     }
     
-    // Update simulated load and report periodically
+    if (isQueueMode) {
+        // Only the running segment knows how far it got; a staged one follows from rest
+        MotionPlanner* running = stepEngine.runningPlanner();
+        long left = runningSegment.steps - (running != nullptr ? running->stepsIssued() : 0);
+        if (left <= 0) {
+            queueStopped();
+            return;
+        }
+        stepBase += stepEngine.steps();
+        runningSegment.steps = left;
+        startSegment(runningSegment);
+        serial->sendLogf("Resuming segment %u: %ld steps left", (unsigned)runningSegment.id, left);
+        return;
+    }
+    
+    long remaining = totalSteps - done;
+    if (isTimeMode) {
+        // Whatever running time is left, at the current speed and with its own ramps
+        unsigned long elapsed = millis() - startTime - totalPausedDuration;
+        remaining = 0;
+        if (elapsed < targetDuration) {
+            planMove(currentSpeedLevel, 0);
+            remaining = (long)planner.stepsForDuration((uint64_t)(targetDuration - elapsed) * 1000ULL);
+        }
+        totalSteps = done + remaining;
+    }
+    if (remaining <= 0) {
+        finishMove();
+        return;
+    }
+    
+    if (lineAxes > 0) {
+        // Every axis runs what it still has to go; the lead axis has exactly remaining
+        long steps[MAX_AXES];
+        for (uint8_t axis = 0; axis < lineAxes; axis++) {
+            steps[axis] = lineTarget[axis] - stepEngine.position(axis);
+        }
+        stepEngine.setAxisSteps(steps, lineAxes);
+    }
+    
+    stepBase = done;
+    currentSteps = done;
+    if (positionMonitor.isTracking()) {
+        positionMonitor.start(moveClockwise, done);  // The following error carries over
+    }
+    stepEngine.events().clear();
+    stepEngine.setRevolution(revolutionSteps, done);
+    planMove(currentSpeedLevel, remaining);
+    stepEngine.start(planner, remaining);
+    serial->sendLogf("Resuming move: %ld steps left", remaining);
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::update() {
+    // Queued segments start as soon as the motor is free
+    if (!isRunning && !motionQueue.isEmpty()) {
+        startQueue();
+    }
+    
+    // A pause ramping down is still moving
+    if (isRunning && (!isPaused || haltPhase == HaltPhase::PAUSING)) {
+        updateMove();
+    }
+    streamTelemetry();
+    sendTrace();
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::updateMove() {
+    // Report the worst following error of the last second
     unsigned long currentTime = millis();
-    if (currentTime - lastLoadReport >= LOAD_REPORT_INTERVAL) {
-        simulatedLoad = calculateSimulatedLoad();
-        Serial.println("LOAD:" + String(simulatedLoad, 1) + "%");
+    if (currentTime - lastFollowReport >= FOLLOW_REPORT_INTERVAL) {
+        long peak = positionMonitor.takePeak();
+        if (serial->canSend()) {
+            serial->sendFollowingError(peak);  // Periodic, so skipped rather than queued when busy
+        }
+        lastFollowReport = currentTime;
+    }
+    if (loadReportInterval > 0 && currentTime - lastLoadReport >= loadReportInterval &&
+        !telemetry.includes(Telemetry::LOAD)) {
+        if (serial->canSend()) {
+            serial->sendLoad(loadTenths);
+        }
         lastLoadReport = currentTime;
     }
     
-    #ifdef TEST_MODE
+    if (Driver::SIMULATED) {
         // In test mode, simulate progress without actual motor control
-        simulateProgress();
-    #else
-        // Real motor control
-        unsigned long currentMicros = micros();
+        if (isQueueMode) {
+            simulateQueue();
+        } else {
+            simulateProgress();
+        }
+    } else {
+        // Real motor control - steps come from the timer ISR, we only report progress
+        reportProgress();
+    }
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::reportProgress() {
+    currentSteps = stepBase + stepEngine.steps();
+    
+    if (retryPending) {
+        if (millis() - stallTime >= STALL_RETRY_DELAY && !stepEngine.isActive()) {
+            retryMove();
+        }
+        return;
+    }
+    checkStall();
+    if (!isRunning) {
+        return;  // Stopped on a stall
+    }
+    
+    // Queued segments aren't checked up front: stop the queue once an axis leaves its range
+    if (isQueueMode) {
+        for (uint8_t axis = 0; axis < axisCount; axis++) {
+            if (!withinLimits(axis, 0)) {
+                serial->sendLogf("Soft limit reached on axis %u at %ld", (unsigned)axis, stepEngine.position(axis));
+                haltAndDisable(MotorState::LIMIT);  // Already past it: no ramp
+                return;
+            }
+        }
+    }
+    
+    // Keep the next queued segment handed to the ISR ahead of time, unless ramping down
+    if (isQueueMode && !stagedPending && !motionQueue.isEmpty() && stepEngine.isActive() &&
+        haltPhase == HaltPhase::NONE) {
+        stageSegment();
+    }
+    
+    // Progress events from the step ISR. Only drain while the serial port has room, so a
+    // slow host never blocks loop(); the ring counts whatever it has to drop meanwhile
+    StepEvent event;
+    while (isRunning && serial->canSend() && stepEngine.events().pop(event)) {
+        handleStepEvent(event);
+    }
+    
+    uint32_t dropped = stepEngine.events().overflows();
+    if (dropped != reportedOverflows && serial->canSend()) {
+        serial->sendLogf("Warning: %lu step events dropped", (unsigned long)(dropped - reportedOverflows));
+        reportedOverflows = dropped;
+    }
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::handleStepEvent(const StepEvent& event) {
+    switch (event.type) {
+        case StepEvent::REVOLUTION:
+            // The ISR counts revolutions itself, so a dropped event can't skew the count
+            completedRotations = (int)event.value;
+            if (homingPhase == HomingPhase::NONE && !telemetry.includes(Telemetry::POS | Telemetry::FRAC)) {
+                serial->sendTurn(completedRotations);
+            }
+            break;
         
-        // Check if it's time for the next step
-        if (currentMicros - lastStepTime >= stepInterval) {
-            generateStep();
-            currentSteps++;
-            lastStepTime = currentMicros;
-            
-            // Update completed rotations
-            if (currentSteps % TOTAL_STEPS_PER_REV == 0) {
-                completedRotations = currentSteps / TOTAL_STEPS_PER_REV;
-                
-                // Send progress update via Serial
-                Serial.println("TURN:" + String(completedRotations));
+        case StepEvent::SEGMENT:
+            serial->sendSegmentDone(runningSegment.id, motionQueue.space());
+            runningSegment = stagedSegment;
+            currentRPM = runningSegment.rpm;
+            stagedPending = false;
+            break;
+        
+        case StepEvent::STOPPED:
+            // Report the final revolution even if its event was dropped
+            if ((int)stepEngine.revolutions() > completedRotations) {
+                completedRotations = (int)stepEngine.revolutions();
+                if (homingPhase == HomingPhase::NONE && !telemetry.includes(Telemetry::POS | Telemetry::FRAC)) {
+                    serial->sendTurn(completedRotations);
+                }
+            }
+            if (haltPhase != HaltPhase::NONE) {
+                rampedDown(false);
+            } else if (isQueueMode) {
+                queueStopped();
+            } else if (homingPhase != HomingPhase::NONE) {
+                homingStopped(false);
+            } else {
+                finishMove();
+            }
+            break;
+        
+        case StepEvent::LIMIT:
+            if (haltPhase != HaltPhase::NONE) {
+                rampedDown(true);
+            } else if (homingPhase != HomingPhase::NONE) {
+                homingStopped(true);
+            }
+            break;
+    }
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::resetEvents() {
+    // Nothing from a previous move may leak into this one
+    stepEngine.events().clear();
+    stepEngine.setRevolution(revolutionSteps);
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::finishMove() {
+    isRunning = false;
+    isQueueMode = false;
+    setState(MotorState::DONE);
+    enableAxes(false);
+    serial->sendDone();
+}
+
+// Follow a new move on the encoder (axis 0 only), starting from no error
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::trackMove(bool tracked, bool clockwise, bool retry) {
+    positionMonitor.clear();
+    if (tracked) {
+        positionMonitor.start(clockwise, 0);
+    } else {
+        positionMonitor.stop();
+    }
+    canRetry = retry;
+    retryPending = false;
+    retriesLeft = STALL_RETRIES;
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::checkStall() {
+    if (!positionMonitor.isTracking()) {
+        return;
+    }
+    
+    long error = positionMonitor.update(currentSteps);
+    if (stallPolicy != StallPolicy::OFF && (error > stallLimit || error < -stallLimit)) {
+        handleStall(error);
+    }
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::handleStall(long error) {
+    // Stop stepping right away; the shaft isn't following anyway. A ramp down is over, a
+    // paused move stays paused until it is retried
+    stepEngine.halt();
+    stepEngine.clearQueued();
+    serial->sendStall(error);
+    bool stopping = haltPhase == HaltPhase::STOPPING;
+    haltPhase = HaltPhase::NONE;
+    
+    if (stallPolicy == StallPolicy::RETRY && canRetry && retriesLeft > 0 && !stopping) {
+        retriesLeft--;
+        retryPending = true;
+        stallTime = millis();
+        serial->sendLogf("Stall detected, following error %ld steps - retrying (%d retries left)", error,
+                         (int)retriesLeft);
+        return;
+    }
+    
+    isRunning = false;
+    isPaused = false;
+    isQueueMode = false;
+    headCommitted = false;
+    stagedPending = false;
+    motionQueue.clear();
+    positionMonitor.stop();
+    setState(MotorState::STALLED);
+    enableAxes(false);
+    serial->sendLogf("Stall detected, following error %ld steps - motor stopped", error);
+    if (homingPhase != HomingPhase::NONE) {
+        homingPhase = HomingPhase::NONE;
+        stepEngine.watchInput(nullptr);
+        serial->sendResponse("HOME_FAILED:STALL");
+    }
+}
+
+// Run the rest of a stalled move from where the shaft actually is, ramping up from rest
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::retryMove() {
+    retryPending = false;
+    
+    long measured = currentSteps - positionMonitor.followingError();
+    if (measured < 0) {
+        measured = 0;
+    }
+    long remaining = totalSteps - measured;
+    if (remaining <= 0) {
+        finishMove();
+        return;
+    }
+    
+    stepBase = measured;
+    currentSteps = measured;
+    completedRotations = (int)(measured / revolutionSteps);
+    positionMonitor.clear();
+    positionMonitor.start(moveClockwise, measured);
+    stepEngine.events().clear();
+    stepEngine.setRevolution(revolutionSteps, measured);
+    planMove(currentSpeedLevel, remaining);
+    stepEngine.start(planner, remaining);
+    serial->sendLogf("Retrying move: %ld steps left", remaining);
+}
+
+template <class Driver, class Motor>
+SpeedChange BasicMotorController<Driver, Motor>::setSpeed(int rpm, int speedLevel) {
+    if (!isRunning) {
+        return SpeedChange::IDLE;
+    }
+    if (isQueueMode || homingPhase != HomingPhase::NONE || retryPending ||
+        (haltPhase != HaltPhase::NONE && haltPhase != HaltPhase::PAUSED)) {
+        return SpeedChange::BUSY;
+    }
+    if (speedLevel < 0 || speedLevel > SPEED_LEVELS) {
+        return SpeedChange::INVALID;
+    }
+    
+    // revolutionSteps is the lead axis' for a line move, so RPM applies to it as at the start
+    int newRPM = speedLevel > 0 ? speedLevelToRPM(speedLevel) : validateRPM(rpm);
+    uint64_t interval = speedLevel > 0 ? (uint64_t)speedLevels.delay(speedLevel) << 32 :
+                        (60000000ULL << 32) / ((uint64_t)newRPM * revolutionSteps);
+    
+    if (!Driver::SIMULATED) {
+        // Paused at rest, resume() plans the rest of the move at the new speed
+        if (haltPhase != HaltPhase::PAUSED) {
+            // Timed moves keep their end time: the steps left are worked out again at the new speed
+            long planned = planner.plannedSteps();
+            long total = 0;
+            if (isTimeMode) {
+                unsigned long elapsed = millis() - startTime - totalPausedDuration;
+                unsigned long remaining = elapsed < targetDuration ? targetDuration - elapsed : 0;
+                total = planner.stepsIssued() + planner.retargetSteps(interval, (uint64_t)remaining * 1000ULL);
             }
             
+            // The engine's limit never falls below the planner's, which ends the move itself
+            if (total > planned) {
+                stepEngine.setStepLimit(total);
+            }
+            if (!planner.retarget(interval, total)) {
+                stepEngine.setStepLimit(planned);
+                return SpeedChange::BUSY;
+            }
+            if (total > 0 && total < planned) {
+                stepEngine.setStepLimit(total);
+            }
             if (isTimeMode) {
-                // Check if time duration has elapsed (excluding paused time)
-                if (millis() - startTime - totalPausedDuration >= targetDuration) {
-                    isRunning = false;
-                    currentStatus = "DONE";
-                    digitalWrite(ENABLE_PIN, HIGH);
-                    Serial.println("DONE");
-                }
-            } else {
-                // Rotation mode - check if target reached
-                if (currentSteps >= totalSteps) {
-                    isRunning = false;
-                    currentStatus = "DONE";
-                    digitalWrite(ENABLE_PIN, HIGH);
-                    Serial.println("DONE");
-                }
+                totalSteps = stepBase + total;
             }
         }
-    #endif
+    } else {
+        simulationUpdateInterval = (unsigned long)((interval * revolutionSteps) >> 32) / 1000;
+    }
+    
+    stepInterval = interval;
+    currentRPM = newRPM;
+    currentSpeedLevel = speedLevel;
+    serial->sendLogf("Speed changed to %d RPM", newRPM);
+    return SpeedChange::APPLIED;
 }
 
-String MotorController::getStatus() {
+template <class Driver, class Motor>
+MoveResult BasicMotorController<Driver, Motor>::executeMove(long target, bool relative, int rpm, int speedLevel) {
     if (isRunning) {
-        String loadInfo = " LOAD:" + String(simulatedLoad, 1) + "%";
-        if (isTimeMode) {
+        return MoveResult::BUSY;
+    }
+    if (speedLevel < 0 || speedLevel > SPEED_LEVELS) {
+        return MoveResult::INVALID;
+    }
+    
+    long from = stepEngine.position(currentAxis);
+    int64_t to = relative ? (int64_t)from + target : (int64_t)target;
+    int64_t distance = to - from;
+    if (to > LONG_MAX || to < LONG_MIN || distance > LONG_MAX || distance < -(int64_t)LONG_MAX) {
+        return MoveResult::INVALID;
+    }
+    if (!withinLimits(currentAxis, (long)distance)) {
+        return MoveResult::LIMIT;
+    }
+    
+    currentRPM = speedLevel > 0 ? speedLevelToRPM(speedLevel) : validateRPM(rpm > 0 ? rpm : MOVE_RPM);
+    if (distance == 0) {
+        setState(MotorState::DONE);
+        serial->sendDone();
+        return MoveResult::STARTED;
+    }
+    startSteps(speedLevel, (long)(distance < 0 ? -distance : distance), distance > 0);
+    
+    serial->sendLogf("Starting move: %ld -> %ld steps, %d RPM", from, (long)to, currentRPM);
+    return MoveResult::STARTED;
+}
+
+template <class Driver, class Motor>
+bool BasicMotorController<Driver, Motor>::setPosition(long steps) {
+    if (isRunning) {
+        return false;
+    }
+    stepEngine.setPosition(currentAxis, steps);
+    if (currentAxis == 0) {
+        homed = false;  // Zero is no longer the switch
+    }
+    return true;
+}
+
+template <class Driver, class Motor>
+long BasicMotorController<Driver, Motor>::degreesToSteps(double degrees) {
+    double steps = degrees * axisStepsPerRev(currentAxis) / 360.0;
+    if (steps >= (double)LONG_MAX) {
+        return LONG_MAX;
+    } else if (steps <= (double)LONG_MIN) {
+        return LONG_MIN;
+    }
+    return lround(steps);
+}
+
+template <class Driver, class Motor>
+double BasicMotorController<Driver, Motor>::stepsToDegrees(long steps) {
+    return steps * 360.0 / axisStepsPerRev(currentAxis);
+}
+
+template <class Driver, class Motor>
+bool BasicMotorController<Driver, Motor>::setSoftLimits(bool enabled, long min, long max) {
+    if (enabled && min >= max) {
+        return false;
+    }
+    SoftLimits& limits = softLimits[currentAxis];
+    limits.enabled = enabled;
+    limits.min = min;
+    limits.max = max;
+    return true;
+}
+
+template <class Driver, class Motor>
+bool BasicMotorController<Driver, Motor>::withinLimits(uint8_t axis, long steps) {
+    const SoftLimits& limits = softLimits[axis];
+    if (!limits.enabled || homingPhase != HomingPhase::NONE) {
+        return true;
+    }
+    int64_t end = (int64_t)stepEngine.position(axis) + steps;
+    return end >= limits.min && end <= limits.max;
+}
+
+template <class Driver, class Motor>
+bool BasicMotorController<Driver, Motor>::checkLimits(uint8_t axis, long steps) {
+    if (withinLimits(axis, steps)) {
+        return true;
+    }
+    serial->sendLogf("Move refused: axis %u would leave its soft limits %ld..%ld", (unsigned)axis,
+                     softLimits[axis].min, softLimits[axis].max);
+    return false;
+}
+
+template <class Driver, class Motor>
+bool BasicMotorController<Driver, Motor>::home() {
+    if (isRunning) {
+        return false;
+    }
+    
+    currentAxis = 0;  // The switch is on axis 0
+    homed = false;
+    if (Driver::SIMULATED) {
+        stepEngine.setPosition(0, 0);
+        homed = true;
+        setState(MotorState::HOMED);
+        serial->sendResponse("HOMED");
+    } else {
+        serial->sendLog("Homing axis 0");
+        startHomingPhase(homeSwitch.triggered() ? HomingPhase::CLEAR : HomingPhase::SEEK);
+    }
+    return true;
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::startHomingPhase(HomingPhase phase) {
+    long backoff = (long)HOME_BACKOFF_FULL_STEPS * axisConfig[0].microsteps;
+    int rpm = phase == HomingPhase::LATCH ? HOME_LATCH_RPM : HOME_SEEK_RPM;
+    currentRPM = rpm < settings.minRpm ? settings.minRpm : rpm > settings.maxRpm ? settings.maxRpm : rpm;
+    homingPhase = phase;
+    
+    // The switch is only watched on the way towards it
+    switch (phase) {
+        case HomingPhase::CLEAR:
+        case HomingPhase::BACKOFF:
+            stepEngine.watchInput(nullptr);
+            startSteps(0, backoff, true);
+            break;
+        case HomingPhase::SEEK:
+            stepEngine.watchInput(&homeSwitch);
+            startSteps(0, (long)HOME_MAX_REVOLUTIONS * axisStepsPerRev(0), false);
+            break;
+        case HomingPhase::LATCH:
+            stepEngine.watchInput(&homeSwitch);
+            startSteps(0, 2 * backoff, false);
+            break;
+        case HomingPhase::NONE:
+            break;
+    }
+    setState(MotorState::HOMING);
+}
+
+// A homing move ended, atSwitch when the switch stopped it
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::homingStopped(bool atSwitch) {
+    stepEngine.watchInput(nullptr);
+    bool closed = homeSwitch.triggered();
+    
+    switch (homingPhase) {
+        case HomingPhase::CLEAR:
+            if (closed) {
+                homingFailed("SWITCH_STUCK");
+            } else {
+                startHomingPhase(HomingPhase::SEEK);
+            }
+            break;
+        case HomingPhase::SEEK:
+            if (atSwitch) {
+                startHomingPhase(HomingPhase::BACKOFF);
+            } else {
+                homingFailed("NOT_FOUND");
+            }
+            break;
+        case HomingPhase::BACKOFF:
+            if (closed) {
+                homingFailed("SWITCH_STUCK");
+            } else {
+                startHomingPhase(HomingPhase::LATCH);
+            }
+            break;
+        case HomingPhase::LATCH:
+            if (!atSwitch) {
+                homingFailed("NOT_FOUND");
+                break;
+            }
+            stepEngine.setPosition(0, 0);
+            homed = true;
+            homingPhase = HomingPhase::NONE;
+            isRunning = false;
+            setState(MotorState::HOMED);
+            enableAxes(false);
+            serial->sendResponse("HOMED");
+            break;
+        case HomingPhase::NONE:
+            break;
+    }
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::homingFailed(const char* reason) {
+    homingPhase = HomingPhase::NONE;
+    isRunning = false;
+    isPaused = false;
+    positionMonitor.stop();
+    setState(MotorState::HOME_FAILED);
+    enableAxes(false);
+    serial->sendResponsef("HOME_FAILED:%s", reason);
+}
+
+template <class Driver, class Motor>
+bool BasicMotorController<Driver, Motor>::sampleLoad() {
+    uint16_t samples[256];
+    size_t count = currentSense.read(samples, sizeof(samples) / sizeof(samples[0]));
+    if (count == 0) {
+        return false;
+    }
+    if (loadFilter.push(samples, count) > 0) {
+        loadTenths = loadFilter.loadTenths();
+    }
+    return true;
+}
+
+template <class Driver, class Motor>
+bool BasicMotorController<Driver, Motor>::startStream(uint8_t fields, uint16_t rate) {
+    if (!serial->isBinaryMode() || rate < 1 || rate > TelemetryStream::MAX_RATE || fields == 0) {
+        return false;
+    }
+    telemetry.start(fields, rate, micros());
+    return true;
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::streamTelemetry() {
+    if (!telemetry.isActive()) {
+        return;
+    }
+    if (!serial->isBinaryMode()) {
+        telemetry.stop();  // Back to text (HELLO): records can't be sent any more
+        return;
+    }
+    
+    uint32_t now = micros();
+    if (telemetry.due(now)) {
+        Telemetry::Sample sample;
+        sample.position = (int32_t)currentSteps;
+        sample.fraction = revolutionSteps > 0 ?
+            (uint16_t)(((uint64_t)(currentSteps % revolutionSteps) << 16) / revolutionSteps) : 0;
+        uint32_t interval = isRunning && !isPaused ? stepEngine.stepIntervalQ8() : 0;
+        uint64_t rpmTenths = interval > 0 && revolutionSteps > 0 ?
+            (600000000ULL << 8) / ((uint64_t)interval * revolutionSteps) : 0;
+        sample.rpmTenths = (uint16_t)(rpmTenths > 0xFFFF ? 0xFFFF : rpmTenths);
+        sample.loadTenths = loadTenths;
+        long error = positionMonitor.followingError();
+        sample.followingError = (int16_t)(error > INT16_MAX ? INT16_MAX : error < INT16_MIN ? INT16_MIN : error);
+        sample.state = stateCode();
+        
+        // Periods missed while the task was held up repeat the latest values
+        do {
+            telemetry.add(sample, now);
+        } while (telemetry.due(now));
+    }
+    
+    uint8_t payload[Frame::MAX_PAYLOAD];
+    size_t length = telemetry.take(payload, now, serial->canSend());
+    if (length > 0) {
+        serial->sendStream(payload, (uint8_t)length);
+    }
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::setState(MotorState state) {
+    currentState = state;
+    if (traceRecorder.isRecording()) {
+        traceRecorder.mark(stepHal.nowMicros(), stepEngine.position(0), (uint8_t)state);
+    }
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::startTrace() {
+    traceDumping = false;
+    noInterrupts();  // Lets a step ISR under way finish first (host timer thread)
+    traceRecorder.start(stepHal.nowMicros(), stepEngine.position(0), stepEngine.reversed(0));
+    interrupts();
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::stopTrace() {
+    noInterrupts();
+    traceRecorder.stop();
+    interrupts();
+}
+
+template <class Driver, class Motor>
+bool BasicMotorController<Driver, Motor>::dumpTrace(size_t from) {
+    if (traceRecorder.isRecording()) {
+        stopTrace();  // Holds still while it goes out
+    }
+    traceSize = traceRecorder.imageSize();
+    if (from > traceSize) {
+        return false;
+    }
+    
+    // CRC of the whole image up front, so a dump resumed part way ends with it too
+    uint8_t chunk[TRACE_CHUNK];
+    uint16_t crc = 0xFFFF;
+    for (size_t offset = 0; offset < traceSize; offset += sizeof(chunk)) {
+        size_t length = traceRecorder.readImage(offset, chunk, sizeof(chunk));
+        crc = Frame::crc16(chunk, length, crc);
+    }
+    traceCrc = crc;
+    traceOffset = from;
+    traceDumping = true;
+    return true;
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::sendTrace() {
+    static const char HEX_DIGITS[] = "0123456789ABCDEF";
+    for (uint8_t line = 0; traceDumping && line < TRACE_LINES && serial->canSend(); line++) {
+        if (traceOffset >= traceSize) {
+            serial->sendResponsef("TRACE END BYTES:%lu CRC:%04X", (unsigned long)traceSize, (unsigned)traceCrc);
+            traceDumping = false;
+            return;
+        }
+        uint8_t chunk[TRACE_CHUNK];
+        size_t length = traceRecorder.readImage(traceOffset, chunk, sizeof(chunk));
+        char hex[2 * TRACE_CHUNK + 1];
+        for (size_t i = 0; i < length; i++) {
+            hex[2 * i] = HEX_DIGITS[chunk[i] >> 4];
+            hex[2 * i + 1] = HEX_DIGITS[chunk[i] & 0x0F];
+        }
+        hex[2 * length] = '\0';
+        serial->sendResponsef("TRACE:%lu %s", (unsigned long)traceOffset, hex);
+        traceOffset += length;
+    }
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::setLoadReportInterval(unsigned long ms) {
+    loadReportInterval = ms;
+    serial->sendLogf("LOAD RATE:%lu", ms);
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::setStallPolicy(StallPolicy policy) {
+    stallPolicy = policy;
+    const char* name = policy == StallPolicy::RETRY ? "RETRY" :
+                       policy == StallPolicy::STOP ? "STOP" : "OFF";
+    serial->sendLogf("STALL:%s LIMIT:%ld", name, (long)stallLimit);
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::getStatus(TextWriter& out) {
+    if (isRunning && haltPhase != HaltPhase::STOPPING) {
+        if (isQueueMode) {
+            out.appendf("ROTATING RPM:%d SEGMENT:%u QUEUED:%u COMPLETED:%d", currentRPM,
+                        (unsigned)runningSegment.id, (unsigned)motionQueue.size(), completedRotations);
+        } else if (isTimeMode) {
             unsigned long elapsed = millis() - startTime - totalPausedDuration;
-            return "TIME_MODE RPM:" + String(currentRPM) + 
-                   " ELAPSED:" + String(elapsed/1000) + "s" +
-                   " ROTATIONS:" + String(completedRotations) +
-                   loadInfo +
-                   #ifdef TEST_MODE
-                   " [TEST]";
-                   #else
-                   "";
-                   #endif
+            out.appendf("TIME_MODE RPM:%d ELAPSED:%lus ROTATIONS:%d", currentRPM, elapsed / 1000,
+                        completedRotations);
         } else {
-            return "ROTATING RPM:" + String(currentRPM) + 
-                   " COMPLETED:" + String(completedRotations) + 
-                   "/" + String(targetRotations) +
-                   loadInfo +
-                   #ifdef TEST_MODE
-                   " [TEST]";
-                   #else
-                   "";
-                   #endif
+            out.appendf("ROTATING RPM:%d COMPLETED:%d/%d", currentRPM, completedRotations, targetRotations);
         }
+        out.appendf(" LOAD:%u.%u%% FOLLOW:%ld", (unsigned)(loadTenths / 10), (unsigned)(loadTenths % 10),
+                    positionMonitor.followingError());
+    } else {
+        out.append(stateName(currentState));
+    }
+    if (Driver::SIMULATED) {
+        out.append(" [TEST]");
+    }
+}
+
+template <class Driver, class Motor>
+const char* BasicMotorController<Driver, Motor>::stateName(MotorState state) {
+    switch (state) {
+        case MotorState::READY:        return Driver::SIMULATED ? "TEST_MODE_READY" : "READY";
+        case MotorState::ROTATING:     return "ROTATING";
+        case MotorState::TIME_MODE:    return "TIME_MODE";
+        case MotorState::PAUSED:       return "PAUSED";
+        case MotorState::STOPPING:     return "STOPPING";
+        case MotorState::DONE:         return "DONE";
+        case MotorState::STOPPED:      return "STOPPED";
+        case MotorState::LIMIT:        return "LIMIT";
+        case MotorState::STALLED:      return "STALLED";
+        case MotorState::HOMING:       return "HOMING";
+        case MotorState::HOMED:        return "HOMED";
+        case MotorState::HOME_FAILED:  return "HOME_FAILED";
+        default:                      return "IDLE";
+    }
+}
+
+template <class Driver, class Motor>
+uint8_t BasicMotorController<Driver, Motor>::stateCode() {
+    if (isPaused) {
+        return Frame::STATE_PAUSED;
+    } else if (isRunning) {
+        return isTimeMode ? Frame::STATE_TIME_MODE : Frame::STATE_ROTATING;
+    } else if (currentState == MotorState::DONE) {
+        return Frame::STATE_DONE;
+    } else if (currentState == MotorState::STOPPED) {
+        return Frame::STATE_STOPPED;
+    } else if (currentState == MotorState::STALLED) {
+        return Frame::STATE_STALLED;
     }
-    return currentStatus + 
-    #ifdef TEST_MODE
-        " [TEST]";
-    #else
-        "";
-    #endif
+    return Frame::STATE_IDLE;
 }
 
-bool MotorController::isMotorRunning() {
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::getStatusRecord(Frame::StatusRecord& status) {
+    status.state = stateCode();
+
+    status.rpm = (uint16_t)currentRPM;
+    status.completedRotations = (uint32_t)completedRotations;
+    status.targetRotations = isTimeMode || isQueueMode ? 0 : (uint32_t)targetRotations;
+    status.elapsedMillis = isRunning ? millis() - startTime - totalPausedDuration : 0;
+    long error = positionMonitor.followingError();
+    status.followingError = (int16_t)(error > INT16_MAX ? INT16_MAX : error < INT16_MIN ? INT16_MIN : error);
+    status.loadTenths = loadTenths;
+}
+
+template <class Driver, class Motor>
+bool BasicMotorController<Driver, Motor>::isMotorRunning() {
     return isRunning;
 }
 
-bool MotorController::isMotorPaused() {
+template <class Driver, class Motor>
+bool BasicMotorController<Driver, Motor>::isMotorPaused() {
     return isPaused;
 }
 
-int MotorController::speedLevelToRPM(int speedLevel) {
+template <class Driver, class Motor>
+int BasicMotorController<Driver, Motor>::speedLevelToRPM(int speedLevel) {
     // Validate speed level
     if (speedLevel < 1) speedLevel = 1;
     if (speedLevel > SPEED_LEVELS) speedLevel = SPEED_LEVELS;
     
-    // Convert delay to RPM
+    // Nearest whole RPM, for RPM validation and status display only
+    return (int)(speedLevelRPM(speedLevel) + 0.5f);
+}
+
+template <class Driver, class Motor>
+float BasicMotorController<Driver, Motor>::speedLevelRPM(int speedLevel) {
     // RPM = (60 * 1,000,000) / (delay * steps_per_revolution)
-    int delay = SPEED_DELAY_TABLE[speedLevel - 1];
-    int rpm = (60L * 1000000L) / (delay * TOTAL_STEPS_PER_REV);
+    int delay = speedLevels.delay(speedLevel);
+    return (60.0f * 1000000.0f) / ((float)delay * axisStepsPerRev(currentAxis));
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::setRamp(RampProfile profile, uint32_t accel, uint32_t jerk) {
+    if (isRunning) {
+        serial->sendLog("Cannot change ramp while running");
+        return;
+    }
     
-    return rpm;
+    RampConfig ramp = { profile, accel, jerk, RAMP_START_RATE };
+    planner.setConfig(ramp);
+    segmentPlanner.setConfig(ramp);
+    
+    const RampConfig& applied = planner.getConfig();
+    const char* name = applied.profile == RampProfile::SCURVE ? "SCURVE" :
+                       applied.profile == RampProfile::TRAPEZOIDAL ? "TRAP" : "NONE";
+    serial->sendLogf("RAMP:%s ACC:%lu JERK:%lu", name, (unsigned long)applied.accel, (unsigned long)applied.jerk);
 }
 
-void MotorController::executeRotationWithSpeed(int speedLevel, int rotations, bool clockwise) {
+template <class Driver, class Motor>
+MoveResult BasicMotorController<Driver, Motor>::executeRotationWithSpeed(int speedLevel, int rotations, bool clockwise) {
     // Validate speed level
     if (speedLevel < 1 || speedLevel > SPEED_LEVELS) {
-        Serial.println("Invalid speed level. Must be 1-20");
-        return;
+        serial->sendLog("Invalid speed level. Must be 1-20");
+        return MoveResult::INVALID;
     }
     
-    // Convert speed level to RPM
-    int rpm = speedLevelToRPM(speedLevel);
+    serial->sendLogf("Speed Level %d = %.1f RPM", speedLevel, speedLevelRPM(speedLevel));
     
-    Serial.println("Speed Level " + String(speedLevel) + " = " + String(rpm) + " RPM");
-    
-    // Execute with converted RPM
-    executeRotation(rpm, rotations, clockwise);
+    return startRotation(speedLevelToRPM(speedLevel), speedLevel, rotations, clockwise);
 }
 
-void MotorController::executeTimeWithSpeed(int speedLevel, int duration, bool clockwise) {
+template <class Driver, class Motor>
+MoveResult BasicMotorController<Driver, Motor>::executeTimeWithSpeed(int speedLevel, int duration, bool clockwise) {
     // Validate speed level
     if (speedLevel < 1 || speedLevel > SPEED_LEVELS) {
-        Serial.println("Invalid speed level. Must be 1-20");
-        return;
+        serial->sendLog("Invalid speed level. Must be 1-20");
+        return MoveResult::INVALID;
+    }
+    
+    serial->sendLogf("Speed Level %d = %.1f RPM", speedLevel, speedLevelRPM(speedLevel));
+    
+    return startTimed(speedLevelToRPM(speedLevel), speedLevel, duration, clockwise);
+}
+
+template <class Driver, class Motor>
+MoveResult BasicMotorController<Driver, Motor>::executeLine(int rpm, int speedLevel, const long* steps, uint8_t count) {
+    if (isRunning) {
+        return MoveResult::BUSY;
+    }
+    if (count > axisCount) {
+        count = axisCount;
+    }
+    
+    // The axis with the most steps leads; the planner times its steps
+    uint8_t lead = 0;
+    long leadSteps = 0;
+    for (uint8_t axis = 0; axis < count; axis++) {
+        long distance = steps[axis] < 0 ? -steps[axis] : steps[axis];
+        if (distance > leadSteps) {
+            leadSteps = distance;
+            lead = axis;
+        }
+    }
+    if (leadSteps == 0) {
+        serial->sendLog("Line move has no steps");
+        return MoveResult::INVALID;
+    }
+    if (speedLevel > SPEED_LEVELS) {
+        serial->sendLog("Invalid speed level. Must be 1-20");
+        return MoveResult::INVALID;
+    }
+    for (uint8_t axis = 0; axis < count; axis++) {
+        if (!checkLimits(axis, steps[axis])) {
+            return MoveResult::LIMIT;
+        }
+    }
+    
+    currentRPM = speedLevel > 0 ? speedLevelToRPM(speedLevel) : validateRPM(rpm);
+    revolutionSteps = axisStepsPerRev(lead);
+    totalSteps = leadSteps;
+    targetRotations = (int)((leadSteps + revolutionSteps - 1) / revolutionSteps);
+    completedRotations = 0;
+    currentSteps = 0;
+    stepBase = 0;
+    moveClockwise = steps[0] >= 0;
+    isTimeMode = false;
+    isPaused = false;
+    haltPhase = HaltPhase::NONE;
+    lineAxes = count;
+    for (uint8_t axis = 0; axis < count; axis++) {
+        lineTarget[axis] = stepEngine.position(axis) + steps[axis];
+    }
+    totalPausedDuration = 0;
+    
+    if (speedLevel > 0) {
+        useSpeed(currentRPM, speedLevel);
+    } else {
+        stepInterval = intervalForRPM(currentRPM, lead);
+        if (Driver::SIMULATED) {
+            simulationUpdateInterval = (unsigned long)((stepInterval * revolutionSteps) >> 32) / 1000;
+        }
+    }
+    
+    isRunning = true;
+    lastSimulationUpdate = millis();
+    startTime = millis();
+    setState(MotorState::ROTATING);
+    
+    if (!Driver::SIMULATED) {
+        for (uint8_t axis = 0; axis < count; axis++) {
+            setDirection(axis, steps[axis] >= 0);
+        }
+        stepEngine.setAxisSteps(steps, count);
+        resetEvents();
+        enableAxes(true);
+        delay(Driver::ENABLE_SETTLE_MS);  // Small delay for driver to stabilize
+        trackMove(lead == 0, steps[0] >= 0, false);  // Rerunning a line would need every axis' position
+        planMove(speedLevel, totalSteps);
+        stepEngine.start(planner, totalSteps);
+    } else {
+        for (uint8_t axis = 0; axis < count; axis++) {
+            stepEngine.setPosition(axis, stepEngine.position(axis) + steps[axis]);
+        }
+    }
+    
+    TextBuffer<OutMessage::MAX_TEXT + 1> move;
+    move.appendf("Starting line move: %d RPM, steps", currentRPM);
+    for (uint8_t axis = 0; axis < count; axis++) {
+        move.appendf(" %ld", steps[axis]);
+    }
+    serial->sendLog(move.c_str());
+    return MoveResult::STARTED;
+}
+
+template <class Driver, class Motor>
+uint16_t BasicMotorController<Driver, Motor>::enqueueRotation(int rpm, int speedLevel, int rotations, bool clockwise) {
+    MotionSegment segment;
+    if (motionQueue.space() == 0 || !buildSegment(rpm, speedLevel, clockwise, segment)) {
+        return 0;
+    }
+    
+    segment.steps = (long)rotations * axisStepsPerRev(segment.axis);
+    return enqueue(segment);
+}
+
+template <class Driver, class Motor>
+uint16_t BasicMotorController<Driver, Motor>::enqueueTime(int rpm, int speedLevel, int duration, bool clockwise) {
+    MotionSegment segment;
+    if (motionQueue.space() == 0 || !buildSegment(rpm, speedLevel, clockwise, segment)) {
+        return 0;
+    }
+    
+    // Timed segments become a step count at cruise speed so they blend like the rest
+    double steps = (double)duration * 1e6 * 4294967296.0 / (double)segment.interval;
+    if (steps > (double)LONG_MAX) {
+        serial->sendLog("Invalid duration for this speed");
+        return 0;
+    }
+    segment.steps = (long)(steps + 0.5);
+    return enqueue(segment);
+}
+
+template <class Driver, class Motor>
+bool BasicMotorController<Driver, Motor>::buildSegment(int rpm, int speedLevel, bool clockwise, MotionSegment& segment) {
+    if (speedLevel > 0) {
+        if (speedLevel > SPEED_LEVELS) {
+            serial->sendLog("Invalid speed level. Must be 1-20");
+            return false;
+        }
+        segment.rpm = speedLevelToRPM(speedLevel);
+        segment.interval = (uint64_t)speedLevels.delay(speedLevel) << 32;
+    } else {
+        segment.rpm = validateRPM(rpm);
+        segment.interval = intervalForRPM(segment.rpm, currentAxis);
     }
     
-    // Convert speed level to RPM
-    int rpm = speedLevelToRPM(speedLevel);
+    segment.axis = currentAxis;
+    segment.speedLevel = speedLevel;
+    segment.clockwise = clockwise;
+    return true;
+}
+
+template <class Driver, class Motor>
+uint16_t BasicMotorController<Driver, Motor>::enqueue(MotionSegment& segment) {
+    if (segment.steps <= 0) {
+        serial->sendLog("Queued segment has no steps");
+        return 0;
+    }
     
-    Serial.println("Speed Level " + String(speedLevel) + " = " + String(rpm) + " RPM");
+    segment.id = nextSegmentId++;
+    if (nextSegmentId == 0) {
+        nextSegmentId = 1;  // 0 means rejected
+    }
+    
+    motionQueue.push(segment);
+    return segment.id;
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::flushQueue() {
+    // A segment the planned motion already blends into has to run, or the motor would
+    // reach the end of the current one at speed and stop dead
+    MotionSegment committed;
+    bool keep = headCommitted && motionQueue.pop(committed);
+    motionQueue.clear();
+    if (keep) {
+        motionQueue.push(committed);
+        serial->sendLogf("Motion queue flushed, segment %u kept", (unsigned)committed.id);
+    } else {
+        serial->sendLog("Motion queue flushed");
+    }
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::startQueue() {
+    MotionSegment segment;
+    motionQueue.pop(segment);
     
-    // Execute with converted RPM
-    executeTime(rpm, duration, clockwise);
-}
\ No newline at end of file
+    isRunning = true;
+    isQueueMode = true;
+    isTimeMode = false;
+    isPaused = false;
+    haltPhase = HaltPhase::NONE;
+    lineAxes = 0;
+    totalPausedDuration = 0;
+    targetRotations = 0;
+    completedRotations = 0;
+    currentSteps = 0;
+    stepBase = 0;
+    stagedPending = false;
+    revolutionSteps = axisStepsPerRev(segment.axis);
+    startTime = millis();
+    lastSimulationUpdate = millis();
+    setState(MotorState::ROTATING);
+    
+    // Enable the driver once for the whole sequence
+    if (!Driver::SIMULATED) {
+        resetEvents();
+        enableAxes(true);
+        delay(Driver::ENABLE_SETTLE_MS);  // Small delay for driver to stabilize
+        trackMove(false, true, false);  // Segments track themselves; stalls stop the queue
+    }
+    
+    serial->sendLogf("Starting queued motion: segment %u, %u more queued", (unsigned)segment.id, (unsigned)motionQueue.size());
+    startSegment(segment);
+}
+
+// Plan a segment to leave at a speed the next queued one can take over from: the
+// slower of both cruise speeds, and no faster than the next segment can stop from.
+// A change of axis or direction, an empty queue, or a staged segment held back by a
+// pause, ends the segment at rest.
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::planSegment(MotionPlanner& segmentPlan, const MotionSegment& segment, uint32_t entryInterval) {
+    uint32_t exitInterval = 0;
+    const MotionSegment* next = stagedPending ? nullptr : motionQueue.peek();
+    if (next != nullptr && next->axis == segment.axis && next->clockwise == segment.clockwise) {
+        exitInterval = (uint32_t)((next->interval > segment.interval ? next->interval : segment.interval) >> 32);
+        uint32_t stopping = segmentPlan.stoppingInterval(next->steps);
+        if (stopping > exitInterval) {
+            exitInterval = stopping;
+        }
+    }
+    
+    headCommitted = exitInterval > 0;
+    segmentPlan.plan(segment.interval, segment.steps, entryInterval, exitInterval);
+}
+
+// Start a segment from rest on the primary planner
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::startSegment(const MotionSegment& segment) {
+    runningSegment = segment;
+    currentRPM = segment.rpm;
+    segmentStartTime = millis();
+    
+    if (!Driver::SIMULATED) {
+        stepEngine.selectAxis(segment.axis);
+        setDirection(segment.axis, segment.clockwise);
+        if (segment.axis == 0) {
+            positionMonitor.start(segment.clockwise, stepBase);
+        } else {
+            positionMonitor.stop();
+        }
+        planSegment(planner, segment, 0);
+        sparePlanner = &segmentPlanner;
+        stepEngine.start(planner);
+    }
+}
+
+// Plan the queue head on the spare planner and hand it to the step ISR
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::stageSegment() {
+    MotionPlanner& running = sparePlanner == &planner ? segmentPlanner : planner;
+    uint32_t entryInterval = headCommitted ? running.exitInterval() : 0;
+    
+    motionQueue.pop(stagedSegment);
+    planSegment(*sparePlanner, stagedSegment, entryInterval);
+    stepEngine.queue(*sparePlanner, stagedSegment.axis, !stagedSegment.clockwise);
+    stagedPending = true;
+    sparePlanner = &running;  // Free again once the ISR has switched over
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::queueStopped() {
+    // The engine stopped: the running segment is complete
+    serial->sendSegmentDone(runningSegment.id, motionQueue.space());
+    stepBase += stepEngine.steps();
+    
+    MotionSegment segment;
+    if (stagedPending) {
+        // The segment finished just before the next one was handed over; restart from rest
+        stepEngine.clearQueued();
+        stagedPending = false;
+        startSegment(stagedSegment);
+    } else if (motionQueue.pop(segment)) {
+        // The host refilled the queue after the motion had already ended
+        startSegment(segment);
+    } else {
+        finishMove();
+    }
+}
+
+template <class Driver, class Motor>
+void BasicMotorController<Driver, Motor>::simulateQueue() {
+    // No motor: each segment takes as long as its steps would at cruise speed
+    unsigned long segmentMillis = (unsigned long)((double)runningSegment.steps * runningSegment.interval / 4294967296e3);
+    if (millis() - segmentStartTime < segmentMillis) {
+        return;
+    }
+    
+    serial->sendSegmentDone(runningSegment.id, motionQueue.space());
+    
+    MotionSegment segment;
+    if (motionQueue.pop(segment)) {
+        startSegment(segment);
+    } else {
+        isRunning = false;
+        isQueueMode = false;
+        setState(MotorState::DONE);
+        serial->sendDone();
+    }
+}
+
+// The station's controller, and the same station with no motor connected or on a DRV8825
+template class BasicMotorController<Tb6600Driver, Nema23Profile>;
+template class BasicMotorController<SimulatedDriver, Nema23Profile>;
+template class BasicMotorController<Drv8825Driver, Nema23Profile>;
@@ -0,0 +1,55 @@
+#include "PositionMonitor.h"
+
+PositionMonitor::PositionMonitor(PositionEncoder& encoder) :
+    encoder(encoder),
+    tracking(false),
+    clockwise(true),
+    stepsPerRevolution(1),
+    baseCount(0),
+    baseCommanded(0),
+    baseError(0),
+    error(0),
+    peak(0) {}
+
+void PositionMonitor::begin(long steps) {
+    stepsPerRevolution = steps > 0 ? steps : 1;
+    encoder.begin(stepsPerRevolution);
+}
+
+void PositionMonitor::start(bool cw, long commandedSteps) {
+    clockwise = cw;
+    baseCount = encoder.count();
+    baseCommanded = commandedSteps;
+    baseError = error;
+    tracking = true;
+}
+
+void PositionMonitor::clear() {
+    error = 0;
+    baseError = 0;
+    peak = 0;
+}
+
+long PositionMonitor::update(long commandedSteps) {
+    if (!tracking) {
+        return error;
+    }
+
+    long counts = encoder.count() - baseCount;
+    if (!clockwise) {
+        counts = -counts;
+    }
+    long measured = (long)((int64_t)counts * stepsPerRevolution / encoder.countsPerRevolution());
+
+    error = baseError + (commandedSteps - baseCommanded) - measured;
+    if ((error < 0 ? -error : error) > (peak < 0 ? -peak : peak)) {
+        peak = error;
+    }
+    return error;
+}
+
+long PositionMonitor::takePeak() {
+    long largest = peak;
+    peak = error;
+    return largest;
+}
@@ -0,0 +1,68 @@
+#include "PulseEncoder.h"
+
+PulseEncoder::PulseEncoder(PulseItem* items, uint16_t capacity, uint32_t pulseWidth) :
+    items(items),
+    capacity(capacity),
+    used(0),
+    lastStep(0),
+    pulseWidth(pulseWidth),
+    elapsed(0) {}
+
+uint16_t PulseEncoder::itemsFor(uint32_t interval, uint32_t pulseWidth) {
+    uint32_t low = interval > pulseWidth ? interval - pulseWidth : 1;
+    if (low <= PulseItem::MAX_DURATION) {
+        return 1;
+    }
+    // The pulse item carries one low half, each further item two
+    uint32_t halves = (low + PulseItem::MAX_DURATION - 1) / PulseItem::MAX_DURATION;
+    return (uint16_t)(halves / 2 + 1);
+}
+
+bool STEP_ISR_ATTR PulseEncoder::step(uint32_t interval) {
+    if (used >= capacity) {
+        return false;
+    }
+    if (interval <= pulseWidth) {
+        interval = pulseWidth + 1;  // A zero low half would end the burst
+    }
+    uint32_t low = interval - pulseWidth;
+    lastStep = used;
+    elapsed += interval;
+
+    if (low <= PulseItem::MAX_DURATION) {
+        items[used++] = PulseItem::make(pulseWidth, true, low, false);
+        return true;
+    }
+
+    uint16_t needed = itemsFor(interval, pulseWidth);
+    if (needed > capacity - used) {
+        items[used++] = PulseItem::make(pulseWidth, true, 0, false);
+        return false;
+    }
+
+    // Slow steps only: split the low time evenly, the first halves taking the remainder
+    uint32_t halves = 2 * needed - 1;
+    uint32_t share = low / halves;
+    uint32_t longer = low % halves;
+    uint32_t first = 0;
+    for (uint32_t i = 0; i < halves; i++) {
+        uint32_t length = share + (i < longer ? 1 : 0);
+        if (i == 0) {
+            items[used++] = PulseItem::make(pulseWidth, true, length, false);
+        } else if (i % 2 == 1) {
+            first = length;
+        } else {
+            items[used++] = PulseItem::make(first, false, length, false);
+        }
+    }
+    return true;
+}
+
+uint16_t STEP_ISR_ATTR PulseEncoder::finish() {
+    if (used == 0) {
+        return 0;
+    }
+    used = lastStep + 1;
+    items[lastStep] = PulseItem::make(pulseWidth, true, 0, false);
+    return used;
+}
@@ -0,0 +1,122 @@
+#include "RtosShim.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+namespace Rtos {
+
+bool startTask(const char* name, TaskFunction function, void* argument,
+               uint32_t stackBytes, uint8_t priority, int core) {
+    // ESP-IDF takes the stack depth in bytes
+    return xTaskCreatePinnedToCore(function, name, stackBytes, argument, priority,
+                                   nullptr, core) == pdPASS;
+}
+
+uint32_t nowMillis() {
+    return (uint32_t)(xTaskGetTickCount() * portTICK_PERIOD_MS);
+}
+
+void delayMillis(uint32_t ms) {
+    vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+WakeTime wakeTime() {
+    return xTaskGetTickCount();
+}
+
+void delayUntil(WakeTime& lastWake, uint32_t periodMs) {
+    TickType_t period = pdMS_TO_TICKS(periodMs);
+    TickType_t now = xTaskGetTickCount();
+    if ((TickType_t)(now - lastWake) >= period) {
+        lastWake = now;  // Overran a period; don't try to catch up with a burst
+        return;
+    }
+    vTaskDelayUntil(&lastWake, period);
+}
+
+}  // namespace Rtos
+
+#else
+
+#include <sched.h>
+#include <limits.h>
+
+namespace Rtos {
+
+namespace {
+
+struct TaskStart {
+    TaskFunction function;
+    void* argument;
+};
+
+void* runTask(void* start) {
+    TaskStart task = *(TaskStart*)start;
+    delete (TaskStart*)start;
+    task.function(task.argument);
+    return nullptr;
+}
+
+}  // namespace
+
+bool startTask(const char* name, TaskFunction function, void* argument,
+               uint32_t stackBytes, uint8_t priority, int core) {
+    (void)priority;  // Needs privileges on Linux; the host build relies on the scheduler
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    if (stackBytes < PTHREAD_STACK_MIN) {
+        stackBytes = PTHREAD_STACK_MIN;
+    }
+    pthread_attr_setstacksize(&attributes, stackBytes);
+
+    pthread_t thread;
+    TaskStart* start = new TaskStart{ function, argument };
+    bool started = pthread_create(&thread, &attributes, runTask, start) == 0;
+    pthread_attr_destroy(&attributes);
+    if (!started) {
+        delete start;
+        return false;
+    }
+
+#if defined(__linux__)
+    pthread_setname_np(thread, name);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    pthread_setaffinity_np(thread, sizeof(cpus), &cpus);  // Ignored if the core doesn't exist
+#else
+    (void)name;
+    (void)core;
+#endif
+    pthread_detach(thread);
+    return true;
+}
+
+uint32_t nowMillis() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000ULL + now.tv_nsec / 1000000);
+}
+
+void delayMillis(uint32_t ms) {
+    timespec duration = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000L };
+    nanosleep(&duration, nullptr);
+}
+
+WakeTime wakeTime() {
+    return nowMillis();
+}
+
+void delayUntil(WakeTime& lastWake, uint32_t periodMs) {
+    lastWake += periodMs;
+    int32_t remaining = (int32_t)(lastWake - nowMillis());
+    if (remaining > 0) {
+        delayMillis((uint32_t)remaining);
+    } else {
+        lastWake = nowMillis();  // Overran a period; don't try to catch up with a burst
+    }
+}
+
+}  // namespace Rtos
+
+#endif
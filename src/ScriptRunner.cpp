@@ -0,0 +1,265 @@
+#include "ScriptRunner.h"
+#include "MotorController.h"
+#include "SerialManager.h"
+#include "FrameCodec.h"
+#include <string.h>
+
+ScriptRunner::ScriptRunner(MotorController& motor, SerialManager& serial) :
+    motor(motor),
+    serial(serial),
+    image{},
+    imageLength(0),
+    code(nullptr),
+    codeLength(0),
+    lines(0),
+    running(false),
+    pc(0),
+    current(0),
+    loops{},
+    depth(0),
+    waiting(Wait::NONE),
+    moving(false),
+    moveAt(0),
+    waitStart(0),
+    waitLength(0),
+    waitPin(0),
+    waitLevel(false) {}
+
+bool ScriptRunner::load(const uint8_t* data, size_t length) {
+    const uint8_t* checkedCode;
+    size_t checkedLength;
+    uint16_t checkedLines;
+    if (running || length > sizeof(image) ||
+        !Script::validate(data, length, checkedCode, checkedLength, checkedLines)) {
+        return false;
+    }
+    memcpy(image, data, length);
+    imageLength = length;
+    code = image + Script::HEADER_SIZE;
+    codeLength = checkedLength;
+    lines = checkedLines;
+    return true;
+}
+
+uint16_t ScriptRunner::crc() const {
+    return imageLength > 0 ? Frame::get16(image + imageLength - 2) : 0;
+}
+
+bool ScriptRunner::run() {
+    if (!hasScript() || running || motor.isMotorRunning()) {
+        return false;
+    }
+    motor.selectAxis(0);
+    pc = 0;
+    current = 0;
+    depth = 0;
+    waiting = Wait::NONE;
+    moving = false;
+    running = true;
+    return true;
+}
+
+bool ScriptRunner::abort() {
+    if (!running) {
+        return false;
+    }
+    halt();
+    return true;
+}
+
+void ScriptRunner::halt() {
+    if (moving && motor.isMotorRunning()) {
+        motor.stop();
+    }
+    running = false;
+    moving = false;
+    waiting = Wait::NONE;
+}
+
+void ScriptRunner::fail(const char* reason) {
+    uint16_t at = line();
+    halt();
+    serial.sendResponsef("RUN_ERROR LINE:%u %s", (unsigned)at, reason);
+}
+
+uint16_t ScriptRunner::line() const {
+    // Instruction n is line n
+    uint16_t count = 1;
+    Script::Instruction instruction;
+    for (size_t offset = 0; offset < current && Script::decode(code, codeLength, offset, instruction);
+         offset += instruction.size) {
+        count++;
+    }
+    return count;
+}
+
+// false once the move the script started last has ended badly; the script has failed then
+bool ScriptRunner::moveOver() {
+    if (!moving || motor.isMotorRunning()) {
+        return true;
+    }
+    moving = false;
+    MotorState state = motor.state();
+    if (state != MotorState::DONE && state != MotorState::HOMED) {
+        current = moveAt;  // A NOWAIT move may have been lines ago
+        fail(MotorController::stateName(state));
+        return false;
+    }
+    return true;
+}
+
+void ScriptRunner::update() {
+    if (!running || !moveOver()) {
+        return;
+    }
+
+    unsigned long now = millis();
+    switch (waiting) {
+        case Wait::MOVE:
+            if (moving) {
+                return;
+            }
+            break;
+        case Wait::DWELL:
+            if (now - waitStart < waitLength) {
+                return;
+            }
+            break;
+        case Wait::PIN:
+            if ((digitalRead(waitPin) == HIGH) != waitLevel) {
+                if (waitLength > 0 && now - waitStart >= waitLength) {
+                    fail("TIMEOUT");
+                }
+                return;
+            }
+            break;
+        case Wait::NONE:
+            break;
+    }
+    waiting = Wait::NONE;
+
+    // A bound on the instructions per pass, so a loop without a wait can't hold up the
+    // motion task
+    for (uint8_t i = 0; i < MAX_STEPS && running && waiting == Wait::NONE; i++) {
+        Script::Instruction instruction;
+        Script::decode(code, codeLength, pc, instruction);  // load() checked them all
+        // A move waits for the one before it, and the script ends once its last move has
+        bool waitsForMove = instruction.op == Script::ROTATE || instruction.op == Script::TIMED ||
+                            instruction.op == Script::MOVE || instruction.op == Script::HOME ||
+                            instruction.op == Script::END;
+        if (waitsForMove && moving) {
+            waiting = Wait::MOVE;
+            break;
+        }
+        current = pc;
+        pc += instruction.size;
+        if (!step(instruction)) {
+            break;
+        }
+    }
+}
+
+// Carries out one instruction; false once the script has ended
+bool ScriptRunner::step(const Script::Instruction& instruction) {
+    switch (instruction.op) {
+        case Script::END:
+            running = false;
+            serial.sendResponse("RUN DONE");
+            return false;
+
+        case Script::ROTATE:
+        case Script::TIMED:
+        case Script::MOVE:
+        case Script::HOME:
+            return startMove(instruction);
+
+        case Script::SET: {
+            bool level = (instruction.flags & Script::LEVEL) != 0;
+            SpeedChange result = motor.setSpeed(level ? 0 : instruction.speed, level ? instruction.speed : 0);
+            if (result != SpeedChange::APPLIED) {
+                fail(result == SpeedChange::IDLE ? "SET_IDLE" : result == SpeedChange::BUSY ? "SET_BUSY" : "SET_INVALID");
+                return false;
+            }
+            return true;
+        }
+
+        case Script::DWELL:
+            waiting = Wait::DWELL;
+            waitStart = millis();
+            waitLength = (unsigned long)instruction.value;
+            return true;
+
+        case Script::LOOP:
+            loops[depth].body = (uint16_t)pc;
+            loops[depth].remaining = (uint16_t)instruction.value;
+            depth++;
+            return true;
+
+        case Script::NEXT: {
+            LoopFrame& loop = loops[depth - 1];
+            if (loop.remaining == 0 || --loop.remaining > 0) {
+                pc = loop.body;
+            } else {
+                depth--;
+            }
+            return true;
+        }
+
+        case Script::WAIT_MOVE:
+            waiting = Wait::MOVE;
+            return true;
+
+        case Script::WAIT_PIN:
+            // Input-only pins, inputs since reset and pulled up or down outside like the home
+            // switch; no pinMode, which would take them from the encoder or current sense
+            waiting = Wait::PIN;
+            waitPin = instruction.pin;
+            waitLevel = (instruction.flags & Script::HIGH_LEVEL) != 0;
+            waitStart = millis();
+            waitLength = (unsigned long)instruction.value;
+            return true;
+    }
+    return true;
+}
+
+bool ScriptRunner::startMove(const Script::Instruction& instruction) {
+    bool clockwise = (instruction.flags & Script::CCW) == 0;
+    bool level = (instruction.flags & Script::LEVEL) != 0;
+    const char* refused = nullptr;
+
+    switch (instruction.op) {
+        case Script::ROTATE:
+            refused = moveRefusal(level ? motor.executeRotationWithSpeed(instruction.speed, instruction.value, clockwise) :
+                                          motor.executeRotation(instruction.speed, instruction.value, clockwise));
+            break;
+
+        case Script::TIMED:
+            refused = moveRefusal(level ? motor.executeTimeWithSpeed(instruction.speed, instruction.value, clockwise) :
+                                          motor.executeTime(instruction.speed, instruction.value, clockwise));
+            break;
+
+        case Script::MOVE: {
+            long target = (instruction.flags & Script::DEGREES) ? motor.degreesToSteps(instruction.value / 1000.0) :
+                          (long)instruction.value;
+            MoveResult result = motor.executeMove(target, (instruction.flags & Script::RELATIVE) != 0,
+                                                  level ? 0 : instruction.speed, level ? instruction.speed : 0);
+            refused = moveRefusal(result);
+            break;
+        }
+
+        case Script::HOME:
+            refused = motor.home() ? nullptr : "HOME_BUSY";
+            break;
+    }
+
+    if (refused != nullptr) {
+        fail(refused);
+        return false;
+    }
+    moving = true;
+    moveAt = current;
+    if (instruction.op == Script::HOME || (instruction.flags & Script::NOWAIT) == 0) {
+        waiting = Wait::MOVE;
+    }
+    return true;
+}
@@ -1,38 +1,340 @@
 #include "SerialManager.h"
 
-SerialManager::SerialManager() : readySent(false), readyStartTime(0) {}
+SerialManager::SerialManager() :
+    readySent(false),
+    readyStartTime(0),
+    handling(false),
+    requestTag(0),
+    operationTag(0),
+    holding(false),
+    binaryMode(false),
+    taggedMode(false),
+    requestedBinary(false),
+    droppedCount(0) {}
 
 void SerialManager::begin() {
     Serial.begin(115200);
     readyStartTime = millis();
 }
 
-bool SerialManager::hasCommand() {
-    return Serial.available();
+bool SerialManager::pollCommand(ParsedCommand& command) {
+    // Move whatever has arrived into the parser's ring, leaving room for a full frame
+    while (Serial.available() && parser.space() > Frame::MAX_PAYLOAD) {
+        uint8_t byte = (uint8_t)Serial.read();
+        if (binaryMode) {
+            pollFrame(byte);
+        } else {
+            parser.feed(byte);
+        }
+    }
+    return parser.poll(command);
+}
+
+void SerialManager::pollFrame(uint8_t byte) {
+    if (!decoder.push(byte) || decoder.type() != Frame::COMMAND) {
+        return;
+    }
+
+    // A COMMAND frame is one text command line
+    parser.feed(decoder.payload(), decoder.length());
+    parser.feed((uint8_t)'\n');
+}
+
+void SerialManager::post(uint8_t type, const uint8_t* payload, uint8_t length) {
+    OutMessage message;
+    message.type = type;
+    message.length = length < OutMessage::MAX_TEXT ? length : OutMessage::MAX_TEXT;
+    if (message.length > 0) {
+        memcpy(message.payload, payload, message.length);
+    }
+    route(message);
+}
+
+void SerialManager::postText(uint8_t type, const char* text) {
+    size_t length = strlen(text);
+    post(type, (const uint8_t*)text, length < OutMessage::MAX_TEXT ? (uint8_t)length : OutMessage::MAX_TEXT);
+}
+
+void SerialManager::postFormatted(uint8_t type, const char* format, va_list args) {
+    OutMessage message;
+    message.type = type;
+    TextWriter text((char*)message.payload, sizeof(message.payload));
+    text.appendv(format, args);
+    message.length = (uint8_t)text.length();
+    route(message);
+}
+
+// A reply with its tag already decided, bypassing the held one
+void SerialManager::postReply(uint16_t tag, const char* text) {
+    OutMessage message;
+    message.type = Frame::RESPONSE;
+    message.tag = tag;
+    size_t length = strlen(text);
+    message.length = length < OutMessage::MAX_TEXT ? (uint8_t)length : OutMessage::MAX_TEXT;
+    memcpy(message.payload, text, message.length);
+    enqueue(message);
+}
+
+// Tags a message for the request being handled or the operation running. Their RESPONSE,
+// STATUS or DONE waits in held until the next message, the request's end or the pass's
+// end shows whether it was the last one
+void SerialManager::route(OutMessage& message) {
+    message.tag = 0;
+    if (message.type == Frame::LOG || message.type == Frame::STREAM || message.type == MODE_SWITCH) {
+        enqueue(message);
+        return;
+    }
+
+    message.tag = handling ? requestTag : operationTag;
+    release(false);
+    bool reply = message.type == Frame::RESPONSE || message.type == Frame::STATUS || message.type == Frame::DONE;
+    if (message.tag != 0 && reply) {
+        held = message;
+        holding = true;
+        return;
+    }
+    enqueue(message);
+}
+
+void SerialManager::release(bool final) {
+    if (!holding) {
+        return;
+    }
+    if (final) {
+        held.tag |= Frame::TAG_FINAL;
+    }
+    holding = false;
+    enqueue(held);
+}
+
+void SerialManager::enqueue(const OutMessage& message) {
+    if (!outbox.send(message, OUTBOX_WAIT_MS)) {
+        droppedCount++;
+    }
 }
 
-String SerialManager::readCommand() {
-    if (Serial.available()) {
-        String input = Serial.readStringUntil('\n');
-        input.trim();
-        return input;
+void SerialManager::pump() {
+    OutMessage message;
+    // Peek first so a message stays queued until the UART has room for it, keeping
+    // this task from stalling on a full TX buffer
+    while (outbox.peek(message) && Serial.availableForWrite() >= (int)Frame::MAX_FRAME) {
+        outbox.receive(message);
+        write(message);
     }
-    return "";
 }
 
-void SerialManager::sendResponse(const String& response) {
-    Serial.println(response);
+void SerialManager::sendFrame(uint8_t type, const uint8_t* payload, uint8_t length) {
+    uint8_t frame[Frame::MAX_FRAME];
+    size_t size = Frame::encode(type, payload, length, frame);
+    Serial.write(frame, size);
+}
+
+void SerialManager::write(const OutMessage& message) {
+    if (message.type == MODE_SWITCH) {
+        binaryMode = message.payload[0] != 0;
+        taggedMode = message.payload[1] != 0;
+        decoder.reset();
+        return;
+    }
+
+    if (binaryMode) {
+        // Long text lines are truncated in binary mode
+        uint8_t payload[Frame::MAX_PAYLOAD];
+        bool trailer = taggedMode && message.type != Frame::LOG && message.type != Frame::STREAM;
+        uint8_t room = Frame::MAX_PAYLOAD - (trailer ? Frame::TAG_SIZE : 0);
+        uint8_t length = message.length < room ? message.length : room;
+        memcpy(payload, message.payload, length);
+        if (trailer) {
+            Frame::put16(payload + length, message.tag);
+            length += Frame::TAG_SIZE;
+        }
+        sendFrame(message.type, payload, length);
+        return;
+    }
+
+    char line[OutMessage::MAX_TEXT + 1];
+    switch (message.type) {
+        case Frame::TURN:
+            snprintf(line, sizeof(line), "TURN:%ld", (long)(int32_t)Frame::get32(message.payload));
+            break;
+        case Frame::LOAD:
+            snprintf(line, sizeof(line), "LOAD:%.1f%%", Frame::get16(message.payload) / 10.0f);
+            break;
+        case Frame::FOLLOW:
+            snprintf(line, sizeof(line), "FOLLOW:%ld", (long)(int32_t)Frame::get32(message.payload));
+            break;
+        case Frame::STALL:
+            snprintf(line, sizeof(line), "STALL:%ld", (long)(int32_t)Frame::get32(message.payload));
+            break;
+        case Frame::DONE:
+            snprintf(line, sizeof(line), "DONE");
+            break;
+        case Frame::SEGDONE:
+            snprintf(line, sizeof(line), "SEGDONE:%u FREE:%u",
+                     (unsigned)Frame::get16(message.payload), (unsigned)message.payload[2]);
+            break;
+        case Frame::STATUS:
+        case Frame::STREAM:
+            return;  // Binary-only records
+        default:
+            memcpy(line, message.payload, message.length);
+            line[message.length] = '\0';
+            break;
+    }
+    writeLine(message, line);
+}
+
+// A text line, behind its channel and tag in a tagged session
+void SerialManager::writeLine(const OutMessage& message, const char* line) {
+    if (!taggedMode) {
+        Serial.println(line);
+        return;
+    }
+
+    char prefix[8];
+    if (message.type == Frame::LOG) {
+        snprintf(prefix, sizeof(prefix), "* ");
+    } else {
+        char channel = (message.tag & Frame::TAG_FINAL) ? '=' : message.type == Frame::RESPONSE ? '#' : '!';
+        snprintf(prefix, sizeof(prefix), "%c%u ", channel, (unsigned)(message.tag & ~Frame::TAG_FINAL));
+    }
+    Serial.print(prefix);
+    Serial.println(line);
+}
+
+void SerialManager::sendResponse(const char* response) {
+    postText(Frame::RESPONSE, response);
+}
+
+void SerialManager::sendResponsef(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    postFormatted(Frame::RESPONSE, format, args);
+    va_end(args);
 }
 
 void SerialManager::sendStartupReady() {
     if (!readySent && millis() - readyStartTime < 3000) {
-        Serial.println("ESP32 READY");
+        postReply(0, "ESP32 READY");  // On the comms task, so never tagged
         delay(200);
     } else {
         readySent = true;
     }
 }
 
-void SerialManager::sendStatus(const String& status) {
-    Serial.println(status);
-}
\ No newline at end of file
+void SerialManager::sendStatus(const char* status) {
+    sendResponse(status);
+}
+
+void SerialManager::sendLog(const char* message) {
+    postText(Frame::LOG, message);
+}
+
+void SerialManager::sendLogf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    postFormatted(Frame::LOG, format, args);
+    va_end(args);
+}
+
+void SerialManager::sendTurn(long rotations) {
+    uint8_t payload[4];
+    Frame::put32(payload, (uint32_t)rotations);
+    post(Frame::TURN, payload, sizeof(payload));
+}
+
+void SerialManager::sendLoad(uint16_t tenths) {
+    uint8_t payload[2];
+    Frame::put16(payload, tenths);
+    post(Frame::LOAD, payload, sizeof(payload));
+}
+
+void SerialManager::sendFollowingError(long steps) {
+    uint8_t payload[4];
+    Frame::put32(payload, (uint32_t)steps);
+    post(Frame::FOLLOW, payload, sizeof(payload));
+}
+
+void SerialManager::sendStall(long steps) {
+    uint8_t payload[4];
+    Frame::put32(payload, (uint32_t)steps);
+    post(Frame::STALL, payload, sizeof(payload));
+}
+
+void SerialManager::sendDone() {
+    post(Frame::DONE, nullptr, 0);
+}
+
+void SerialManager::sendSegmentDone(uint16_t id, uint8_t freeSlots) {
+    uint8_t payload[3];
+    Frame::put16(payload, id);
+    payload[2] = freeSlots;
+    post(Frame::SEGDONE, payload, sizeof(payload));
+}
+
+void SerialManager::sendStatusRecord(const Frame::StatusRecord& status) {
+    uint8_t payload[Frame::STATUS_SIZE];
+    Frame::encodeStatus(status, payload);
+    post(Frame::STATUS, payload, sizeof(payload));
+}
+
+void SerialManager::sendStream(const uint8_t* batch, uint8_t length) {
+    post(Frame::STREAM, batch, length);
+}
+
+bool SerialManager::canSend() {
+    return outbox.space() >= 4;
+}
+
+void SerialManager::beginRequest(uint16_t tag) {
+    release(false);
+    handling = true;
+    requestTag = tag;
+}
+
+void SerialManager::endRequest(bool started) {
+    handling = false;
+    if (requestTag == 0) {
+        return;
+    }
+    if (started) {
+        if (holding) {
+            release(false);
+        } else {
+            postReply(requestTag, "STARTED");
+        }
+        operationTag = requestTag;
+    } else if (holding) {
+        release(true);
+    } else {
+        postReply(requestTag | Frame::TAG_FINAL, "OK");
+    }
+    requestTag = 0;
+}
+
+void SerialManager::finishOperation(const char* reply) {
+    if (operationTag == 0) {
+        return;
+    }
+    if (holding && held.tag == operationTag) {
+        release(true);
+    } else {
+        postReply(operationTag | Frame::TAG_FINAL, reply);
+    }
+    operationTag = 0;
+}
+
+void SerialManager::flushReplies() {
+    release(false);
+}
+
+void SerialManager::sendRejected(uint16_t tag, const char* response) {
+    postReply(tag != 0 ? tag | Frame::TAG_FINAL : 0, response);
+}
+
+void SerialManager::setBinaryMode(bool enabled, bool tagged) {
+    release(false);  // Replies before the switch keep the old encoding
+    requestedBinary = enabled;
+    uint8_t payload[2] = { (uint8_t)(enabled ? 1 : 0), (uint8_t)(tagged ? 1 : 0) };
+    post(MODE_SWITCH, payload, sizeof(payload));
+}
@@ -0,0 +1,43 @@
+#include "SpeedLevels.h"
+#include <string.h>
+
+SpeedLevels::SpeedLevels() :
+    ramps(SpeedTable::TABLES.ramp),
+    offsets(SpeedTable::TABLES.offset) {
+    memcpy(delays, SpeedTable::DELAY_US, sizeof(delays));
+}
+
+uint32_t SpeedLevels::rampEntries(const uint16_t* levelDelays) {
+    uint32_t total = 0;
+    for (int level = 0; level < SpeedTable::LEVELS; level++) {
+        total += SpeedTable::rampLength(levelDelays[level]);
+    }
+    return total;
+}
+
+bool SpeedLevels::build(const uint16_t* levelDelays) {
+    if (memcmp(levelDelays, SpeedTable::DELAY_US, sizeof(delays)) == 0) {
+        memcpy(delays, levelDelays, sizeof(delays));
+        ramps = SpeedTable::TABLES.ramp;
+        offsets = SpeedTable::TABLES.offset;
+        return true;
+    }
+    if (rampEntries(levelDelays) > MAX_RAMP_ENTRIES) {
+        return false;
+    }
+
+    uint32_t position = 0;
+    for (int level = 0; level < SpeedTable::LEVELS; level++) {
+        builtOffsets[level] = (uint16_t)position;
+        uint32_t length = SpeedTable::rampLength(levelDelays[level]);
+        for (uint32_t k = 0; k < length; k++) {
+            built[position++] = SpeedTable::rampInterval(k, levelDelays[level]);
+        }
+    }
+    builtOffsets[SpeedTable::LEVELS] = (uint16_t)position;
+
+    memcpy(delays, levelDelays, sizeof(delays));
+    ramps = built;
+    offsets = builtOffsets;
+    return true;
+}
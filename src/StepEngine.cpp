@@ -0,0 +1,519 @@
+#include "StepEngine.h"
+
+StepEngine::StepEngine(StepTimerHal& hal) :
+    hal(hal),
+    axes{ &hal },
+    axisCount(1),
+    directMask(1),
+    bresenhamMask(0),
+    raisedMask(0),
+    reverseMask(0),
+    axisPosition{},
+    stopInput(nullptr),
+    trace(nullptr),
+    axisSteps{},
+    axisError{},
+    masterSteps(0),
+    planner(nullptr),
+    queuedPlanner(nullptr),
+    queuedAxis(0),
+    queuedDirection(false),
+    segmentCount(0),
+    revolutionSteps(0),
+    untilRevolution(0),
+    revolutionCount(0),
+    burstSteps(0),
+    burstStart(0),
+    burstPending(false),
+    burstTail(false),
+    tailStop(false),
+    tailDelay(0),
+    dirPending(false),
+    pendingDirLevel(false),
+    cutRequested(false),
+    interval(1000),
+    stepCount(0),
+    stepLimit(0),
+    active(false),
+    stepHigh(false) {}
+
+void StepEngine::begin() {
+    hal.begin(&StepEngine::onAlarmThunk, this);
+    writeAxes((1 << axisCount) - 1, false);
+}
+
+uint8_t StepEngine::addAxis(StepOutput& axisOutput) {
+    if (axisCount >= MAX_AXES) {
+        return MAX_AXES;
+    }
+    axes[axisCount] = &axisOutput;
+    return axisCount++;
+}
+
+void StepEngine::selectAxis(uint8_t axis) {
+    if (axis >= axisCount) {
+        return;
+    }
+    directMask = 1 << axis;
+    bresenhamMask = 0;
+}
+
+void StepEngine::setAxisSteps(const long* steps, uint8_t count) {
+    if (count > axisCount) {
+        count = axisCount;
+    }
+
+    masterSteps = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        axisSteps[i] = steps[i] < 0 ? -steps[i] : steps[i];
+        if (axisSteps[i] > masterSteps) {
+            masterSteps = axisSteps[i];
+        }
+    }
+
+    uint8_t direct = 0;
+    uint8_t spread = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (axisSteps[i] == masterSteps) {
+            direct |= 1 << i;
+        } else if (axisSteps[i] > 0) {
+            spread |= 1 << i;
+        }
+    }
+    directMask = direct;
+    bresenhamMask = spread;
+}
+
+void StepEngine::setDirection(uint8_t axis, bool dirLevel) {
+    if (axis >= axisCount) {
+        return;
+    }
+    if (axis == 0 && burstPending) {
+        // The alarm after the burst sets it. If that alarm has just been, write it here
+        pendingDirLevel = dirLevel;
+        dirPending = true;
+        if (burstPending) {
+            return;
+        }
+        dirPending = false;
+    }
+    writeDir(axis, dirLevel);
+}
+
+void StepEngine::setPosition(uint8_t axis, long steps) {
+    if (axis < axisCount) {
+        axisPosition[axis] = steps;
+    }
+}
+
+void StepEngine::start(uint32_t intervalMicros, long limit) {
+    launch(intervalMicros, nullptr, limit);
+}
+
+void StepEngine::start(MotionPlanner& motionPlanner, long limit) {
+    uint32_t first = motionPlanner.nextInterval();
+    if (first == 0) {
+        return;  // Nothing to move
+    }
+    launch(first, &motionPlanner, limit);
+}
+
+void StepEngine::launch(uint32_t firstInterval, MotionPlanner* motionPlanner, long limit) {
+    hal.cancelAlarm();
+    if (stepHigh) {
+        writeAxes(raisedMask, false);
+        stepHigh = false;
+    }
+
+    // Start every error term half way so the spread axes step centred in their slots
+    for (uint8_t i = 0; i < axisCount; i++) {
+        axisError[i] = masterSteps / 2;
+    }
+
+    planner = motionPlanner;
+    queuedPlanner = nullptr;
+    segmentCount = 0;
+    setInterval(firstInterval);
+    stepCount = 0;
+    stepLimit = limit;
+    tailStop = false;
+    active = true;
+
+    // First step one interval from now, matching the old polling behaviour
+    startAfterBurst(interval);
+}
+
+void StepEngine::startAfterBurst(uint32_t delay) {
+    hal.cancelAlarm();  // Keeps the ISR out from here on
+    if (!burstPending) {
+        hal.startAlarm(delay);
+        return;
+    }
+    // The burst still playing ends before the alarm armed for after it; take that alarm
+    // as a tail, which sets any DIR waiting for it and arms the first step. A cut still
+    // to come re-arms it itself
+    tailDelay = delay;
+    burstTail = true;
+    if (cutRequested) {
+        hal.startAlarm(1);
+        return;
+    }
+    int32_t busy = (int32_t)(hal.alarmMicros() - hal.nowMicros());
+    hal.startAlarm(busy > 0 ? (uint32_t)busy : 1);
+}
+
+bool StepEngine::queue(MotionPlanner& motionPlanner, uint8_t axis, bool dirLevel) {
+    if (queuedPlanner != nullptr || axis >= axisCount) {
+        return false;
+    }
+
+    // Axis and direction first: the ISR reads them as soon as it sees the planner
+    queuedAxis = axis;
+    queuedDirection = dirLevel;
+    queuedPlanner = &motionPlanner;
+    return true;
+}
+
+void StepEngine::setRevolution(long stepsPerRevolution, long position) {
+    revolutionSteps = 0;  // Keep the ISR out while the counters change
+    if (stepsPerRevolution > 0) {
+        untilRevolution = stepsPerRevolution - position % stepsPerRevolution;
+        revolutionCount = (uint32_t)(position / stepsPerRevolution);
+    } else {
+        untilRevolution = 0;
+        revolutionCount = 0;
+    }
+    revolutionSteps = stepsPerRevolution;
+}
+
+void StepEngine::setInterval(uint32_t intervalMicros) {
+    interval = intervalMicros < MIN_INTERVAL_US ? MIN_INTERVAL_US : intervalMicros;
+}
+
+uint32_t StepEngine::stepIntervalQ8() const {
+    if (!active) {
+        return 0;
+    }
+    MotionPlanner* running = planner;
+    return running != nullptr ? running->lastIntervalQ8() : interval << 8;
+}
+
+void StepEngine::halt() {
+    // A pending falling edge still completes; the ISR just won't schedule another step
+    active = false;
+    if (burstPending) {
+        cutRequested = true;
+        hal.startAlarm(1);  // Its alarm after the burst is re-armed by the cut
+    }
+}
+
+void StepEngine::rampDown() {
+    // The ISR may switch planners between any two of these lines: go again if it did
+    MotionPlanner* running;
+    do {
+        running = planner;
+        if (running == nullptr) {
+            halt();
+            return;
+        }
+        MotionPlanner* following = queuedPlanner;
+        long left = running->plannedSteps() - running->stepsIssued();
+        if (following != nullptr && left > 0 && left < running->stoppingSteps()) {
+            following->requestDecel();
+        } else {
+            queuedPlanner = nullptr;
+            running->requestDecel();
+        }
+    } while (planner != running);
+}
+
+void StepEngine::resume() {
+    if (active || (stepLimit > 0 && stepCount >= stepLimit)) {
+        return;
+    }
+
+    active = true;
+
+    // If the falling edge is still pending the ISR re-arms by itself
+    if (!stepHigh) {
+        startAfterBurst(interval);
+    }
+}
+
+void STEP_ISR_ATTR StepEngine::writeAxes(uint8_t mask, bool level) {
+    for (uint8_t i = 0; mask != 0; i++, mask >>= 1) {
+        if (mask & 1) {
+            axes[i]->writeStep(level);
+        }
+    }
+}
+
+void STEP_ISR_ATTR StepEngine::writeDir(uint8_t axis, bool level) {
+    axes[axis]->writeDir(level);
+    if (level) {
+        reverseMask = reverseMask | (1 << axis);
+    } else {
+        reverseMask = reverseMask & ~(1 << axis);
+    }
+}
+
+void STEP_ISR_ATTR StepEngine::post(uint8_t type, uint32_t value) {
+    StepEvent event = { type, value, hal.nowMicros() };
+    // Counted as an overflow if loop() has fallen behind
+    eventRing.push(event, type == StepEvent::REVOLUTION ? EVENT_RESERVE : 0);
+}
+
+void STEP_ISR_ATTR StepEngine::onAlarmThunk(void* context) {
+    static_cast<StepEngine*>(context)->onAlarm();
+}
+
+bool STEP_ISR_ATTR StepEngine::canBurst(uint16_t capacity) const {
+    // Room for a step and the one ending the burst; the limit switch is checked per step
+    return capacity >= 2 && directMask == 1 && bresenhamMask == 0 && stopInput == nullptr;
+}
+
+void STEP_ISR_ATTR StepEngine::sendBurst(uint16_t capacity) {
+    PulseEncoder encoder(burst, capacity < MAX_BURST_ITEMS ? capacity : MAX_BURST_ITEMS, PULSE_WIDTH_US);
+    uint32_t lastStart = 0;
+    bool stop = false;
+    bool turn = false;
+
+    // Each pass is the falling edge's bookkeeping for one step; its pulse goes in once
+    // the interval to the next one is known
+    uint8_t steps = 0;
+    for (;;) {
+        lastStart = encoder.duration();
+        burstOffsets[steps] = lastStart;
+        burstFirstItems[steps] = (uint8_t)encoder.count();
+        steps++;
+        axisPosition[0] = axisPosition[0] + ((reverseMask & 1) ? -1 : 1);
+        stepCount++;
+
+        if (revolutionSteps > 0 && --untilRevolution <= 0) {
+            untilRevolution = revolutionSteps;
+            post(StepEvent::REVOLUTION, ++revolutionCount);
+        }
+
+        if (stepLimit > 0 && stepCount >= stepLimit) {
+            stop = true;
+            break;
+        }
+
+        if (planner != nullptr) {
+            uint32_t next = planner->nextInterval();
+            MotionPlanner* following = queuedPlanner;
+            if (next == 0 && following != nullptr) {
+                queuedPlanner = nullptr;
+                planner = following;
+                segmentCount++;
+                post(StepEvent::SEGMENT, segmentCount);
+                directMask = 1 << queuedAxis;
+                bresenhamMask = 0;
+                if (queuedAxis == 0 && queuedDirection != ((reverseMask & 1) != 0)) {
+                    // Not under the pulses still in this burst
+                    pendingDirLevel = queuedDirection;
+                    dirPending = true;
+                    turn = true;
+                } else {
+                    writeDir(queuedAxis, queuedDirection);
+                }
+                next = following->nextInterval();
+            }
+            if (next == 0) {
+                stop = true;
+                break;
+            }
+            interval = next < MIN_INTERVAL_US ? MIN_INTERVAL_US : next;
+        }
+
+        if (turn || !encoder.step(interval)) {
+            break;
+        }
+        if (!active || directMask != 1 || encoder.full() || encoder.duration() >= BURST_MAX_US) {
+            break;
+        }
+    }
+    if (stop || turn) {
+        encoder.step(MIN_INTERVAL_US);  // Only its pulse is kept
+    }
+    uint16_t count = encoder.finish();
+
+    // The burst starts when this alarm is serviced, so it runs as late as a step would.
+    // Should the next alarm come before its last pulse is over, it waits for that
+    burstStart = hal.nowMicros();
+    uint32_t late = burstStart - hal.alarmMicros();
+    uint32_t end = lastStart + PULSE_WIDTH_US + late;
+    hal.sendBurst(burst, count);
+    burstSteps = steps;
+    burstPending = true;
+    burstTail = stop || turn;
+
+    if (stop || turn) {
+        // The tail waits for the late pulse; the step after it doesn't
+        tailStop = stop;
+        tailDelay = interval - PULSE_WIDTH_US > late + PULSE_WIDTH_US ? interval - PULSE_WIDTH_US - late : PULSE_WIDTH_US;
+        hal.armNext(end);
+    } else {
+        hal.armNext(encoder.duration() > end ? encoder.duration() : end);
+    }
+}
+
+// The alarm after the last pulse of a burst cut short
+void STEP_ISR_ATTR StepEngine::finishBurst() {
+    burstTail = false;
+    if (tailStop) {
+        tailStop = false;
+        active = false;
+        post(StepEvent::STOPPED, stepCount);
+        return;
+    }
+    if (active) {
+        hal.armNext(tailDelay);
+    }
+}
+
+// Alarm armed by halt(): end the burst before the steps it hasn't started and take them
+// back, then re-arm the alarm after it for the end of what is left
+void STEP_ISR_ATTR StepEngine::cutBurst() {
+    uint32_t elapsed = hal.nowMicros() - burstStart;
+    uint8_t kept = 1;
+    while (kept < burstSteps && burstOffsets[kept] <= elapsed + BURST_CUT_US) {
+        kept++;
+    }
+    uint32_t end = burstOffsets[kept - 1] + PULSE_WIDTH_US;
+    if (kept < burstSteps) {
+        hal.endBurstAt(burstFirstItems[kept]);
+        long cut = burstSteps - kept;
+        axisPosition[0] = axisPosition[0] + ((reverseMask & 1) ? cut : -cut);
+        stepCount = stepCount - cut;
+        burstSteps = kept;
+        end = burstOffsets[kept];  // The generator runs on to where the cut step would start
+    }
+    int32_t left = (int32_t)(burstStart + end - hal.nowMicros());
+    hal.startAlarm(left > 0 ? (uint32_t)left : 1);
+}
+
+// Alarm after a burst: log the steps that went out, the last at the current position
+void STEP_ISR_ATTR StepEngine::traceBurst() {
+    TraceRecorder* recorder = trace;
+    if (recorder == nullptr) {
+        return;
+    }
+    bool reverse = (reverseMask & 1) != 0;
+    long direction = reverse ? -1 : 1;
+    long position = axisPosition[0] - direction * (burstSteps - 1);
+    for (uint8_t i = 0; i < burstSteps; i++) {
+        recorder->step(burstStart + burstOffsets[i], reverse, position);
+        position += direction;
+    }
+}
+
+void STEP_ISR_ATTR StepEngine::onAlarm() {
+    if (cutRequested) {
+        cutRequested = false;
+        if (burstPending) {
+            cutBurst();
+            return;
+        }
+    }
+    if (burstPending) {
+        burstPending = false;
+        traceBurst();  // Under the DIR it went out with
+        if (dirPending) {
+            dirPending = false;
+            writeDir(0, pendingDirLevel);
+        }
+        if (burstTail) {
+            finishBurst();
+            return;
+        }
+    }
+
+    if (!stepHigh) {
+        if (!active) {
+            return;
+        }
+        LimitSwitch* input = stopInput;
+        if (input != nullptr && input->triggered()) {
+            active = false;
+            post(StepEvent::LIMIT, stepCount);
+            return;
+        }
+        uint32_t now = hal.nowMicros();
+        stepLateness.record(now - hal.alarmMicros());
+
+        uint16_t capacity = hal.burstItems();
+        if (canBurst(capacity)) {
+            sendBurst(capacity);
+            return;
+        }
+
+        uint8_t mask = directMask;
+        uint8_t spread = bresenhamMask;
+        for (uint8_t i = 0; spread != 0; i++, spread >>= 1) {
+            if (spread & 1) {
+                axisError[i] += axisSteps[i];
+                if (axisError[i] >= masterSteps) {
+                    axisError[i] -= masterSteps;
+                    mask |= 1 << i;
+                }
+            }
+        }
+        writeAxes(mask, true);
+        raisedMask = mask;
+        uint8_t reverse = reverseMask;
+        TraceRecorder* recorder = (mask & 1) ? trace : nullptr;
+        for (uint8_t i = 0; mask != 0; i++, mask >>= 1, reverse >>= 1) {
+            if (mask & 1) {
+                axisPosition[i] = axisPosition[i] + ((reverse & 1) ? -1 : 1);
+            }
+        }
+        if (recorder != nullptr) {
+            recorder->step(now, (reverseMask & 1) != 0, axisPosition[0]);
+        }
+        stepHigh = true;
+        hal.armNext(PULSE_WIDTH_US);
+        return;
+    }
+
+    writeAxes(raisedMask, false);
+    stepHigh = false;
+    stepCount++;
+
+    if (revolutionSteps > 0 && --untilRevolution <= 0) {
+        untilRevolution = revolutionSteps;
+        post(StepEvent::REVOLUTION, ++revolutionCount);
+    }
+
+    if (stepLimit > 0 && stepCount >= stepLimit) {
+        active = false;
+        post(StepEvent::STOPPED, stepCount);
+        return;
+    }
+
+    if (planner != nullptr) {
+        uint32_t next = planner->nextInterval();
+        MotionPlanner* following = queuedPlanner;
+        if (next == 0 && following != nullptr) {
+            // Blend straight into the queued segment; DIR has a full interval to settle
+            queuedPlanner = nullptr;
+            planner = following;
+            segmentCount++;
+            post(StepEvent::SEGMENT, segmentCount);
+            directMask = 1 << queuedAxis;
+            bresenhamMask = 0;
+            writeDir(queuedAxis, queuedDirection);
+            next = following->nextInterval();
+        }
+        if (next == 0) {
+            active = false;
+            post(StepEvent::STOPPED, stepCount);
+            return;
+        }
+        interval = next < MIN_INTERVAL_US ? MIN_INTERVAL_US : next;
+    }
+
+    if (active) {
+        hal.armNext(interval - PULSE_WIDTH_US);
+    }
+}
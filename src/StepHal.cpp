@@ -0,0 +1,392 @@
+#include "StepHal.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+#include <driver/rmt.h>
+#include <soc/gpio_struct.h>
+#include <soc/rmt_struct.h>
+
+namespace {
+
+const rmt_channel_t STEP_CHANNEL = RMT_CHANNEL_0;
+
+// One store to the set or clear register instead of digitalWrite()'s checks and lookups
+inline void IRAM_ATTR writePin(int pin, bool level) {
+    if (pin < 0) {
+        return;
+    }
+    if (pin < 32) {
+        if (level) {
+            GPIO.out_w1ts = 1u << pin;
+        } else {
+            GPIO.out_w1tc = 1u << pin;
+        }
+    } else if (level) {
+        GPIO.out1_w1ts.val = 1u << (pin - 32);
+    } else {
+        GPIO.out1_w1tc.val = 1u << (pin - 32);
+    }
+}
+
+}  // namespace
+
+Esp32StepOutput::Esp32StepOutput(int stepPin, int dirPin, int enablePin) :
+    stepPin(stepPin),
+    dirPin(dirPin),
+    enablePin(enablePin) {}
+
+void Esp32StepOutput::begin() {
+    pinMode(stepPin, OUTPUT);
+    pinMode(dirPin, OUTPUT);
+    pinMode(enablePin, OUTPUT);
+    digitalWrite(stepPin, LOW);
+}
+
+void IRAM_ATTR Esp32StepOutput::writeStep(bool level) {
+    writePin(stepPin, level);
+}
+
+void IRAM_ATTR Esp32StepOutput::writeDir(bool level) {
+    writePin(dirPin, level);
+}
+
+void Esp32StepOutput::writeEnable(bool level) {
+    writePin(enablePin, level);
+}
+
+void GpioPulses::begin(int stepPin) {
+    pin = stepPin;
+    pinMode(pin, OUTPUT);
+    digitalWrite(pin, LOW);
+}
+
+void IRAM_ATTR GpioPulses::write(bool level) {
+    writePin(pin, level);
+}
+
+void RmtPulses::begin(int stepPin) {
+    rmt_config_t config = RMT_DEFAULT_CONFIG_TX((gpio_num_t)stepPin, STEP_CHANNEL);
+    config.clk_div = 80;  // 1 tick per microsecond, like the step timer
+    config.mem_block_num = 1;
+    config.tx_config.carrier_en = false;
+    config.tx_config.loop_en = false;
+    config.tx_config.idle_output_en = true;
+    config.tx_config.idle_level = RMT_IDLE_LEVEL_LOW;
+    // Registers only: no driver and no RMT interrupt, the step ISR feeds the channel itself
+    rmt_config(&config);
+}
+
+void IRAM_ATTR RmtPulses::write(bool level) {
+    RMT.conf_ch[STEP_CHANNEL].conf1.idle_out_lv = level ? 1 : 0;
+}
+
+void IRAM_ATTR RmtPulses::send(const PulseItem* items, uint16_t count) {
+    volatile rmt_item32_t* memory = RMTMEM.chan[STEP_CHANNEL].data32;
+    for (uint16_t i = 0; i < count; i++) {
+        memory[i].val = items[i].value;
+    }
+    RMT.conf_ch[STEP_CHANNEL].conf1.mem_rd_rst = 1;
+    RMT.conf_ch[STEP_CHANNEL].conf1.mem_rd_rst = 0;
+    RMT.conf_ch[STEP_CHANNEL].conf1.tx_start = 1;
+}
+
+void IRAM_ATTR RmtPulses::end(uint16_t item) {
+    RMTMEM.chan[STEP_CHANNEL].data32[item].val = 0;  // Zero duration: the channel stops there
+}
+
+template <class Pulses>
+Esp32StepHal<Pulses>* Esp32StepHal<Pulses>::instance = nullptr;
+
+template <class Pulses>
+Esp32StepHal<Pulses>::Esp32StepHal(int stepPin, int dirPin, int enablePin) :
+    stepPin(stepPin),
+    dirPin(dirPin),
+    enablePin(enablePin),
+    timer(nullptr),
+    alarmAt(0),
+    callback(nullptr),
+    context(nullptr) {}
+
+template <class Pulses>
+void IRAM_ATTR Esp32StepHal<Pulses>::onTimer() {
+    if (instance != nullptr && instance->callback != nullptr) {
+        instance->callback(instance->context);
+    }
+}
+
+template <class Pulses>
+void Esp32StepHal<Pulses>::begin(AlarmCallback cb, void* ctx) {
+    callback = cb;
+    context = ctx;
+    instance = this;
+
+    pulses.begin(stepPin);
+    pinMode(dirPin, OUTPUT);
+    pinMode(enablePin, OUTPUT);
+
+    // Timer 0, prescaler 80 -> 1 tick per microsecond, counting up
+    timer = timerBegin(0, 80, true);
+    timerAttachInterrupt(timer, &Esp32StepHal::onTimer, false);  // Level: 2.x has no edge-triggered timer interrupts
+}
+
+template <class Pulses>
+void Esp32StepHal<Pulses>::startAlarm(uint32_t delayMicros) {
+    alarmAt = timerRead(timer) + delayMicros;
+    timerAlarmWrite(timer, alarmAt, false);
+    timerAlarmEnable(timer);
+}
+
+template <class Pulses>
+void IRAM_ATTR Esp32StepHal<Pulses>::armNext(uint32_t delayMicros) {
+    // alarmAt stays on the schedule even when that has passed, so a late alarm doesn't
+    // shift every step after it
+    alarmAt += delayMicros;
+
+    // If we already fell behind, fire as soon as possible instead of waiting for a counter wrap
+    uint64_t now = timerRead(timer);
+    timerAlarmWrite(timer, alarmAt > now + 1 ? alarmAt : now + 2, false);
+    timerAlarmEnable(timer);
+}
+
+template <class Pulses>
+void Esp32StepHal<Pulses>::cancelAlarm() {
+    timerAlarmDisable(timer);
+}
+
+template <class Pulses>
+uint32_t IRAM_ATTR Esp32StepHal<Pulses>::nowMicros() {
+    return (uint32_t)timerRead(timer);
+}
+
+template <class Pulses>
+uint32_t IRAM_ATTR Esp32StepHal<Pulses>::alarmMicros() {
+    return (uint32_t)alarmAt;
+}
+
+template <class Pulses>
+void IRAM_ATTR Esp32StepHal<Pulses>::sendBurst(const PulseItem* items, uint16_t count) {
+    pulses.send(items, count);
+}
+
+template <class Pulses>
+void IRAM_ATTR Esp32StepHal<Pulses>::endBurstAt(uint16_t item) {
+    pulses.end(item);
+}
+
+template <class Pulses>
+void IRAM_ATTR Esp32StepHal<Pulses>::writeStep(bool level) {
+    pulses.write(level);
+}
+
+template <class Pulses>
+void IRAM_ATTR Esp32StepHal<Pulses>::writeDir(bool level) {
+    writePin(dirPin, level);
+}
+
+template <class Pulses>
+void Esp32StepHal<Pulses>::writeEnable(bool level) {
+    writePin(enablePin, level);
+}
+
+template class Esp32StepHal<GpioPulses>;
+template class Esp32StepHal<RmtPulses>;
+
+#else
+
+#include <Arduino.h>
+
+const SimStepHal* SimStepHal::clock = nullptr;
+
+SimStepOutput::SimStepOutput(int stepPin, int dirPin, int enablePin) :
+    stepPin(stepPin),
+    dirPin(dirPin),
+    enablePin(enablePin),
+    stepLevel(false),
+    dirLevel(false),
+    enableLevel(true),
+    pulseCount(0),
+    position(0) {}
+
+void SimStepOutput::writeStep(bool level) {
+    if (level && !stepLevel) {
+        pulseTimes[pulseCount % MAX_RECORDED_PULSES] = SimStepHal::clock != nullptr ? SimStepHal::clock->now64() : 0;
+        pulseCount++;
+        position += dirLevel ? -1 : 1;
+    }
+    stepLevel = level;
+}
+
+// DIR and ENABLE also go through digitalWrite() so they show up in Sim's edge record;
+// STEP edges are too many for it and are kept in pulseTimes instead
+void SimStepOutput::writeDir(bool level) {
+    dirLevel = level;
+    if (dirPin >= 0) {
+        digitalWrite(dirPin, level ? HIGH : LOW);
+    }
+}
+
+void SimStepOutput::writeEnable(bool level) {
+    enableLevel = level;
+    if (enablePin >= 0) {
+        digitalWrite(enablePin, level ? HIGH : LOW);
+    }
+}
+
+SimStepHal::SimStepHal(int stepPin, int dirPin, int enablePin) :
+    now(0),
+    alarmAt(0),
+    alarmArmed(false),
+    alarmLatency(0),
+    alarmJitter(0),
+    jitterSeed(1),
+    alarmFiresAt(0),
+    alarmCount(0),
+    callback(nullptr),
+    context(nullptr),
+    pins(stepPin, dirPin, enablePin),
+    burstCapacity(0),
+    burstHead(0),
+    burstTail(0),
+    burstEnd(0),
+    burstErrorCount(0) {}
+
+void SimStepHal::begin(AlarmCallback cb, void* ctx) {
+    callback = cb;
+    context = ctx;
+    clock = this;
+
+    // Follow the fake Arduino clock, so micros() and the step timer agree
+    now = Sim::now();
+    Sim::attachTimer(advanceTimer, this);
+}
+
+void SimStepHal::advanceTimer(void* hal, uint64_t micros) {
+    static_cast<SimStepHal*>(hal)->advance(micros);
+}
+
+void SimStepHal::arm(uint64_t at) {
+    alarmAt = at;
+    uint32_t delay = alarmLatency;
+    if (alarmJitter > 0) {
+        jitterSeed = jitterSeed * 1664525u + 1013904223u;  // LCG, reproducible per seed
+        delay += (jitterSeed >> 8) % (alarmJitter + 1);
+    }
+    alarmFiresAt = (at <= now ? now + 1 : at) + delay;
+    alarmArmed = true;
+}
+
+void SimStepHal::startAlarm(uint32_t delayMicros) {
+    arm(now + delayMicros);
+}
+
+void SimStepHal::armNext(uint32_t delayMicros) {
+    arm(alarmAt + delayMicros);  // Past due fires at once, keeping the schedule
+}
+
+void SimStepHal::cancelAlarm() {
+    alarmArmed = false;
+}
+
+uint32_t SimStepHal::nowMicros() {
+    return (uint32_t)now;
+}
+
+uint32_t SimStepHal::alarmMicros() {
+    return (uint32_t)alarmAt;
+}
+
+void SimStepHal::sendBurst(const PulseItem* items, uint16_t count) {
+    if (now < burstEnd || count > burstCapacity) {
+        burstErrorCount++;  // The RMT would garble the one still playing, or overrun its memory
+    }
+
+    // The line idles low: every high half that follows a low one is a step
+    uint64_t at = now;
+    bool level = false;
+    bool ended = false;
+    for (uint16_t i = 0; i < count && !ended; i++) {
+        uint32_t durations[2] = { items[i].duration0(), items[i].duration1() };
+        bool levels[2] = { items[i].level0(), items[i].level1() };
+        for (int half = 0; half < 2; half++) {
+            if (durations[half] == 0) {
+                ended = true;
+                break;
+            }
+            if (levels[half] && !level) {
+                if (burstTail - burstHead >= MAX_BURST_PULSES) {
+                    burstErrorCount++;
+                } else {
+                    BurstPulse pulse = { at, i };
+                    burstPulses[burstTail++ % MAX_BURST_PULSES] = pulse;
+                }
+            }
+            level = levels[half];
+            at += durations[half];
+        }
+    }
+    if (!ended) {
+        burstErrorCount++;  // The RMT would run on into whatever is left in its memory
+    }
+    burstEnd = at;
+}
+
+void SimStepHal::endBurstAt(uint16_t item) {
+    // The generator stops where the item would have started: at its first pulse
+    uint64_t end = burstEnd;
+    while (burstTail != burstHead && burstPulses[(burstTail - 1) % MAX_BURST_PULSES].item >= item) {
+        burstTail--;
+        end = burstPulses[burstTail % MAX_BURST_PULSES].time;
+    }
+    if (end <= now) {
+        burstErrorCount++;
+    }
+    burstEnd = end;
+}
+
+void SimStepHal::writeStep(bool level) {
+    if (now < burstEnd) {
+        burstErrorCount++;
+    }
+    pins.writeStep(level);
+}
+
+void SimStepHal::writeDir(bool level) {
+    if (now < burstEnd && level != pins.dir()) {
+        burstErrorCount++;  // Steps still to play would go the wrong way
+    }
+    pins.writeDir(level);
+}
+
+void SimStepHal::writeEnable(bool level) {
+    pins.writeEnable(level);
+}
+
+void SimStepHal::advance(uint64_t micros) {
+    uint64_t end = now + micros;
+
+    // Burst pulses and alarms in time order; a pulse due with the alarm is already playing
+    for (;;) {
+        uint64_t pulseAt = burstPulses[burstHead % MAX_BURST_PULSES].time;
+        bool pulseDue = burstHead != burstTail && pulseAt <= end;
+        bool alarmDue = alarmArmed && alarmFiresAt <= end;
+        if (pulseDue && (!alarmDue || pulseAt <= alarmFiresAt)) {
+            now = pulseAt;
+            burstHead++;
+            pins.writeStep(true);
+            pins.writeStep(false);
+        } else if (alarmDue) {
+            now = alarmFiresAt;
+            alarmArmed = false;  // One-shot: the callback re-arms if it wants another alarm
+            alarmCount++;
+            if (callback != nullptr) {
+                callback(context);
+            }
+        } else {
+            break;
+        }
+    }
+
+    now = end;
+}
+
+#endif
@@ -0,0 +1,221 @@
+#include "Telemetry.h"
+#include "FrameCodec.h"
+#include <string.h>
+
+namespace Telemetry {
+
+namespace {
+
+const char* const NAMES[FIELD_COUNT] = { "POS", "FRAC", "RPM", "LOAD", "ERR", "STATE" };
+const uint8_t SIZES[FIELD_COUNT] = { 4, 2, 2, 2, 2, 1 };
+
+}  // namespace
+
+uint8_t fieldByName(const char* name) {
+    for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+        if (strcmp(name, NAMES[i]) == 0) {
+            return (uint8_t)(1 << i);
+        }
+    }
+    return 0;
+}
+
+const char* fieldName(uint8_t field) {
+    for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+        if (field == (1 << i)) {
+            return NAMES[i];
+        }
+    }
+    return "";
+}
+
+size_t sampleSize(uint8_t fields) {
+    size_t size = 0;
+    for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+        if (fields & (1 << i)) {
+            size += SIZES[i];
+        }
+    }
+    return size;
+}
+
+uint8_t batchCapacity(uint8_t fields) {
+    size_t size = sampleSize(fields);
+    if (size == 0) {
+        return 0;
+    }
+    size_t samples = (Frame::MAX_PAYLOAD - HEADER_SIZE) / size;
+    return (uint8_t)(samples & ~(size_t)1);
+}
+
+size_t encode(const Batch& batch, const Sample* samples, uint8_t* payload) {
+    Frame::put16(payload, batch.sequence);
+    payload[2] = batch.stride;
+    payload[3] = batch.count;
+    payload[4] = batch.fields;
+
+    uint8_t* out = payload + HEADER_SIZE;
+    for (uint8_t i = 0; i < batch.count; i++) {
+        const Sample& sample = samples[i];
+        if (batch.fields & POS) {
+            Frame::put32(out, (uint32_t)sample.position);
+            out += 4;
+        }
+        if (batch.fields & FRAC) {
+            Frame::put16(out, sample.fraction);
+            out += 2;
+        }
+        if (batch.fields & RPM) {
+            Frame::put16(out, sample.rpmTenths);
+            out += 2;
+        }
+        if (batch.fields & LOAD) {
+            Frame::put16(out, sample.loadTenths);
+            out += 2;
+        }
+        if (batch.fields & ERR) {
+            Frame::put16(out, (uint16_t)sample.followingError);
+            out += 2;
+        }
+        if (batch.fields & STATE) {
+            *out++ = sample.state;
+        }
+    }
+    return (size_t)(out - payload);
+}
+
+bool decode(const uint8_t* payload, size_t length, Batch& batch, Sample* samples, size_t maxSamples) {
+    if (length < HEADER_SIZE) {
+        return false;
+    }
+    batch.sequence = Frame::get16(payload);
+    batch.stride = payload[2];
+    batch.count = payload[3];
+    batch.fields = payload[4];
+    if (batch.count > maxSamples || (batch.fields & ~ALL) != 0 ||
+        length != HEADER_SIZE + batch.count * sampleSize(batch.fields)) {
+        return false;
+    }
+
+    const uint8_t* in = payload + HEADER_SIZE;
+    for (uint8_t i = 0; i < batch.count; i++) {
+        Sample& sample = samples[i];
+        memset(&sample, 0, sizeof(sample));
+        if (batch.fields & POS) {
+            sample.position = (int32_t)Frame::get32(in);
+            in += 4;
+        }
+        if (batch.fields & FRAC) {
+            sample.fraction = Frame::get16(in);
+            in += 2;
+        }
+        if (batch.fields & RPM) {
+            sample.rpmTenths = Frame::get16(in);
+            in += 2;
+        }
+        if (batch.fields & LOAD) {
+            sample.loadTenths = Frame::get16(in);
+            in += 2;
+        }
+        if (batch.fields & ERR) {
+            sample.followingError = (int16_t)Frame::get16(in);
+            in += 2;
+        }
+        if (batch.fields & STATE) {
+            sample.state = *in++;
+        }
+    }
+    return true;
+}
+
+}  // namespace Telemetry
+
+TelemetryStream::TelemetryStream() :
+    active(false),
+    fields(0),
+    period(0),
+    nextSample(0),
+    sequence(0),
+    capacity(0),
+    batch(),
+    count(0),
+    stride(1),
+    batchSequence(0),
+    batchStart(0),
+    taken(0),
+    sent(0),
+    batches(0) {}
+
+void TelemetryStream::start(uint8_t selected, uint16_t rate, uint32_t now) {
+    fields = selected & Telemetry::ALL;
+    capacity = Telemetry::batchCapacity(fields);
+    period = 1000000UL / (rate > 0 ? rate : 1);
+    nextSample = now;
+    sequence = 0;
+    count = 0;
+    stride = 1;
+    taken = 0;
+    sent = 0;
+    batches = 0;
+    active = capacity > 0;
+}
+
+void TelemetryStream::stop() {
+    active = false;
+    count = 0;
+}
+
+bool TelemetryStream::due(uint32_t now) {
+    if (!active || (int32_t)(now - nextSample) < 0) {
+        return false;
+    }
+    nextSample += period;
+    return true;
+}
+
+void TelemetryStream::add(const Telemetry::Sample& sample, uint32_t now) {
+    uint16_t index = sequence++;
+    taken++;
+
+    if (count == 0) {
+        batchSequence = index;
+        batchStart = now;
+        stride = 1;
+    } else if ((uint16_t)(index - batchSequence) != (uint16_t)(count * stride)) {
+        return;  // Falls between the samples of a coalesced batch
+    }
+
+    if (count == capacity) {
+        if (stride >= MAX_STRIDE) {
+            // The link has been blocked for MAX_STRIDE batches: start over from here
+            batchSequence = index;
+            batchStart = now;
+            stride = 1;
+            count = 0;
+        } else {
+            // Keep samples 0, 2, 4, ...: this one is then exactly the next in line
+            for (uint8_t i = 1; i < capacity / 2; i++) {
+                batch[i] = batch[2 * i];
+            }
+            count = capacity / 2;
+            stride *= 2;
+        }
+    }
+    batch[count++] = sample;
+}
+
+size_t TelemetryStream::take(uint8_t* payload, uint32_t now, bool canSend) {
+    if (!active || count == 0 || !canSend) {
+        return 0;
+    }
+    if (count < capacity && now - batchStart < FLUSH_MICROS) {
+        return 0;
+    }
+
+    Telemetry::Batch header = { batchSequence, stride, count, fields };
+    size_t length = Telemetry::encode(header, batch, payload);
+    sent += count;
+    batches++;
+    count = 0;
+    return length;
+}
@@ -0,0 +1,45 @@
+#include "TextWriter.h"
+#include <stdio.h>
+#include <string.h>
+
+TextWriter::TextWriter(char* buffer, size_t capacity) :
+    buffer(buffer),
+    capacity(capacity),
+    used(0) {
+    buffer[0] = '\0';
+}
+
+TextWriter& TextWriter::append(const char* text) {
+    size_t length = strlen(text);
+    size_t room = capacity - 1 - used;
+    if (length > room) {
+        length = room;
+    }
+    memcpy(buffer + used, text, length);
+    used += length;
+    buffer[used] = '\0';
+    return *this;
+}
+
+TextWriter& TextWriter::appendf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    appendv(format, args);
+    va_end(args);
+    return *this;
+}
+
+TextWriter& TextWriter::appendv(const char* format, va_list args) {
+    size_t room = capacity - used;
+    int written = vsnprintf(buffer + used, room, format, args);
+    if (written > 0) {
+        // vsnprintf reports what it would have written; keep what fitted
+        used += (size_t)written < room ? (size_t)written : room - 1;
+    }
+    return *this;
+}
+
+void TextWriter::clear() {
+    used = 0;
+    buffer[0] = '\0';
+}
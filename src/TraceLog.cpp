@@ -0,0 +1,262 @@
+#include "TraceLog.h"
+#include "FrameCodec.h"
+#include <string.h>
+
+namespace {
+
+// Byte stores of their own rather than Frame::put*, which live in flash: the step ISR
+// writes block headers
+inline void STEP_ISR_ATTR store16(uint8_t* out, uint16_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+}
+
+inline void STEP_ISR_ATTR store32(uint8_t* out, uint32_t value) {
+    store16(out, (uint16_t)value);
+    store16(out + 2, (uint16_t)(value >> 16));
+}
+
+inline uint32_t STEP_ISR_ATTR zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+inline int32_t unzigzag(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+inline uint8_t* STEP_ISR_ATTR putVarint(uint8_t* out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+// false past end or beyond 64 bits
+bool getVarint(const uint8_t*& in, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (in >= end) {
+            return false;
+        }
+        uint8_t byte = *in++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Copies what of part lies at or after offset, moving offset, out and length on
+void copyPart(const uint8_t* part, size_t size, size_t& offset, uint8_t*& out, size_t& length) {
+    if (offset >= size) {
+        offset -= size;
+        return;
+    }
+    size_t count = size - offset < length ? size - offset : length;
+    memcpy(out, part + offset, count);
+    out += count;
+    length -= count;
+    offset = 0;
+}
+
+}  // namespace
+
+namespace Trace {
+
+bool decodeImageHeader(const uint8_t* in, size_t length, ImageHeader& header) {
+    if (length < IMAGE_HEADER_SIZE || in[0] != 'T' || in[1] != 'R' || in[2] != 'C' || in[3] != VERSION) {
+        return false;
+    }
+    header.blocks = Frame::get16(in + 4);
+    header.marks = Frame::get16(in + 6);
+    header.steps = Frame::get32(in + 8);
+    return true;
+}
+
+void decodeBlockHeader(const uint8_t* in, BlockHeader& header) {
+    header.sequence = Frame::get16(in);
+    header.length = Frame::get16(in + 2);
+    header.time = Frame::get32(in + 4);
+    header.interval = Frame::get32(in + 8);
+    header.position = (int32_t)Frame::get32(in + 12);
+    header.reverse = in[16] != 0;
+}
+
+long decodeBlock(const BlockHeader& header, const uint8_t* records, Step* steps, size_t maxSteps) {
+    const uint8_t* in = records;
+    const uint8_t* end = records + header.length;
+    uint32_t time = header.time;
+    uint32_t interval = header.interval;
+    int32_t position = header.position;
+    bool reverse = header.reverse;
+    int32_t jump = 0;
+    size_t count = 0;
+
+    while (in < end) {
+        uint64_t value;
+        if (!getVarint(in, end, value)) {
+            return -1;
+        }
+        if (value & 1) {
+            uint64_t marker = value >> 1;
+            if (marker == DIR_CW || marker == DIR_CCW) {
+                reverse = marker == DIR_CCW;
+            } else if (marker == POSITION) {
+                uint64_t distance;
+                if (!getVarint(in, end, distance) || distance > UINT32_MAX) {
+                    return -1;
+                }
+                jump = unzigzag((uint32_t)distance);
+            } else {
+                return -1;
+            }
+            continue;
+        }
+        if (count >= maxSteps || (value >> 1) > UINT32_MAX) {
+            return -1;
+        }
+        interval += (uint32_t)unzigzag((uint32_t)(value >> 1));
+        time += interval;
+        position += (reverse ? -1 : 1) + jump;
+        jump = 0;
+        steps[count++] = { time, interval, position, reverse };
+    }
+    return (long)count;
+}
+
+void decodeMark(const uint8_t* in, Mark& mark) {
+    mark.time = Frame::get32(in);
+    mark.position = (int32_t)Frame::get32(in + 4);
+    mark.state = in[8];
+}
+
+}  // namespace Trace
+
+TraceRecorder::TraceRecorder() :
+    blocks{},
+    marks{},
+    recording(false),
+    head(0),
+    used(0),
+    lastTime(0),
+    lastInterval(0),
+    lastPosition(0),
+    lastReverse(false),
+    stepCount(0),
+    markCount(0) {}
+
+void TraceRecorder::start(uint32_t now, long position, bool reverse) {
+    recording = false;  // The step ISR leaves it alone from here
+    head = 0;
+    lastTime = now;
+    lastInterval = 0;
+    lastPosition = position;
+    lastReverse = reverse;
+    stepCount = 0;
+    markCount = 0;
+    open();
+    recording = true;
+}
+
+void TraceRecorder::stop() {
+    recording = false;
+    store16(blocks[head % BLOCKS] + 2, used);
+}
+
+// Starts block head from the last step, over the oldest one when the ring is full
+void STEP_ISR_ATTR TraceRecorder::open() {
+    uint8_t* block = blocks[head % BLOCKS];
+    store16(block, (uint16_t)head);
+    store16(block + 2, 0);
+    store32(block + 4, lastTime);
+    store32(block + 8, lastInterval);
+    store32(block + 12, (uint32_t)lastPosition);
+    block[16] = lastReverse ? 1 : 0;
+    used = 0;
+}
+
+void STEP_ISR_ATTR TraceRecorder::step(uint32_t time, bool reverse, long position) {
+    if (!recording) {
+        return;
+    }
+    if (used > Trace::BLOCK_SIZE - Trace::BLOCK_HEADER_SIZE - MAX_RECORD) {
+        store16(blocks[head % BLOCKS] + 2, used);
+        head++;
+        open();
+    }
+    uint8_t* start = blocks[head % BLOCKS] + Trace::BLOCK_HEADER_SIZE + used;
+    uint8_t* out = start;
+
+    if (reverse != lastReverse) {
+        *out++ = (uint8_t)(((reverse ? Trace::DIR_CCW : Trace::DIR_CW) << 1) | 1);
+    }
+    long expected = lastPosition + (reverse ? -1 : 1);
+    if (position != expected) {
+        *out++ = (uint8_t)((Trace::POSITION << 1) | 1);
+        out = putVarint(out, zigzag((int32_t)(position - expected)));
+    }
+    uint32_t interval = time - lastTime;
+    uint32_t change = zigzag((int32_t)(interval - lastInterval));
+    if (change < 0x40) {
+        *out++ = (uint8_t)(change << 1);
+    } else {
+        out = putVarint(out, (uint64_t)change << 1);
+    }
+
+    used = (uint16_t)(used + (out - start));
+    lastTime = time;
+    lastInterval = interval;
+    lastPosition = position;
+    lastReverse = reverse;
+    stepCount++;
+}
+
+void TraceRecorder::mark(uint32_t time, long position, uint8_t state) {
+    if (!recording) {
+        return;
+    }
+    Trace::Mark& mark = marks[markCount % MARKS];
+    mark.time = time;
+    mark.position = (int32_t)position;
+    mark.state = state;
+    markCount++;
+}
+
+size_t TraceRecorder::blockBytes(uint32_t block) const {
+    return Trace::BLOCK_HEADER_SIZE + Frame::get16(blocks[block % BLOCKS] + 2);
+}
+
+size_t TraceRecorder::imageSize() const {
+    size_t size = Trace::IMAGE_HEADER_SIZE + (size_t)marksHeld() * Trace::MARK_SIZE;
+    for (uint32_t block = head + 1 - blocksHeld(); block != head + 1; block++) {
+        size += blockBytes(block);
+    }
+    return size;
+}
+
+size_t TraceRecorder::readImage(size_t offset, uint8_t* out, size_t length) const {
+    size_t wanted = length;
+
+    uint8_t header[Trace::IMAGE_HEADER_SIZE] = { 'T', 'R', 'C', Trace::VERSION };
+    Frame::put16(header + 4, blocksHeld());
+    Frame::put16(header + 6, marksHeld());
+    Frame::put32(header + 8, stepCount);
+    copyPart(header, sizeof(header), offset, out, length);
+
+    for (uint32_t block = head + 1 - blocksHeld(); block != head + 1 && length > 0; block++) {
+        copyPart(blocks[block % BLOCKS], blockBytes(block), offset, out, length);
+    }
+
+    for (uint32_t i = markCount - marksHeld(); i != markCount && length > 0; i++) {
+        const Trace::Mark& mark = marks[i % MARKS];
+        uint8_t record[Trace::MARK_SIZE];
+        Frame::put32(record, mark.time);
+        Frame::put32(record + 4, (uint32_t)mark.position);
+        record[8] = mark.state;
+        copyPart(record, sizeof(record), offset, out, length);
+    }
+    return wanted - length;
+}
@@ -2,6 +2,13 @@
 #include <Arduino.h>
 #include "SerialManager.h"
 #include "MotorController.h"
+#include "RtosShim.h"
+#include "Histogram.h"
+#include "ConfigStore.h"
+#include "HeapStats.h"
+#include "MotionScript.h"
+#include "ScriptRunner.h"
+#include <limits.h>
 
 const int led1Pin = 2;   // Hi 명령 수신 시 (내장 LED)
 const int led2Pin = 4;   // RPM ROT 명령 시
@@ -17,49 +24,852 @@ bool runningLedBlink = false;
 unsigned long runningLedBlinkTime = 0;
 bool runningLedState = false;
 
+// Stepper axes: X drives the original TB6600, Y/Z/A share its step timer
+const AxisConfig AXES[] = {
+  { 16, 17, 18, 200, 16 },     // X: GPIO16 PUL+, GPIO17 DIR+, GPIO18 ENA+, 1/16 microsteps
+  // { 19, 21, 22, 200, 16 },  // Y
+  // { 23, 25, 26, 200, 16 },  // Z
+  // { 27, 32, 33, 200, 16 },  // A
+};
+const char AXIS_NAMES[] = "XYZA";
+
 SerialManager serialManager;
-MotorController motorController;
+MotorController motorController(AXES[0]);
 
-void setup() {
-  serialManager.begin();
-  motorController.begin();
-  
-  pinMode(led1Pin, OUTPUT);
-  pinMode(led2Pin, OUTPUT);
-  pinMode(led3Pin, OUTPUT);
-  pinMode(led4Pin, OUTPUT);
-  
+// Station configuration in NVS (a file on Linux), loaded over the compiled-in values
+PlatformConfigStorage configStorage;
+ConfigStore configStore(configStorage);
+MotorConfig defaultConfig;  // Compiled-in, for CONFIG DEFAULTS
+const size_t CONFIG_LINE = 60;  // CONFIG replies are split to fit one binary frame
+
+// Motion script, compiled line by line as PROG lines arrive, stored next to the
+// configuration and run from the motion task
+#if defined(ARDUINO_ARCH_ESP32)
+PlatformConfigStorage scriptStorage("motor", "script");
+#else
+PlatformConfigStorage scriptStorage("motor_script.bin");
+#endif
+ScriptCompiler scriptCompiler;
+ScriptRunner scriptRunner(motorController, serialManager);
+bool scriptUploading = false;
+
+// Motion (MotorController, LEDs, command handlers) runs on core 1 next to the step ISR;
+// serial I/O and parsing run on core 0. Parsed commands cross over through a bounded
+// queue and all output goes through SerialManager's outbox, so the tasks share no state.
+const int MOTION_CORE = 1;
+const int COMMS_CORE = 0;
+const uint8_t MOTION_PRIORITY = 5;
+const uint8_t COMMS_PRIORITY = 3;
+const uint32_t MOTION_PERIOD_MS = 1;
+const uint8_t LOAD_PRIORITY = 1;      // Below comms: filtering the current sense can wait
+const uint32_t LOAD_POLL_MS = 5;      // The ADC DMA ring holds ~100 ms
+
+BoundedQueue<ParsedCommand, 8> commandQueue;
+
+// Motion task timing for PERF (step lateness is recorded by the step ISR)
+Histogram loopPeriod;  // Microseconds between the starts of two motion task passes
+Histogram loopBusy;    // Microseconds one pass takes, command handlers included
+
+// LED 표시: 구동 명령 종류에 따라 LED2(ROT) 또는 LED3(TIME) 켜기
+void showMoveLeds(bool rotationMode) {
+  digitalWrite(led1Pin, LOW);
+  digitalWrite(led2Pin, rotationMode ? HIGH : LOW);
+  digitalWrite(led3Pin, rotationMode ? LOW : HIGH);
+  led4Blinking = false;
+  digitalWrite(led4Pin, LOW);
+}
+
+void clearLeds() {
   digitalWrite(led1Pin, LOW);
   digitalWrite(led2Pin, LOW);
   digitalWrite(led3Pin, LOW);
+}
+
+bool isClockwise(const ParsedCommand& command) {
+  // DIR defaults to CW; anything other than CW means CCW
+  return strcmp(command.getText("DIR", "CW"), "CW") == 0;
+}
+
+// AXIS:{X|Y|Z|A} picks the axis for a single-axis move, X when omitted
+bool useAxis(const ParsedCommand& command) {
+  const char* name = command.getText("AXIS", "X");
+  const char* found = strchr(AXIS_NAMES, name[0]);
+  if (name[0] == '\0' || name[1] != '\0' || found == nullptr ||
+      !motorController.selectAxis(found - AXIS_NAMES)) {
+    serialManager.sendResponse("INVALID_AXIS");
+    return false;
+  }
+  return true;
+}
+
+// Host moves would fight a running script for the motor
+bool scriptIdle() {
+  if (scriptRunner.isRunning()) {
+    serialManager.sendResponse("RUN_BUSY");
+    return false;
+  }
+  return true;
+}
+
+// HELLO [BIN] [TAG]: text lines or binary frames (FrameCodec.h), TAG for a session of
+// tagged requests (SerialManager.h)
+void handleHelloBinary(const ParsedCommand& command) {
+  // Acknowledge in text, then switch to binary frames
+  bool tagged = command.has("TAG");
+  serialManager.sendResponse(tagged ? "READY BIN TAG" : "READY BIN");
+  serialManager.setBinaryMode(true, tagged);
+}
+
+void handleHello(const ParsedCommand& command) {
+  bool tagged = command.has("TAG");
+  serialManager.setBinaryMode(false, tagged);
+  serialManager.sendResponse(tagged ? "READY TAG" : "READY");
+}
+
+void handleHi(const ParsedCommand&) {
+  digitalWrite(led1Pin, HIGH);
+  digitalWrite(led2Pin, LOW);
+  digitalWrite(led3Pin, LOW);
+  led4Blinking = false;
   digitalWrite(led4Pin, LOW);
+  serialManager.sendResponse("Hi_RECEIVED");
+}
+
+// A started move answers with its TURN/DONE lines; a refused one with MOVE_BUSY,
+// MOVE_LIMIT MIN:{steps} MAX:{steps} or MOVE_INVALID, the final reply of a tagged request
+void replyToMove(MoveResult result, bool rotating) {
+  if (result == MoveResult::STARTED) {
+    showMoveLeds(rotating);
+  } else if (result == MoveResult::LIMIT) {
+    const SoftLimits& limits = motorController.softLimit();
+    serialManager.sendResponsef("MOVE_LIMIT MIN:%ld MAX:%ld", limits.min, limits.max);
+  } else {
+    serialManager.sendResponse(moveRefusal(result));
+  }
+}
+
+// SPEED:{level} or RPM:{rpm} with ROT:{rotations} [DIR:{CW|CCW}], keys in any order
+void handleRotation(const ParsedCommand& command) {
+  if (!scriptIdle() || !useAxis(command)) {
+    return;
+  }
   
+  int rotations = command.getInt("ROT", 0);
+  if (command.has("SPEED")) {
+    replyToMove(motorController.executeRotationWithSpeed(command.getInt("SPEED", 0), rotations, isClockwise(command)), true);
+  } else {
+    replyToMove(motorController.executeRotation(command.getInt("RPM", 0), rotations, isClockwise(command)), true);
+  }
 }
 
-void loop() {
-  serialManager.sendStartupReady();
+// SPEED:{level} or RPM:{rpm} with TIME:{seconds} [DIR:{CW|CCW}], keys in any order
+void handleTimed(const ParsedCommand& command) {
+  if (!scriptIdle() || !useAxis(command)) {
+    return;
+  }
+  
+  int duration = command.getInt("TIME", 0);
+  if (command.has("SPEED")) {
+    replyToMove(motorController.executeTimeWithSpeed(command.getInt("SPEED", 0), duration, isClockwise(command)), false);
+  } else {
+    replyToMove(motorController.executeTime(command.getInt("RPM", 0), duration, isClockwise(command)), false);
+  }
+}
+
+// QUEUE SPEED:{level}|RPM:{rpm} ROT:{rotations}|TIME:{seconds} [DIR:{CW|CCW}]
+// Queued moves run back-to-back and blend without stopping. Replies QUEUED:{id} FREE:{n},
+// then SEGDONE:{id} FREE:{n} as each one completes and DONE when the queue runs dry.
+// A bare QUEUE reports the queue depth.
+void handleQueue(const ParsedCommand& command) {
+  if (((command.has("ROT") || command.has("TIME")) && !scriptIdle()) || !useAxis(command)) {
+    return;
+  }
+  
+  int level = command.has("SPEED") ? command.getInt("SPEED", 0) : 0;
+  int rpm = command.getInt("RPM", 0);
+  uint16_t id;
+  
+  if (command.has("ROT")) {
+    id = motorController.enqueueRotation(rpm, level, command.getInt("ROT", 0), isClockwise(command));
+  } else if (command.has("TIME")) {
+    id = motorController.enqueueTime(rpm, level, command.getInt("TIME", 0), isClockwise(command));
+  } else {
+    serialManager.sendResponsef("QUEUE DEPTH:%u FREE:%u", (unsigned)motorController.queueDepth(),
+                                (unsigned)motorController.queueSpace());
+    return;
+  }
+  
+  if (id != 0) {
+    serialManager.sendResponsef("QUEUED:%u FREE:%u", (unsigned)id, (unsigned)motorController.queueSpace());
+  } else if (motorController.queueSpace() == 0) {
+    serialManager.sendResponse("QUEUE_FULL");
+  } else {
+    serialManager.sendResponse("QUEUE_REJECTED");
+  }
+}
+
+void handleQueueFlush(const ParsedCommand&) {
+  motorController.flushQueue();
+  serialManager.sendResponsef("QUEUE DEPTH:%u FREE:%u", (unsigned)motorController.queueDepth(),
+                              (unsigned)motorController.queueSpace());
+}
+
+// LINE SPEED:{level}|RPM:{rpm} X:{steps} [Y:{steps}] [Z:{steps}] [A:{steps}]
+// Coordinated move: signed steps per axis (positive = CW), all axes finish together.
+// The speed applies to the axis with the most steps.
+void handleLine(const ParsedCommand& command) {
+  if (!scriptIdle()) {
+    return;
+  }
+  
+  long steps[4];
+  char key[2] = { 0, 0 };
+  for (int axis = 0; axis < 4; axis++) {
+    key[0] = AXIS_NAMES[axis];
+    steps[axis] = command.getInt(key, 0);
+  }
+  
+  int level = command.has("SPEED") ? command.getInt("SPEED", 0) : 0;
+  MoveResult result = motorController.executeLine(command.getInt("RPM", 0), level, steps, 4);
+  if (result == MoveResult::LIMIT) {
+    serialManager.sendResponse("MOVE_LIMIT");  // Any of the axes; the log names it
+  } else {
+    replyToMove(result, true);
+  }
+}
+
+// Steps from KEY:{value}, read as degrees when the command has the DEG word
+long stepsOf(const ParsedCommand& command, const char* key, long fallback) {
+  if (!command.has(key)) {
+    return fallback;
+  }
+  if (command.has("DEG")) {
+    return motorController.degreesToSteps(atof(command.getText(key, "0")));
+  }
+  return command.getInt(key, fallback);
+}
+
+// MOVE:{target} [REL] [DEG] [SPEED:{level}|RPM:{rpm}] [AXIS:{X|Y|Z|A}]
+// Position mode: to target, or by it with REL, in microsteps or with DEG in degrees
+// (positive = CW). Ends with DONE like a rotation; refused moves reply MOVE_BUSY,
+// MOVE_LIMIT MIN:{steps} MAX:{steps} or MOVE_INVALID.
+void handleMove(const ParsedCommand& command) {
+  if (!scriptIdle() || !useAxis(command)) {
+    return;
+  }
+  
+  long target = stepsOf(command, "MOVE", 0);
+  int level = command.has("SPEED") ? command.getInt("SPEED", 0) : 0;
+  replyToMove(motorController.executeMove(target, command.has("REL"), command.getInt("RPM", 0), level), true);
+}
+
+// HOME: find the X home switch and make it position 0. Replies HOMING, then HOMED or
+// HOME_FAILED:{NOT_FOUND|SWITCH_STUCK|STALL}
+void handleHome(const ParsedCommand&) {
+  if (!scriptIdle()) {
+    return;
+  }
+  if (motorController.isMotorRunning()) {
+    serialManager.sendResponse("HOME_BUSY");
+    return;
+  }
+  showMoveLeds(true);
+  serialManager.sendResponse("HOMING");
+  motorController.home();
+}
+
+// POS [SET:{steps}] [AXIS:{X|Y|Z|A}]: POS:{steps} DEG:{degrees} HOMED:{0|1} (HOMED is
+// about X); SET redefines the position while stopped, POS_BUSY otherwise
+void handlePosition(const ParsedCommand& command) {
+  if (!useAxis(command)) {
+    return;
+  }
+  if (command.has("SET") && !motorController.setPosition(command.getInt("SET", 0))) {
+    serialManager.sendResponse("POS_BUSY");
+    return;
+  }
+  
+  long steps = motorController.position();
+  serialManager.sendResponsef("POS:%ld DEG:%.2f HOMED:%d", steps, motorController.stepsToDegrees(steps),
+                              motorController.isHomed() ? 1 : 0);
+}
+
+// LIMITS [MIN:{steps}] [MAX:{steps}] [DEG] [AXIS:{X|Y|Z|A}]: soft limits of the axis,
+// unbounded on a side that is left out; LIMITS OFF lifts them. Replies
+// LIMITS MIN:{steps} MAX:{steps} or LIMITS OFF, LIMITS_INVALID if MIN is not below MAX
+void handleLimits(const ParsedCommand& command) {
+  if (!useAxis(command)) {
+    return;
+  }
+  
+  if (command.has("OFF")) {
+    motorController.setSoftLimits(false, 0, 0);
+  } else if (command.has("MIN") || command.has("MAX")) {
+    long min = stepsOf(command, "MIN", LONG_MIN);
+    long max = stepsOf(command, "MAX", LONG_MAX);
+    if (!motorController.setSoftLimits(true, min, max)) {
+      serialManager.sendResponse("LIMITS_INVALID");
+      return;
+    }
+  }
+  
+  const SoftLimits& limits = motorController.softLimit();
+  if (limits.enabled) {
+    serialManager.sendResponsef("LIMITS MIN:%ld MAX:%ld", limits.min, limits.max);
+  } else {
+    serialManager.sendResponse("LIMITS OFF");
+  }
+}
+
+// SET RPM:{rpm} or SET SPEED:{level}: new cruise speed for the running move, reached at the
+// ramp's acceleration. Replies SET RPM:{rpm}, or SET_IDLE / SET_BUSY / SET_INVALID
+void handleSetSpeed(const ParsedCommand& command) {
+  int level = 0;
+  if (command.has("SPEED")) {
+    level = command.getInt("SPEED", 0);
+    level = level < 1 ? -1 : level;
+  }
+  
+  SpeedChange result = motorController.setSpeed(command.getInt("RPM", 0), level);
+  if (result == SpeedChange::APPLIED) {
+    serialManager.sendResponsef("SET RPM:%d", motorController.rpm());
+  } else if (result == SpeedChange::IDLE) {
+    serialManager.sendResponse("SET_IDLE");
+  } else if (result == SpeedChange::BUSY) {
+    serialManager.sendResponse("SET_BUSY");
+  } else {
+    serialManager.sendResponse("SET_INVALID");
+  }
+}
+
+void handleStop(const ParsedCommand&) {
+  clearLeds();
+  led4Blinking = true;
+  led4BlinkTime = millis();
+  
+  motorController.pause();
+  serialManager.sendResponse("PAUSED");
+}
+
+void handleStopped(const ParsedCommand&) {
+  // Pause the motor if it's running
+  if (motorController.isMotorRunning() && !motorController.isMotorPaused()) {
+    motorController.pause();
+    serialManager.sendResponse("PAUSED");
+  }
+}
+
+void handleReload(const ParsedCommand&) {
+  // Resume the motor if it's paused
+  if (motorController.isMotorRunning() && motorController.isMotorPaused()) {
+    motorController.resume();
+    serialManager.sendResponse("RESUMED");
+  }
+}
+
+// CLOSE and ESTOP end a running script along with its move
+void endScript() {
+  uint16_t line = scriptRunner.line();
+  if (scriptRunner.abort()) {
+    serialManager.sendResponsef("ABORTED LINE:%u", (unsigned)line);
+  }
+}
+
+void handleClose(const ParsedCommand&) {
+  // Complete termination
+  clearLeds();
+  led4Blinking = false;
+  digitalWrite(led4Pin, LOW);
+  
+  motorController.stop();
+  serialManager.sendResponse("CLOSED");
+  endScript();
+}
+
+void handleEmergencyStop(const ParsedCommand&) {
+  // Halt without a ramp and disable the drivers
+  clearLeds();
+  led4Blinking = false;
+  digitalWrite(led4Pin, LOW);
+  
+  motorController.emergencyStop();
+  serialManager.sendResponse("ESTOP");
+  endScript();
+}
+
+// RAMP:{NONE|TRAP|SCURVE} [ACC:{steps/s^2}] [JERK:{steps/s^3}]
+void handleRamp(const ParsedCommand& command) {
+  const char* name = command.getText("RAMP", "");
+  RampProfile profile;
+  if (strcmp(name, "NONE") == 0) {
+    profile = RampProfile::NONE;
+  } else if (strcmp(name, "TRAP") == 0) {
+    profile = RampProfile::TRAPEZOIDAL;
+  } else if (strcmp(name, "SCURVE") == 0) {
+    profile = RampProfile::SCURVE;
+  } else {
+    serialManager.sendResponse("RAMP_INVALID");  // The current ramp stays
+    return;
+  }
+  motorController.setRamp(profile, command.getInt("ACC", MotorController::RAMP_ACCEL),
+                          command.getInt("JERK", MotorController::RAMP_JERK));
+}
+
+// STALL:{OFF|STOP|RETRY}: what a following error beyond the stall limit does
+void handleStallPolicy(const ParsedCommand& command) {
+  const char* name = command.getText("STALL", "");
+  StallPolicy policy;
+  if (strcmp(name, "OFF") == 0) {
+    policy = StallPolicy::OFF;
+  } else if (strcmp(name, "STOP") == 0) {
+    policy = StallPolicy::STOP;
+  } else if (strcmp(name, "RETRY") == 0) {
+    policy = StallPolicy::RETRY;
+  } else {
+    serialManager.sendResponse("STALL_INVALID");  // The current policy stays
+    return;
+  }
+  motorController.setStallPolicy(policy);
+}
+
+void sendStreamState() {
+  const TelemetryStream& stream = motorController.stream();
+  serialManager.sendResponsef("STREAM %s SAMPLES:%lu SENT:%lu BATCHES:%lu", stream.isActive() ? "ON" : "OFF",
+                              (unsigned long)stream.samplesTaken(), (unsigned long)stream.samplesSent(),
+                              (unsigned long)stream.batchesSent());
+}
+
+// STREAM RATE:{hz} [POS] [FRAC] [RPM] [LOAD] [ERR] [STATE]: batched binary telemetry of the
+// named fields (all when none is named), binary mode only. Replies with the field bits and
+// samples per batch. STREAM OFF stops it; a bare STREAM reports its counters.
+void handleStreamStart(const ParsedCommand& command) {
+  uint8_t fields = 0;
+  for (uint8_t i = 0; i < command.count; i++) {
+    const CommandField& word = command.fields[i];
+    if (word.hasValue || strcmp(word.key, "STREAM") == 0) {
+      continue;
+    }
+    uint8_t field = Telemetry::fieldByName(word.key);
+    if (field == 0) {
+      serialManager.sendResponsef("STREAM_UNKNOWN:%s", word.key);
+      return;
+    }
+    fields |= field;
+  }
+  if (fields == 0) {
+    fields = Telemetry::ALL;
+  }
+  
+  long rate = command.getInt("RATE", 0);
+  if (!serialManager.isBinaryMode()) {
+    serialManager.sendResponse("STREAM_BINARY_ONLY");
+  } else if (rate < 1 || rate > TelemetryStream::MAX_RATE || !motorController.startStream(fields, (uint16_t)rate)) {
+    serialManager.sendResponsef("STREAM_RATE:1..%u", (unsigned)TelemetryStream::MAX_RATE);
+  } else {
+    serialManager.sendResponsef("STREAM RATE:%ld FIELDS:%u BATCH:%u", rate, (unsigned)fields,
+                                (unsigned)motorController.stream().batchSize());
+  }
+}
+
+void handleStreamStop(const ParsedCommand&) {
+  motorController.stopStream();
+  sendStreamState();
+}
+
+void handleStream(const ParsedCommand&) {
+  sendStreamState();
+}
+
+// LOAD: current load; LOAD RATE:{ms}: how often it is reported while running (0 = off)
+void handleLoadRate(const ParsedCommand& command) {
+  long ms = command.getInt("RATE", 1000);
+  motorController.setLoadReportInterval(ms > 0 ? (unsigned long)ms : 0);
+}
+
+void handleLoad(const ParsedCommand&) {
+  serialManager.sendResponsef("LOAD:%.1f%%", motorController.load() / 10.0f);
+}
+
+// Adds " FIELD:value" to a CONFIG reply, sending the line first if it would get too long
+void addConfigField(TextWriter& line, uint8_t field) {
+  char name[CommandField::MAX_KEY + 1];
+  char pair[24];
+  ConfigStore::fieldName(field, name, sizeof(name));
+  size_t pairLength = (size_t)snprintf(pair, sizeof(pair), " %s:%u", name,
+                                       (unsigned)ConfigStore::getField(motorController.config(), field));
+  if (line.length() + pairLength > CONFIG_LINE) {
+    serialManager.sendResponse(line.c_str());
+    line.clear();
+    line.append("CONFIG");
+  }
+  line.append(pair);
+}
+
+// CONFIG GET [FIELD ...]: CONFIG FIELD:value lines, every field when none is named
+void handleConfigGet(const ParsedCommand& command) {
+  TextBuffer<CONFIG_LINE + 1> line;
+  line.append("CONFIG");
+  bool named = false;
+  
+  for (uint8_t i = 0; i < command.count; i++) {
+    const CommandField& word = command.fields[i];
+    if (word.hasValue || strcmp(word.key, "CONFIG") == 0 || strcmp(word.key, "GET") == 0) {
+      continue;
+    }
+    int field = ConfigStore::findField(word.key);
+    if (field < 0) {
+      serialManager.sendResponsef("CONFIG_UNKNOWN:%s", word.key);
+      return;
+    }
+    addConfigField(line, (uint8_t)field);
+    named = true;
+  }
+  for (uint8_t field = 0; !named && field < ConfigStore::FIELDS; field++) {
+    addConfigField(line, field);
+  }
+  serialManager.sendResponse(line.c_str());
+}
+
+// CONFIG SET FIELD:value [FIELD:value ...]: change the configuration in use, all fields or
+// none; CONFIG SAVE makes it stick. Replies with the new values.
+void handleConfigSet(const ParsedCommand& command) {
+  MotorConfig config = motorController.config();
+  uint8_t changed[ParsedCommand::MAX_FIELDS];
+  uint8_t changes = 0;
+  
+  for (uint8_t i = 0; i < command.count; i++) {
+    const CommandField& pair = command.fields[i];
+    if (!pair.hasValue) {
+      continue;
+    }
+    int field = ConfigStore::findField(pair.key);
+    if (field < 0) {
+      serialManager.sendResponsef("CONFIG_UNKNOWN:%s", pair.key);
+      return;
+    }
+    if (!ConfigStore::setField(config, (uint8_t)field, pair.number)) {
+      uint16_t minimum;
+      uint16_t maximum;
+      ConfigStore::fieldRange((uint8_t)field, minimum, maximum);
+      serialManager.sendResponsef("CONFIG_RANGE:%s %u..%u", pair.key, (unsigned)minimum, (unsigned)maximum);
+      return;
+    }
+    changed[changes++] = (uint8_t)field;
+  }
+  
+  const char* problem = ConfigStore::validate(config);
+  if (problem != nullptr) {
+    serialManager.sendResponsef("CONFIG_INVALID:%s", problem);
+    return;
+  }
   
-  // Update motor controller (handles step generation)
-  motorController.update();
+  const MotorConfig& previous = motorController.config();
+  bool pinsChanged = config.stepPin != previous.stepPin || config.dirPin != previous.dirPin ||
+                     config.enablePin != previous.enablePin;
+  if (!motorController.configure(config)) {
+    serialManager.sendResponse("CONFIG_BUSY");
+    return;
+  }
+  
+  TextBuffer<CONFIG_LINE + 1> line;
+  line.append("CONFIG");
+  for (uint8_t i = 0; i < changes; i++) {
+    addConfigField(line, changed[i]);
+  }
+  serialManager.sendResponse(line.c_str());
+  if (pinsChanged) {
+    serialManager.sendLog("Pin changes apply after CONFIG SAVE and a restart");
+  }
+}
+
+// CONFIG SAVE: not while a move or script runs, as an NVS write holds up the motion task
+// and stalls code running from flash
+void handleConfigSave(const ParsedCommand&) {
+  if (motorController.isMotorRunning() || scriptRunner.isRunning()) {
+    serialManager.sendResponse("CONFIG_BUSY");
+    return;
+  }
+  serialManager.sendResponse(configStore.save(motorController.config()) ? "CONFIG SAVED" : "CONFIG_SAVE_FAILED");
+}
+
+// CONFIG DEFAULTS: back to the compiled-in values (until the next CONFIG SAVE or restart)
+void handleConfigDefaults(const ParsedCommand&) {
+  serialManager.sendResponse(motorController.configure(defaultConfig) ? "CONFIG DEFAULTS" : "CONFIG_BUSY");
+}
+
+// Stored configuration over the compiled-in one, before begin() binds the pins
+void loadConfig() {
+  defaultConfig = motorController.config();
+  MotorConfig config = defaultConfig;
+  ConfigStore::Result result = configStore.load(config);
+  if (result == ConfigStore::LOADED && motorController.configure(config)) {
+    serialManager.sendLog("CONFIG LOADED");
+  } else {
+    serialManager.sendLogf("CONFIG %s, using defaults", ConfigStore::resultName(result));
+  }
+}
+
+void sendPerf(const char* name, const Histogram& histogram) {
+  serialManager.sendResponsef("PERF %s N:%lu P50:%lu P99:%lu MAX:%lu", name,
+                              (unsigned long)histogram.count(), (unsigned long)histogram.percentile(500),
+                              (unsigned long)histogram.percentile(990), (unsigned long)histogram.maximum());
+}
+
+// PERF [RESET]: step lateness and motion task period/busy time in microseconds
+void handlePerf(const ParsedCommand& command) {
+  if (command.has("RESET")) {
+    motorController.stepLateness().reset();
+    loopPeriod.reset();
+    loopBusy.reset();
+    serialManager.sendResponse("PERF RESET");
+    return;
+  }
   
+  sendPerf("STEP", motorController.stepLateness());
+  sendPerf("LOOP", loopPeriod);
+  sendPerf("BUSY", loopBusy);
+}
+
+// HEAP [RESET]: HEAP FREE:{bytes} MIN:{bytes} LARGEST:{bytes} FRAG:{percent}
+// BLOCKS:{held} ALLOCS:{count}; ALLOCS counts every allocation since boot or HEAP RESET
+void handleHeap(const ParsedCommand& command) {
+  if (command.has("RESET")) {
+    Heap::resetAllocations();
+    serialManager.sendResponse("HEAP RESET");
+    return;
+  }
+  
+  Heap::Stats stats;
+  Heap::read(stats);
+  serialManager.sendResponsef("HEAP FREE:%lu MIN:%lu LARGEST:%lu FRAG:%u BLOCKS:%lu ALLOCS:%lu",
+                              (unsigned long)stats.freeBytes, (unsigned long)stats.minimumFreeBytes,
+                              (unsigned long)stats.largestFreeBlock, (unsigned)Heap::fragmentation(stats),
+                              (unsigned long)stats.usedBlocks, (unsigned long)stats.allocations);
+}
+
+void sendTraceState() {
+  const TraceRecorder& trace = motorController.trace();
+  serialManager.sendResponsef("TRACE %s STEPS:%lu BLOCKS:%u MARKS:%u", trace.isRecording() ? "ON" : "OFF",
+                              (unsigned long)trace.steps(), (unsigned)trace.blocksHeld(), (unsigned)trace.marksHeld());
+}
+
+// TRACE [ON|OFF]: the motion trace of axis 0 (steps, DIR, states), on from boot; ON drops
+// it and starts again. TRACE DUMP [FROM:{offset}] stops it and sends it as
+// TRACE:{offset} {hex} lines, then TRACE END BYTES:{size} CRC:{crc16}; the tracebench
+// program decodes a captured dump
+void handleTraceOn(const ParsedCommand&) {
+  motorController.startTrace();
+  sendTraceState();
+}
+
+void handleTraceOff(const ParsedCommand&) {
+  motorController.stopTrace();
+  sendTraceState();
+}
+
+void handleTraceDump(const ParsedCommand& command) {
+  long from = command.getInt("FROM", 0);
+  if (from < 0 || !motorController.dumpTrace((size_t)from)) {
+    serialManager.sendResponse("TRACE_RANGE");
+  }
+}
+
+void handleTrace(const ParsedCommand&) {
+  sendTraceState();
+}
+
+void sendScriptState(const char* prefix) {
+  if (!scriptRunner.hasScript()) {
+    serialManager.sendResponsef("%s NONE", prefix);
+  } else if (scriptRunner.isRunning()) {
+    serialManager.sendResponsef("%s BYTES:%u LINES:%u CRC:%04X LINE:%u", prefix, (unsigned)scriptRunner.size(),
+                                (unsigned)scriptRunner.lineCount(), (unsigned)scriptRunner.crc(),
+                                (unsigned)scriptRunner.line());
+  } else {
+    serialManager.sendResponsef("%s BYTES:%u LINES:%u CRC:%04X", prefix, (unsigned)scriptRunner.size(),
+                                (unsigned)scriptRunner.lineCount(), (unsigned)scriptRunner.crc());
+  }
+}
+
+void sendScriptError() {
+  serialManager.sendResponsef("PROG_ERROR LINE:%u %s", (unsigned)scriptCompiler.errorLine(), scriptCompiler.error());
+}
+
+// PROG BEGIN, then PROG {statement} per script line, then PROG END: upload a motion script
+// (MotionScript.h). Each line is compiled as it arrives and acknowledged PROG:{line};
+// PROG END stores the script and replies PROG SAVED BYTES:{n} LINES:{n} CRC:{crc16}. A bad
+// line replies PROG_ERROR LINE:{n} {reason} and drops the upload. PROG END during a move
+// replies PROG_BUSY and keeps the upload open, as the NVS write would hold up the motion
+// task. A bare PROG reports the stored script (with the LINE it is on while running), or
+// PROG NONE
+void handleProgBegin(const ParsedCommand&) {
+  if (scriptRunner.isRunning()) {
+    serialManager.sendResponse("RUN_BUSY");
+    return;
+  }
+  scriptCompiler.begin();
+  scriptUploading = true;
+  serialManager.sendResponse("PROG BEGIN");
+}
+
+void handleProgEnd(const ParsedCommand&) {
+  if (!scriptUploading) {
+    serialManager.sendResponse("PROG_IDLE");
+    return;
+  }
+  if (motorController.isMotorRunning() || scriptRunner.isRunning()) {
+    serialManager.sendResponse("PROG_BUSY");
+    return;
+  }
+  scriptUploading = false;
+  if (scriptCompiler.finish() != nullptr) {
+    sendScriptError();
+    return;
+  }
+  
+  // RUN is refused during an upload, so nothing runs the script being replaced
+  scriptRunner.load(scriptCompiler.data(), scriptCompiler.size());
+  if (!scriptStorage.write(scriptCompiler.data(), scriptCompiler.size())) {
+    serialManager.sendResponse("PROG_SAVE_FAILED");  // Loaded until the next restart
+    return;
+  }
+  sendScriptState("PROG SAVED");
+}
+
+void handleProgLine(const ParsedCommand& command) {
+  if (command.count == 1) {
+    sendScriptState("PROG");
+    return;
+  }
+  if (!scriptUploading) {
+    serialManager.sendResponse("PROG_IDLE");
+    return;
+  }
+  if (scriptCompiler.add(command) != nullptr) {
+    scriptUploading = false;
+    sendScriptError();
+    return;
+  }
+  serialManager.sendResponsef("PROG:%u", (unsigned)scriptCompiler.lineCount());
+}
+
+// RUN: run the stored script from its first line, RUN LINES:{n}; RUN DONE or
+// RUN_ERROR LINE:{n} {reason} follow when it ends. RUN_NONE without a script, RUN_BUSY
+// while a script, an upload or a move is under way. ABORT ends it: ABORTED LINE:{n}
+void handleRun(const ParsedCommand&) {
+  if (!scriptRunner.hasScript()) {
+    serialManager.sendResponse("RUN_NONE");
+  } else if (scriptUploading || !scriptRunner.run()) {
+    serialManager.sendResponse("RUN_BUSY");
+  } else {
+    showMoveLeds(true);
+    serialManager.sendResponsef("RUN LINES:%u", (unsigned)scriptRunner.lineCount());
+  }
+}
+
+void handleAbort(const ParsedCommand&) {
+  uint16_t line = scriptRunner.line();
+  if (scriptRunner.abort()) {
+    serialManager.sendResponsef("ABORTED LINE:%u", (unsigned)line);
+  } else {
+    serialManager.sendResponse("ABORT_IDLE");
+  }
+}
+
+// Stored script, if any, ready for RUN
+void loadScript() {
+  uint8_t image[Script::MAX_IMAGE];
+  size_t length = scriptStorage.read(image, sizeof(image));
+  if (length == 0) {
+    return;
+  }
+  if (scriptRunner.load(image, length)) {
+    serialManager.sendLogf("PROG LOADED LINES:%u", (unsigned)scriptRunner.lineCount());
+  } else {
+    serialManager.sendLog("PROG CORRUPT, not loaded");
+  }
+}
+
+void handleStatus(const ParsedCommand&) {
+  if (serialManager.isBinaryMode()) {
+    Frame::StatusRecord status;
+    motorController.getStatusRecord(status);
+    serialManager.sendStatusRecord(status);
+  } else {
+    TextBuffer<OutMessage::MAX_TEXT + 1> line;
+    motorController.getStatus(line);
+    serialManager.sendResponse(line.c_str());
+  }
+}
+
+// First match wins, so more specific patterns go first. PROG lines carry script statements
+// that look like other commands, so they come before everything else
+const CommandEntry COMMANDS[] = {
+  { "PROG BEGIN",   handleProgBegin },
+  { "PROG END",     handleProgEnd },
+  { "PROG",         handleProgLine },
+  { "RUN",          handleRun },
+  { "ABORT",        handleAbort },
+  { "HELLO BIN",    handleHelloBinary },
+  { "HELLO",        handleHello },
+  { "HI",           handleHi },
+  { "QUEUE FLUSH",  handleQueueFlush },
+  { "QUEUE",        handleQueue },
+  { "LINE",         handleLine },
+  { "MOVE:",        handleMove },
+  { "HOME",         handleHome },
+  { "SET SPEED:",   handleSetSpeed },
+  { "SET RPM:",     handleSetSpeed },
+  { "SPEED: ROT:",  handleRotation },
+  { "SPEED: TIME:", handleTimed },
+  { "RPM: ROT:",    handleRotation },
+  { "RPM: TIME:",   handleTimed },
+  { "STOP",         handleStop },
+  { "STOPPED",      handleStopped },
+  { "RELOAD",       handleReload },
+  { "CLOSE",        handleClose },
+  { "ESTOP",        handleEmergencyStop },
+  { "RAMP:",        handleRamp },
+  { "STALL:",       handleStallPolicy },
+  { "CONFIG GET",   handleConfigGet },
+  { "CONFIG SET",   handleConfigSet },
+  { "CONFIG SAVE",  handleConfigSave },
+  { "CONFIG DEFAULTS", handleConfigDefaults },
+  { "STREAM OFF",   handleStreamStop },
+  { "STREAM RATE:", handleStreamStart },
+  { "STREAM",       handleStream },
+  { "POS",          handlePosition },
+  { "LIMITS",       handleLimits },
+  { "LOAD RATE:",   handleLoadRate },
+  { "LOAD",         handleLoad },
+  { "STATUS",       handleStatus },
+  { "PERF",         handlePerf },
+  { "HEAP",         handleHeap },
+  { "TRACE DUMP",   handleTraceDump },
+  { "TRACE ON",     handleTraceOn },
+  { "TRACE OFF",    handleTraceOff },
+  { "TRACE",        handleTrace },
+};
+
+void updateLeds() {
   // LED 깜빡이기 처리 - 테스트 모드에서 모터 동작 시뮬레이션
   if (motorController.isTestMode() && motorController.isMotorRunning()) {
     // Running 상태일 때 해당 LED 깜빡이기
     if (millis() - runningLedBlinkTime > 200) {  // 빠른 깜빡임
       runningLedState = !runningLedState;
       // 현재 상태에 따라 LED2 또는 LED3 깜빡이기
-      String status = motorController.getStatus();
-      if (status.indexOf("ROTATING") != -1) {
+      MotorState state = motorController.state();
+      if (state == MotorState::ROTATING || state == MotorState::HOMING) {
         digitalWrite(led2Pin, runningLedState);
-      } else if (status.indexOf("TIME_MODE") != -1) {
+      } else if (state == MotorState::TIME_MODE) {
         digitalWrite(led3Pin, runningLedState);
       }
       runningLedBlinkTime = millis();
     }
   } else if (motorController.isTestMode() && !motorController.isMotorRunning()) {
     // 모터가 정지했을 때 모든 LED 끄기 (LED4 제외)
-    String status = motorController.getStatus();
-    if (status.indexOf("DONE") != -1 || status.indexOf("STOPPED") != -1) {
+    MotorState state = motorController.state();
+    if (state == MotorState::DONE || state == MotorState::STOPPED) {
       if (!led4Blinking) {  // STOP 명령으로 깜빡이지 않을 때만
         digitalWrite(led2Pin, LOW);
         digitalWrite(led3Pin, LOW);
@@ -75,170 +885,135 @@ void loop() {
       led4BlinkTime = millis();
     }
   }
-  
-  if (serialManager.hasCommand()) {
-    String input = serialManager.readCommand();
+}
+
+// A move, script or trace dump is under way and sends replies of its own
+bool stationBusy() {
+  return motorController.isMotorRunning() || scriptRunner.isRunning() || motorController.isDumpingTrace();
+}
+
+// An operation that ended without a reply of its own (CLOSE, ESTOP, ABORT, stall) is
+// answered STOPPED
+void finishEndedOperation() {
+  if (serialManager.runningOperation() != 0 && !stationBusy()) {
+    serialManager.finishOperation("STOPPED");
+  }
+}
+
+// Runs a command as a tagged request: a command that leaves the station busy hands its tag
+// to what it started. Unknown tagged commands are answered; untagged ones stay silent as
+// they always have. A line the parser dropped is answered either way
+void handleCommand(const ParsedCommand& command) {
+  finishEndedOperation();  // An ESTOP earlier in this pass must not lose its operation's tag to this one
+  bool busy = stationBusy();
+  serialManager.beginRequest(command.tag);
+  if (command.malformed) {
+    serialManager.sendResponse("PARSE_ERROR");
+  } else if (!CommandParser::dispatch(COMMANDS, sizeof(COMMANDS) / sizeof(COMMANDS[0]), command) && command.tag != 0) {
+    serialManager.sendResponse("UNKNOWN");
+  }
+  serialManager.endRequest(!busy && stationBusy());
+}
+
+void motionTask(void*) {
+  Rtos::WakeTime lastWake = Rtos::wakeTime();
+  uint32_t lastPass = micros();
+  for (;;) {
+    uint32_t passStart = micros();
+    loopPeriod.record(passStart - lastPass);
+    lastPass = passStart;
     
-    if (input == "HELLO") {
-      serialManager.sendResponse("READY");
-    }
-    else if (input == "HI") {
-      digitalWrite(led1Pin, HIGH);
-      digitalWrite(led2Pin, LOW);
-      digitalWrite(led3Pin, LOW);
-      led4Blinking = false;
-      digitalWrite(led4Pin, LOW);
-      serialManager.sendResponse("Hi_RECEIVED");
-    }
-    else if (input.startsWith("SPEED:") && input.indexOf(" ROT:") != -1) {
-      int speedIndex = input.indexOf("SPEED:") + 6;
-      int rotIndex = input.indexOf(" ROT:") + 5;
-      int dirIndex = input.indexOf(" DIR:");
-      
-      int speedLevel = input.substring(speedIndex, input.indexOf(" ROT:")).toInt();
-      int rotations = 0;
-      bool clockwise = true; // default to CW
-      
-      if (dirIndex != -1) {
-        // DIR parameter exists
-        rotations = input.substring(rotIndex, dirIndex).toInt();
-        String direction = input.substring(dirIndex + 5);
-        direction.trim();
-        clockwise = (direction == "CW");
-      } else {
-        // No DIR parameter, use original parsing
-        rotations = input.substring(rotIndex).toInt();
-      }
-      
-      digitalWrite(led1Pin, LOW);
-      digitalWrite(led2Pin, HIGH);
-      digitalWrite(led3Pin, LOW);
-      led4Blinking = false;
-      digitalWrite(led4Pin, LOW);
-      
-      motorController.executeRotationWithSpeed(speedLevel, rotations, clockwise);
-    }
-    else if (input.startsWith("SPEED:") && input.indexOf(" TIME:") != -1) {
-      int speedIndex = input.indexOf("SPEED:") + 6;
-      int timeIndex = input.indexOf(" TIME:") + 6;
-      int dirIndex = input.indexOf(" DIR:");
-      
-      int speedLevel = input.substring(speedIndex, input.indexOf(" TIME:")).toInt();
-      int duration = 0;
-      bool clockwise = true; // default to CW
-      
-      if (dirIndex != -1) {
-        // DIR parameter exists
-        duration = input.substring(timeIndex, dirIndex).toInt();
-        String direction = input.substring(dirIndex + 5);
-        direction.trim();
-        clockwise = (direction == "CW");
-      } else {
-        // No DIR parameter, use original parsing
-        duration = input.substring(timeIndex).toInt();
-      }
-      
-      digitalWrite(led1Pin, LOW);
-      digitalWrite(led2Pin, LOW);
-      digitalWrite(led3Pin, HIGH);
-      led4Blinking = false;
-      digitalWrite(led4Pin, LOW);
-      
-      motorController.executeTimeWithSpeed(speedLevel, duration, clockwise);
-    }
-    else if (input.startsWith("RPM:") && input.indexOf(" ROT:") != -1) {
-      int rpmIndex = input.indexOf("RPM:") + 4;
-      int rotIndex = input.indexOf(" ROT:") + 5;
-      int dirIndex = input.indexOf(" DIR:");
-      
-      int rpm = input.substring(rpmIndex, input.indexOf(" ROT:")).toInt();
-      int rotations = 0;
-      bool clockwise = true; // default to CW
-      
-      if (dirIndex != -1) {
-        // DIR parameter exists
-        rotations = input.substring(rotIndex, dirIndex).toInt();
-        String direction = input.substring(dirIndex + 5);
-        direction.trim();
-        clockwise = (direction == "CW");
-      } else {
-        // No DIR parameter, use original parsing
-        rotations = input.substring(rotIndex).toInt();
-      }
-      
-      digitalWrite(led1Pin, LOW);
-      digitalWrite(led2Pin, HIGH);
-      digitalWrite(led3Pin, LOW);
-      led4Blinking = false;
-      digitalWrite(led4Pin, LOW);
-      
-      motorController.executeRotation(rpm, rotations, clockwise);
-    }
-    else if (input.startsWith("RPM:") && input.indexOf(" TIME:") != -1) {
-      int rpmIndex = input.indexOf("RPM:") + 4;
-      int timeIndex = input.indexOf(" TIME:") + 6;
-      int dirIndex = input.indexOf(" DIR:");
-      
-      int rpm = input.substring(rpmIndex, input.indexOf(" TIME:")).toInt();
-      int duration = 0;
-      bool clockwise = true; // default to CW
-      
-      if (dirIndex != -1) {
-        // DIR parameter exists
-        duration = input.substring(timeIndex, dirIndex).toInt();
-        String direction = input.substring(dirIndex + 5);
-        direction.trim();
-        clockwise = (direction == "CW");
-      } else {
-        // No DIR parameter, use original parsing
-        duration = input.substring(timeIndex).toInt();
-      }
-      
-      digitalWrite(led1Pin, LOW);
-      digitalWrite(led2Pin, LOW);
-      digitalWrite(led3Pin, HIGH);
-      led4Blinking = false;
-      digitalWrite(led4Pin, LOW);
-      
-      motorController.executeTime(rpm, duration, clockwise);
-    }
-    else if (input == "STOP") {
-      digitalWrite(led1Pin, LOW);
-      digitalWrite(led2Pin, LOW);
-      digitalWrite(led3Pin, LOW);
-      led4Blinking = true;
-      led4BlinkTime = millis();
-      
-      motorController.pause();
-      Serial.println("PAUSED");
-    }
-    else if (input == "STOPPED") {
-      // Pause the motor if it's running
-      if (motorController.isMotorRunning() && !motorController.isMotorPaused()) {
-        motorController.pause();
-        Serial.println("PAUSED");
-      }
+    // Update motor controller (handles step generation)
+    motorController.update();
+    scriptRunner.update();
+    updateLeds();
+    finishEndedOperation();
+    
+    ParsedCommand command;
+    while (commandQueue.receive(command)) {
+      handleCommand(command);
     }
-    else if (input == "RELOAD") {
-      // Resume the motor if it's paused
-      if (motorController.isMotorRunning() && motorController.isMotorPaused()) {
-        motorController.resume();
-        Serial.println("RESUMED");
-      }
+    serialManager.flushReplies();
+    
+    loopBusy.record(micros() - passStart);
+    Rtos::delayUntil(lastWake, MOTION_PERIOD_MS);
+  }
+}
+
+// A line the command queue had no room for, offered again before anything more is read
+ParsedCommand heldCommand;
+bool commandHeld = false;
+
+// Hands parsed lines to the motion task. With its queue full a tagged request is refused
+// BUSY for the host to retry; an untagged line has no way to hear that, so it is held and
+// the bytes behind it stay in the UART until the queue takes it
+void queueCommands() {
+  if (commandHeld) {
+    if (!commandQueue.send(heldCommand)) {
+      return;
     }
-    else if (input == "CLOSE") {
-      // Complete termination
-      digitalWrite(led1Pin, LOW);
-      digitalWrite(led2Pin, LOW);
-      digitalWrite(led3Pin, LOW);
-      led4Blinking = false;
-      digitalWrite(led4Pin, LOW);
-      
-      motorController.stop();
-      Serial.println("CLOSED");
+    commandHeld = false;
+  }
+  ParsedCommand command;
+  while (serialManager.pollCommand(command)) {
+    if (commandQueue.send(command)) {
+      continue;
     }
-    else if (input == "STATUS") {
-      serialManager.sendResponse(motorController.getStatus());
+    if (command.tag != 0) {
+      serialManager.sendRejected(command.tag, "BUSY");
+    } else {
+      heldCommand = command;
+      commandHeld = true;
+      return;
     }
   }
 }
+
+void commsTask(void*) {
+  for (;;) {
+    serialManager.sendStartupReady();
+    queueCommands();
+    serialManager.pump();
+    Rtos::delayMillis(1);
+  }
+}
+
+// Filters the DMA-sampled current sense off the motion core
+void loadTask(void*) {
+  for (;;) {
+    if (!motorController.sampleLoad()) {
+      Rtos::delayMillis(LOAD_POLL_MS);
+    }
+  }
+}
+
+void setup() {
+  serialManager.begin();
+  loadConfig();
+  for (size_t axis = 1; axis < sizeof(AXES) / sizeof(AXES[0]); axis++) {
+    motorController.addAxis(AXES[axis]);
+  }
+  motorController.begin(serialManager);
+  loadScript();
+  
+  pinMode(led1Pin, OUTPUT);
+  pinMode(led2Pin, OUTPUT);
+  pinMode(led3Pin, OUTPUT);
+  pinMode(led4Pin, OUTPUT);
+  
+  digitalWrite(led1Pin, LOW);
+  digitalWrite(led2Pin, LOW);
+  digitalWrite(led3Pin, LOW);
+  digitalWrite(led4Pin, LOW);
+  
+  // motorController.begin() above attached the step timer ISR to this core (1), which
+  // is where the motion task runs too
+  Rtos::startTask("motion", motionTask, nullptr, 8192, MOTION_PRIORITY, MOTION_CORE);
+  Rtos::startTask("comms", commsTask, nullptr, 8192, COMMS_PRIORITY, COMMS_CORE);
+  Rtos::startTask("load", loadTask, nullptr, 4096, LOAD_PRIORITY, COMMS_CORE);
+}
+
+void loop() {
+  // All work happens in motionTask and commsTask
+  Rtos::delayMillis(1000);
+}
@@ -0,0 +1,97 @@
+#pragma once
+// The fixture of the suites that drive a whole MotorController and SerialManager on the
+// simulated clock (pio test -e native): one station per case, run a motion task pass at a
+// time, with everything it writes collected in `output`. Each suite is a binary of its own,
+// so this lives in an anonymous namespace like the suites' own helpers. test_station drives
+// main.cpp's station instead and has its own pass().
+#include <Arduino.h>
+#include <unity.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include "SerialManager.h"
+#include "MotorController.h"
+
+namespace {
+
+const uint64_t MAX_MOVE_MICROS = 120ULL * 1000000ULL;  // runToEnd() gives up after
+
+std::unique_ptr<SerialManager> serial;
+std::unique_ptr<MotorController> motor;
+std::string output;               // Text the station has written since the case started
+uint32_t tickMicros = 1000;       // Virtual time a pass takes
+std::function<void()> afterTick;  // A suite's check after every pass, if any
+
+// One motion task pass: the clock moves on, the controller updates, the comms task writes
+inline void tick() {
+    Sim::advance(tickMicros);
+    motor->update();
+    serial->pump();
+    output += Sim::serialOutput();
+    Sim::clearSerialOutput();
+    if (afterTick) {
+        afterTick();
+    }
+}
+
+inline void runFor(unsigned long passes) {
+    for (unsigned long i = 0; i < passes; i++) {
+        tick();
+    }
+}
+
+// Runs while busy() holds, then five passes for its last lines; false if it still holds
+// after maxMicros
+inline bool runWhile(const std::function<bool()>& busy, uint64_t maxMicros = MAX_MOVE_MICROS) {
+    uint64_t start = Sim::now();
+    while (busy()) {
+        if (Sim::now() - start > maxMicros) {
+            return false;
+        }
+        tick();
+    }
+    runFor(5);
+    return true;
+}
+
+// Runs until the move has ended and its last lines are out
+inline bool runToEnd(uint64_t maxMicros = MAX_MOVE_MICROS) {
+    return runWhile([] { return motor->isMotorRunning(); }, maxMicros);
+}
+
+// A whole line the station wrote
+inline bool sent(const std::string& line) {
+    return output.find(line + "\r\n") != std::string::npos;
+}
+
+// Text anywhere in what it wrote, e.g. the start of a line with a figure after it
+inline bool sentText(const char* text) {
+    return output.find(text) != std::string::npos;
+}
+
+// For setUp(): a fresh station on a reset clock with `axes` axes of DEFAULT_AXIS, passes of
+// `micros` and its startup lines out of the way
+inline void startStation(uint8_t axes = 1, uint32_t micros = 1000) {
+    Sim::reset();
+    tickMicros = micros;
+    afterTick = nullptr;
+    serial.reset(new SerialManager());
+    motor.reset(new MotorController());
+    for (uint8_t axis = 1; axis < axes; axis++) {
+        TEST_ASSERT_EQUAL(axis, motor->addAxis(MotorController::DEFAULT_AXIS));
+    }
+    serial->begin();
+    motor->begin(*serial);
+    runFor(5);
+    output.clear();
+}
+
+// For tearDown()
+inline void stopStation() {
+    Sim::reset();  // Detach the step timer before its controller goes
+    afterTick = nullptr;
+    motor.reset();
+    serial.reset();
+}
+
+}  // namespace
@@ -0,0 +1,232 @@
+// CommandParser (pio test -e native): tokenizing in any order and across arbitrary byte
+// splits, tags, lines dropped as malformed (numbers past a 32-bit long among them),
+// ring overflow, command table matching, and a fuzz run of random input.
+#include <unity.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "CommandParser.h"
+
+namespace {
+
+CommandParser* parser;
+int dispatched;
+
+bool parseLine(const char* text, ParsedCommand& command) {
+    parser->feed((const uint8_t*)text, strlen(text));
+    return parser->poll(command);
+}
+
+void onMove(const ParsedCommand&) { dispatched = 1; }
+void onHello(const ParsedCommand&) { dispatched = 2; }
+void onHelloBin(const ParsedCommand&) { dispatched = 3; }
+
+const CommandEntry TABLE[] = {
+    { "RPM: ROT:",  onMove },
+    { "HELLO BIN",  onHelloBin },
+    { "HELLO",      onHello },
+};
+
+bool dispatch(const ParsedCommand& command) {
+    dispatched = 0;
+    return CommandParser::dispatch(TABLE, sizeof(TABLE) / sizeof(TABLE[0]), command);
+}
+
+}  // namespace
+
+void setUp() {
+    parser = new CommandParser();
+}
+
+void tearDown() {
+    delete parser;
+}
+
+void test_key_value_pairs_in_any_order() {
+    ParsedCommand command;
+    TEST_ASSERT_TRUE(parseLine("ROT:5 DIR:CCW RPM:100\r\n", command));
+    TEST_ASSERT_EQUAL(3, command.count);
+    TEST_ASSERT_EQUAL(100, command.getInt("RPM", 0));
+    TEST_ASSERT_EQUAL(5, command.getInt("ROT", 0));
+    TEST_ASSERT_EQUAL_STRING("CCW", command.getText("DIR", ""));
+    TEST_ASSERT_EQUAL(-1, command.getInt("TIME", -1));
+    TEST_ASSERT_FALSE(command.malformed);
+    TEST_ASSERT_EQUAL(0, command.tag);
+}
+
+void test_numbers_parse_like_toint() {
+    ParsedCommand command;
+    TEST_ASSERT_TRUE(parseLine("A:-42 B:12abc C:abc D:- E:2147483647 F:-2147483647\n", command));
+    TEST_ASSERT_EQUAL(-42, command.getInt("A", 0));
+    TEST_ASSERT_EQUAL(12, command.getInt("B", 0));
+    TEST_ASSERT_EQUAL(0, command.getInt("C", 1));
+    TEST_ASSERT_EQUAL(0, command.getInt("D", 1));
+    TEST_ASSERT_EQUAL(2147483647L, command.getInt("E", 0));
+    TEST_ASSERT_EQUAL(-2147483647L, command.getInt("F", 0));
+}
+
+void test_number_past_a_32_bit_long_is_refused() {
+    // long is 32 bits on the ESP32; 2^31 would wrap negative there, so every build refuses it
+    ParsedCommand command;
+    const char* over[] = { "RPM:60 ROT:2147483648\n", "RPM:60 ROT:-2147483648\n", "RPM:60 ROT:99999999999999\n",
+                           "TIME:4294967297 RPM:60\n" };
+    for (const char* line : over) {
+        TEST_ASSERT_TRUE(parseLine(line, command));
+        TEST_ASSERT_TRUE(command.malformed);
+        TEST_ASSERT_EQUAL(0, command.count);
+    }
+    TEST_ASSERT_EQUAL(4, (long)parser->rejectedLines());
+
+    // The next line parses normally
+    TEST_ASSERT_TRUE(parseLine("RPM:60 ROT:2147483647\n", command));
+    TEST_ASSERT_FALSE(command.malformed);
+    TEST_ASSERT_EQUAL(2147483647L, command.getInt("ROT", 0));
+}
+
+void test_every_byte_split_parses_the_same() {
+    const char* line = "#7 RPM:300 TIME:12 DIR:CW\n";
+    size_t length = strlen(line);
+    for (size_t split = 1; split < length; split++) {
+        ParsedCommand command;
+        parser->feed((const uint8_t*)line, split);
+        TEST_ASSERT_FALSE(parser->poll(command));
+        parser->feed((const uint8_t*)line + split, length - split);
+        TEST_ASSERT_TRUE(parser->poll(command));
+        TEST_ASSERT_EQUAL(7, command.tag);
+        TEST_ASSERT_EQUAL(3, command.count);
+        TEST_ASSERT_EQUAL(12, command.getInt("TIME", 0));
+    }
+}
+
+void test_blank_lines_are_skipped() {
+    ParsedCommand command;
+    TEST_ASSERT_FALSE(parseLine("\n\r\n   \t \n", command));
+    TEST_ASSERT_TRUE(parseLine("  HELLO  \n", command));
+    TEST_ASSERT_EQUAL(1, command.count);
+    TEST_ASSERT_FALSE(command.fields[0].hasValue);
+    TEST_ASSERT_EQUAL_STRING("HELLO", command.fields[0].key);
+}
+
+void test_tags() {
+    ParsedCommand command;
+    TEST_ASSERT_TRUE(parseLine("#32767 POS\n", command));
+    TEST_ASSERT_EQUAL(32767, command.tag);
+    TEST_ASSERT_EQUAL(1, command.count);
+
+    // A tag alone is handed on, so its host hears back
+    TEST_ASSERT_TRUE(parseLine("#5\n", command));
+    TEST_ASSERT_EQUAL(5, command.tag);
+    TEST_ASSERT_EQUAL(0, command.count);
+    TEST_ASSERT_FALSE(command.malformed);
+
+    const char* bad[] = { "#0 POS\n", "#32768 POS\n", "#12a POS\n", "#99999999999 POS\n" };
+    for (const char* line : bad) {
+        TEST_ASSERT_TRUE(parseLine(line, command));
+        TEST_ASSERT_TRUE(command.malformed);
+        TEST_ASSERT_EQUAL(0, command.tag);
+    }
+
+    // Only the first word is a tag
+    TEST_ASSERT_TRUE(parseLine("POS #3\n", command));
+    TEST_ASSERT_EQUAL(0, command.tag);
+    TEST_ASSERT_EQUAL(2, command.count);
+}
+
+void test_oversized_lines_are_malformed() {
+    ParsedCommand command;
+    TEST_ASSERT_TRUE(parseLine("#9 A B C D E F G H I\n", command));  // 9 fields
+    TEST_ASSERT_TRUE(command.malformed);
+    TEST_ASSERT_EQUAL(9, command.tag);
+    TEST_ASSERT_EQUAL(0, command.count);
+
+    TEST_ASSERT_TRUE(parseLine("A B C D E F G H\n", command));  // 8 fit
+    TEST_ASSERT_FALSE(command.malformed);
+    TEST_ASSERT_EQUAL(8, command.count);
+
+    TEST_ASSERT_TRUE(parseLine("ABCDEFGHIJKL:1\n", command));  // 12 character key
+    TEST_ASSERT_TRUE(command.malformed);
+    TEST_ASSERT_TRUE(parseLine("KEY:ABCDEFGHIJKLMNOP\n", command));  // 16 character value
+    TEST_ASSERT_TRUE(command.malformed);
+    TEST_ASSERT_TRUE(parseLine("ABCDEFGHIJK:ABCDEFGHIJKLMNO\n", command));  // Both at their limit
+    TEST_ASSERT_FALSE(command.malformed);
+    TEST_ASSERT_EQUAL(3, (long)parser->rejectedLines());
+}
+
+void test_ring_overflow_is_counted() {
+    uint8_t bytes[300];
+    memset(bytes, 'A', sizeof(bytes));
+    size_t accepted = parser->feed(bytes, sizeof(bytes));
+    TEST_ASSERT_EQUAL(255, (long)accepted);
+    TEST_ASSERT_EQUAL(45, (long)parser->overflows());
+    TEST_ASSERT_EQUAL(0, (long)parser->space());
+}
+
+void test_table_matches_words_and_keys() {
+    ParsedCommand command;
+    TEST_ASSERT_TRUE(parseLine("ROT:2 RPM:60\n", command));
+    TEST_ASSERT_TRUE(dispatch(command));
+    TEST_ASSERT_EQUAL(1, dispatched);
+
+    TEST_ASSERT_TRUE(parseLine("HELLO BIN\n", command));
+    TEST_ASSERT_TRUE(dispatch(command));
+    TEST_ASSERT_EQUAL(3, dispatched);
+
+    TEST_ASSERT_TRUE(parseLine("HELLO\n", command));
+    TEST_ASSERT_TRUE(dispatch(command));
+    TEST_ASSERT_EQUAL(2, dispatched);
+
+    // A key needs its value and a word must not have one
+    TEST_ASSERT_TRUE(parseLine("RPM ROT:2\n", command));
+    TEST_ASSERT_FALSE(dispatch(command));
+    TEST_ASSERT_TRUE(parseLine("HELLO:1\n", command));
+    TEST_ASSERT_FALSE(dispatch(command));
+}
+
+void test_fuzz_random_input_never_breaks_the_parser() {
+    // Random bytes, weighted towards the ones the tokenizer cares about, then a known line:
+    // every known line must come out whole, whatever came before it
+    const char ALPHABET[] = "RPM:ROT#0123456789- \t\r\n:AZ";
+    srand(5);
+    long known = 0;
+    for (int round = 0; round < 20000; round++) {
+        int noise = rand() % 80;
+        for (int i = 0; i < noise; i++) {
+            uint8_t byte = rand() % 4 == 0 ? (uint8_t)rand() : (uint8_t)ALPHABET[rand() % (sizeof(ALPHABET) - 1)];
+            parser->feed(byte);
+        }
+        const char* line = "\n#77 RPM:123 ROT:-45 DIR:CW\n";
+        parser->feed((const uint8_t*)line, strlen(line));
+
+        ParsedCommand command;
+        while (parser->poll(command)) {
+            TEST_ASSERT_TRUE(command.count <= ParsedCommand::MAX_FIELDS);
+            TEST_ASSERT_TRUE(command.tag <= ParsedCommand::MAX_TAG);
+            TEST_ASSERT_TRUE(!command.malformed || command.count == 0);
+            for (uint8_t i = 0; i < command.count; i++) {
+                TEST_ASSERT_TRUE(strlen(command.fields[i].key) <= (size_t)CommandField::MAX_KEY);
+                TEST_ASSERT_TRUE(strlen(command.fields[i].value) <= (size_t)CommandField::MAX_VALUE);
+            }
+            if (command.tag == 77 && command.count == 3 && command.getInt("RPM", 0) == 123 &&
+                command.getInt("ROT", 0) == -45) {
+                known++;
+            }
+        }
+        TEST_ASSERT_EQUAL(round + 1, known);
+    }
+    TEST_ASSERT_EQUAL(0, (long)parser->overflows());
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_key_value_pairs_in_any_order);
+    RUN_TEST(test_numbers_parse_like_toint);
+    RUN_TEST(test_number_past_a_32_bit_long_is_refused);
+    RUN_TEST(test_every_byte_split_parses_the_same);
+    RUN_TEST(test_blank_lines_are_skipped);
+    RUN_TEST(test_tags);
+    RUN_TEST(test_oversized_lines_are_malformed);
+    RUN_TEST(test_ring_overflow_is_counted);
+    RUN_TEST(test_table_matches_words_and_keys);
+    RUN_TEST(test_fuzz_random_input_never_breaks_the_parser);
+    return UNITY_END();
+}
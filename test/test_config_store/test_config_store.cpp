@@ -0,0 +1,213 @@
+// ConfigStore (pio test -e native): the stored configuration blob, round trips, the damage
+// and version cases load() refuses, and FileConfigStorage on a file of its own.
+#include <Arduino.h>
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include "ConfigStore.h"
+#include "FrameCodec.h"
+#include "MotorController.h"
+
+namespace {
+
+const char* TEST_FILE = "test_config_store.bin";  // Never the station's motor_config.bin
+
+// A blob in memory
+class MemoryStorage : public ConfigStorage {
+public:
+    uint8_t data[ConfigStore::MAX_BLOB];
+    size_t length = 0;
+    bool failWrites = false;
+
+    size_t read(uint8_t* out, size_t capacity) override {
+        size_t n = length < capacity ? length : capacity;
+        memcpy(out, data, n);
+        return n;
+    }
+    bool write(const uint8_t* in, size_t size) override {
+        if (failWrites || size > sizeof(data)) {
+            return false;
+        }
+        memcpy(data, in, size);
+        length = size;
+        return true;
+    }
+
+    // After changing the blob, so only the change is wrong with it
+    void resign() {
+        Frame::put16(data + length - 2, Frame::crc16(data, length - 2));
+    }
+};
+
+MotorConfig defaults() {
+    static MotorController controller;
+    return controller.config();
+}
+
+bool sameConfig(const MotorConfig& a, const MotorConfig& b) {
+    for (uint8_t field = 0; field < ConfigStore::FIELDS; field++) {
+        if (ConfigStore::getField(a, field) != ConfigStore::getField(b, field)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+MotorConfig changed() {
+    MotorConfig config = defaults();
+    config.microsteps = 8;
+    config.maxRpm = 600;
+    config.speedDelay[19] = 300;
+    return config;
+}
+
+}  // namespace
+
+void setUp() {
+    remove(TEST_FILE);
+}
+
+void tearDown() {
+    remove(TEST_FILE);
+}
+
+void test_nothing_stored_is_missing() {
+    MemoryStorage storage;
+    ConfigStore store(storage);
+    MotorConfig config = changed();
+    TEST_ASSERT_EQUAL(ConfigStore::MISSING, store.load(config));
+    TEST_ASSERT_TRUE(sameConfig(changed(), config));  // Left as it was
+}
+
+void test_save_and_load_round_trip() {
+    MemoryStorage storage;
+    ConfigStore store(storage);
+    TEST_ASSERT_TRUE(store.save(changed()));
+    TEST_ASSERT_EQUAL(8 + 2 * ConfigStore::FIELDS + 2, (int)storage.length);
+
+    MotorConfig config = defaults();
+    TEST_ASSERT_EQUAL(ConfigStore::LOADED, store.load(config));
+    TEST_ASSERT_TRUE(sameConfig(changed(), config));
+}
+
+void test_every_damaged_byte_is_refused() {
+    MemoryStorage storage;
+    ConfigStore store(storage);
+    store.save(changed());
+    for (size_t i = 0; i < storage.length; i++) {
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            storage.data[i] ^= (uint8_t)(1 << bit);
+            MotorConfig config = defaults();
+            TEST_ASSERT_NOT_EQUAL(ConfigStore::LOADED, store.load(config));
+            TEST_ASSERT_TRUE(sameConfig(defaults(), config));
+            storage.data[i] ^= (uint8_t)(1 << bit);
+        }
+    }
+}
+
+void test_truncated_blob_is_corrupt() {
+    MemoryStorage storage;
+    ConfigStore store(storage);
+    store.save(changed());
+    size_t full = storage.length;
+    for (size_t length = 1; length < full; length++) {
+        storage.length = length;
+        MotorConfig config = defaults();
+        TEST_ASSERT_EQUAL(ConfigStore::CORRUPT, store.load(config));
+    }
+}
+
+void test_blob_from_newer_firmware_is_unsupported() {
+    MemoryStorage storage;
+    ConfigStore store(storage);
+    store.save(changed());
+    Frame::put16(storage.data + 4, ConfigStore::VERSION + 1);
+    storage.resign();
+    MotorConfig config = defaults();
+    TEST_ASSERT_EQUAL(ConfigStore::UNSUPPORTED, store.load(config));
+}
+
+void test_older_blob_keeps_the_fields_it_lacks() {
+    // A blob with only the scalar fields: the speed delays stay at their current values
+    MemoryStorage storage;
+    ConfigStore store(storage);
+    store.save(changed());
+    const uint16_t scalars = ConfigStore::FIELDS - SpeedTable::LEVELS;
+    Frame::put16(storage.data + 6, scalars);
+    storage.length = 8 + 2 * scalars + 2;
+    storage.resign();
+
+    MotorConfig config = defaults();
+    TEST_ASSERT_EQUAL(ConfigStore::LOADED, store.load(config));
+    TEST_ASSERT_EQUAL(8, config.microsteps);
+    TEST_ASSERT_EQUAL(600, config.maxRpm);
+    TEST_ASSERT_EQUAL(defaults().speedDelay[19], config.speedDelay[19]);
+}
+
+void test_intact_blob_out_of_range_is_invalid() {
+    MemoryStorage storage;
+    ConfigStore store(storage);
+    store.save(changed());
+    Frame::put16(storage.data + 8 + 2 * ConfigStore::findField("MICROSTEPS"), 0);
+    storage.resign();
+    MotorConfig config = defaults();
+    TEST_ASSERT_EQUAL(ConfigStore::INVALID, store.load(config));
+    TEST_ASSERT_TRUE(sameConfig(defaults(), config));
+}
+
+void test_failed_write_reports_false() {
+    MemoryStorage storage;
+    storage.failWrites = true;
+    ConfigStore store(storage);
+    TEST_ASSERT_FALSE(store.save(changed()));
+}
+
+void test_file_storage_round_trip() {
+    FileConfigStorage storage(TEST_FILE);
+    ConfigStore store(storage);
+    MotorConfig config = defaults();
+    TEST_ASSERT_EQUAL(ConfigStore::MISSING, store.load(config));
+    TEST_ASSERT_TRUE(store.save(changed()));
+    TEST_ASSERT_TRUE(store.save(changed()));  // Replacing the file
+    TEST_ASSERT_EQUAL(ConfigStore::LOADED, store.load(config));
+    TEST_ASSERT_TRUE(sameConfig(changed(), config));
+
+    FILE* temporary = fopen("test_config_store.bin.tmp", "rb");
+    TEST_ASSERT_NULL(temporary);  // Renamed over the old file
+}
+
+void test_field_names_and_ranges() {
+    char name[16];
+    for (uint8_t field = 0; field < ConfigStore::FIELDS; field++) {
+        ConfigStore::fieldName(field, name, sizeof(name));
+        TEST_ASSERT_EQUAL(field, ConfigStore::findField(name));
+        uint16_t minimum;
+        uint16_t maximum;
+        ConfigStore::fieldRange(field, minimum, maximum);
+        MotorConfig config = defaults();
+        TEST_ASSERT_TRUE(ConfigStore::setField(config, field, maximum));
+        if (maximum < 65535) {
+            TEST_ASSERT_FALSE(ConfigStore::setField(config, field, (long)maximum + 1));
+        }
+        if (minimum > 0) {
+            TEST_ASSERT_FALSE(ConfigStore::setField(config, field, (long)minimum - 1));
+        }
+    }
+    TEST_ASSERT_EQUAL(-1, ConfigStore::findField("NOSUCH"));
+    TEST_ASSERT_NULL(ConfigStore::validate(defaults()));
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_nothing_stored_is_missing);
+    RUN_TEST(test_save_and_load_round_trip);
+    RUN_TEST(test_every_damaged_byte_is_refused);
+    RUN_TEST(test_truncated_blob_is_corrupt);
+    RUN_TEST(test_blob_from_newer_firmware_is_unsupported);
+    RUN_TEST(test_older_blob_keeps_the_fields_it_lacks);
+    RUN_TEST(test_intact_blob_out_of_range_is_invalid);
+    RUN_TEST(test_failed_write_reports_false);
+    RUN_TEST(test_file_storage_round_trip);
+    RUN_TEST(test_field_names_and_ranges);
+    return UNITY_END();
+}
@@ -0,0 +1,170 @@
+// EventRing (pio test -e native): the lock-free single-producer / single-consumer ring
+// the step ISR reports through, alone and under two threads racing on it.
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include "EventRing.h"
+
+namespace {
+
+// A record that shows whether it was read whole
+struct Record {
+    uint32_t sequence;
+    uint32_t check;  // ~sequence
+    uint64_t payload[3];
+};
+
+Record makeRecord(uint32_t sequence) {
+    Record record;
+    record.sequence = sequence;
+    record.check = ~sequence;
+    for (int i = 0; i < 3; i++) {
+        record.payload[i] = (uint64_t)sequence * (i + 7);
+    }
+    return record;
+}
+
+bool whole(const Record& record) {
+    for (int i = 0; i < 3; i++) {
+        if (record.payload[i] != (uint64_t)record.sequence * (i + 7)) {
+            return false;
+        }
+    }
+    return record.check == ~record.sequence;
+}
+
+struct Outcome {
+    uint32_t received;
+    uint32_t torn;       // Records read half written
+    uint32_t reordered;  // Sequence numbers going backwards or repeating
+};
+
+// Producer pushes count records as fast as it can; the consumer drains them on another
+// thread, pausing every so often so the ring fills and the producer has to drop
+template <uint32_t SIZE>
+Outcome race(EventRing<Record, SIZE>& ring, uint32_t count, uint32_t consumerPauseEvery) {
+    std::atomic<bool> producing(true);
+    Outcome outcome = { 0, 0, 0 };
+
+    std::thread consumer([&]() {
+        uint32_t expectedAtLeast = 0;
+        Record record;
+        for (;;) {
+            bool done = !producing.load(std::memory_order_acquire);
+            while (ring.pop(record)) {
+                if (!whole(record)) {
+                    outcome.torn++;
+                }
+                if (record.sequence < expectedAtLeast) {
+                    outcome.reordered++;
+                }
+                expectedAtLeast = record.sequence + 1;
+                outcome.received++;
+                if (consumerPauseEvery != 0 && outcome.received % consumerPauseEvery == 0) {
+                    std::this_thread::yield();
+                }
+            }
+            if (done) {
+                return;
+            }
+        }
+    });
+
+    for (uint32_t sequence = 0; sequence < count; sequence++) {
+        ring.push(makeRecord(sequence));
+    }
+    producing.store(false, std::memory_order_release);
+    consumer.join();
+    return outcome;
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_records_come_out_in_order() {
+    EventRing<Record, 8> ring;
+    for (uint32_t i = 0; i < 5; i++) {
+        TEST_ASSERT_TRUE(ring.push(makeRecord(i)));
+    }
+    TEST_ASSERT_EQUAL_UINT32(5, ring.size());
+    Record record;
+    for (uint32_t i = 0; i < 5; i++) {
+        TEST_ASSERT_TRUE(ring.pop(record));
+        TEST_ASSERT_EQUAL_UINT32(i, record.sequence);
+    }
+    TEST_ASSERT_FALSE(ring.pop(record));
+    TEST_ASSERT_EQUAL_UINT32(0, ring.overflows());
+}
+
+void test_full_ring_drops_and_counts() {
+    EventRing<Record, 8> ring;
+    uint32_t accepted = 0;
+    for (uint32_t i = 0; i < 20; i++) {
+        accepted += ring.push(makeRecord(i)) ? 1 : 0;
+    }
+    // Free-running indices tell full from empty, so every slot is used
+    TEST_ASSERT_EQUAL_UINT32(8, accepted);
+    TEST_ASSERT_EQUAL_UINT32(12, ring.overflows());
+    Record record;
+    TEST_ASSERT_TRUE(ring.pop(record));
+    TEST_ASSERT_EQUAL_UINT32(0, record.sequence);  // The oldest are kept, the newest dropped
+}
+
+void test_reserve_keeps_slots_for_records_that_must_not_be_lost() {
+    EventRing<Record, 8> ring;
+    uint32_t accepted = 0;
+    for (uint32_t i = 0; i < 10; i++) {
+        accepted += ring.push(makeRecord(i), 2) ? 1 : 0;
+    }
+    TEST_ASSERT_EQUAL_UINT32(6, accepted);
+    TEST_ASSERT_TRUE(ring.push(makeRecord(100)));
+    TEST_ASSERT_TRUE(ring.push(makeRecord(101)));
+    TEST_ASSERT_FALSE(ring.push(makeRecord(102)));
+}
+
+void test_clear_drops_what_is_queued() {
+    EventRing<Record, 8> ring;
+    ring.push(makeRecord(1));
+    ring.push(makeRecord(2));
+    ring.clear();
+    TEST_ASSERT_EQUAL_UINT32(0, ring.size());
+    Record record;
+    TEST_ASSERT_FALSE(ring.pop(record));
+    TEST_ASSERT_TRUE(ring.push(makeRecord(3)));
+    TEST_ASSERT_TRUE(ring.pop(record));
+    TEST_ASSERT_EQUAL_UINT32(3, record.sequence);
+}
+
+void test_two_threads_lose_nothing_uncounted() {
+    // Free-running indices wrap the ring's slots many times over
+    const uint32_t COUNT = 2000000;
+    EventRing<Record, 64> ring;
+    Outcome outcome = race(ring, COUNT, 0);
+    TEST_ASSERT_EQUAL_UINT32(0, outcome.torn);
+    TEST_ASSERT_EQUAL_UINT32(0, outcome.reordered);
+    TEST_ASSERT_EQUAL_UINT32(COUNT, outcome.received + ring.overflows());
+    TEST_ASSERT_EQUAL_UINT32(0, ring.size());
+}
+
+void test_two_threads_with_a_slow_consumer() {
+    const uint32_t COUNT = 500000;
+    EventRing<Record, 16> ring;
+    Outcome outcome = race(ring, COUNT, 3);
+    TEST_ASSERT_EQUAL_UINT32(0, outcome.torn);
+    TEST_ASSERT_EQUAL_UINT32(0, outcome.reordered);
+    TEST_ASSERT_EQUAL_UINT32(COUNT, outcome.received + ring.overflows());
+    TEST_ASSERT_GREATER_THAN_UINT32(0, outcome.received);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_records_come_out_in_order);
+    RUN_TEST(test_full_ring_drops_and_counts);
+    RUN_TEST(test_reserve_keeps_slots_for_records_that_must_not_be_lost);
+    RUN_TEST(test_clear_drops_what_is_queued);
+    RUN_TEST(test_two_threads_lose_nothing_uncounted);
+    RUN_TEST(test_two_threads_with_a_slow_consumer);
+    return UNITY_END();
+}
@@ -0,0 +1,226 @@
+// Binary framing (pio test -e native): FrameCodec encode/decode, CRC, resynchronisation
+// after noise and damaged frames, the STATUS record, and SerialManager's binary session
+// on the simulated Serial.
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "StationHarness.h"
+#include "FrameCodec.h"
+
+namespace {
+
+struct Decoded {
+    uint8_t type;
+    std::vector<uint8_t> payload;
+};
+
+std::vector<Decoded> decodeAll(FrameDecoder& decoder, const uint8_t* data, size_t length) {
+    std::vector<Decoded> frames;
+    for (size_t i = 0; i < length; i++) {
+        if (decoder.push(data[i])) {
+            frames.push_back({ decoder.type(), std::vector<uint8_t>(decoder.payload(), decoder.payload() + decoder.length()) });
+        }
+    }
+    return frames;
+}
+
+std::vector<Decoded> decodeAll(const std::string& bytes) {
+    FrameDecoder decoder;
+    return decodeAll(decoder, (const uint8_t*)bytes.data(), bytes.size());
+}
+
+}  // namespace
+
+void setUp() {
+    Sim::reset();
+}
+
+void tearDown() {
+    stopStation();
+}
+
+void test_crc_is_ccitt_false() {
+    TEST_ASSERT_EQUAL_HEX16(0x29B1, Frame::crc16((const uint8_t*)"123456789", 9));
+    TEST_ASSERT_EQUAL_HEX16(0xFFFF, Frame::crc16(nullptr, 0));
+}
+
+void test_every_payload_length_round_trips() {
+    uint8_t payload[Frame::MAX_PAYLOAD];
+    uint8_t frame[Frame::MAX_FRAME];
+    for (int i = 0; i < Frame::MAX_PAYLOAD; i++) {
+        payload[i] = (uint8_t)(i * 37 + 1);
+    }
+    FrameDecoder decoder;
+    for (uint8_t length = 0; length <= Frame::MAX_PAYLOAD; length++) {
+        size_t size = Frame::encode(Frame::RESPONSE, payload, length, frame);
+        TEST_ASSERT_EQUAL(length + Frame::OVERHEAD, size);
+        TEST_ASSERT_EQUAL_HEX8(Frame::SYNC, frame[0]);
+        std::vector<Decoded> frames = decodeAll(decoder, frame, size);
+        TEST_ASSERT_EQUAL(1, (int)frames.size());
+        TEST_ASSERT_EQUAL_HEX8(Frame::RESPONSE, frames[0].type);
+        TEST_ASSERT_EQUAL(length, (int)frames[0].payload.size());
+        TEST_ASSERT_TRUE(length == 0 || memcmp(payload, frames[0].payload.data(), length) == 0);
+    }
+    TEST_ASSERT_EQUAL(0, Frame::encode(Frame::RESPONSE, payload, Frame::MAX_PAYLOAD + 1, frame));
+    TEST_ASSERT_EQUAL(0, (long)decoder.crcErrors());
+    TEST_ASSERT_EQUAL(0, (long)decoder.droppedBytes());
+}
+
+void test_noise_before_a_frame_is_dropped() {
+    uint8_t stream[64] = { 'R', 'E', 'A', 'D', 'Y', '\r', '\n', 0x00, 0x13 };
+    uint8_t turn[4];
+    Frame::put32(turn, 7);
+    size_t size = 9 + Frame::encode(Frame::TURN, turn, 4, stream + 9);
+    FrameDecoder decoder;
+    std::vector<Decoded> frames = decodeAll(decoder, stream, size);
+    TEST_ASSERT_EQUAL(1, (int)frames.size());
+    TEST_ASSERT_EQUAL_UINT32(7, Frame::get32(frames[0].payload.data()));
+    TEST_ASSERT_EQUAL(9, (long)decoder.droppedBytes());
+}
+
+void test_damaged_frame_is_dropped_and_the_next_one_decodes() {
+    uint8_t stream[64];
+    uint8_t value[4];
+    Frame::put32(value, 1);
+    size_t first = Frame::encode(Frame::TURN, value, 4, stream);
+    Frame::put32(value, 2);
+    size_t size = first + Frame::encode(Frame::TURN, value, 4, stream + first);
+    stream[4] ^= 0x01;  // Payload bit of the first frame
+
+    FrameDecoder decoder;
+    std::vector<Decoded> frames = decodeAll(decoder, stream, size);
+    TEST_ASSERT_EQUAL(1, (int)frames.size());
+    TEST_ASSERT_EQUAL_UINT32(2, Frame::get32(frames[0].payload.data()));
+    TEST_ASSERT_EQUAL(1, (long)decoder.crcErrors());
+}
+
+void test_impossible_length_resynchronises() {
+    // A sync byte followed by a length over MAX_PAYLOAD, then a real frame; and a doubled
+    // sync byte, whose second one is read as the length and starts the frame instead
+    const uint8_t leads[][2] = { { Frame::SYNC, 200 }, { Frame::SYNC, Frame::SYNC } };
+    for (const uint8_t* lead : leads) {
+        uint8_t stream[16] = { lead[0] };
+        size_t size = 1 + Frame::encode(Frame::DONE, nullptr, 0, stream + 1);
+        if (lead[1] != Frame::SYNC) {
+            memmove(stream + 2, stream + 1, size - 1);
+            stream[1] = lead[1];
+            size++;
+        }
+        FrameDecoder decoder;
+        std::vector<Decoded> frames = decodeAll(decoder, stream, size);
+        TEST_ASSERT_EQUAL(1, (int)frames.size());
+        TEST_ASSERT_EQUAL_HEX8(Frame::DONE, frames[0].type);
+    }
+}
+
+void test_status_record_round_trips() {
+    Frame::StatusRecord status = { Frame::STATE_PAUSED, 1000, 123456789, 4000000000u, 86400000, -1234, 999 };
+    uint8_t payload[Frame::STATUS_SIZE];
+    Frame::encodeStatus(status, payload);
+    Frame::StatusRecord decoded;
+    Frame::decodeStatus(payload, decoded);
+    TEST_ASSERT_EQUAL(19, Frame::STATUS_SIZE);
+    TEST_ASSERT_EQUAL_UINT8(status.state, decoded.state);
+    TEST_ASSERT_EQUAL_UINT16(status.rpm, decoded.rpm);
+    TEST_ASSERT_EQUAL_UINT32(status.completedRotations, decoded.completedRotations);
+    TEST_ASSERT_EQUAL_UINT32(status.targetRotations, decoded.targetRotations);
+    TEST_ASSERT_EQUAL_UINT32(status.elapsedMillis, decoded.elapsedMillis);
+    TEST_ASSERT_EQUAL_INT16(status.followingError, decoded.followingError);
+    TEST_ASSERT_EQUAL_UINT16(status.loadTenths, decoded.loadTenths);
+}
+
+void test_frames_survive_random_noise() {
+    // Noise bursts between frames, each followed by enough non-sync bytes to end any frame
+    // the noise seemed to start: every real frame still comes out, in order
+    srand(11);
+    std::vector<uint8_t> stream;
+    uint8_t frame[Frame::MAX_FRAME];
+    uint8_t value[4];
+    for (uint32_t i = 0; i < 2000; i++) {
+        int noise = rand() % 40;
+        for (int n = 0; n < noise; n++) {
+            stream.push_back((uint8_t)rand());
+        }
+        stream.insert(stream.end(), Frame::MAX_FRAME, 0);
+        Frame::put32(value, i);
+        size_t size = Frame::encode(Frame::TURN, value, 4, frame);
+        stream.insert(stream.end(), frame, frame + size);
+    }
+    FrameDecoder decoder;
+    std::vector<Decoded> frames = decodeAll(decoder, stream.data(), stream.size());
+    uint32_t next = 0;
+    for (const Decoded& decoded : frames) {
+        if (decoded.type == Frame::TURN && decoded.payload.size() == 4 && Frame::get32(decoded.payload.data()) == next) {
+            next++;
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(2000, next);
+}
+
+void test_binary_session_carries_commands_and_telemetry() {
+    startStation();
+    serial->setBinaryMode(true);
+    serial->pump();
+    Sim::clearSerialOutput();
+
+    // A COMMAND frame parses like the text line it carries
+    uint8_t frame[Frame::MAX_FRAME];
+    const char* line = "RPM:300 ROT:2 DIR:CCW";
+    size_t size = Frame::encode(Frame::COMMAND, (const uint8_t*)line, (uint8_t)strlen(line), frame);
+    Sim::serialInput(frame, size);
+    ParsedCommand command;
+    bool parsed = false;
+    for (int i = 0; i < 10 && !parsed; i++) {
+        parsed = serial->pollCommand(command);
+    }
+    TEST_ASSERT_TRUE(parsed);
+    TEST_ASSERT_EQUAL(300, command.getInt("RPM", 0));
+    TEST_ASSERT_EQUAL(2, command.getInt("ROT", 0));
+    TEST_ASSERT_EQUAL_STRING("CCW", command.getText("DIR", ""));
+
+    // The move's TURNs and DONE come back as fixed-size frames, nothing as text
+    motor->executeRotation(300, 2);
+    TEST_ASSERT_TRUE(runToEnd(5000000));
+    Frame::StatusRecord status = { Frame::STATE_DONE, 300, 2, 2, 0, 0, 0 };
+    serial->sendStatusRecord(status);
+    runFor(5);
+
+    std::vector<uint32_t> turns;
+    bool done = false;
+    bool statusSeen = false;
+    for (const Decoded& decoded : decodeAll(output)) {
+        if (decoded.type == Frame::TURN) {
+            TEST_ASSERT_EQUAL(4, (int)decoded.payload.size());
+            turns.push_back(Frame::get32(decoded.payload.data()));
+        } else if (decoded.type == Frame::DONE) {
+            TEST_ASSERT_EQUAL(0, (int)decoded.payload.size());
+            done = true;
+        } else if (decoded.type == Frame::STATUS) {
+            TEST_ASSERT_EQUAL(Frame::STATUS_SIZE, (int)decoded.payload.size());
+            Frame::StatusRecord decodedStatus;
+            Frame::decodeStatus(decoded.payload.data(), decodedStatus);
+            TEST_ASSERT_EQUAL_UINT32(2, decodedStatus.completedRotations);
+            statusSeen = true;
+        }
+    }
+    TEST_ASSERT_EQUAL(2, (int)turns.size());
+    TEST_ASSERT_EQUAL_UINT32(1, turns[0]);
+    TEST_ASSERT_EQUAL_UINT32(2, turns[1]);
+    TEST_ASSERT_TRUE(done);
+    TEST_ASSERT_TRUE(statusSeen);
+    TEST_ASSERT_TRUE(output.find("TURN:") == std::string::npos);
+    TEST_ASSERT_TRUE(output.find("DONE\r\n") == std::string::npos);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_crc_is_ccitt_false);
+    RUN_TEST(test_every_payload_length_round_trips);
+    RUN_TEST(test_noise_before_a_frame_is_dropped);
+    RUN_TEST(test_damaged_frame_is_dropped_and_the_next_one_decodes);
+    RUN_TEST(test_impossible_length_resynchronises);
+    RUN_TEST(test_status_record_round_trips);
+    RUN_TEST(test_frames_survive_random_noise);
+    RUN_TEST(test_binary_session_carries_commands_and_telemetry);
+    return UNITY_END();
+}
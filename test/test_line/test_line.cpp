@@ -0,0 +1,194 @@
+// Coordinated LINE moves (pio test -e native): four axes on the shared step timer of
+// SimStepHal, each checked for its exact step count and for keeping in line with the
+// lead axis on every tick of the stepped clock.
+#include <algorithm>
+#include <vector>
+#include "StationHarness.h"
+
+namespace {
+
+const long STEPS_PER_REV = 3200;  // 200 x 1/16 on every axis
+const uint8_t AXES = 4;
+
+long worstLag;  // Largest distance, in steps, of a follower from its share of the lead's
+
+long netSteps(uint8_t axis) {
+    return axis == 0 ? motor->timer().netSteps() : motor->axisOutput(axis).netSteps();
+}
+
+long pulses(uint8_t axis) {
+    return axis == 0 ? motor->timer().recordedPulses() : motor->axisOutput(axis).recordedPulses();
+}
+
+uint64_t pulseTime(uint8_t axis, long index) {
+    return axis == 0 ? motor->timer().pulseTime(index) : motor->axisOutput(axis).pulseTime(index);
+}
+
+// Where each axis should be, as a share of the lead axis' progress, within a step
+void checkInLine(const long* steps, uint8_t lead) {
+    long leadDone = pulses(lead);
+    long leadTotal = steps[lead] < 0 ? -steps[lead] : steps[lead];
+    for (uint8_t axis = 0; axis < AXES; axis++) {
+        long total = steps[axis] < 0 ? -steps[axis] : steps[axis];
+        double share = (double)leadDone * total / leadTotal;
+        long lag = (long)(share > pulses(axis) ? share - pulses(axis) + 0.5 : pulses(axis) - share + 0.5);
+        worstLag = std::max(worstLag, lag);
+    }
+}
+
+// Runs the LINE until it has ended, checking the axes stay in line on every tick
+bool runLine(const long* steps, uint8_t lead) {
+    afterTick = [steps, lead] { checkInLine(steps, lead); };
+    bool ended = runToEnd();
+    afterTick = nullptr;
+    return ended;
+}
+
+// Every pulse of a follower falls on a pulse of the lead axis
+bool onLeadTicks(uint8_t axis, uint8_t lead) {
+    std::vector<uint64_t> leadTimes;
+    for (long i = 0; i < pulses(lead); i++) {
+        leadTimes.push_back(pulseTime(lead, i));
+    }
+    for (long i = 0; i < pulses(axis); i++) {
+        if (!std::binary_search(leadTimes.begin(), leadTimes.end(), pulseTime(axis, i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Index of the lead axis' pulse at a time
+long leadTick(uint8_t lead, uint64_t time) {
+    long low = 0;
+    long high = pulses(lead) - 1;
+    while (low < high) {
+        long middle = (low + high) / 2;
+        if (pulseTime(lead, middle) < time) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void checkLine(const long* steps, uint8_t lead) {
+    for (uint8_t axis = 0; axis < AXES; axis++) {
+        long total = steps[axis] < 0 ? -steps[axis] : steps[axis];
+        TEST_ASSERT_EQUAL(steps[axis], netSteps(axis));
+        TEST_ASSERT_EQUAL(total, pulses(axis));
+        motor->selectAxis(axis);
+        TEST_ASSERT_EQUAL(steps[axis], motor->position());
+        if (total == 0) {
+            continue;
+        }
+        // Followers start half a step of theirs into the move, so their steps sit centred
+        // between the lead's first and last tick
+        long leadTotal = pulses(lead);
+        long margin = leadTotal / (2 * total) + 1;
+        TEST_ASSERT_TRUE(onLeadTicks(axis, lead));
+        TEST_ASSERT_LESS_OR_EQUAL(margin, leadTick(lead, pulseTime(axis, 0)));
+        TEST_ASSERT_GREATER_OR_EQUAL(leadTotal - 1 - margin, leadTick(lead, pulseTime(axis, total - 1)));
+    }
+    motor->selectAxis(0);
+    TEST_ASSERT_LESS_OR_EQUAL(1, worstLag);
+}
+
+}  // namespace
+
+void setUp() {
+    worstLag = 0;
+    startStation(AXES);
+}
+
+void tearDown() {
+    stopStation();
+}
+
+void test_no_fifth_axis() {
+    TEST_ASSERT_EQUAL(AXES, motor->axes());
+    TEST_ASSERT_EQUAL(-1, motor->addAxis(MotorController::DEFAULT_AXIS));
+}
+
+void test_three_axes_finish_together() {
+    const long steps[AXES] = { 3200, -1600, 1001, 0 };
+    motor->executeLine(120, 0, steps, AXES);
+    TEST_ASSERT_TRUE(runLine(steps, 0));
+    checkLine(steps, 0);
+    TEST_ASSERT_TRUE(sent("DONE"));
+}
+
+void test_four_axes_with_a_prime_ratio() {
+    const long steps[AXES] = { -2003, 6397, 4099, -1 };
+    motor->executeLine(300, 0, steps, AXES);
+    TEST_ASSERT_TRUE(runLine(steps, 1));
+    checkLine(steps, 1);
+}
+
+void test_speed_applies_to_the_lead_axis() {
+    // 60 RPM on Y, the axis with the most steps: 312.5 us a step at cruise
+    const long steps[AXES] = { 500, -6400, 0, 0 };
+    motor->executeLine(60, 0, steps, AXES);
+    TEST_ASSERT_TRUE(runLine(steps, 1));
+    checkLine(steps, 1);
+    uint64_t span = pulseTime(1, 4000) - pulseTime(1, 3000);
+    TEST_ASSERT_UINT64_WITHIN(2, 312500, span);
+}
+
+void test_pause_and_resume_keep_the_axes_in_line() {
+    const long steps[AXES] = { 9600, 4800, -3200, 1 };
+    motor->executeLine(300, 0, steps, AXES);
+    runFor(400);
+    motor->pause();
+    runFor(500);
+    TEST_ASSERT_TRUE(motor->isMotorPaused());
+    long stopped = pulses(0);
+    TEST_ASSERT_GREATER_THAN(0, stopped);
+    TEST_ASSERT_LESS_THAN(9600, stopped);
+    checkInLine(steps, 0);
+
+    motor->resume();
+    TEST_ASSERT_TRUE(runLine(steps, 0));
+    for (uint8_t axis = 0; axis < AXES; axis++) {
+        TEST_ASSERT_EQUAL(steps[axis], netSteps(axis));
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(1, worstLag);
+}
+
+void test_line_from_an_offset_reaches_its_targets() {
+    const long first[AXES] = { 1000, -2000, 3000, -4000 };
+    motor->executeLine(300, 0, first, AXES);
+    TEST_ASSERT_TRUE(runLine(first, 3));
+    const long second[AXES] = { -1000, 3000, 0, 4000 };
+    motor->executeLine(300, 0, second, AXES);
+    TEST_ASSERT_TRUE(runLine(second, 3));
+    const long net[AXES] = { 0, 1000, 3000, 0 };
+    for (uint8_t axis = 0; axis < AXES; axis++) {
+        TEST_ASSERT_EQUAL(net[axis], netSteps(axis));
+        motor->selectAxis(axis);
+        TEST_ASSERT_EQUAL(net[axis], motor->position());
+    }
+}
+
+void test_line_without_steps_does_not_move() {
+    const long steps[AXES] = { 0, 0, 0, 0 };
+    motor->executeLine(300, 0, steps, AXES);
+    TEST_ASSERT_FALSE(motor->isMotorRunning());
+    runFor(100);
+    for (uint8_t axis = 0; axis < AXES; axis++) {
+        TEST_ASSERT_EQUAL(0, pulses(axis));
+    }
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_no_fifth_axis);
+    RUN_TEST(test_three_axes_finish_together);
+    RUN_TEST(test_four_axes_with_a_prime_ratio);
+    RUN_TEST(test_speed_applies_to_the_lead_axis);
+    RUN_TEST(test_pause_and_resume_keep_the_axes_in_line);
+    RUN_TEST(test_line_from_an_offset_reaches_its_targets);
+    RUN_TEST(test_line_without_steps_does_not_move);
+    return UNITY_END();
+}
@@ -0,0 +1,208 @@
+// LoadFilter (pio test -e native) over the current sense capture next to this file: the
+// step response and settling time, the chopper ripple left on the load figure and
+// calibration from the capture's own idle and rated stretches.
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "LoadFilter.h"
+
+namespace {
+
+// The capture's layout, see its header
+const double RATE = 20000;           // Hz, MotorController::LOAD_SAMPLE_RATE
+const double RATED_AT = 0.25;        // s, idle before
+const double PARTIAL_AT = 0.65;      // s, rated before, 40 % after
+const double END = 1.0;
+const uint16_t OFFSET = 120;         // Raw reading with the driver idle
+const uint16_t RATED = 3100;
+
+// The station's filter (LOAD_DECIMATION, LOAD_SMOOTHING_SHIFT), calibrated for the capture
+const LoadFilter::Config FILTER = { 64, 4, OFFSET, RATED };
+const double OUTPUT_RATE = RATE / 64;  // 312.5 Hz
+
+std::vector<uint16_t> capture;
+
+// LoadBench's sample file format: readings separated by commas, spaces or lines, '#' comments
+bool loadCapture(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        char* comment = strchr(line, '#');
+        if (comment != nullptr) {
+            *comment = '\0';
+        }
+        for (char* token = strtok(line, " ,;\t\r\n"); token != nullptr; token = strtok(nullptr, " ,;\t\r\n")) {
+            capture.push_back((uint16_t)atoi(token));
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+// Beside this file, wherever the test runs from
+std::string capturePath() {
+    std::string path = __FILE__;
+    size_t slash = path.find_last_of("/\\");
+    return (slash == std::string::npos ? std::string() : path.substr(0, slash + 1)) + "load_capture.txt";
+}
+
+// The capture through the filter a decimation block at a time; the load or Q16 level after
+// every output
+void run(LoadFilter& filter, std::vector<uint16_t>* loads, std::vector<uint32_t>* levels) {
+    size_t block = filter.getConfig().decimation;
+    for (size_t i = 0; i + block <= capture.size(); i += block) {
+        TEST_ASSERT_EQUAL(1, filter.push(&capture[i], block));
+        if (loads != nullptr) {
+            loads->push_back(filter.loadTenths());
+        }
+        if (levels != nullptr) {
+            levels->push_back(filter.levelQ16());
+        }
+    }
+}
+
+size_t outputAt(double seconds) {
+    return (size_t)(seconds * OUTPUT_RATE);
+}
+
+int millis(size_t outputs) {
+    return (int)(outputs * 1000.0 / OUTPUT_RATE + 0.5);
+}
+
+// Outputs after `from` until the load first gets past `fraction` of the way from `low` to `high`
+size_t reach(const std::vector<uint16_t>& loads, size_t from, double low, double high, double fraction) {
+    double mark = low + (high - low) * fraction;
+    for (size_t i = from; i < loads.size(); i++) {
+        if (high > low ? loads[i] >= mark : loads[i] <= mark) {
+            return i - from;
+        }
+    }
+    return loads.size();
+}
+
+// Outputs after `from` until the load stays within `band` of `target` up to `to`
+size_t settle(const std::vector<uint16_t>& loads, size_t from, size_t to, int target, int band) {
+    size_t last = from;
+    for (size_t i = from; i < to; i++) {
+        if (abs((int)loads[i] - target) > band) {
+            last = i + 1;
+        }
+    }
+    return last - from;
+}
+
+int peakToPeak(const std::vector<uint16_t>& loads, size_t from, size_t to) {
+    uint16_t low = 0xFFFF;
+    uint16_t high = 0;
+    for (size_t i = from; i < to; i++) {
+        low = loads[i] < low ? loads[i] : low;
+        high = loads[i] > high ? loads[i] : high;
+    }
+    return high - low;
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_capture_is_the_one_described() {
+    TEST_ASSERT_EQUAL((size_t)(RATE * END), capture.size());
+}
+
+// 10-90 % in about 2.2 IIR time constants (16 outputs, 51 ms) plus up to a block of delay
+void test_step_response() {
+    LoadFilter filter;
+    filter.configure(FILTER);
+    std::vector<uint16_t> loads;
+    run(filter, &loads, nullptr);
+
+    size_t up = outputAt(RATED_AT);
+    int rise = millis(reach(loads, up, 0, 1000, 0.9) - reach(loads, up, 0, 1000, 0.1));
+    TEST_ASSERT_INT_WITHIN(15, 113, rise);
+
+    size_t down = outputAt(PARTIAL_AT);
+    int fall = millis(reach(loads, down, 1000, 400, 0.9) - reach(loads, down, 1000, 400, 0.1));
+    TEST_ASSERT_INT_WITHIN(15, 113, fall);
+}
+
+// Within 1 % of the new load in under 5 time constants, and staying there
+void test_settling_time() {
+    LoadFilter filter;
+    filter.configure(FILTER);
+    std::vector<uint16_t> loads;
+    run(filter, &loads, nullptr);
+
+    TEST_ASSERT_LESS_OR_EQUAL(260, millis(settle(loads, outputAt(RATED_AT), outputAt(PARTIAL_AT), 1000, 10)));
+    TEST_ASSERT_LESS_OR_EQUAL(260, millis(settle(loads, outputAt(PARTIAL_AT), loads.size(), 400, 10)));
+}
+
+// The 1 kHz chopper ripple (+-200 raw, 13 % of rated current) and the noise leave under
+// 1 % peak to peak once settled
+void test_residual_ripple() {
+    LoadFilter filter;
+    filter.configure(FILTER);
+    std::vector<uint16_t> loads;
+    run(filter, &loads, nullptr);
+
+    size_t window = outputAt(0.1);
+    TEST_ASSERT_LESS_OR_EQUAL(10, peakToPeak(loads, outputAt(RATED_AT) - window, outputAt(RATED_AT)));
+    TEST_ASSERT_LESS_OR_EQUAL(10, peakToPeak(loads, outputAt(PARTIAL_AT) - window, outputAt(PARTIAL_AT)));
+    TEST_ASSERT_LESS_OR_EQUAL(10, peakToPeak(loads, loads.size() - window, loads.size()));
+}
+
+// Zero and full taken from the filtered idle and rated stretches, the way a board is
+// calibrated; the partial stretch then reads 40 %
+void test_calibration_from_the_capture() {
+    LoadFilter filter;
+    LoadFilter::Config uncalibrated = { FILTER.decimation, FILTER.smoothingShift, 0, 4095 };
+    filter.configure(uncalibrated);
+    std::vector<uint32_t> levels;
+    run(filter, nullptr, &levels);
+
+    uint16_t zero = (uint16_t)((levels[outputAt(RATED_AT) - 1] + 0x8000) >> 16);
+    uint16_t full = (uint16_t)((levels[outputAt(PARTIAL_AT) - 1] + 0x8000) >> 16);
+    TEST_ASSERT_INT_WITHIN(5, OFFSET, zero);
+    TEST_ASSERT_INT_WITHIN(15, RATED, full);
+
+    filter.setCalibration(zero, full);
+    TEST_ASSERT_INT_WITHIN(10, 400, filter.loadTenths());
+}
+
+// The load task pushes whole DMA frames; the outputs don't depend on the frame size
+void test_frames_of_any_size_filter_the_same() {
+    LoadFilter blocks;
+    blocks.configure(FILTER);
+    run(blocks, nullptr, nullptr);
+
+    const size_t FRAMES[] = { 1, 37, 256, 1000 };
+    for (size_t frame : FRAMES) {
+        LoadFilter filter;
+        filter.configure(FILTER);
+        for (size_t i = 0; i < capture.size(); i += frame) {
+            filter.push(&capture[i], capture.size() - i < frame ? capture.size() - i : frame);
+        }
+        TEST_ASSERT_EQUAL(blocks.outputCount(), filter.outputCount());
+        TEST_ASSERT_EQUAL(blocks.levelQ16(), filter.levelQ16());
+    }
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    if (!loadCapture(capturePath().c_str())) {
+        printf("Cannot read %s\n", capturePath().c_str());
+    }
+    RUN_TEST(test_capture_is_the_one_described);
+    RUN_TEST(test_step_response);
+    RUN_TEST(test_settling_time);
+    RUN_TEST(test_residual_ripple);
+    RUN_TEST(test_calibration_from_the_capture);
+    RUN_TEST(test_frames_of_any_size_filter_the_same);
+    return UNITY_END();
+}
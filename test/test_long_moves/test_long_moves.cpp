@@ -0,0 +1,123 @@
+// Multi-hour moves on the virtual clock (pio test -e native): rotation moves must land on
+// their exact step count and timed ones on the count their duration plans, with the cruise
+// rate held to the requested RPM over millions of steps rather than drifting with them.
+#include "StationHarness.h"
+#include "MotionPlanner.h"
+#include "SpeedTable.h"
+
+namespace {
+
+const long STEPS_PER_REV = 3200;   // DEFAULT_AXIS: 200 x 1/16
+const uint32_t UPDATE_MICROS = 10000;  // The motion task is run every 10 ms of virtual time
+
+uint64_t hours(double count) {
+    return (uint64_t)(count * 3600e6);
+}
+
+// Cruise interval of an RPM in Q32 microseconds
+uint64_t cruiseQ32(double rpm) {
+    return (uint64_t)(60e6 / (rpm * STEPS_PER_REV) * 4294967296.0);
+}
+
+// Steps a timed move at rpm plans for its duration, on the controller's default ramp
+long plannedSteps(double rpm, int seconds) {
+    MotionPlanner plan;
+    RampConfig ramp = { RampProfile::TRAPEZOIDAL, SpeedTable::RAMP_ACCEL, 0, SpeedTable::RAMP_START_RATE };
+    plan.setConfig(ramp);
+    plan.plan(cruiseQ32(rpm), 0);
+    return (long)plan.stepsForDuration((uint64_t)seconds * 1000000ULL);
+}
+
+// Time between pulses first and last, against what the cruise interval makes it
+double cruiseError(long first, long last, double rpm) {
+    uint64_t span = motor->timer().pulseTime(last) - motor->timer().pulseTime(first);
+    return (double)span - (last - first) * 60e6 / (rpm * STEPS_PER_REV);
+}
+
+}  // namespace
+
+void setUp() {
+    startStation(1, UPDATE_MICROS);
+}
+
+void tearDown() {
+    stopStation();
+}
+
+void test_two_hour_rotation_at_60_rpm() {
+    const int ROTATIONS = 7200;
+    motor->executeRotation(60, ROTATIONS);
+    TEST_ASSERT_TRUE(runToEnd(hours(2.1)));
+    TEST_ASSERT_EQUAL(ROTATIONS * STEPS_PER_REV, motor->timer().recordedPulses());
+    TEST_ASSERT_EQUAL(ROTATIONS * STEPS_PER_REV, motor->timer().netSteps());
+    TEST_ASSERT_EQUAL(ROTATIONS * STEPS_PER_REV, motor->position());
+}
+
+void test_two_hour_rotation_at_7_rpm() {
+    // 8.57 s a revolution: 2 h is 840 rotations, 2.69 M steps at 2678.57 us each
+    const int ROTATIONS = 840;
+    motor->executeRotation(7, ROTATIONS);
+    TEST_ASSERT_TRUE(runToEnd(hours(2.1)));
+    long total = ROTATIONS * STEPS_PER_REV;
+    TEST_ASSERT_EQUAL(total, motor->timer().recordedPulses());
+    TEST_ASSERT_EQUAL(total, motor->position());
+    // Within the last 65536 recorded pulses, still exactly at the requested rate
+    TEST_ASSERT_DOUBLE_WITHIN(1.0, 0.0, cruiseError(total - 60000, total - 1000, 7));
+}
+
+void test_cruise_at_1000_rpm_does_not_drift() {
+    // 18.75 us a step; whole microseconds would make it 18 and gain 4% in an hour
+    motor->executeRotation(1000, 1000000);
+    for (int hour = 0; hour < 2; hour++) {
+        // Half an hour on, measure the last 60000 steps the timer recorded
+        for (uint64_t t = 0; t < hours(0.5); t += UPDATE_MICROS) {
+            tick();
+        }
+        long last = motor->timer().recordedPulses() - 1;
+        TEST_ASSERT_DOUBLE_WITHIN(1.0, 0.0, cruiseError(last - 60000, last, 1000));
+    }
+    // No step has gone missing between the timer and the controller's count
+    TEST_ASSERT_EQUAL(motor->timer().recordedPulses(), motor->timer().netSteps());
+    TEST_ASSERT_EQUAL(motor->timer().recordedPulses(), motor->position());
+    motor->emergencyStop();
+    tick();
+}
+
+void test_timed_hour_ends_on_its_planned_count() {
+    const int SECONDS = 3600;
+    long planned = plannedSteps(120, SECONDS);
+
+    motor->executeTime(120, SECONDS);
+    tick();
+    TEST_ASSERT_GREATER_THAN(0, motor->timer().recordedPulses());
+    uint64_t firstStep = motor->timer().pulseTime(0);  // Before the record wraps
+    TEST_ASSERT_TRUE(runToEnd(hours(1.1)));
+    long pulses = motor->timer().recordedPulses();
+    TEST_ASSERT_INT32_WITHIN(1, planned, pulses);
+    TEST_ASSERT_EQUAL(pulses, motor->position());
+
+    // The run, first step to last, takes the hour to within the ramp estimate
+    uint64_t ran = motor->timer().pulseTime(pulses - 1) - firstStep;
+    TEST_ASSERT_UINT64_WITHIN(50000, (uint64_t)SECONDS * 1000000ULL, ran);
+}
+
+void test_timed_five_hours_at_30_rpm() {
+    const int SECONDS = 5 * 3600;
+    long planned = plannedSteps(30, SECONDS);
+    motor->executeTime(30, SECONDS);
+    TEST_ASSERT_TRUE(runToEnd(hours(5.1)));
+    TEST_ASSERT_INT32_WITHIN(1, planned, motor->timer().recordedPulses());
+    TEST_ASSERT_EQUAL(motor->timer().recordedPulses(), motor->position());
+    long last = motor->timer().recordedPulses() - 1;
+    TEST_ASSERT_DOUBLE_WITHIN(1.0, 0.0, cruiseError(last - 60000, last - 5000, 30));
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_two_hour_rotation_at_60_rpm);
+    RUN_TEST(test_two_hour_rotation_at_7_rpm);
+    RUN_TEST(test_cruise_at_1000_rpm_does_not_drift);
+    RUN_TEST(test_timed_hour_ends_on_its_planned_count);
+    RUN_TEST(test_timed_five_hours_at_30_rpm);
+    return UNITY_END();
+}
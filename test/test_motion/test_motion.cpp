@@ -0,0 +1,234 @@
+// Rotation and time mode, pause/resume and stop through MotorController on the native
+// build (pio test -e native). Every case runs a fresh controller on SimStepHal against the
+// stepped clock of lib/ArduinoSim, so the steps checked are the real step ISR's.
+#include "StationHarness.h"
+
+namespace {
+
+const long STEPS_PER_REV = 3200;  // DEFAULT_AXIS: 200 x 1/16
+
+// ENA is active low on the TB6600
+bool driverEnabled() {
+    return !motor->timer().enabled();
+}
+
+}  // namespace
+
+void setUp() {
+    startStation();
+}
+
+void tearDown() {
+    stopStation();
+}
+
+void test_rotation_makes_exact_steps_and_reports_turns() {
+    motor->executeRotation(300, 3);
+    TEST_ASSERT_TRUE(motor->isMotorRunning());
+    TEST_ASSERT_EQUAL(MotorState::ROTATING, motor->state());
+    TEST_ASSERT_TRUE(driverEnabled());
+
+    TEST_ASSERT_TRUE(runToEnd());
+    TEST_ASSERT_EQUAL(3 * STEPS_PER_REV, motor->timer().recordedPulses());
+    TEST_ASSERT_EQUAL(3 * STEPS_PER_REV, motor->position());
+    TEST_ASSERT_TRUE(sent("TURN:1"));
+    TEST_ASSERT_TRUE(sent("TURN:2"));
+    TEST_ASSERT_TRUE(sent("TURN:3"));
+    TEST_ASSERT_FALSE(sent("TURN:4"));
+    TEST_ASSERT_TRUE(output.find("TURN:3\r\nDONE\r\n") != std::string::npos);
+    TEST_ASSERT_EQUAL(MotorState::DONE, motor->state());
+    TEST_ASSERT_FALSE(driverEnabled());
+}
+
+void test_rotation_counterclockwise_counts_down() {
+    motor->executeRotation(120, 1, false);
+    TEST_ASSERT_TRUE(runToEnd());
+    TEST_ASSERT_EQUAL(-STEPS_PER_REV, motor->position());
+    TEST_ASSERT_TRUE(motor->timer().dir());  // DIR high is CCW
+    TEST_ASSERT_TRUE(sent("DONE"));
+}
+
+void test_rotation_cruises_at_its_rpm() {
+    // 120 RPM is 6400 steps/s, 156.25 us a step once the 1280 step ramp is over
+    motor->executeRotation(120, 4);
+    TEST_ASSERT_TRUE(runToEnd());
+    SimStepHal& timer = motor->timer();
+    long middle = 2 * STEPS_PER_REV;
+    uint64_t span = timer.pulseTime(middle + 640) - timer.pulseTime(middle);
+    TEST_ASSERT_UINT64_WITHIN(2, 100000, span);
+}
+
+void test_speed_level_rotation_finishes() {
+    motor->executeRotationWithSpeed(10, 2);
+    TEST_ASSERT_TRUE(runToEnd());
+    TEST_ASSERT_EQUAL(2 * STEPS_PER_REV, motor->position());
+    TEST_ASSERT_TRUE(sent("DONE"));
+}
+
+void test_time_mode_runs_for_its_duration() {
+    uint64_t start = Sim::now();
+    motor->executeTime(120, 2);
+    TEST_ASSERT_EQUAL(MotorState::TIME_MODE, motor->state());
+    TEST_ASSERT_TRUE(runToEnd());
+    uint64_t lastStep = motor->timer().pulseTime(motor->timer().recordedPulses() - 1);
+
+    // The settle delay before the first step is not running time
+    TEST_ASSERT_UINT64_WITHIN(20000, start + 2000000 + 10000, lastStep);
+    TEST_ASSERT_TRUE(sent("TURN:1"));
+    TEST_ASSERT_TRUE(sent("DONE"));
+    TEST_ASSERT_EQUAL(MotorState::DONE, motor->state());
+}
+
+void test_pause_ramps_down_and_resume_finishes_the_rotation() {
+    motor->executeRotation(300, 3);
+    runFor(300);
+    motor->pause();
+    TEST_ASSERT_EQUAL(MotorState::PAUSED, motor->state());
+
+    runFor(500);  // Down to rest, then standing still
+    long paused = motor->timer().recordedPulses();
+    TEST_ASSERT_GREATER_THAN(0, paused);
+    TEST_ASSERT_LESS_THAN(3 * STEPS_PER_REV, paused);
+    runFor(300);
+    TEST_ASSERT_EQUAL(paused, motor->timer().recordedPulses());
+    TEST_ASSERT_TRUE(motor->isMotorPaused());
+    TEST_ASSERT_TRUE(driverEnabled());  // Holding torque while paused
+
+    motor->resume();
+    TEST_ASSERT_EQUAL(MotorState::ROTATING, motor->state());
+    TEST_ASSERT_TRUE(runToEnd());
+    TEST_ASSERT_EQUAL(3 * STEPS_PER_REV, motor->timer().recordedPulses());
+    TEST_ASSERT_TRUE(sent("TURN:3"));
+    TEST_ASSERT_TRUE(sent("DONE"));
+}
+
+void test_resume_while_ramping_down_loses_no_steps() {
+    motor->executeRotation(300, 2);
+    runFor(250);
+    motor->pause();
+    runFor(5);
+    motor->resume();
+    TEST_ASSERT_TRUE(runToEnd());
+    TEST_ASSERT_EQUAL(2 * STEPS_PER_REV, motor->position());
+    TEST_ASSERT_TRUE(sent("DONE"));
+}
+
+void test_paused_time_mode_keeps_its_running_time() {
+    uint64_t start = Sim::now();
+    motor->executeTime(120, 2);
+    runFor(500);
+    motor->pause();
+    runFor(1000);
+    long paused = motor->timer().recordedPulses();
+    uint64_t rest = Sim::now() - motor->timer().pulseTime(paused - 1);
+    motor->resume();
+    TEST_ASSERT_TRUE(runToEnd());
+
+    // Running time is the time stepping (ramps included) plus the time spent ramping up
+    // again from rest, about one start interval
+    uint64_t lastStep = motor->timer().pulseTime(motor->timer().recordedPulses() - 1);
+    TEST_ASSERT_UINT64_WITHIN(40000, start + 2000000 + 10000 + rest, lastStep);
+    TEST_ASSERT_TRUE(sent("DONE"));
+}
+
+void test_stop_ramps_down_and_disables_the_driver() {
+    motor->executeRotation(300, 5);
+    runFor(400);
+    motor->stop();
+    TEST_ASSERT_EQUAL(MotorState::STOPPING, motor->state());
+    TEST_ASSERT_TRUE(motor->isMotorRunning());
+
+    TEST_ASSERT_TRUE(runToEnd());
+    TEST_ASSERT_EQUAL(MotorState::STOPPED, motor->state());
+    TEST_ASSERT_FALSE(driverEnabled());
+    long stopped = motor->timer().recordedPulses();
+    TEST_ASSERT_LESS_THAN(5 * STEPS_PER_REV, stopped);
+    TEST_ASSERT_FALSE(sent("DONE"));
+
+    // The last steps came down to the 320 steps/s rest speed, about 3 ms apart
+    SimStepHal& timer = motor->timer();
+    TEST_ASSERT_GREATER_THAN(1000, timer.pulseTime(stopped - 1) - timer.pulseTime(stopped - 2));
+    runFor(100);
+    TEST_ASSERT_EQUAL(stopped, motor->timer().recordedPulses());
+}
+
+void test_emergency_stop_halts_at_once() {
+    motor->executeRotation(300, 5);
+    runFor(400);
+    long before = motor->timer().recordedPulses();
+    motor->emergencyStop();
+    TEST_ASSERT_EQUAL(MotorState::STOPPED, motor->state());
+    TEST_ASSERT_FALSE(motor->isMotorRunning());
+    TEST_ASSERT_FALSE(driverEnabled());
+    runFor(100);
+    TEST_ASSERT_INT_WITHIN(1, before, motor->timer().recordedPulses());
+}
+
+void test_stop_while_paused_ends_the_move() {
+    motor->executeRotation(300, 3);
+    runFor(300);
+    motor->pause();
+    runFor(500);
+    motor->stop();
+    TEST_ASSERT_FALSE(motor->isMotorRunning());
+    TEST_ASSERT_EQUAL(MotorState::STOPPED, motor->state());
+    motor->resume();  // Nothing left to resume
+    runFor(100);
+    TEST_ASSERT_FALSE(motor->isMotorRunning());
+}
+
+void test_new_move_is_ignored_while_one_runs() {
+    motor->executeRotation(300, 1);
+    motor->executeRotation(60, 5, false);
+    TEST_ASSERT_EQUAL(300, motor->rpm());
+    TEST_ASSERT_TRUE(runToEnd());
+    TEST_ASSERT_EQUAL(STEPS_PER_REV, motor->position());
+}
+
+void test_moves_without_steps_or_time_are_refused() {
+    motor->executeRotation(300, 0);
+    motor->executeRotation(300, -2);
+    motor->executeRotationWithSpeed(10, 0);
+    motor->executeTime(300, 0);
+    motor->executeTimeWithSpeed(10, -1);
+    TEST_ASSERT_FALSE(motor->isMotorRunning());
+    runFor(100);
+    TEST_ASSERT_EQUAL(0, motor->timer().recordedPulses());
+    TEST_ASSERT_FALSE(driverEnabled());
+
+    // And the station still takes the next move
+    motor->executeRotation(300, 1);
+    TEST_ASSERT_TRUE(runToEnd());
+    TEST_ASSERT_EQUAL(STEPS_PER_REV, motor->position());
+}
+
+void test_status_line_follows_the_move() {
+    TextBuffer<OutMessage::MAX_TEXT + 1> status;
+    motor->executeRotation(300, 2);
+    runFor(10);
+    motor->getStatus(status);
+    TEST_ASSERT_EQUAL_STRING_LEN("ROTATING RPM:300 COMPLETED:0/2", status.c_str(), 30);
+    TEST_ASSERT_TRUE(runToEnd());
+    status.clear();
+    motor->getStatus(status);
+    TEST_ASSERT_EQUAL_STRING("DONE", status.c_str());
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_rotation_makes_exact_steps_and_reports_turns);
+    RUN_TEST(test_rotation_counterclockwise_counts_down);
+    RUN_TEST(test_rotation_cruises_at_its_rpm);
+    RUN_TEST(test_speed_level_rotation_finishes);
+    RUN_TEST(test_time_mode_runs_for_its_duration);
+    RUN_TEST(test_pause_ramps_down_and_resume_finishes_the_rotation);
+    RUN_TEST(test_resume_while_ramping_down_loses_no_steps);
+    RUN_TEST(test_paused_time_mode_keeps_its_running_time);
+    RUN_TEST(test_stop_ramps_down_and_disables_the_driver);
+    RUN_TEST(test_emergency_stop_halts_at_once);
+    RUN_TEST(test_stop_while_paused_ends_the_move);
+    RUN_TEST(test_new_move_is_ignored_while_one_runs);
+    RUN_TEST(test_moves_without_steps_or_time_are_refused);
+    RUN_TEST(test_status_line_follows_the_move);
+    return UNITY_END();
+}
@@ -0,0 +1,167 @@
+// Motion queue (pio test -e native): overflow and rejection, acknowledgments, and the step
+// count of every segment across blended and reversing boundaries, on SimStepHal.
+#include <vector>
+#include "StationHarness.h"
+
+namespace {
+
+const long STEPS_PER_REV = 3200;  // DEFAULT_AXIS: 200 x 1/16
+const int CAPACITY = 16;          // MotionQueue
+
+std::vector<long> turningPoints;  // Net position wherever the direction reversed
+long lastPosition;
+int lastDirection;
+
+// After every pass
+void trackDirection() {
+    long position = motor->timer().netSteps();
+    int direction = position > lastPosition ? 1 : position < lastPosition ? -1 : 0;
+    if (direction != 0) {
+        if (lastDirection != 0 && direction != lastDirection) {
+            turningPoints.push_back(lastPosition);
+        }
+        lastDirection = direction;
+    }
+    lastPosition = position;
+}
+
+// Until the last queued segment has run
+bool runQueue() {
+    return runWhile([] { return motor->isMotorRunning() || motor->queueDepth() > 0; });
+}
+
+size_t occurrences(const std::string& line) {
+    size_t count = 0;
+    for (size_t at = output.find(line + "\r\n"); at != std::string::npos; at = output.find(line + "\r\n", at + 1)) {
+        count++;
+    }
+    return count;
+}
+
+}  // namespace
+
+void setUp() {
+    turningPoints.clear();
+    lastPosition = 0;
+    lastDirection = 0;
+    startStation();
+    afterTick = trackDirection;
+}
+
+void tearDown() {
+    stopStation();
+}
+
+void test_queue_overflow_is_refused_and_the_rest_run() {
+    for (int i = 1; i <= CAPACITY; i++) {
+        TEST_ASSERT_EQUAL(i, motor->enqueueRotation(300, 0, 1, true));
+        TEST_ASSERT_EQUAL(CAPACITY - i, motor->queueSpace());
+    }
+    TEST_ASSERT_EQUAL(0, motor->enqueueRotation(300, 0, 1, true));
+    TEST_ASSERT_EQUAL(0, motor->enqueueTime(300, 0, 1, true));
+    TEST_ASSERT_EQUAL(CAPACITY, motor->queueDepth());
+
+    TEST_ASSERT_TRUE(runQueue());
+    TEST_ASSERT_EQUAL(CAPACITY * STEPS_PER_REV, motor->position());
+    TEST_ASSERT_EQUAL(CAPACITY * STEPS_PER_REV, motor->timer().recordedPulses());
+    // Each acknowledgment counts the slots of the done and the staged segment
+    for (int i = 1; i <= CAPACITY; i++) {
+        int free = i + 1 < CAPACITY ? i + 1 : CAPACITY;
+        TEST_ASSERT_EQUAL(1, (int)occurrences("SEGDONE:" + std::to_string(i) + " FREE:" + std::to_string(free)));
+    }
+    TEST_ASSERT_EQUAL(1, (int)occurrences("DONE"));
+    TEST_ASSERT_TRUE(output.find("SEGDONE:16 FREE:16\r\nDONE\r\n") != std::string::npos);
+}
+
+void test_freed_slots_take_new_segments() {
+    for (int i = 0; i < CAPACITY; i++) {
+        motor->enqueueRotation(300, 0, 1, true);
+    }
+    // The first segment leaves the queue once it starts, the second once it is staged
+    for (int i = 0; i < 50 && motor->queueSpace() == 0; i++) {
+        tick();
+    }
+    TEST_ASSERT_EQUAL(2, motor->queueSpace());
+    TEST_ASSERT_EQUAL(CAPACITY + 1, motor->enqueueRotation(300, 0, 1, true));
+    TEST_ASSERT_EQUAL(CAPACITY + 2, motor->enqueueRotation(300, 0, 1, true));
+    TEST_ASSERT_EQUAL(0, motor->enqueueRotation(300, 0, 1, true));
+    TEST_ASSERT_TRUE(runQueue());
+    TEST_ASSERT_EQUAL((CAPACITY + 2) * STEPS_PER_REV, motor->position());
+    TEST_ASSERT_TRUE(sent("SEGDONE:18 FREE:16"));
+}
+
+void test_segment_without_steps_is_rejected_not_full() {
+    TEST_ASSERT_EQUAL(0, motor->enqueueRotation(300, 0, 0, true));
+    TEST_ASSERT_EQUAL(0, motor->enqueueRotation(300, 0, -3, true));
+    TEST_ASSERT_EQUAL(0, motor->enqueueRotation(300, 21, 1, true));  // No such speed level
+    TEST_ASSERT_EQUAL(CAPACITY, motor->queueSpace());
+    runQueue();
+    TEST_ASSERT_EQUAL(0, motor->timer().recordedPulses());
+}
+
+void test_every_segment_makes_its_steps_across_reversals() {
+    // Each reversal stops at rest, so the position there is the sum of the segments so far
+    motor->enqueueRotation(120, 0, 2, true);
+    motor->enqueueRotation(60, 0, 1, false);
+    motor->enqueueRotation(0, 20, 3, true);   // Speed level 20
+    motor->enqueueTime(120, 0, 1, false);     // 1 s at 6400 steps/s
+    TEST_ASSERT_TRUE(runQueue());
+
+    TEST_ASSERT_EQUAL(3, (int)turningPoints.size());
+    TEST_ASSERT_EQUAL(2 * STEPS_PER_REV, turningPoints[0]);
+    TEST_ASSERT_EQUAL(1 * STEPS_PER_REV, turningPoints[1]);
+    TEST_ASSERT_EQUAL(4 * STEPS_PER_REV, turningPoints[2]);
+    TEST_ASSERT_EQUAL(4 * STEPS_PER_REV - 6400, motor->position());
+    TEST_ASSERT_EQUAL(motor->position(), motor->timer().netSteps());
+    TEST_ASSERT_EQUAL((2 + 1 + 3) * STEPS_PER_REV + 6400, motor->timer().recordedPulses());
+    TEST_ASSERT_TRUE(sent("SEGDONE:4 FREE:16"));
+}
+
+void test_same_direction_segments_blend_without_stopping() {
+    // 120 RPM (156.25 us a step) into 60 RPM (312.5 us): the first segment slows to the
+    // second's cruise and hands over at it
+    motor->enqueueRotation(120, 0, 2, true);
+    motor->enqueueRotation(60, 0, 1, true);
+    TEST_ASSERT_TRUE(runQueue());
+    SimStepHal& timer = motor->timer();
+    TEST_ASSERT_EQUAL(3 * STEPS_PER_REV, timer.recordedPulses());
+    TEST_ASSERT_EQUAL(0, (int)turningPoints.size());
+
+    long boundary = 2 * STEPS_PER_REV;
+    uint64_t before = timer.pulseTime(boundary - 1) - timer.pulseTime(boundary - 2);
+    uint64_t after = timer.pulseTime(boundary + 1) - timer.pulseTime(boundary);
+    uint64_t cruise = timer.pulseTime(STEPS_PER_REV + 1) - timer.pulseTime(STEPS_PER_REV);
+    TEST_ASSERT_UINT64_WITHIN(1, 156, cruise);
+    TEST_ASSERT_UINT64_WITHIN(1, 312, before);
+    TEST_ASSERT_UINT64_WITHIN(1, 312, after);  // Nowhere near a stop (3125 us)
+    uint64_t span = timer.pulseTime(boundary + 2000) - timer.pulseTime(boundary + 1000);
+    TEST_ASSERT_UINT64_WITHIN(2, 312500, span);
+    TEST_ASSERT_EQUAL(1, (int)occurrences("DONE"));
+}
+
+void test_flush_drops_pending_segments() {
+    for (int i = 0; i < 6; i++) {
+        motor->enqueueRotation(300, 0, 1, true);
+    }
+    for (int i = 0; i < 100; i++) {
+        tick();
+    }
+    motor->flushQueue();
+    TEST_ASSERT_LESS_OR_EQUAL(1, motor->queueDepth());  // A segment already blended into stays
+    TEST_ASSERT_TRUE(runQueue());
+    long position = motor->position();
+    TEST_ASSERT_EQUAL(0, position % STEPS_PER_REV);
+    TEST_ASSERT_LESS_THAN(6 * STEPS_PER_REV, position);
+    TEST_ASSERT_EQUAL(position, motor->timer().recordedPulses());
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_queue_overflow_is_refused_and_the_rest_run);
+    RUN_TEST(test_freed_slots_take_new_segments);
+    RUN_TEST(test_segment_without_steps_is_rejected_not_full);
+    RUN_TEST(test_every_segment_makes_its_steps_across_reversals);
+    RUN_TEST(test_same_direction_segments_blend_without_stopping);
+    RUN_TEST(test_flush_drops_pending_segments);
+    return UNITY_END();
+}
@@ -0,0 +1,234 @@
+// Pause, stop and emergency stop under random timing (pio test -e native), the checks of
+// bench/PauseBench.cpp on a fixed seed: moves of every kind and ramp profile are paused at
+// random, resumed after a rest or while still ramping down, or ended with stop() or
+// emergencyStop(), and every STEP edge is followed. The speed must ramp rather than jump,
+// come down to rest speed before every standstill and start from it after, and rotations
+// and queued segments must make their exact count and timed moves last their time.
+#include <math.h>
+#include <random>
+#include "StationHarness.h"
+
+namespace {
+
+const long STEPS_PER_REV = 3200;               // DEFAULT_AXIS: 200 x 1/16
+const uint32_t RAMP_ACCEL = SpeedTable::RAMP_ACCEL;  // Default ramp, so speed levels use their tables
+const uint32_t RAMP_JERK = 160000;
+const double REST_INTERVAL = 1e6 / SpeedTable::RAMP_START_RATE;  // us, first and last step
+const double STANDSTILL = 1.01 * REST_INTERVAL;  // Longer gaps between steps are rests
+const double JUMP_SLACK_US = 2.0;              // Whole-microsecond rounding of two intervals
+const double JUMP_MARGIN = 1.25;               // The integrator steps at the mean velocity
+const double END_LIMIT = 2.0;                  // Steps next to a rest at most this much above rest speed
+const double TIME_TOLERANCE = 0.02;
+const int MOVES = 4;                           // Per case
+const uint32_t SEED = 1;
+
+enum MoveKind { ROTATION_RPM, ROTATION_LEVEL, TIMED_RPM, TIMED_LEVEL, QUEUED };
+
+std::mt19937 rng;
+
+long uniform(long low, long high) {
+    return std::uniform_int_distribution<long>(low, high)(rng);
+}
+
+// The STEP rising edges of one move as they are recorded (the simulation keeps a ring of
+// them, too short for a whole move)
+struct PulseCheck {
+    long seen;
+    long steps;
+    uint64_t first;
+    uint64_t last;
+    double lastInterval;  // 0 before the first interval and after a standstill
+    double restTime;      // Standstills, less the start interval that follows each
+    double worstJump;     // Share of the allowed interval change
+    double worstRest;     // Speed next to a standstill over rest speed
+};
+
+PulseCheck check;
+
+void rest(double interval) {
+    check.worstRest = fmax(check.worstRest, REST_INTERVAL / interval);
+}
+
+void followPulses() {
+    SimStepHal& timer = motor->timer();
+    for (long recorded = timer.recordedPulses(); check.seen < recorded; check.seen++) {
+        uint64_t pulse = timer.pulseTime(check.seen);
+        if (check.steps == 0) {
+            check.first = pulse;
+        } else {
+            double interval = (double)(pulse - check.last);
+            if (interval > STANDSTILL) {
+                // Stood still: it must have come down to rest speed first
+                if (check.lastInterval > 0) {
+                    rest(check.lastInterval);
+                }
+                check.restTime += interval - REST_INTERVAL;
+                check.lastInterval = 0;
+            } else if (check.lastInterval == 0) {
+                rest(interval);
+                check.lastInterval = interval;
+            } else {
+                double longer = fmax(check.lastInterval, interval);
+                // dt = 1 / v, so one step changes it by a * dt^3 at acceleration a
+                double allowed = JUMP_MARGIN * RAMP_ACCEL * longer * longer * longer * 1e-12;
+                double change = fabs(interval - check.lastInterval) - JUMP_SLACK_US;
+                check.worstJump = fmax(check.worstJump, change > 0 ? change / allowed : 0);
+                check.lastInterval = interval;
+            }
+        }
+        check.last = pulse;
+        check.steps++;
+    }
+}
+
+// Starts the move; returns the steps it has to make, 0 for timed moves
+long startMove(MoveKind kind, int seconds) {
+    int rotations = (int)uniform(5, 30);
+    switch (kind) {
+        case ROTATION_RPM:
+            motor->executeRotation((int)uniform(30, 600), rotations);
+            break;
+        case ROTATION_LEVEL:
+            motor->executeRotationWithSpeed((int)uniform(14, 20), rotations);
+            break;
+        case TIMED_RPM:
+            motor->executeTime((int)uniform(30, 600), seconds);
+            return 0;
+        case TIMED_LEVEL:
+            motor->executeTimeWithSpeed((int)uniform(14, 20), seconds);
+            return 0;
+        case QUEUED: {
+            // Same direction, so consecutive segments blend at speed
+            long steps = 0;
+            for (long i = uniform(2, 6); i > 0; i--) {
+                rotations = (int)uniform(1, 5);
+                TEST_ASSERT_NOT_EQUAL(0, motor->enqueueRotation((int)uniform(30, 600), 0, rotations));
+                steps += rotations * STEPS_PER_REV;
+            }
+            tick();  // The queue starts from update()
+            return steps;
+        }
+    }
+    return (long)rotations * STEPS_PER_REV;
+}
+
+// One move with something every 50..800 ms: mostly a pause, now and then the end of it
+void runMove(MoveKind kind) {
+    motor->timer().clearPulses();
+    check = PulseCheck();
+    int seconds = (int)uniform(2, 6);
+    long steps = startMove(kind, seconds);
+
+    uint64_t start = Sim::now();
+    uint64_t nextAction = start + (uint64_t)uniform(50, 800) * 1000;
+    uint64_t resumeAt = 0;
+    bool stopped = false;
+    bool emergency = false;
+    while (motor->isMotorRunning()) {
+        TEST_ASSERT_TRUE(Sim::now() - start < MAX_MOVE_MICROS);
+        if (motor->isMotorPaused()) {
+            if (Sim::now() >= resumeAt) {
+                motor->resume();
+                nextAction = Sim::now() + (uint64_t)uniform(50, 800) * 1000;
+            }
+        } else if (!stopped && Sim::now() >= nextAction) {
+            long action = uniform(0, 19);
+            if (action < 16) {
+                motor->pause();
+                // One in three resumes while it is still ramping down
+                long restMs = uniform(0, 2) == 0 ? uniform(0, 5) : uniform(20, 300);
+                resumeAt = Sim::now() + (uint64_t)restMs * 1000;
+            } else if (action < 18) {
+                motor->stop();
+                stopped = true;
+            } else {
+                followPulses();
+                long before = motor->timer().recordedPulses();
+                motor->emergencyStop();
+                stopped = true;
+                emergency = true;
+                TEST_ASSERT_FALSE(motor->isMotorRunning());
+                runFor(5);
+                TEST_ASSERT_LESS_OR_EQUAL(1, motor->timer().recordedPulses() - before);  // The step under way
+                check.seen = motor->timer().recordedPulses();  // It halted at speed, on purpose
+                check.lastInterval = 0;
+            }
+        }
+        tick();
+    }
+    runFor(5);  // Nothing may follow the end of the move
+
+    if (!emergency && check.lastInterval > 0) {
+        rest(check.lastInterval);
+    }
+    TEST_ASSERT_TRUE(check.worstJump <= 1.0);       // Ramped
+    TEST_ASSERT_TRUE(check.worstRest <= END_LIMIT);  // Stopped and started from rest speed
+    if (!stopped && steps > 0) {
+        TEST_ASSERT_EQUAL(steps, check.steps);
+    }
+    if (!stopped && steps == 0 && check.steps >= 2) {
+        // The first step comes one interval after the start, like the last one before the end
+        double running = (check.last - check.first - check.restTime) / 1e6;
+        TEST_ASSERT_DOUBLE_WITHIN(TIME_TOLERANCE * seconds, seconds, running);
+    }
+}
+
+void runMoves(MoveKind kind, RampProfile profile) {
+    motor->setRamp(profile, RAMP_ACCEL, RAMP_JERK);
+    for (int i = 0; i < MOVES; i++) {
+        runMove(kind);
+    }
+}
+
+}  // namespace
+
+void setUp() {
+    rng.seed(SEED);
+    startStation();
+    motor->timer().setAlarmLatency(2);  // Constant, so the intervals stay exact
+    afterTick = followPulses;
+}
+
+void tearDown() {
+    stopStation();
+}
+
+void test_rotations_at_an_rpm() {
+    runMoves(ROTATION_RPM, RampProfile::TRAPEZOIDAL);
+}
+
+void test_rotations_at_a_speed_level() {
+    runMoves(ROTATION_LEVEL, RampProfile::TRAPEZOIDAL);  // Ramp tables
+}
+
+void test_rotations_on_an_s_curve() {
+    runMoves(ROTATION_RPM, RampProfile::SCURVE);
+}
+
+void test_timed_moves_at_an_rpm() {
+    runMoves(TIMED_RPM, RampProfile::TRAPEZOIDAL);
+}
+
+void test_timed_moves_at_a_speed_level() {
+    runMoves(TIMED_LEVEL, RampProfile::TRAPEZOIDAL);
+}
+
+void test_timed_moves_on_an_s_curve() {
+    runMoves(TIMED_RPM, RampProfile::SCURVE);
+}
+
+void test_queued_segments() {
+    runMoves(QUEUED, RampProfile::TRAPEZOIDAL);  // Blended
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_rotations_at_an_rpm);
+    RUN_TEST(test_rotations_at_a_speed_level);
+    RUN_TEST(test_rotations_on_an_s_curve);
+    RUN_TEST(test_timed_moves_at_an_rpm);
+    RUN_TEST(test_timed_moves_at_a_speed_level);
+    RUN_TEST(test_timed_moves_on_an_s_curve);
+    RUN_TEST(test_queued_segments);
+    return UNITY_END();
+}
@@ -0,0 +1,225 @@
+// MotionPlanner on its own (pio test -e native): every profile ends on its step count,
+// ramps stay within the configured acceleration and jerk, the decel lands on the start
+// speed, and requestDecel()/retarget() keep the count they promise.
+#include <unity.h>
+#include <math.h>
+#include <vector>
+#include "MotionPlanner.h"
+
+namespace {
+
+const uint32_t ACCEL = 16000;    // steps/s^2
+const uint32_t JERK = 160000;    // steps/s^3
+const uint32_t START_RATE = 320; // steps/s
+
+MotionPlanner planner;
+
+struct Step {
+    uint32_t interval;  // us, as emitted
+    double seconds;     // exact interval, before rounding
+    double rate;        // steps/s
+};
+
+void configure(RampProfile profile) {
+    RampConfig config = { profile, ACCEL, JERK, START_RATE };
+    planner.setConfig(config);
+}
+
+uint64_t q32(double micros) {
+    return (uint64_t)(micros * 4294967296.0);
+}
+
+// Runs the planner to the end, as the step ISR would; stops at limit in case it never ends
+std::vector<Step> drain(long limit = 10000000) {
+    std::vector<Step> steps;
+    uint32_t interval;
+    while ((interval = planner.nextInterval()) != 0 && (long)steps.size() < limit) {
+        double seconds = planner.lastIntervalQ8() / 256e6;
+        steps.push_back({ interval, seconds, 1 / seconds });
+    }
+    return steps;
+}
+
+// A move starts and ends within two steps' acceleration of the start rate
+bool nearRest(double rate) {
+    return rate >= START_RATE * 0.99 && rate <= sqrt((double)START_RATE * START_RATE + 4.0 * ACCEL);
+}
+
+// Largest |dv/dt|, steps/s^2. The Q8 intervals resolve the speed to about a step/s at
+// 20000 steps/s, as much as one step adds, so it is measured over WINDOW steps
+double peakAccel(const std::vector<Step>& steps) {
+    const size_t WINDOW = 64;
+    double peak = 0;
+    double seconds = 0;  // steps (i - WINDOW, i]
+    for (size_t i = 1; i < steps.size(); i++) {
+        seconds += steps[i].seconds;
+        if (i > WINDOW) {
+            seconds -= steps[i - WINDOW].seconds;
+        }
+        if (i >= WINDOW) {
+            peak = fmax(peak, fabs(steps[i].rate - steps[i - WINDOW].rate) / seconds);
+        }
+    }
+    return peak;
+}
+
+}  // namespace
+
+void setUp() {
+    planner = MotionPlanner();
+}
+
+void tearDown() {}
+
+void test_every_profile_ends_on_its_step_count() {
+    const RampProfile profiles[] = { RampProfile::NONE, RampProfile::TRAPEZOIDAL, RampProfile::SCURVE };
+    const long lengths[] = { 1, 2, 3, 17, 100, 1999, 3200, 64000 };
+    const double intervals[] = { 18.75, 50, 156.25, 3125 };
+    for (RampProfile profile : profiles) {
+        for (long length : lengths) {
+            for (double micros : intervals) {
+                configure(profile);
+                planner.plan(q32(micros), length);
+                TEST_ASSERT_EQUAL(length, (long)drain().size());
+                TEST_ASSERT_EQUAL(length, planner.stepsIssued());
+                TEST_ASSERT_EQUAL_UINT32(0, planner.nextInterval());
+            }
+        }
+    }
+}
+
+void test_trapezoid_stays_within_its_acceleration() {
+    configure(RampProfile::TRAPEZOIDAL);
+    planner.plan(q32(50), 40000);  // 20000 steps/s
+    std::vector<Step> steps = drain();
+    TEST_ASSERT_EQUAL(40000, (long)steps.size());
+
+    // Starts and stops at the start rate, cruises at 20000 steps/s in between
+    TEST_ASSERT_TRUE(nearRest(steps.front().rate));
+    TEST_ASSERT_TRUE(nearRest(steps.back().rate));
+    TEST_ASSERT_DOUBLE_WITHIN(1, 20000, steps[20000].rate);
+    TEST_ASSERT_LESS_OR_EQUAL(ACCEL * 1.05, peakAccel(steps));
+
+    // 20000^2 / (2 * 16000) = 12500 steps each way
+    long accelSteps = 0;
+    while (steps[accelSteps].rate < 19999) {
+        accelSteps++;
+    }
+    TEST_ASSERT_INT_WITHIN(50, 12500, accelSteps);
+}
+
+void test_scurve_limits_jerk() {
+    configure(RampProfile::SCURVE);
+    planner.plan(q32(50), 40000);
+    std::vector<Step> steps = drain();
+    TEST_ASSERT_EQUAL(40000, (long)steps.size());
+    TEST_ASSERT_LESS_OR_EQUAL(ACCEL * 1.05, peakAccel(steps));
+    TEST_ASSERT_DOUBLE_WITHIN(1, 20000, steps[20000].rate);
+    TEST_ASSERT_TRUE(nearRest(steps.back().rate));
+
+    // Acceleration builds up at no more than the jerk: over the first 20 ms it can reach
+    // at most 0.02 * 160000 = 3200 steps/s^2, where a trapezoid starts at 16000
+    double elapsed = 0;
+    double early = 0;
+    for (size_t i = 1; i < steps.size() && elapsed < 0.02; i++) {
+        elapsed += steps[i].seconds;
+        early = fmax(early, (steps[i].rate - steps[i - 1].rate) / steps[i].seconds);
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(JERK * 0.02 * 1.2, early);
+}
+
+void test_short_move_never_reaches_cruise() {
+    configure(RampProfile::TRAPEZOIDAL);
+    planner.plan(q32(50), 2000);  // 1000 steps up reach about 5660 steps/s
+    std::vector<Step> steps = drain();
+    TEST_ASSERT_EQUAL(2000, (long)steps.size());
+    double peak = 0;
+    for (const Step& step : steps) {
+        peak = fmax(peak, step.rate);
+    }
+    TEST_ASSERT_DOUBLE_WITHIN(200, sqrt(320.0 * 320.0 + 2.0 * ACCEL * 1000), peak);
+    TEST_ASSERT_LESS_OR_EQUAL(ACCEL * 1.05, peakAccel(steps));
+}
+
+void test_cruise_interval_keeps_its_fraction() {
+    configure(RampProfile::NONE);
+    planner.plan(q32(18.75), 64000);
+    uint64_t total = 0;
+    for (const Step& step : drain()) {
+        total += step.interval;
+    }
+    TEST_ASSERT_UINT64_WITHIN(1, 1200000, total);
+}
+
+void test_open_ended_move_stops_after_its_stopping_steps() {
+    configure(RampProfile::TRAPEZOIDAL);
+    planner.plan(q32(100), 0);
+    for (int i = 0; i < 10000; i++) {
+        TEST_ASSERT_NOT_EQUAL(0, planner.nextInterval());
+    }
+    long stopping = planner.stoppingSteps();
+    TEST_ASSERT_GREATER_THAN(0, stopping);
+    planner.requestDecel();
+    std::vector<Step> steps = drain();
+    TEST_ASSERT_INT_WITHIN(1, stopping, (long)steps.size());
+    TEST_ASSERT_TRUE(nearRest(steps.back().rate));
+    TEST_ASSERT_LESS_OR_EQUAL(ACCEL * 1.05, peakAccel(steps));
+}
+
+void test_retarget_changes_speed_and_keeps_the_count() {
+    const RampProfile profiles[] = { RampProfile::TRAPEZOIDAL, RampProfile::SCURVE };
+    for (RampProfile profile : profiles) {
+        configure(profile);
+        planner.plan(q32(100), 60000);  // 10000 steps/s
+        for (int i = 0; i < 8000; i++) {
+            planner.nextInterval();
+        }
+        TEST_ASSERT_TRUE(planner.retarget(q32(50)));
+        std::vector<Step> steps = drain();
+        TEST_ASSERT_EQUAL(52000, (long)steps.size());
+        TEST_ASSERT_DOUBLE_WITHIN(1, 20000, steps[20000].rate);
+        TEST_ASSERT_LESS_OR_EQUAL(ACCEL * 1.05, peakAccel(steps));
+        TEST_ASSERT_TRUE(nearRest(steps.back().rate));
+    }
+}
+
+void test_retarget_refused_once_decelerating() {
+    configure(RampProfile::TRAPEZOIDAL);
+    planner.plan(q32(100), 8000);
+    while (!planner.isDecelerating()) {
+        planner.nextInterval();
+    }
+    TEST_ASSERT_FALSE(planner.retarget(q32(50)));
+    TEST_ASSERT_GREATER_THAN(0, (long)drain().size());
+    TEST_ASSERT_EQUAL(8000, planner.stepsIssued());
+}
+
+void test_steps_for_duration_matches_the_planned_time() {
+    const RampProfile profiles[] = { RampProfile::NONE, RampProfile::TRAPEZOIDAL, RampProfile::SCURVE };
+    for (RampProfile profile : profiles) {
+        configure(profile);
+        planner.plan(q32(156.25), 0);
+        long steps = (long)planner.stepsForDuration(5000000);
+        planner.plan(q32(156.25), steps);
+        uint64_t total = 0;
+        for (const Step& step : drain()) {
+            total += step.interval;
+        }
+        // The first step leaves at once, so n steps span n - 1 intervals plus the last one
+        TEST_ASSERT_UINT64_WITHIN(5000, 5000000, total);
+    }
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_every_profile_ends_on_its_step_count);
+    RUN_TEST(test_trapezoid_stays_within_its_acceleration);
+    RUN_TEST(test_scurve_limits_jerk);
+    RUN_TEST(test_short_move_never_reaches_cruise);
+    RUN_TEST(test_cruise_interval_keeps_its_fraction);
+    RUN_TEST(test_open_ended_move_stops_after_its_stopping_steps);
+    RUN_TEST(test_retarget_changes_speed_and_keeps_the_count);
+    RUN_TEST(test_retarget_refused_once_decelerating);
+    RUN_TEST(test_steps_for_duration_matches_the_planned_time);
+    return UNITY_END();
+}
@@ -0,0 +1,172 @@
+// Position mode (pio test -e native), the checks of bench/PositionBench.cpp on a fixed seed:
+// random absolute and relative MOVEs in steps and degrees, at RPMs and speed levels on every
+// ramp profile, some paused and resumed or stopped part way, must leave the axis position on
+// the target and the step engine's count on the steps the simulated shaft made. Homing
+// against the simulated switch must put position 0 on the switch edge, from off and on it,
+// and soft limits must refuse moves past them.
+#include <math.h>
+#include <random>
+#include "StationHarness.h"
+
+namespace {
+
+const long STEPS_PER_REV = 3200;                 // DEFAULT_AXIS: 200 x 1/16
+const long MAX_TARGET = 8 * STEPS_PER_REV;       // Absolute targets within +-8 revolutions
+const long MAX_RELATIVE = 3 * STEPS_PER_REV;
+const int MOVES = 60;
+const int HOMING_TRIALS = 8;
+const int MOVES_AFTER_HOMING = 3;
+const uint32_t SEED = 1;
+
+std::mt19937 rng;
+long shaftZero;  // Shaft net steps at position 0
+
+long uniform(long low, long high) {
+    return std::uniform_int_distribution<long>(low, high)(rng);
+}
+
+// The engine's position is offset from the shaft's net steps by whatever zero was set last
+void checkPosition(long expected) {
+    TEST_ASSERT_EQUAL(expected, motor->position());
+    TEST_ASSERT_EQUAL(motor->position(), motor->timer().netSteps() - shaftZero);
+}
+
+void randomRamp() {
+    switch (uniform(0, 5)) {
+        case 0:
+            motor->setRamp(RampProfile::NONE, 0, 0);
+            break;
+        case 1:
+            motor->setRamp(RampProfile::SCURVE, (uint32_t)uniform(4000, 40000), (uint32_t)uniform(40000, 400000));
+            break;
+        default:
+            motor->setRamp(RampProfile::TRAPEZOIDAL, SpeedTable::RAMP_ACCEL, 160000);
+            break;
+    }
+}
+
+// One random move from the current position, run to its end; returns where it must be
+long randomMove() {
+    bool relative = uniform(0, 1) == 1;
+    long target;
+    if (uniform(0, 3) == 0) {
+        // Hundredths of a degree, as the MOVE command parses them
+        double limit = (relative ? MAX_RELATIVE : MAX_TARGET) * 360.0 / STEPS_PER_REV;
+        double value = uniform((long)(-limit * 100), (long)(limit * 100)) / 100.0;
+        target = motor->degreesToSteps(value);
+        TEST_ASSERT_EQUAL((long)llround(value * STEPS_PER_REV / 360.0), target);
+    } else {
+        target = relative ? uniform(-MAX_RELATIVE, MAX_RELATIVE) : uniform(-MAX_TARGET, MAX_TARGET);
+    }
+
+    // Speeds that cross the longest move (16 revolutions) well within MAX_MOVE_MICROS
+    int level = uniform(0, 4) == 0 ? (int)uniform(14, 20) : 0;
+    int rpm = (int)uniform(30, 600);
+    if (uniform(0, 9) == 0) {
+        randomRamp();
+    }
+
+    long start = motor->position();
+    TEST_ASSERT_TRUE(motor->executeMove(target, relative, rpm, level) == MoveResult::STARTED);
+    long expected = relative ? start + target : target;
+
+    // Interrupt one move in ten part way: pause and resume, or stop it for good
+    if (uniform(0, 9) == 0) {
+        long wait = uniform(1, 200);
+        for (long i = 0; i < wait && motor->isMotorRunning(); i++) {
+            tick();
+        }
+        if (uniform(0, 1) == 0) {
+            motor->pause();
+            runFor((unsigned long)uniform(1, 50));
+            motor->resume();
+        } else if (motor->isMotorRunning()) {
+            // Ramped down or halted at once (ESTOP)
+            if (uniform(0, 1) == 0) {
+                motor->stop();
+            } else {
+                motor->emergencyStop();
+            }
+            TEST_ASSERT_TRUE(runToEnd());  // And a pending falling edge
+            // Wherever the shaft stopped; the position must agree
+            expected = motor->timer().netSteps() - shaftZero;
+        }
+    }
+    TEST_ASSERT_TRUE(runToEnd());
+    return expected;
+}
+
+// Homes with the switch placed so it closes `distance` steps CCW of the shaft (negative:
+// the shaft starts on it)
+void homeOnce(long distance) {
+    long closesAt = motor->timer().netSteps() - distance;
+    motor->limitSwitch().place(closesAt);
+    TEST_ASSERT_TRUE(motor->home());
+    TEST_ASSERT_TRUE(runToEnd());
+    TEST_ASSERT_TRUE(motor->isHomed());
+
+    // The latch pass stops before the first step with the switch closed: on its edge
+    shaftZero = motor->timer().netSteps();
+    TEST_ASSERT_EQUAL(closesAt, shaftZero);
+    checkPosition(0);
+    motor->limitSwitch().remove();
+}
+
+}  // namespace
+
+void setUp() {
+    rng.seed(SEED);
+    startStation();
+    motor->timer().setAlarmLatency(2);
+    motor->timer().setAlarmJitter(6, SEED);
+    shaftZero = motor->timer().netSteps() - motor->position();
+}
+
+void tearDown() {
+    stopStation();
+}
+
+void test_random_moves_end_on_their_target() {
+    for (int i = 0; i < MOVES; i++) {
+        checkPosition(randomMove());
+    }
+}
+
+void test_homing_lands_on_the_switch_edge() {
+    for (int trial = 0; trial < HOMING_TRIALS; trial++) {
+        // One run in four starts with the switch already closed
+        homeOnce(trial % 4 == 3 ? -uniform(0, 400) : uniform(1, 20 * STEPS_PER_REV));
+        for (int i = 0; i < MOVES_AFTER_HOMING; i++) {
+            checkPosition(randomMove());  // Positions still add up from the new zero
+        }
+    }
+}
+
+void test_homing_without_a_switch_fails() {
+    TEST_ASSERT_TRUE(motor->home());
+    TEST_ASSERT_TRUE(runToEnd());  // Gives up after HOME_MAX_REVOLUTIONS
+    TEST_ASSERT_FALSE(motor->isHomed());
+}
+
+void test_soft_limits_refuse_moves_past_them() {
+    homeOnce(uniform(1, STEPS_PER_REV));
+    motor->setSoftLimits(true, -STEPS_PER_REV, STEPS_PER_REV);
+    TEST_ASSERT_TRUE(motor->executeMove(2 * STEPS_PER_REV, false, 120, 0) == MoveResult::LIMIT);
+    TEST_ASSERT_TRUE(motor->executeMove(-STEPS_PER_REV - 1, true, 120, 0) == MoveResult::LIMIT);
+    TEST_ASSERT_FALSE(motor->isMotorRunning());
+    checkPosition(0);
+
+    TEST_ASSERT_TRUE(motor->executeMove(STEPS_PER_REV, false, 120, 0) == MoveResult::STARTED);
+    TEST_ASSERT_TRUE(runToEnd());
+    checkPosition(STEPS_PER_REV);  // Onto the limit itself
+    motor->setSoftLimits(false, 0, 0);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_random_moves_end_on_their_target);
+    RUN_TEST(test_homing_lands_on_the_switch_edge);
+    RUN_TEST(test_homing_without_a_switch_fails);
+    RUN_TEST(test_soft_limits_refuse_moves_past_them);
+    return UNITY_END();
+}
@@ -0,0 +1,189 @@
+// Live speed changes (pio test -e native), the checks of bench/RetargetBench.cpp on a fixed
+// seed: rotations and timed moves at an RPM, at a speed level and on an S-curve get a new
+// speed from setSpeed() (SET RPM: / SET SPEED:) every 20..400 ms, the odd one landing on the
+// ramps, and every STEP edge is followed. The speed must ramp rather than jump, come down to
+// rest speed at the end, and rotations must make their exact count and timed moves last
+// their time.
+#include <math.h>
+#include <random>
+#include "StationHarness.h"
+
+namespace {
+
+const long STEPS_PER_REV = 3200;               // DEFAULT_AXIS: 200 x 1/16
+const uint32_t RAMP_ACCEL = SpeedTable::RAMP_ACCEL;  // Default ramp, so speed levels use their tables
+const uint32_t RAMP_JERK = 160000;
+const uint32_t START_RATE = SpeedTable::RAMP_START_RATE;
+const double JUMP_SLACK_US = 2.0;              // Whole-microsecond rounding of two intervals
+const double JUMP_MARGIN = 1.25;               // The integrator steps at the mean velocity
+const double END_LIMIT = 2.0;                  // Last step at most this much above rest speed
+const double TIME_TOLERANCE = 0.02;
+const int MOVES = 4;                           // Per case
+const uint32_t SEED = 1;
+
+enum MoveKind { ROTATION_RPM, ROTATION_LEVEL, TIMED_RPM, TIMED_LEVEL };
+
+std::mt19937 rng;
+
+long uniform(long low, long high) {
+    return std::uniform_int_distribution<long>(low, high)(rng);
+}
+
+// The STEP rising edges of one move as they are recorded (the simulation keeps a ring of
+// them, too short for a whole move)
+struct PulseCheck {
+    long seen;
+    long steps;
+    uint64_t first;
+    uint64_t last;
+    double lastInterval;
+    double worstJump;  // Share of the allowed interval change
+};
+
+PulseCheck check;
+long applied;  // SETs that changed the speed of a running move
+
+void followPulses() {
+    SimStepHal& timer = motor->timer();
+    for (long recorded = timer.recordedPulses(); check.seen < recorded; check.seen++) {
+        uint64_t pulse = timer.pulseTime(check.seen);
+        if (check.steps > 0) {
+            double interval = (double)(pulse - check.last);
+            if (check.steps > 1) {
+                double longer = fmax(check.lastInterval, interval);
+                // dt = 1 / v, so one step changes it by a * dt^3 at acceleration a
+                double allowed = JUMP_MARGIN * RAMP_ACCEL * longer * longer * longer * 1e-12;
+                double change = fabs(interval - check.lastInterval) - JUMP_SLACK_US;
+                check.worstJump = fmax(check.worstJump, change > 0 ? change / allowed : 0);
+            }
+            check.lastInterval = interval;
+        } else {
+            check.first = pulse;
+        }
+        check.last = pulse;
+        check.steps++;
+    }
+}
+
+// A new speed of the kind the move started with: speed levels 14..20 or 30..600 RPM
+void changeSpeed(MoveKind kind) {
+    SpeedChange change;
+    if (kind == ROTATION_LEVEL || kind == TIMED_LEVEL) {
+        change = motor->setSpeed(0, (int)uniform(14, 20));
+    } else {
+        change = motor->setSpeed((int)uniform(30, 600), 0);
+    }
+    if (change == SpeedChange::APPLIED) {
+        applied++;
+    }
+}
+
+void runMove(MoveKind kind) {
+    motor->timer().clearPulses();
+    check = PulseCheck();
+    int rotations = (int)uniform(5, 30);
+    int seconds = (int)uniform(2, 6);
+    switch (kind) {
+        case ROTATION_RPM:
+            motor->executeRotation((int)uniform(30, 600), rotations);
+            break;
+        case ROTATION_LEVEL:
+            motor->executeRotationWithSpeed((int)uniform(14, 20), rotations);
+            break;
+        case TIMED_RPM:
+            motor->executeTime((int)uniform(30, 600), seconds);
+            break;
+        case TIMED_LEVEL:
+            motor->executeTimeWithSpeed((int)uniform(14, 20), seconds);
+            break;
+    }
+
+    uint64_t start = Sim::now();
+    uint64_t nextSet = start + (uint64_t)uniform(20, 400) * 1000;
+    double slowestRate = 1e9;
+    while (motor->isMotorRunning()) {
+        TEST_ASSERT_TRUE(Sim::now() - start < MAX_MOVE_MICROS);
+        if (Sim::now() >= nextSet) {
+            changeSpeed(kind);
+            nextSet = Sim::now() + (uint64_t)uniform(20, 400) * 1000;
+        }
+        tick();
+        slowestRate = fmin(slowestRate, motor->rpm() * STEPS_PER_REV / 60.0);
+    }
+
+    TEST_ASSERT_TRUE(check.worstJump <= 1.0);  // Ramped
+    TEST_ASSERT_TRUE(check.steps >= 2);
+    // Moves slower than the start speed stop at their cruise speed
+    double restRate = fmin(slowestRate, (double)START_RATE);
+    TEST_ASSERT_TRUE(1e6 / check.lastInterval / restRate <= END_LIMIT);
+    if (kind == ROTATION_RPM || kind == ROTATION_LEVEL) {
+        TEST_ASSERT_EQUAL(rotations * STEPS_PER_REV, check.steps);
+    } else {
+        // The first step comes one interval after the start, like the last one before the end
+        double duration = (check.last - check.first) / 1e6;
+        TEST_ASSERT_DOUBLE_WITHIN(TIME_TOLERANCE * seconds, seconds, duration);
+    }
+}
+
+void runMoves(MoveKind kind, RampProfile profile) {
+    motor->setRamp(profile, RAMP_ACCEL, RAMP_JERK);
+    applied = 0;
+    for (int i = 0; i < MOVES; i++) {
+        runMove(kind);
+    }
+    TEST_ASSERT_TRUE(applied >= MOVES);  // Something to check
+}
+
+}  // namespace
+
+void setUp() {
+    rng.seed(SEED);
+    startStation();
+    motor->timer().setAlarmLatency(2);  // Constant, so the intervals stay exact
+    afterTick = followPulses;
+}
+
+void tearDown() {
+    stopStation();
+}
+
+void test_rotations_at_an_rpm() {
+    runMoves(ROTATION_RPM, RampProfile::TRAPEZOIDAL);
+}
+
+void test_rotations_at_a_speed_level() {
+    runMoves(ROTATION_LEVEL, RampProfile::TRAPEZOIDAL);  // Starts on the ramp table
+}
+
+void test_rotations_on_an_s_curve() {
+    runMoves(ROTATION_RPM, RampProfile::SCURVE);
+}
+
+void test_timed_moves_at_an_rpm() {
+    runMoves(TIMED_RPM, RampProfile::TRAPEZOIDAL);
+}
+
+void test_timed_moves_at_a_speed_level() {
+    runMoves(TIMED_LEVEL, RampProfile::TRAPEZOIDAL);
+}
+
+void test_timed_moves_on_an_s_curve() {
+    runMoves(TIMED_RPM, RampProfile::SCURVE);
+}
+
+// A SET between moves has nothing to change
+void test_set_without_a_move_is_refused() {
+    TEST_ASSERT_TRUE(motor->setSpeed(120, 0) == SpeedChange::IDLE);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_rotations_at_an_rpm);
+    RUN_TEST(test_rotations_at_a_speed_level);
+    RUN_TEST(test_rotations_on_an_s_curve);
+    RUN_TEST(test_timed_moves_at_an_rpm);
+    RUN_TEST(test_timed_moves_at_a_speed_level);
+    RUN_TEST(test_timed_moves_on_an_s_curve);
+    RUN_TEST(test_set_without_a_move_is_refused);
+    return UNITY_END();
+}
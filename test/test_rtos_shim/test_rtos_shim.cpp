@@ -0,0 +1,155 @@
+// RtosShim on the host (pio test -e native): the pthread tasks, the periodic delay the
+// motion task runs on, and BoundedQueue between threads, on the real clock.
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include "RtosShim.h"
+
+namespace {
+
+struct Item {
+    uint32_t producer;
+    uint32_t sequence;
+};
+
+std::atomic<int> taskRuns(0);
+
+void countRun(void* argument) {
+    taskRuns.fetch_add(*(int*)argument);
+}
+
+}  // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_task_runs_its_function() {
+    static int by = 3;
+    taskRuns = 0;
+    TEST_ASSERT_TRUE(Rtos::startTask("shimtest", countRun, &by, 4096, 1, 0));
+    uint32_t start = Rtos::nowMillis();
+    while (taskRuns.load() == 0 && Rtos::nowMillis() - start < 1000) {
+        Rtos::delayMillis(1);
+    }
+    TEST_ASSERT_EQUAL(3, taskRuns.load());
+}
+
+void test_delay_until_keeps_its_period() {
+    const uint32_t PERIOD = 5;
+    const int PERIODS = 40;
+    Rtos::WakeTime lastWake = Rtos::wakeTime();
+    Rtos::WakeTime first = lastWake;
+    uint32_t start = Rtos::nowMillis();
+    for (int i = 0; i < PERIODS; i++) {
+        Rtos::delayUntil(lastWake, PERIOD);
+    }
+    // The wake times step by exactly the period, so sleeping late doesn't add up
+    TEST_ASSERT_EQUAL_UINT32(first + PERIODS * PERIOD, lastWake);
+    uint32_t elapsed = Rtos::nowMillis() - start;
+    TEST_ASSERT_UINT32_WITHIN(15, PERIODS * PERIOD, elapsed);
+}
+
+void test_delay_until_restarts_after_an_overrun() {
+    Rtos::WakeTime lastWake = Rtos::wakeTime();
+    Rtos::delayMillis(30);  // Six periods late
+    uint32_t before = Rtos::nowMillis();
+    Rtos::delayUntil(lastWake, 5);
+    TEST_ASSERT_UINT32_WITHIN(2, before, Rtos::nowMillis());  // No sleep
+    TEST_ASSERT_UINT32_WITHIN(2, before, lastWake);           // From now, not the missed periods
+
+    Rtos::delayUntil(lastWake, 5);
+    TEST_ASSERT_UINT32_WITHIN(3, before + 5, Rtos::nowMillis());
+}
+
+void test_queue_is_first_in_first_out() {
+    BoundedQueue<Item, 4> queue;
+    for (uint32_t i = 0; i < 4; i++) {
+        TEST_ASSERT_TRUE(queue.send(Item{ 0, i }));
+    }
+    TEST_ASSERT_EQUAL(4, (int)queue.waiting());
+    TEST_ASSERT_EQUAL(0, (int)queue.space());
+    TEST_ASSERT_FALSE(queue.send(Item{ 0, 4 }));  // Full, and 0 never waits
+
+    Item item;
+    TEST_ASSERT_TRUE(queue.peek(item));
+    TEST_ASSERT_EQUAL_UINT32(0, item.sequence);
+    for (uint32_t i = 0; i < 4; i++) {
+        TEST_ASSERT_TRUE(queue.receive(item));
+        TEST_ASSERT_EQUAL_UINT32(i, item.sequence);
+    }
+    TEST_ASSERT_FALSE(queue.receive(item));
+    TEST_ASSERT_FALSE(queue.peek(item));
+}
+
+void test_queue_timeouts_wait_then_give_up() {
+    BoundedQueue<Item, 2> queue;
+    Item item;
+    uint32_t start = Rtos::nowMillis();
+    TEST_ASSERT_FALSE(queue.receive(item, 40));
+    TEST_ASSERT_UINT32_WITHIN(10, 45, Rtos::nowMillis() - start);
+
+    queue.send(Item{ 0, 1 });
+    queue.send(Item{ 0, 2 });
+    start = Rtos::nowMillis();
+    TEST_ASSERT_FALSE(queue.send(Item{ 0, 3 }, 40));
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(39, Rtos::nowMillis() - start);
+}
+
+void test_blocked_send_goes_through_once_there_is_room() {
+    BoundedQueue<Item, 1> queue;
+    queue.send(Item{ 0, 1 });
+    std::thread consumer([&queue]() {
+        Rtos::delayMillis(20);
+        Item item;
+        queue.receive(item);
+    });
+    uint32_t start = Rtos::nowMillis();
+    TEST_ASSERT_TRUE(queue.send(Item{ 0, 2 }, 1000));
+    TEST_ASSERT_LESS_THAN_UINT32(500, Rtos::nowMillis() - start);
+    consumer.join();
+    Item item;
+    TEST_ASSERT_TRUE(queue.receive(item));
+    TEST_ASSERT_EQUAL_UINT32(2, item.sequence);
+}
+
+void test_two_producers_one_consumer_lose_nothing() {
+    const uint32_t PER_PRODUCER = 50000;
+    BoundedQueue<Item, 8> queue;
+    auto produce = [&queue](uint32_t producer) {
+        for (uint32_t i = 0; i < PER_PRODUCER; i++) {
+            while (!queue.send(Item{ producer, i }, 100)) {
+            }
+        }
+    };
+    std::thread first(produce, 0);
+    std::thread second(produce, 1);
+
+    uint32_t next[2] = { 0, 0 };
+    uint32_t outOfOrder = 0;
+    Item item;
+    for (uint32_t received = 0; received < 2 * PER_PRODUCER; received++) {
+        TEST_ASSERT_TRUE(queue.receive(item, 1000));
+        if (item.sequence != next[item.producer]) {
+            outOfOrder++;
+        }
+        next[item.producer] = item.sequence + 1;
+    }
+    first.join();
+    second.join();
+    TEST_ASSERT_EQUAL_UINT32(0, outOfOrder);
+    TEST_ASSERT_EQUAL_UINT32(PER_PRODUCER, next[0]);
+    TEST_ASSERT_EQUAL_UINT32(PER_PRODUCER, next[1]);
+    TEST_ASSERT_FALSE(queue.receive(item));
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_task_runs_its_function);
+    RUN_TEST(test_delay_until_keeps_its_period);
+    RUN_TEST(test_delay_until_restarts_after_an_overrun);
+    RUN_TEST(test_queue_is_first_in_first_out);
+    RUN_TEST(test_queue_timeouts_wait_then_give_up);
+    RUN_TEST(test_blocked_send_goes_through_once_there_is_room);
+    RUN_TEST(test_two_producers_one_consumer_lose_nothing);
+    return UNITY_END();
+}
@@ -0,0 +1,159 @@
+// Speed level tables (pio test -e native): the compile-time ramps of SpeedTable.h and the
+// ones SpeedLevels builds for configured delays against the analytic constant-acceleration
+// intervals, and a speed level move stepping at exactly those intervals.
+#include <math.h>
+#include "StationHarness.h"
+#include "SpeedLevels.h"
+
+namespace {
+
+const double A = SpeedTable::RAMP_ACCEL;
+const double V0 = SpeedTable::RAMP_START_RATE;
+const double Q4 = 1 << SpeedTable::INTERVAL_SHIFT;
+
+// t(k + 1) - t(k) in Q4 microseconds, t(k) = (sqrt(v0^2 + 2ak) - v0) / a
+double analyticInterval(uint32_t k) {
+    double t0 = (sqrt(V0 * V0 + 2 * A * k) - V0) / A;
+    double t1 = (sqrt(V0 * V0 + 2 * A * (k + 1)) - V0) / A;
+    return (t1 - t0) * 1e6 * Q4;
+}
+
+// Steps to accelerate from v0 to a level's rate, (v^2 - v0^2) / 2a
+long analyticLength(uint16_t delayUs) {
+    double v = 1e6 / delayUs;
+    return v <= V0 ? 0 : (long)((v * v - V0 * V0) / (2 * A));
+}
+
+void checkRamp(const uint16_t* ramp, uint16_t steps, uint16_t delayUs) {
+    TEST_ASSERT_INT_WITHIN(1, analyticLength(delayUs), steps);
+    double cruise = delayUs * Q4;
+    for (uint32_t k = 0; k < steps; k++) {
+        double expected = fmax(analyticInterval(k), cruise);
+        // Rounded to Q4, from velocities floored to 1/1024 steps/s: a difference of two
+        // is off by less than 1/1024 / RAMP_ACCEL s, just under one Q4 unit
+        TEST_ASSERT_DOUBLE_WITHIN(1.5, expected, ramp[k]);
+        TEST_ASSERT_GREATER_OR_EQUAL(delayUs * Q4, ramp[k]);
+        if (k > 0) {
+            TEST_ASSERT_LESS_OR_EQUAL(ramp[k - 1], ramp[k]);
+        }
+    }
+}
+
+}  // namespace
+
+void setUp() {
+    Sim::reset();
+}
+
+void tearDown() {
+    stopStation();
+}
+
+void test_flash_ramps_match_the_formula() {
+    for (int level = 1; level <= SpeedTable::LEVELS; level++) {
+        checkRamp(SpeedTable::ramp(level), SpeedTable::rampSteps(level), SpeedTable::DELAY_US[level - 1]);
+    }
+    TEST_ASSERT_EQUAL_UINT32(SpeedTable::RAMP_ENTRIES, SpeedTable::TABLES.offset[SpeedTable::LEVELS]);
+}
+
+void test_ramp_time_matches_the_formula() {
+    // Accelerating from v0 to v takes (v - v0) / a
+    for (int level = 1; level <= SpeedTable::LEVELS; level++) {
+        const uint16_t* ramp = SpeedTable::ramp(level);
+        double total = 0;
+        for (uint16_t k = 0; k < SpeedTable::rampSteps(level); k++) {
+            total += ramp[k] / Q4;
+        }
+        double v = 1e6 / SpeedTable::DELAY_US[level - 1];
+        double expected = v > V0 ? (v - V0) / A * 1e6 : 0;
+        TEST_ASSERT_DOUBLE_WITHIN(expected * 0.001 + SpeedTable::DELAY_US[level - 1], expected, total);
+    }
+}
+
+void test_isqrt_is_exact() {
+    const uint64_t values[] = { 0, 1, 2, 3, 4, 15, 16, 17, 1000000, 999999999999ULL, (1ULL << 62) + 12345 };
+    for (uint64_t x : values) {
+        uint64_t r = SpeedTable::isqrt(x);
+        TEST_ASSERT_TRUE(r * r <= x);
+        TEST_ASSERT_TRUE((r + 1) * (r + 1) > x);
+    }
+}
+
+void test_default_levels_use_the_flash_tables() {
+    SpeedLevels levels;
+    TEST_ASSERT_TRUE(levels.build(SpeedTable::DELAY_US));
+    for (int level = 1; level <= SpeedTable::LEVELS; level++) {
+        TEST_ASSERT_EQUAL_PTR(SpeedTable::ramp(level), levels.ramp(level));
+        TEST_ASSERT_EQUAL_UINT16(SpeedTable::DELAY_US[level - 1], levels.delay(level));
+    }
+}
+
+void test_configured_levels_build_the_same_ramps() {
+    uint16_t delays[SpeedTable::LEVELS];
+    for (int level = 0; level < SpeedTable::LEVELS; level++) {
+        delays[level] = (uint16_t)(12000 - level * 570);  // 12000 down to 1170 us
+    }
+    SpeedLevels levels;
+    TEST_ASSERT_TRUE(levels.build(delays));
+    for (int level = 1; level <= SpeedTable::LEVELS; level++) {
+        TEST_ASSERT_EQUAL_UINT16(delays[level - 1], levels.delay(level));
+        checkRamp(levels.ramp(level), levels.rampSteps(level), delays[level - 1]);
+    }
+}
+
+void test_too_long_ramps_are_refused() {
+    uint16_t delays[SpeedTable::LEVELS];
+    for (int level = 0; level < SpeedTable::LEVELS; level++) {
+        delays[level] = 60;  // 16666 steps/s: over 8000 ramp steps each
+    }
+    TEST_ASSERT_GREATER_THAN_UINT32(SpeedLevels::MAX_RAMP_ENTRIES, SpeedLevels::rampEntries(delays));
+    SpeedLevels levels;
+    TEST_ASSERT_FALSE(levels.build(delays));
+    TEST_ASSERT_EQUAL_UINT16(SpeedTable::DELAY_US[0], levels.delay(1));  // Unchanged
+}
+
+void test_speed_level_maps_to_its_true_rate() {
+    startStation();
+    // Level 20 is 280 us at 3200 steps/rev: 66.96 RPM, not a rounded whole RPM
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 60e6f / (280.0f * 3200.0f), motor->speedLevelRPM(20));
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 1.875f, motor->speedLevelRPM(1));
+}
+
+void test_speed_level_move_steps_at_the_table_intervals() {
+    startStation();
+    const int LEVEL = 20;
+    motor->executeRotationWithSpeed(LEVEL, 1);
+    TEST_ASSERT_TRUE(runToEnd(2000000));
+
+    SimStepHal& timer = motor->timer();
+    TEST_ASSERT_EQUAL(3200, timer.recordedPulses());
+    const uint16_t* ramp = SpeedTable::ramp(LEVEL);
+    uint16_t rampSteps = SpeedTable::rampSteps(LEVEL);
+    // Entry 0 is the wait before the first step, so step k follows step k - 1 by entry k.
+    // Whole microseconds with the Q4 fraction carried: each interval within 1 us of its
+    // entry and the ramp as a whole within 1 us of the table's sum
+    double sum = 0;
+    for (uint16_t k = 1; k < rampSteps; k++) {
+        double interval = (double)(timer.pulseTime(k) - timer.pulseTime(k - 1));
+        TEST_ASSERT_DOUBLE_WITHIN(1, ramp[k] / Q4, interval);
+        sum += ramp[k] / Q4;
+    }
+    TEST_ASSERT_DOUBLE_WITHIN(1, sum, (double)(timer.pulseTime(rampSteps - 1) - timer.pulseTime(0)));
+    // Then exactly the level's delay
+    for (long step = rampSteps + 1; step < 1600; step++) {
+        TEST_ASSERT_EQUAL_UINT64(280, timer.pulseTime(step) - timer.pulseTime(step - 1));
+    }
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_flash_ramps_match_the_formula);
+    RUN_TEST(test_ramp_time_matches_the_formula);
+    RUN_TEST(test_isqrt_is_exact);
+    RUN_TEST(test_default_levels_use_the_flash_tables);
+    RUN_TEST(test_configured_levels_build_the_same_ramps);
+    RUN_TEST(test_too_long_ramps_are_refused);
+    RUN_TEST(test_speed_level_maps_to_its_true_rate);
+    RUN_TEST(test_speed_level_move_steps_at_the_table_intervals);
+    return UNITY_END();
+}
@@ -0,0 +1,162 @@
+// Stall detection (pio test -e native): slips and stalls injected into SimEncoder while
+// MotorController runs on SimStepHal, checking the following error it reports, how soon a
+// stall is caught at different speeds, and what STOP and RETRY do about it.
+#include "StationHarness.h"
+
+namespace {
+
+const long STEPS_PER_REV = 3200;                             // DEFAULT_AXIS: 200 x 1/16
+const long STALL_LIMIT = 8 * 16;                             // STALL_FULL_STEPS at 1/16
+const long COUNTS_PER_REV = 4000;                            // 1000 lines, 4x decoding
+
+SimEncoder& encoder() {
+    return motor->positionEncoder();
+}
+
+// Where the shaft is, in steps
+long shaftSteps() {
+    return encoder().count() * STEPS_PER_REV / COUNTS_PER_REV;
+}
+
+// Runs until the move is at cruise, stalls the shaft and returns the microseconds until
+// the controller has stopped it
+uint64_t stallLatency(int rpm, bool clockwise) {
+    motor->setStallPolicy(StallPolicy::STOP);
+    motor->executeRotation(rpm, 1000, clockwise);
+    runFor(rpm < 60 ? 500 : 4000);  // Past the ramp
+    TEST_ASSERT_TRUE(motor->isMotorRunning());
+    TEST_ASSERT_INT32_WITHIN(2, 0, motor->followingError());
+
+    encoder().setStalled(true);
+    uint64_t stalledAt = Sim::now();
+    while (motor->state() != MotorState::STALLED && Sim::now() - stalledAt < 2000000) {
+        tick();
+    }
+    TEST_ASSERT_EQUAL(MotorState::STALLED, motor->state());
+    return Sim::now() - stalledAt;
+}
+
+}  // namespace
+
+void setUp() {
+    startStation();
+}
+
+void tearDown() {
+    stopStation();
+}
+
+void test_following_error_stays_zero_without_slip() {
+    motor->setStallPolicy(StallPolicy::STOP);
+    motor->executeRotation(300, 5);
+    long worst = 0;
+    while (motor->isMotorRunning()) {
+        tick();
+        long error = motor->followingError();
+        worst = error > worst ? error : -error > worst ? -error : worst;
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(2, worst);
+    TEST_ASSERT_EQUAL(MotorState::DONE, motor->state());
+    TEST_ASSERT_EQUAL(5 * STEPS_PER_REV, shaftSteps());
+}
+
+void test_slip_shows_as_following_error_without_stopping_when_off() {
+    motor->executeRotation(300, 5);
+    runFor(500);
+    encoder().slip(200);
+    runFor(2);
+    TEST_ASSERT_INT32_WITHIN(2, 200, motor->followingError());
+    TEST_ASSERT_TRUE(runToEnd());
+    TEST_ASSERT_EQUAL(MotorState::DONE, motor->state());  // OFF only reports
+    TEST_ASSERT_EQUAL(5 * STEPS_PER_REV - 200, shaftSteps());
+    TEST_ASSERT_TRUE(sentText("FOLLOW:"));
+}
+
+void test_slip_below_the_limit_is_tolerated_and_above_it_stops() {
+    motor->setStallPolicy(StallPolicy::STOP);
+    motor->executeRotation(300, 10);
+    runFor(500);
+    encoder().slip(STALL_LIMIT / 2);
+    runFor(200);
+    TEST_ASSERT_TRUE(motor->isMotorRunning());
+    TEST_ASSERT_INT32_WITHIN(2, STALL_LIMIT / 2, motor->followingError());
+
+    encoder().slip(STALL_LIMIT * 3 / 4);  // 160 lost in all
+    tick();
+    TEST_ASSERT_EQUAL(MotorState::STALLED, motor->state());
+    TEST_ASSERT_FALSE(motor->isMotorRunning());
+    TEST_ASSERT_TRUE(motor->timer().enabled());  // ENA high: drivers off
+    long pulses = motor->timer().recordedPulses();
+    runFor(100);
+    TEST_ASSERT_EQUAL(pulses, motor->timer().recordedPulses());
+    TEST_ASSERT_TRUE(sentText("STALL:"));
+}
+
+// The error passes the limit one step after it reaches it; the motion pass that sees
+// that comes at most 1 ms later, and this loop only looks once a millisecond
+void checkLatency(uint64_t latency, double stepsPerSecond) {
+    uint64_t limitReached = (uint64_t)((STALL_LIMIT + 1) * 1e6 / stepsPerSecond);
+    TEST_ASSERT_GREATER_OR_EQUAL(limitReached, latency);
+    TEST_ASSERT_LESS_OR_EQUAL(limitReached + 2000, latency);
+}
+
+void test_stall_latency_at_6_rpm() {
+    checkLatency(stallLatency(6, true), 320);  // About 400 ms
+}
+
+void test_stall_latency_at_60_rpm() {
+    checkLatency(stallLatency(60, true), 3200);  // About 40 ms
+}
+
+void test_stall_latency_at_60_rpm_counterclockwise() {
+    checkLatency(stallLatency(60, false), 3200);
+}
+
+void test_stall_latency_at_1000_rpm() {
+    checkLatency(stallLatency(1000, true), 53333.3);  // About 2.4 ms
+}
+
+void test_retry_finishes_the_move_on_the_shaft() {
+    motor->setStallPolicy(StallPolicy::RETRY);
+    motor->executeRotation(300, 5);
+    runFor(500);
+    encoder().slip(200);
+    runFor(2);
+    TEST_ASSERT_TRUE(sentText("STALL:"));
+    TEST_ASSERT_TRUE(motor->isMotorRunning());  // Waiting to retry
+
+    TEST_ASSERT_TRUE(runToEnd());
+    TEST_ASSERT_EQUAL(MotorState::DONE, motor->state());
+    // The retry ran the lost steps again: the shaft is where the move was meant to go
+    TEST_ASSERT_EQUAL(5 * STEPS_PER_REV, shaftSteps());
+    TEST_ASSERT_EQUAL(5 * STEPS_PER_REV + 200, motor->timer().netSteps());
+}
+
+void test_retry_gives_up_after_its_retries() {
+    motor->setStallPolicy(StallPolicy::RETRY);
+    motor->executeRotation(300, 5);
+    runFor(500);
+    encoder().setStalled(true);  // Never comes free
+    uint64_t start = Sim::now();
+    while (motor->state() != MotorState::STALLED && Sim::now() - start < 10000000) {
+        tick();
+    }
+    TEST_ASSERT_EQUAL(MotorState::STALLED, motor->state());
+    TEST_ASSERT_FALSE(motor->isMotorRunning());
+    // Two retries, each after STALL_RETRY_DELAY at rest
+    TEST_ASSERT_GREATER_OR_EQUAL(1000000, Sim::now() - start);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_following_error_stays_zero_without_slip);
+    RUN_TEST(test_slip_shows_as_following_error_without_stopping_when_off);
+    RUN_TEST(test_slip_below_the_limit_is_tolerated_and_above_it_stops);
+    RUN_TEST(test_stall_latency_at_6_rpm);
+    RUN_TEST(test_stall_latency_at_60_rpm);
+    RUN_TEST(test_stall_latency_at_60_rpm_counterclockwise);
+    RUN_TEST(test_stall_latency_at_1000_rpm);
+    RUN_TEST(test_retry_finishes_the_move_on_the_shaft);
+    RUN_TEST(test_retry_gives_up_after_its_retries);
+    return UNITY_END();
+}
@@ -0,0 +1,313 @@
+// The station's command handling in main.cpp (pio test -e native): lines go in through the
+// simulated Serial and SerialManager's parser, and run through handleCommand() the way the
+// motion task runs them, against main.cpp's own controller. The station is started once;
+// every case leaves it idle.
+#include <Arduino.h>
+#include <unity.h>
+#include <string>
+#include "SerialManager.h"
+#include "MotorController.h"
+#include "ScriptRunner.h"
+#include "RtosShim.h"
+
+extern SerialManager serialManager;
+extern MotorController motorController;
+extern ScriptRunner scriptRunner;
+extern BoundedQueue<ParsedCommand, 8> commandQueue;
+void handleCommand(const ParsedCommand& command);
+void queueCommands();
+bool stationBusy();
+
+namespace {
+
+std::string output;  // Text the station has written since the case started
+
+// One motion task pass, then the comms task's writes
+void pass() {
+    Sim::advance(1000);
+    motorController.update();
+    scriptRunner.update();
+    if (serialManager.runningOperation() != 0 && !stationBusy()) {
+        serialManager.finishOperation("STOPPED");
+    }
+    ParsedCommand command;
+    while (serialManager.pollCommand(command)) {
+        handleCommand(command);
+    }
+    serialManager.flushReplies();
+    serialManager.pump();
+    output += Sim::serialOutput();
+    Sim::clearSerialOutput();
+}
+
+void runFor(int ms) {
+    for (int i = 0; i < ms; i++) {
+        pass();
+    }
+}
+
+void send(const char* line) {
+    Sim::serialInput(line);
+    Sim::serialInput("\n");
+    runFor(2);
+}
+
+bool sent(const char* line) {
+    return output.find(std::string(line) + "\r\n") != std::string::npos;
+}
+
+size_t count(const char* text) {
+    size_t found = 0;
+    for (size_t at = output.find(text); at != std::string::npos; at = output.find(text, at + 1)) {
+        found++;
+    }
+    return found;
+}
+
+void runUntilIdle() {
+    for (int i = 0; i < 60000 && stationBusy(); i++) {
+        pass();
+    }
+    runFor(5);
+}
+
+}  // namespace
+
+void setUp() {
+    runFor(2);
+    output.clear();
+}
+
+void tearDown() {
+    send("ESTOP");
+    runUntilIdle();
+    send("HELLO");  // Back to an untagged text session
+}
+
+void test_malformed_line_is_answered() {
+    send("RPM:60 ROT:99999999999");
+    TEST_ASSERT_TRUE(sent("PARSE_ERROR"));
+    TEST_ASSERT_FALSE(motorController.isMotorRunning());
+
+    output.clear();
+    send("ABCDEFGHIJKLMNOP");
+    TEST_ASSERT_TRUE(sent("PARSE_ERROR"));
+
+    // The station carries on with the next line
+    output.clear();
+    send("HELLO");
+    TEST_ASSERT_TRUE(sent("READY"));
+}
+
+void test_malformed_tagged_line_gets_a_final_reply() {
+    send("HELLO TAG");
+    output.clear();
+    send("#12 A B C D E F G H I");
+    TEST_ASSERT_TRUE(sent("=12 PARSE_ERROR"));
+    send("#13 NOSUCH");
+    TEST_ASSERT_TRUE(sent("=13 UNKNOWN"));
+}
+
+void test_config_save_is_refused_while_a_move_runs() {
+    long start = motorController.position();
+    send("RPM:300 ROT:2");
+    TEST_ASSERT_TRUE(motorController.isMotorRunning());
+    output.clear();
+    send("CONFIG SAVE");
+    TEST_ASSERT_TRUE(sent("CONFIG_BUSY"));
+    TEST_ASSERT_FALSE(sent("CONFIG SAVED"));
+    TEST_ASSERT_TRUE(motorController.isMotorRunning());
+    runUntilIdle();
+    TEST_ASSERT_EQUAL(start + 2 * 3200, motorController.position());  // The move went on
+}
+
+void test_prog_end_waits_for_the_move() {
+    send("PROG BEGIN");
+    send("PROG RPM:300 ROT:1");
+    send("RPM:300 ROT:2");
+    TEST_ASSERT_TRUE(motorController.isMotorRunning());
+    output.clear();
+    send("PROG END");
+    TEST_ASSERT_TRUE(sent("PROG_BUSY"));
+    TEST_ASSERT_FALSE(sent("PROG SAVED"));
+
+    // The upload is still open; a bad line drops it rather than storing it
+    output.clear();
+    send("PROG DWELL:10");
+    TEST_ASSERT_TRUE(sent("PROG:2"));
+    send("PROG NOSUCH");
+    TEST_ASSERT_TRUE(output.find("PROG_ERROR LINE:3") != std::string::npos);
+    runUntilIdle();
+}
+
+void test_script_may_only_wait_on_input_only_pins() {
+    send("PROG BEGIN");
+    output.clear();
+    send("PROG WAIT PIN:16 HIGH");  // STEP
+    TEST_ASSERT_TRUE(sent("PROG_ERROR LINE:1 PIN:34..39"));
+
+    send("PROG BEGIN");
+    output.clear();
+    send("PROG WAIT PIN:1 LOW");  // UART0 TX
+    TEST_ASSERT_TRUE(sent("PROG_ERROR LINE:1 PIN:34..39"));
+
+    send("PROG BEGIN");
+    output.clear();
+    send("PROG WAIT PIN:39 LOW TIMEOUT:10");
+    TEST_ASSERT_TRUE(sent("PROG:1"));
+    send("PROG END");
+    TEST_ASSERT_TRUE(output.find("PROG SAVED") != std::string::npos);
+}
+
+void test_refused_tagged_moves_carry_the_refusal() {
+    send("HELLO TAG");
+    send("#20 RPM:300 ROT:2");
+    TEST_ASSERT_TRUE(motorController.isMotorRunning());
+    output.clear();
+    send("#21 RPM:60 ROT:1");
+    send("#22 RPM:60 TIME:5");
+    send("#23 LINE RPM:60 X:100");
+    TEST_ASSERT_TRUE(sent("=21 MOVE_BUSY"));
+    TEST_ASSERT_TRUE(sent("=22 MOVE_BUSY"));
+    TEST_ASSERT_TRUE(sent("=23 MOVE_BUSY"));
+    TEST_ASSERT_FALSE(sent("=21 OK"));
+    TEST_ASSERT_FALSE(sent("=22 OK"));
+    TEST_ASSERT_FALSE(sent("=23 OK"));
+    runUntilIdle();
+}
+
+void test_moves_of_nothing_get_a_final_reply() {
+    send("HELLO TAG");
+    output.clear();
+    send("#30 RPM:60 TIME:0");
+    send("#31 RPM:60 ROT:0");
+    send("#32 SPEED:10 ROT:-1");
+    send("#33 LINE RPM:60 X:0");
+    TEST_ASSERT_TRUE(sent("=30 MOVE_INVALID"));
+    TEST_ASSERT_TRUE(sent("=31 MOVE_INVALID"));
+    TEST_ASSERT_TRUE(sent("=32 MOVE_INVALID"));
+    TEST_ASSERT_TRUE(sent("=33 MOVE_INVALID"));
+    TEST_ASSERT_FALSE(motorController.isMotorRunning());
+
+    // Untagged, the refusal is still answered
+    send("HELLO");
+    output.clear();
+    send("RPM:60 TIME:0");
+    TEST_ASSERT_TRUE(sent("MOVE_INVALID"));
+}
+
+void test_stop_and_start_in_one_pass_answer_both_operations() {
+    send("HELLO TAG");
+    send("#12 RPM:100 ROT:5");
+    TEST_ASSERT_TRUE(motorController.isMotorRunning());
+    output.clear();
+    Sim::serialInput("#13 ESTOP\n#14 RPM:10 ROT:1\n");
+    pass();  // Both lines are handled before the pass's ended-operation check
+    runFor(2);
+    TEST_ASSERT_TRUE(sent("=13 ESTOP"));
+    TEST_ASSERT_TRUE(sent("=12 STOPPED"));
+    TEST_ASSERT_TRUE(sent("#14 STARTED"));
+    TEST_ASSERT_TRUE(motorController.isMotorRunning());
+
+    // ABORT and RUN of a stored script the same way; a dwell ends at once
+    send("ESTOP");
+    runUntilIdle();
+    send("PROG BEGIN");
+    send("PROG DWELL:5000");
+    send("PROG END");
+    send("#15 RUN");
+    TEST_ASSERT_TRUE(scriptRunner.isRunning());
+    output.clear();
+    Sim::serialInput("#16 ABORT\n#17 RUN\n");
+    pass();
+    runFor(2);
+    TEST_ASSERT_TRUE(output.find("=16 ABORTED LINE:") != std::string::npos);
+    TEST_ASSERT_TRUE(sent("=15 STOPPED"));
+    TEST_ASSERT_TRUE(sent("#17 RUN LINES:1"));
+    TEST_ASSERT_TRUE(scriptRunner.isRunning());
+    runUntilIdle();
+    TEST_ASSERT_TRUE(sent("=17 RUN DONE"));
+}
+
+void test_unknown_stall_policy_is_refused() {
+    send("STALL:RETRY");
+    output.clear();
+    send("STALL:STPO");
+    TEST_ASSERT_TRUE(sent("STALL_INVALID"));
+    TEST_ASSERT_TRUE(motorController.getStallPolicy() == StallPolicy::RETRY);
+    send("STALL:OFF");
+    TEST_ASSERT_TRUE(motorController.getStallPolicy() == StallPolicy::OFF);
+}
+
+void test_unknown_ramp_profile_is_refused() {
+    send("RAMP:SCURVE ACC:8000");
+    output.clear();
+    send("RAMP:SCURV");
+    TEST_ASSERT_TRUE(sent("RAMP_INVALID"));
+    TEST_ASSERT_FALSE(sent("RAMP:TRAP ACC:16000 JERK:160000"));
+    send("RAMP:TRAP");  // The defaults again
+    TEST_ASSERT_TRUE(sent("RAMP:TRAP ACC:16000 JERK:160000"));
+}
+
+// A burst bigger than the command queue, with the motion task late: the comms task holds
+// the untagged line the queue has no room for and reads nothing more until it goes in, so
+// every line runs; a tagged one is refused BUSY instead
+void test_untagged_burst_waits_for_the_command_queue() {
+    const int BURST = 20;
+    for (int i = 0; i < BURST; i++) {
+        Sim::serialInput("POS\n");
+    }
+    queueCommands();
+    queueCommands();
+    TEST_ASSERT_EQUAL(8, (int)commandQueue.waiting());
+
+    ParsedCommand command;
+    for (int i = 0; i < BURST; i++) {
+        TEST_ASSERT_TRUE(commandQueue.receive(command));  // The motion task takes one
+        handleCommand(command);
+        serialManager.flushReplies();
+        serialManager.pump();
+        queueCommands();
+    }
+    output += Sim::serialOutput();
+    Sim::clearSerialOutput();
+    TEST_ASSERT_EQUAL(0, (int)commandQueue.waiting());
+    TEST_ASSERT_EQUAL(BURST, (int)count("POS:"));
+    TEST_ASSERT_EQUAL(0, (int)count("BUSY"));
+
+    send("HELLO TAG");
+    output.clear();
+    Sim::serialInput("#1 POS\n#2 POS\n#3 POS\n#4 POS\n#5 POS\n#6 POS\n#7 POS\n#8 POS\n#9 POS\n");
+    queueCommands();
+    serialManager.pump();
+    output += Sim::serialOutput();
+    Sim::clearSerialOutput();
+    TEST_ASSERT_TRUE(sent("=9 BUSY"));
+    TEST_ASSERT_EQUAL(1, (int)count("BUSY"));
+    while (commandQueue.receive(command)) {
+        handleCommand(command);
+    }
+    runFor(2);
+    TEST_ASSERT_TRUE(output.find("=8 POS:") != std::string::npos);
+}
+
+int main(int, char**) {
+    Sim::reset();
+    serialManager.begin();
+    motorController.begin(serialManager);
+    runFor(3500);  // Past the startup READY lines
+
+    UNITY_BEGIN();
+    RUN_TEST(test_malformed_line_is_answered);
+    RUN_TEST(test_malformed_tagged_line_gets_a_final_reply);
+    RUN_TEST(test_config_save_is_refused_while_a_move_runs);
+    RUN_TEST(test_prog_end_waits_for_the_move);
+    RUN_TEST(test_script_may_only_wait_on_input_only_pins);
+    RUN_TEST(test_refused_tagged_moves_carry_the_refusal);
+    RUN_TEST(test_moves_of_nothing_get_a_final_reply);
+    RUN_TEST(test_stop_and_start_in_one_pass_answer_both_operations);
+    RUN_TEST(test_untagged_burst_waits_for_the_command_queue);
+    RUN_TEST(test_unknown_stall_policy_is_refused);
+    RUN_TEST(test_unknown_ramp_profile_is_refused);
+    return UNITY_END();
+}
@@ -0,0 +1,195 @@
+// StepEngine on SimStepHal (pio test -e native): step counts, pulse timestamps and their
+// jitter under simulated interrupt latency, the ISR's position and events, and pulse
+// bursts against the edge-per-alarm pulse train.
+#include <Arduino.h>
+#include <unity.h>
+#include <memory>
+#include "StepEngine.h"
+#include "MotionPlanner.h"
+
+namespace {
+
+std::unique_ptr<SimStepHal> hal;
+std::unique_ptr<StepEngine> engine;
+
+// Runs the clock in 1 ms slices until the engine stops; false if it never does
+bool runToEnd(uint64_t limitMicros) {
+    uint64_t start = Sim::now();
+    while (engine->isActive()) {
+        if (Sim::now() - start > limitMicros) {
+            return false;
+        }
+        Sim::advance(1000);
+    }
+    Sim::advance(1000);
+    return true;
+}
+
+uint64_t interval(long step) {
+    return hal->pulseTime(step) - hal->pulseTime(step - 1);
+}
+
+bool nextEvent(StepEvent& event) {
+    return engine->events().pop(event);
+}
+
+void planCruise(MotionPlanner& planner, uint64_t intervalQ32, long steps) {
+    RampConfig none = { RampProfile::NONE, 16000, 160000, 320 };
+    planner.setConfig(none);
+    planner.plan(intervalQ32, steps);
+}
+
+}  // namespace
+
+void setUp() {
+    Sim::reset();
+    hal.reset(new SimStepHal());
+    engine.reset(new StepEngine(*hal));
+    engine->begin();
+}
+
+void tearDown() {
+    Sim::reset();
+    engine.reset();
+    hal.reset();
+}
+
+void test_fixed_interval_makes_exact_steps() {
+    engine->start(100, 1000);
+    TEST_ASSERT_TRUE(runToEnd(1000000));
+    TEST_ASSERT_EQUAL(1000, hal->recordedPulses());
+    TEST_ASSERT_EQUAL(1000, engine->steps());
+    for (long step = 1; step < 1000; step++) {
+        TEST_ASSERT_EQUAL_UINT64(100, interval(step));
+    }
+    TEST_ASSERT_FALSE(engine->isActive());
+}
+
+void test_stop_event_carries_the_step_count() {
+    engine->setRevolution(200);
+    engine->start(50, 1000);
+    TEST_ASSERT_TRUE(runToEnd(1000000));
+
+    StepEvent event;
+    for (uint32_t revolution = 1; revolution <= 5; revolution++) {
+        TEST_ASSERT_TRUE(nextEvent(event));
+        TEST_ASSERT_EQUAL(StepEvent::REVOLUTION, event.type);
+        TEST_ASSERT_EQUAL_UINT32(revolution, event.value);
+    }
+    TEST_ASSERT_TRUE(nextEvent(event));
+    TEST_ASSERT_EQUAL(StepEvent::STOPPED, event.type);
+    TEST_ASSERT_EQUAL_UINT32(1000, event.value);
+    TEST_ASSERT_FALSE(nextEvent(event));
+}
+
+void test_latency_never_accumulates_into_the_pulse_train() {
+    // 2..8 us late on every alarm: each edge moves by that much, but the next one is armed
+    // from when the alarm was due, so the train as a whole keeps its rate
+    hal->setAlarmLatency(2);
+    hal->setAlarmJitter(6, 7);
+    engine->start(40, 20000);
+    TEST_ASSERT_TRUE(runToEnd(2000000));
+    TEST_ASSERT_EQUAL(20000, hal->recordedPulses());
+
+    uint64_t worst = 0;
+    for (long step = 1; step < 20000; step++) {
+        uint64_t step_interval = interval(step);
+        uint64_t error = step_interval > 40 ? step_interval - 40 : 40 - step_interval;
+        worst = error > worst ? error : worst;
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(6, worst);
+    TEST_ASSERT_UINT64_WITHIN(6, 19999ULL * 40, hal->pulseTime(19999) - hal->pulseTime(0));
+
+    // The ISR saw every alarm late by the latency it was given
+    const Histogram& late = engine->lateness();
+    TEST_ASSERT_GREATER_OR_EQUAL(20000, late.count());
+    TEST_ASSERT_LESS_OR_EQUAL(8, late.maximum());
+    TEST_ASSERT_GREATER_OR_EQUAL(2, late.maximum());
+}
+
+void test_fractional_interval_keeps_its_average_rate() {
+    // 1000 RPM at 3200 steps per revolution: 18.75 us a step, emitted as whole microseconds
+    MotionPlanner planner;
+    planCruise(planner, (uint64_t)75 << 30, 32000);
+    engine->start(planner, 32000);
+    TEST_ASSERT_TRUE(runToEnd(2000000));
+    TEST_ASSERT_EQUAL(32000, hal->recordedPulses());
+
+    for (long step = 1; step < 32000; step++) {
+        uint64_t step_interval = interval(step);
+        TEST_ASSERT_TRUE(step_interval == 18 || step_interval == 19);
+    }
+    // 31999 intervals of 18.75 us, to within the microsecond the last one was rounded to
+    TEST_ASSERT_UINT64_WITHIN(1, 599981, hal->pulseTime(31999) - hal->pulseTime(0));
+}
+
+void test_position_counts_with_dir() {
+    engine->setDirection(0, false);  // CW
+    engine->start(20, 500);
+    TEST_ASSERT_TRUE(runToEnd(100000));
+    TEST_ASSERT_EQUAL(500, engine->position(0));
+
+    engine->setDirection(0, true);  // CCW
+    engine->start(20, 200);
+    TEST_ASSERT_TRUE(runToEnd(100000));
+    TEST_ASSERT_EQUAL(300, engine->position(0));
+    TEST_ASSERT_EQUAL(300, hal->netSteps());
+}
+
+void test_halt_and_resume_keep_the_step_count() {
+    engine->start(100, 2000);
+    Sim::advance(50000);
+    engine->halt();
+    Sim::advance(1000);
+    long halted = engine->steps();
+    TEST_ASSERT_INT_WITHIN(2, 500, halted);
+    Sim::advance(10000);
+    TEST_ASSERT_EQUAL(halted, hal->recordedPulses());
+
+    engine->resume();
+    TEST_ASSERT_TRUE(runToEnd(1000000));
+    TEST_ASSERT_EQUAL(2000, hal->recordedPulses());
+}
+
+void test_bursts_play_the_same_edges_as_single_alarms() {
+    // A ramped move edge by edge, then again through 64-item bursts
+    RampConfig ramp = { RampProfile::TRAPEZOIDAL, 16000, 160000, 320 };
+    MotionPlanner planner;
+    planner.setConfig(ramp);
+    planner.plan((uint64_t)50 << 32, 6000);
+    engine->start(planner, 6000);
+    TEST_ASSERT_TRUE(runToEnd(5000000));
+    TEST_ASSERT_EQUAL(6000, hal->recordedPulses());
+    std::unique_ptr<uint64_t[]> edges(new uint64_t[6000]);
+    for (long step = 0; step < 6000; step++) {
+        edges[step] = hal->pulseTime(step) - hal->pulseTime(0);
+    }
+    long singleAlarms = hal->alarms();
+
+    Sim::reset();
+    hal.reset(new SimStepHal());
+    engine.reset(new StepEngine(*hal));
+    hal->setBurstItems(64);
+    engine->begin();
+    planner.plan((uint64_t)50 << 32, 6000);
+    engine->start(planner, 6000);
+    TEST_ASSERT_TRUE(runToEnd(5000000));
+    TEST_ASSERT_EQUAL(6000, hal->recordedPulses());
+    TEST_ASSERT_EQUAL(0, hal->burstErrors());
+    for (long step = 0; step < 6000; step++) {
+        TEST_ASSERT_EQUAL_UINT64(edges[step], hal->pulseTime(step) - hal->pulseTime(0));
+    }
+    TEST_ASSERT_LESS_THAN(singleAlarms / 4, hal->alarms());
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_fixed_interval_makes_exact_steps);
+    RUN_TEST(test_stop_event_carries_the_step_count);
+    RUN_TEST(test_latency_never_accumulates_into_the_pulse_train);
+    RUN_TEST(test_fractional_interval_keeps_its_average_rate);
+    RUN_TEST(test_position_counts_with_dir);
+    RUN_TEST(test_halt_and_resume_keep_the_step_count);
+    RUN_TEST(test_bursts_play_the_same_edges_as_single_alarms);
+    return UNITY_END();
+}
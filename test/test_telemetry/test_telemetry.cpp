@@ -0,0 +1,300 @@
+// STREAM telemetry (pio test -e native), the checks behind bench/StreamBench.cpp without the
+// pseudo-terminal: the batch layout round trip, TelemetryStream's sample rate, batching and
+// flushing, the framing overhead of a full batch, coalescing while the link is blocked, and a
+// station streaming all fields during a move over the simulated Serial drained at 115200
+// baud, keeping up at 500 Hz and coalescing evenly at 1000 Hz.
+#include <string.h>
+#include <vector>
+#include "StationHarness.h"
+#include "FrameCodec.h"
+#include "Telemetry.h"
+
+namespace {
+
+const uint32_t PASS_MICROS = 1000;  // Motion task period
+const unsigned long BAUD = 115200;
+
+// Sample n of a stream, distinct in every field
+Telemetry::Sample sampleNumber(uint32_t n) {
+    Telemetry::Sample sample;
+    sample.position = (int32_t)(n * 1000003u);
+    sample.fraction = (uint16_t)(n * 7919u);
+    sample.rpmTenths = (uint16_t)(n * 31u);
+    sample.loadTenths = (uint16_t)(n % 1000u);
+    sample.followingError = (int16_t)(n * 13u);
+    sample.state = (uint8_t)n;
+    return sample;
+}
+
+struct Sent {
+    Telemetry::Batch batch;
+    Telemetry::Sample samples[TelemetryStream::MAX_BATCH];
+    uint32_t at;
+    size_t length;
+};
+
+// Runs a stream on its own for `micros`, one pass every PASS_MICROS, adding sample number
+// n for the nth period due; canSend(now) says whether the outbox has room
+template <typename CanSend>
+std::vector<Sent> runStream(TelemetryStream& stream, uint32_t& now, uint32_t micros, CanSend canSend) {
+    std::vector<Sent> sent;
+    uint8_t payload[Frame::MAX_PAYLOAD];
+    for (uint32_t end = now + micros; now < end; now += PASS_MICROS) {
+        while (stream.due(now)) {
+            stream.add(sampleNumber(stream.samplesTaken()), now);
+        }
+        size_t length = stream.take(payload, now, canSend(now));
+        if (length > 0) {
+            TEST_ASSERT_TRUE(length <= Frame::MAX_PAYLOAD);
+            Sent batch;
+            TEST_ASSERT_TRUE(Telemetry::decode(payload, length, batch.batch, batch.samples, TelemetryStream::MAX_BATCH));
+            batch.at = now;
+            batch.length = length;
+            sent.push_back(batch);
+        }
+    }
+    return sent;
+}
+
+// Every sample of a batch is the one its sequence and stride say
+void checkSpacing(const Sent& sent) {
+    for (uint8_t i = 0; i < sent.batch.count; i++) {
+        uint16_t sequence = (uint16_t)(sent.batch.sequence + i * sent.batch.stride);
+        TEST_ASSERT_EQUAL_INT32(sampleNumber(sequence).position, sent.samples[i].position);
+    }
+}
+
+struct Received {
+    uint32_t samples;
+    uint16_t maxGap;     // Sample periods between consecutive samples
+    uint8_t maxStride;
+};
+
+// The STREAM frames in what the station wrote
+Received receive(const std::string& bytes) {
+    Received received = {};
+    FrameDecoder decoder;
+    Telemetry::Sample samples[TelemetryStream::MAX_BATCH];
+    bool first = true;
+    uint16_t last = 0;
+    for (char byte : bytes) {
+        Telemetry::Batch batch;
+        if (!decoder.push((uint8_t)byte) || decoder.type() != Frame::STREAM) {
+            continue;
+        }
+        TEST_ASSERT_TRUE(Telemetry::decode(decoder.payload(), decoder.length(), batch, samples, TelemetryStream::MAX_BATCH));
+        for (uint8_t i = 0; i < batch.count; i++) {
+            uint16_t sequence = (uint16_t)(batch.sequence + i * batch.stride);
+            uint16_t gap = (uint16_t)(sequence - last);
+            if (!first) {
+                TEST_ASSERT_TRUE(gap > 0);  // In order, none twice
+                received.maxGap = gap > received.maxGap ? gap : received.maxGap;
+            }
+            last = sequence;
+            first = false;
+        }
+        received.samples += batch.count;
+        received.maxStride = batch.stride > received.maxStride ? batch.stride : received.maxStride;
+    }
+    return received;
+}
+
+// All fields at `rate` for two seconds of a 300 RPM move, as StreamBench runs it, from
+// once the move's start is out of the way
+Received streamDuringMove(uint16_t rate) {
+    Sim::setBaudRate(BAUD);
+    serial->setBinaryMode(true);
+    motor->executeRotation(300, 1000);
+    runFor(100);
+    TEST_ASSERT_TRUE(motor->startStream(Telemetry::ALL, rate));
+    output.clear();
+    runFor(2000);
+    return receive(output);
+}
+
+}  // namespace
+
+void setUp() {
+    Sim::reset();
+}
+
+void tearDown() {
+    stopStation();
+}
+
+void test_field_names_and_batch_sizes() {
+    for (uint8_t i = 0; i < Telemetry::FIELD_COUNT; i++) {
+        uint8_t field = (uint8_t)(1 << i);
+        TEST_ASSERT_EQUAL_HEX8(field, Telemetry::fieldByName(Telemetry::fieldName(field)));
+    }
+    TEST_ASSERT_EQUAL_HEX8(0, Telemetry::fieldByName("SPEED"));
+    TEST_ASSERT_EQUAL(13, (int)Telemetry::sampleSize(Telemetry::ALL));
+    TEST_ASSERT_EQUAL(TelemetryStream::MAX_BATCH, Telemetry::batchCapacity(Telemetry::STATE));
+    for (uint8_t fields = 1; fields <= Telemetry::ALL; fields++) {
+        uint8_t capacity = Telemetry::batchCapacity(fields);
+        TEST_ASSERT_EQUAL(0, capacity % 2);
+        TEST_ASSERT_TRUE(capacity >= 2);
+        TEST_ASSERT_TRUE(Telemetry::HEADER_SIZE + capacity * Telemetry::sampleSize(fields) <= Frame::MAX_PAYLOAD);
+    }
+}
+
+void test_every_layout_round_trips() {
+    Telemetry::Sample samples[TelemetryStream::MAX_BATCH];
+    Telemetry::Sample decoded[TelemetryStream::MAX_BATCH];
+    uint8_t payload[Frame::MAX_PAYLOAD];
+    for (uint8_t fields = 1; fields <= Telemetry::ALL; fields++) {
+        Telemetry::Batch batch = { (uint16_t)(65530u + fields), 4, Telemetry::batchCapacity(fields), fields };
+        for (uint8_t i = 0; i < batch.count; i++) {
+            samples[i] = sampleNumber(fields * 100u + i);
+        }
+        size_t length = Telemetry::encode(batch, samples, payload);
+        TEST_ASSERT_EQUAL(Telemetry::HEADER_SIZE + batch.count * Telemetry::sampleSize(fields), length);
+
+        Telemetry::Batch header;
+        TEST_ASSERT_TRUE(Telemetry::decode(payload, length, header, decoded, TelemetryStream::MAX_BATCH));
+        TEST_ASSERT_EQUAL_UINT16(batch.sequence, header.sequence);
+        TEST_ASSERT_EQUAL_UINT8(4, header.stride);
+        TEST_ASSERT_EQUAL_UINT8(batch.count, header.count);
+        for (uint8_t i = 0; i < batch.count; i++) {
+            // Fields left out decode as 0
+            TEST_ASSERT_EQUAL_INT32(fields & Telemetry::POS ? samples[i].position : 0, decoded[i].position);
+            TEST_ASSERT_EQUAL_UINT16(fields & Telemetry::FRAC ? samples[i].fraction : 0, decoded[i].fraction);
+            TEST_ASSERT_EQUAL_UINT16(fields & Telemetry::RPM ? samples[i].rpmTenths : 0, decoded[i].rpmTenths);
+            TEST_ASSERT_EQUAL_UINT16(fields & Telemetry::LOAD ? samples[i].loadTenths : 0, decoded[i].loadTenths);
+            TEST_ASSERT_EQUAL_INT16(fields & Telemetry::ERR ? samples[i].followingError : 0, decoded[i].followingError);
+            TEST_ASSERT_EQUAL_UINT8(fields & Telemetry::STATE ? samples[i].state : 0, decoded[i].state);
+        }
+
+        TEST_ASSERT_FALSE(Telemetry::decode(payload, length - 1, header, decoded, TelemetryStream::MAX_BATCH));
+        TEST_ASSERT_FALSE(Telemetry::decode(payload, length, header, decoded, batch.count - 1));
+    }
+}
+
+void test_samples_come_at_the_rate() {
+    const uint16_t RATES[] = { 1, 20, 250, 500, 1000 };
+    for (uint16_t rate : RATES) {
+        TelemetryStream stream;
+        uint32_t now = 12345;
+        stream.start(Telemetry::ALL, rate, now);
+        runStream(stream, now, 10000000, [](uint32_t) { return true; });
+        TEST_ASSERT_EQUAL_UINT32(rate * 10u, stream.samplesTaken());
+    }
+}
+
+// Full batches at 1000 Hz, one every four samples; at 20 Hz a batch waits FLUSH_MICROS for
+// company and goes out short
+void test_batches_go_out_full_or_when_they_are_old() {
+    TelemetryStream fast;
+    uint32_t now = 0;
+    fast.start(Telemetry::ALL, 1000, now);
+    std::vector<Sent> sent = runStream(fast, now, 1000000, [](uint32_t) { return true; });
+    TEST_ASSERT_EQUAL(1000 / Telemetry::batchCapacity(Telemetry::ALL), (int)sent.size());
+    for (const Sent& batch : sent) {
+        TEST_ASSERT_EQUAL_UINT8(Telemetry::batchCapacity(Telemetry::ALL), batch.batch.count);
+        TEST_ASSERT_EQUAL_UINT8(1, batch.batch.stride);
+        checkSpacing(batch);
+    }
+    TEST_ASSERT_EQUAL_UINT32(fast.samplesTaken(), fast.samplesSent());
+
+    TelemetryStream slow;
+    now = 0;
+    slow.start(Telemetry::ALL, 20, now);
+    sent = runStream(slow, now, 1000000, [](uint32_t) { return true; });
+    for (const Sent& batch : sent) {
+        TEST_ASSERT_TRUE(batch.batch.count < Telemetry::batchCapacity(Telemetry::ALL));
+        TEST_ASSERT_TRUE(batch.at - batch.batch.sequence * 50000u <= TelemetryStream::FLUSH_MICROS);
+        checkSpacing(batch);
+    }
+    TEST_ASSERT_TRUE(slow.samplesTaken() - slow.samplesSent() <= 1);
+}
+
+// Header and framing against sample bytes, all fields in full batches: about a fifth,
+// where a frame per sample would be over three quarters
+void test_byte_overhead_of_a_full_batch() {
+    TelemetryStream stream;
+    uint32_t now = 0;
+    stream.start(Telemetry::ALL, 1000, now);
+    std::vector<Sent> sent = runStream(stream, now, 100000, [](uint32_t) { return true; });
+    size_t sampleBytes = 0;
+    size_t frameBytes = 0;
+    for (const Sent& batch : sent) {
+        sampleBytes += batch.batch.count * Telemetry::sampleSize(Telemetry::ALL);
+        frameBytes += batch.length + Frame::OVERHEAD;
+    }
+    TEST_ASSERT_EQUAL(1923, (int)(10000 * (frameBytes - sampleBytes) / sampleBytes));  // 10 / 52
+}
+
+// A blocked outbox: the batch halves and doubles its stride each time it fills, so what
+// finally goes out still spans the whole wait, evenly spaced, and ends with the latest sample
+void test_blocked_link_coalesces_evenly() {
+    const uint32_t BLOCKED = 100000;  // 100 samples at 1000 Hz
+    TelemetryStream stream;
+    uint32_t now = 0;
+    stream.start(Telemetry::ALL, 1000, now);
+    std::vector<Sent> sent = runStream(stream, now, BLOCKED + PASS_MICROS, [](uint32_t at) { return at >= BLOCKED; });
+    TEST_ASSERT_EQUAL(1, (int)sent.size());
+    const Sent& batch = sent[0];
+    checkSpacing(batch);
+    TEST_ASSERT_EQUAL_UINT16(0, batch.batch.sequence);
+    TEST_ASSERT_TRUE(batch.batch.stride > 1);
+    TEST_ASSERT_EQUAL(0, batch.batch.stride & (batch.batch.stride - 1));  // A power of two
+    uint32_t newest = batch.batch.sequence + (batch.batch.count - 1) * batch.batch.stride;
+    TEST_ASSERT_TRUE(stream.samplesTaken() - 1 - newest < batch.batch.stride);
+
+    // Past MAX_STRIDE the batch starts over from the present
+    stream.start(Telemetry::ALL, 1000, now);
+    uint32_t blockedUntil = now + 2000000;
+    sent = runStream(stream, now, 2000000 + PASS_MICROS, [&](uint32_t at) { return at >= blockedUntil; });
+    TEST_ASSERT_EQUAL(1, (int)sent.size());
+    checkSpacing(sent[0]);
+    TEST_ASSERT_TRUE(sent[0].batch.stride <= TelemetryStream::MAX_STRIDE);
+    TEST_ASSERT_TRUE(sent[0].batch.sequence > 0);
+}
+
+void test_station_keeps_up_at_500_hz() {
+    startStation();
+    Received received = streamDuringMove(500);
+    TEST_ASSERT_INT_WITHIN(10, 1000, received.samples);  // Two seconds' worth
+    TEST_ASSERT_EQUAL_UINT8(1, received.maxStride);
+    TEST_ASSERT_EQUAL_UINT16(1, received.maxGap);
+}
+
+// At 1000 Hz all fields need more than the line carries: fewer samples, evenly spaced,
+// and the link kept busy
+void test_station_coalesces_at_1000_hz() {
+    startStation();
+    Received received = streamDuringMove(1000);
+    TEST_ASSERT_TRUE(received.maxStride > 1);
+    TEST_ASSERT_TRUE(received.maxGap <= 2 * received.maxStride);
+    TEST_ASSERT_TRUE(received.samples > 1000);  // Over 500 a second
+    TEST_ASSERT_TRUE(received.samples < 2000);
+    TEST_ASSERT_TRUE(output.size() * 10 > BAUD * 2 * 9 / 10);  // Over 90 % of the line rate
+}
+
+void test_stream_needs_binary_mode_and_a_rate() {
+    startStation();
+    TEST_ASSERT_FALSE(motor->startStream(Telemetry::ALL, 100));  // Text mode
+    serial->setBinaryMode(true);
+    TEST_ASSERT_FALSE(motor->startStream(Telemetry::ALL, 0));
+    TEST_ASSERT_FALSE(motor->startStream(Telemetry::ALL, TelemetryStream::MAX_RATE + 1));
+    TEST_ASSERT_FALSE(motor->startStream(0, 100));
+    TEST_ASSERT_TRUE(motor->startStream(Telemetry::POS, 100));
+
+    serial->setBinaryMode(false);  // HELLO back to text
+    runFor(5);
+    TEST_ASSERT_FALSE(motor->stream().isActive());
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_field_names_and_batch_sizes);
+    RUN_TEST(test_every_layout_round_trips);
+    RUN_TEST(test_samples_come_at_the_rate);
+    RUN_TEST(test_batches_go_out_full_or_when_they_are_old);
+    RUN_TEST(test_byte_overhead_of_a_full_batch);
+    RUN_TEST(test_blocked_link_coalesces_evenly);
+    RUN_TEST(test_station_keeps_up_at_500_hz);
+    RUN_TEST(test_station_coalesces_at_1000_hz);
+    RUN_TEST(test_stream_needs_binary_mode_and_a_rate);
+    return UNITY_END();
+}